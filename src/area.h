@@ -0,0 +1,516 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "pyramid.h"
+#include "region.h"
+#include "thread_pool.h"
+
+namespace los {
+
+// Area-to-area visibility: how many (observer, target) cell pairs between two
+// regions have line of sight, without tracing every one of them.
+//
+// Each region is a rectangle of cells, optionally narrowed by a mask of the
+// rectangle's shape (row-major, non-zero = in), so any rasterized polygon
+// works. Observers stand at cell centres on cells.lower(x, y) plus a height,
+// like viewshed targets; cells with no data are left out.
+//
+// The pairs are refined as a tree of block pairs. For a pair of blocks, one
+// from each region, the segments between them fill the convex hull of their
+// centres. That hull is cut into strips along the axis the blocks lie apart
+// on, and per strip the terrain pyramid bounds the highest cell a ray may
+// test while the block heights bound the lowest ray over it: if the terrain
+// stays below the rays in every strip, every pair is visible. If a strip
+// every ray must cross has a lowest cell (a "floor" pyramid over the minima)
+// above the highest ray, every pair is blocked. Otherwise the larger block
+// splits into its four children, and pairs of a few cells are traced
+// exactly. The bounds read the same cells the walks do, padded a cell for
+// corner steps (two for bilinear patches, which read their neighbours), so
+// a pair is never misclassified.
+struct AreaRegion {
+    CellRect rect;
+    const uint8_t* mask = nullptr;  // (y1 - y0 + 1) rows of (x1 - x0 + 1), or null
+};
+
+// Pair counts of an area query. Pairs left unresolved (when the query stopped
+// early) are neither visible nor blocked.
+struct AreaResult {
+    int64_t pairs = 0;
+    int64_t visible = 0;
+    int64_t blocked = 0;
+    int64_t rays = 0;        // pairs traced one by one
+    int64_t blockPairs = 0;  // block pairs bounded without tracing
+
+    int64_t unresolved() const { return pairs - visible - blocked; }
+    bool exact() const { return unresolved() == 0; }
+    // Visible fraction, and its bounds while pairs are unresolved; the
+    // estimate is the midpoint. NaN with no pairs.
+    double fraction_low() const { return ratio(visible); }
+    double fraction_high() const { return ratio(pairs - blocked); }
+    double fraction() const { return ratio(visible + 0.5 * unresolved()); }
+
+private:
+    double ratio(double n) const {
+        return pairs ? n / static_cast<double>(pairs) : std::numeric_limits<double>::quiet_NaN();
+    }
+};
+
+// Largest value(x, y) over r, from the level-`level` blocks of `pyramid`
+// covering it (cells themselves at level 0). NaN values are ignored.
+template <typename Value>
+inline float area_rect_max(const MaxPyramid& pyramid, const Value& value, int level,
+                           const CellRect& r) {
+    float m = -std::numeric_limits<float>::infinity();
+    level = std::min(level, pyramid.levels());
+    if (level <= 0) {
+        for (int y = r.y0; y <= r.y1; y++)
+            for (int x = r.x0; x <= r.x1; x++) {
+                float v = value(x, y);
+                if (v > m) m = v;
+            }
+        return m;
+    }
+    for (int by = r.y0 >> level; by <= r.y1 >> level; by++)
+        for (int bx = r.x0 >> level; bx <= r.x1 >> level; bx++)
+            m = std::max(m, pyramid.block_max(level, bx << level, by << level));
+    return m;
+}
+
+// -cells(x, y), with NaN as +inf: a MaxPyramid over this holds minus the
+// lowest height of each block, and a block with a hole can block nothing.
+template <typename Cells>
+struct NegatedCells {
+    const Cells& cells;
+
+    float operator()(int x, int y) const {
+        float v = cells(x, y);
+        return std::isnan(v) ? std::numeric_limits<float>::infinity() : -v;
+    }
+};
+
+// Endpoint heights of one region: cells.lower(x, y) + height for the cells
+// in it, NaN elsewhere, with pyramids of their highest and lowest values and
+// a summed-area table of the cell count, all in region-local coordinates.
+class AreaEndpoints {
+public:
+    struct Block {
+        CellRect rect;  // grid coordinates
+        int64_t count;
+        double zLow, zHigh;
+    };
+
+    template <typename Cells>
+    AreaEndpoints(const Cells& cells, int width, int height, const AreaRegion& region,
+                  double height_above)
+        : rect_(region.rect) {
+        const CellRect& r = region.rect;
+        if (r.x0 < 0 || r.y0 < 0 || r.x0 > r.x1 || r.y0 > r.y1 || r.x1 >= width ||
+            r.y1 >= height)
+            throw std::invalid_argument("region must be a non-empty rectangle inside the terrain");
+        w_ = r.x1 - r.x0 + 1;
+        h_ = r.y1 - r.y0 + 1;
+        z_.resize(static_cast<size_t>(w_) * h_);
+        parallel_for(h_, 16, [&](int64_t begin, int64_t end, int) {
+            for (int j = static_cast<int>(begin); j < end; j++)
+                for (int i = 0; i < w_; i++) {
+                    size_t k = static_cast<size_t>(j) * w_ + i;
+                    bool in = !region.mask || region.mask[k];
+                    z_[k] = in ? cells.lower(r.x0 + i, r.y0 + j) + height_above
+                               : std::numeric_limits<double>::quiet_NaN();
+                }
+        });
+
+        counts_.assign(static_cast<size_t>(w_ + 1) * (h_ + 1), 0);
+        for (int j = 0; j < h_; j++)
+            for (int i = 0; i < w_; i++)
+                counts_[index(i + 1, j + 1)] = counts_[index(i, j + 1)] +
+                                               counts_[index(i + 1, j)] -
+                                               counts_[index(i, j)] + !std::isnan(z(i, j));
+
+        // NaN cells drop out of both pyramids; the slack added in the queries
+        // covers rounding the heights to float here.
+        high_.build_cells([this](int i, int j) { return static_cast<float>(z(i, j)); }, w_, h_);
+        low_.build_cells([this](int i, int j) { return static_cast<float>(-z(i, j)); }, w_, h_);
+    }
+
+    int64_t count() const { return counts_.back(); }
+    int levels() const { return high_.levels(); }
+    const CellRect& rect() const { return rect_; }
+
+    // Observer height of region-local cell (i, j); NaN if not in the region.
+    double z(int i, int j) const { return z_[static_cast<size_t>(j) * w_ + i]; }
+
+    // Block (bx, by) of level `level`, in local block indices.
+    Block block(int level, int bx, int by) const {
+        int i0 = bx << level, j0 = by << level;
+        int i1 = std::min(i0 + (1 << level), w_) - 1, j1 = std::min(j0 + (1 << level), h_) - 1;
+        Block b{{rect_.x0 + i0, rect_.y0 + j0, rect_.x0 + i1, rect_.y0 + j1},
+                counts_[index(i1 + 1, j1 + 1)] - counts_[index(i0, j1 + 1)] -
+                    counts_[index(i1 + 1, j0)] + counts_[index(i0, j0)],
+                0.0, 0.0};
+        if (level == 0) {
+            b.zLow = b.zHigh = z(i0, j0);
+        } else {
+            b.zHigh = high_.block_max(level, i0, j0);
+            b.zLow = -low_.block_max(level, i0, j0);
+        }
+        return b;
+    }
+
+    // At most the lowest observer height over the cells of grid rect r in
+    // the region (+inf if none), from the largest blocks that fit r.
+    double low_in(const CellRect& r) const {
+        int i0 = std::max(r.x0 - rect_.x0, 0), i1 = std::min(r.x1 - rect_.x0, w_ - 1);
+        int j0 = std::max(r.y0 - rect_.y0, 0), j1 = std::min(r.y1 - rect_.y0, h_ - 1);
+        if (i0 > i1 || j0 > j1)
+            return std::numeric_limits<double>::infinity();
+        int level = 0;
+        while (level < levels() && (2 << level) <= std::min(i1 - i0, j1 - j0) + 1)
+            level++;
+        double m = std::numeric_limits<double>::infinity();
+        for (int by = j0 >> level; by <= j1 >> level; by++)
+            for (int bx = i0 >> level; bx <= i1 >> level; bx++)
+                m = std::min(m, level ? -static_cast<double>(
+                                            low_.block_max(level, bx << level, by << level))
+                                      : z(bx, by));
+        return m;
+    }
+
+    // Blocks along each axis at `level`.
+    int blocks_x(int level) const { return ((w_ - 1) >> level) + 1; }
+    int blocks_y(int level) const { return ((h_ - 1) >> level) + 1; }
+
+private:
+    size_t index(int i, int j) const { return static_cast<size_t>(j) * (w_ + 1) + i; }
+
+    CellRect rect_;
+    int w_ = 0, h_ = 0;
+    std::vector<double> z_;
+    std::vector<int64_t> counts_;
+    MaxPyramid high_, low_;
+};
+
+// Block pairs up to this many cell pairs are traced rather than bounded.
+constexpr int64_t kAreaLeafRays = 16;
+
+// Relative slack on the bounds for rounding: float walks, heights stored
+// as float in the endpoint pyramids.
+constexpr double kAreaSlack = 1e-6;
+
+// Count the visible pairs between regions `a` (observers) and `b`
+// (targets) on a width x height grid read through `cells`.
+//
+// `top` is a MaxPyramid over cells, `floor` one over NegatedCells, and
+// trace(x0, y0, z0, x1, y1, z1) the exact los_boolean the results must
+// agree with. `curvature` is the terrain's ray drop (BasicDDA); `reach` is
+// 1 for nearest-cell walks and 2 for bilinear ones.
+//
+// Refinement stops once at most tolerance * pairs are unresolved, or with
+// `stop_at_first` once any pair is visible; tolerance 0 and no early stop
+// resolve every pair. Each round of block pairs runs over the thread pool
+// and the result does not depend on the thread count.
+template <typename Cells, typename Trace>
+inline AreaResult area_visibility_cells(const Cells& cells, int width, int height,
+                                        const MaxPyramid& top, const MaxPyramid& floor,
+                                        const AreaEndpoints& a, const AreaEndpoints& b,
+                                        double curvature, int reach, double tolerance,
+                                        bool stop_at_first, const Trace& trace) {
+    using Block = AreaEndpoints::Block;
+    struct Node {
+        int la, ax, ay, lb, bx, by;
+    };
+
+    AreaResult out;
+    out.pairs = a.count() * b.count();
+    if (out.pairs == 0)
+        return out;
+    const NegatedCells<Cells> negated{cells};
+    const int pad = reach;          // cells beside the segments the walks read
+    const int spill = reach - 1;    // and past a strip along its axis
+
+    // Corner cell centres of blocks p and q, whose convex hull holds every
+    // segment between them.
+    auto hull = [](const Block& p, const Block& q, double (*corners)[2]) {
+        int k = 0;
+        for (const Block* blk : {&p, &q})
+            for (int j = 0; j < 2; j++)
+                for (int i = 0; i < 2; i++) {
+                    corners[k][0] = (i ? blk->rect.x1 : blk->rect.x0) + 0.5;
+                    corners[k][1] = (j ? blk->rect.y1 : blk->rect.y0) + 0.5;
+                    k++;
+                }
+    };
+
+    // Range of the other coordinate over that hull where the `axis`
+    // coordinate is in [u0, u1]: corners inside the slab, and every corner
+    // pair's crossings of its two edges.
+    auto slab = [](const double (*p)[2], int axis, double u0, double u1, double& lo,
+                   double& hi) {
+        lo = std::numeric_limits<double>::infinity();
+        hi = -lo;
+        for (int i = 0; i < 8; i++) {
+            double u = p[i][axis], v = p[i][1 - axis];
+            if (u >= u0 && u <= u1) {
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+            for (int j = i + 1; j < 8; j++) {
+                double uj = p[j][axis], vj = p[j][1 - axis];
+                if (u == uj)
+                    continue;
+                for (double c : {u0, u1})
+                    if ((c - u) * (c - uj) <= 0) {
+                        double vc = v + (vj - v) * (c - u) / (uj - u);
+                        lo = std::min(lo, vc);
+                        hi = std::max(hi, vc);
+                    }
+            }
+        }
+        return lo <= hi;
+    };
+
+    // Cell rect of strip [u0, u1] x [lo, hi] along `axis`, clipped.
+    auto strip_rect = [&](int axis, int u0, int u1, double lo, double hi, CellRect& r) {
+        int v0 = std::max(static_cast<int>(std::floor(lo)) - pad, 0);
+        int v1 = std::min(static_cast<int>(std::floor(hi)) + pad,
+                          (axis == 0 ? height : width) - 1);
+        u0 = std::max(u0 - spill, 0);
+        u1 = std::min(u1 + spill, (axis == 0 ? width : height) - 1);
+        if (u0 > u1 || v0 > v1)
+            return false;
+        r = axis == 0 ? CellRect{u0, v0, u1, v1} : CellRect{v0, u0, v1, u1};
+        return true;
+    };
+
+    auto lo_of = [](const CellRect& r, int axis) { return axis == 0 ? r.x0 : r.y0; };
+    auto hi_of = [](const CellRect& r, int axis) { return axis == 0 ? r.x1 : r.y1; };
+
+    // Every pair of p (observers) and q visible: in each strip the terrain
+    // stays at or below the lowest ray. t over a strip follows from how far
+    // along `axis` it lies between the blocks, when they are apart on it;
+    // then only endpoints on the near side of the strip bound its rays.
+    // Strips over the blocks themselves are one cell wide while that costs
+    // no more lookups than `budget`, since the ground there rises up to the
+    // rays.
+    auto all_visible = [&](const Block& p, const Block& q, int level, int64_t budget) {
+        double dx = std::max(std::abs(double(q.rect.x1) - p.rect.x0),
+                             std::abs(double(p.rect.x1) - q.rect.x0));
+        double dy = std::max(std::abs(double(q.rect.y1) - p.rect.y0),
+                             std::abs(double(p.rect.y1) - q.rect.y0));
+        double bulge = curvature * (dx * dx + dy * dy);
+        double slack = kAreaSlack * (1 + std::max({std::abs(p.zLow), std::abs(p.zHigh),
+                                                    std::abs(q.zLow), std::abs(q.zHigh)}) +
+                                     bulge);
+
+        // Slice along the axis the centres are furthest apart on, with the
+        // first block first so t grows with u.
+        double cx = (q.rect.x0 + q.rect.x1) - (p.rect.x0 + p.rect.x1);
+        double cy = (q.rect.y0 + q.rect.y1) - (p.rect.y0 + p.rect.y1);
+        int axis = std::abs(cx) >= std::abs(cy) ? 0 : 1;
+        bool flip = (axis == 0 ? cx : cy) < 0;
+        const Block& f = flip ? q : p;
+        const Block& s = flip ? p : q;
+        const AreaEndpoints& fe = flip ? b : a;
+        const AreaEndpoints& se = flip ? a : b;
+        bool apart = hi_of(f.rect, axis) < lo_of(s.rect, axis);
+        double faLo = lo_of(f.rect, axis) + 0.5, faHi = hi_of(f.rect, axis) + 0.5;
+        double sbLo = lo_of(s.rect, axis) + 0.5, sbHi = hi_of(s.rect, axis) + 0.5;
+
+        double corners[8][2];
+        hull(p, q, corners);
+
+        int uStart = std::min(lo_of(p.rect, axis), lo_of(q.rect, axis));
+        int uEnd = std::max(hi_of(p.rect, axis), hi_of(q.rect, axis));
+        int fine = level;
+        while (fine > 0 && int64_t(2) << (2 * (level - fine + 1)) <= budget)
+            fine--;
+        auto over_block = [&](int u0, int u1) {
+            return (u0 <= hi_of(f.rect, axis) && u1 >= lo_of(f.rect, axis)) ||
+                   (u0 <= hi_of(s.rect, axis) && u1 >= lo_of(s.rect, axis));
+        };
+
+        auto clamp01 = [](double t) { return std::min(std::max(t, 0.0), 1.0); };
+        for (int u0 = (uStart >> fine) << fine; u0 <= uEnd;) {
+            int l = level;
+            if ((u0 & ((1 << level) - 1)) || over_block(u0, u0 + (1 << level) - 1))
+                l = fine;
+            int u1 = std::min(u0 + (1 << l) - 1, uEnd);
+            int next = u0 + (1 << l);
+
+            double lo, hi;
+            CellRect r;
+            if (!slab(corners, axis, u0 - spill, u1 + 1 + spill, lo, hi) ||
+                !strip_rect(axis, u0, u1, lo, hi, r)) {
+                u0 = next;
+                continue;
+            }
+
+            // A cell is tested at a t up to a cell past it on the walk's
+            // major axis, and no ray reads cells behind its start.
+            double t0 = 0, t1 = 1;
+            double z0 = f.zLow, z1 = s.zLow;
+            if (apart) {
+                t0 = clamp01((u0 - 1 - faHi) / (sbHi - faHi));
+                t1 = clamp01((u1 + 2 - faLo) / (sbLo - faLo));
+                CellRect near = f.rect;
+                if (u1 + spill < hi_of(f.rect, axis)) {
+                    (axis == 0 ? near.x1 : near.y1) = u1 + spill;
+                    z0 = fe.low_in(near);
+                }
+                near = s.rect;
+                if (u0 - spill > lo_of(s.rect, axis)) {
+                    (axis == 0 ? near.x0 : near.y0) = u0 - spill;
+                    z1 = se.low_in(near);
+                }
+            }
+            double ray = std::min(z0 + t0 * (z1 - z0), z0 + t1 * (z1 - z0));
+            if (bulge != 0) {
+                double peak = t1 < 0.5 ? t1 * (1 - t1) : t0 > 0.5 ? t0 * (1 - t0) : 0.25;
+                ray -= bulge * peak;
+            }
+            if (!(area_rect_max(top, cells, l, r) <= ray - slack))
+                return false;
+            u0 = next;
+        }
+        return true;
+    };
+
+    // Every pair blocked: some strip strictly between the blocks along x or
+    // y, which every ray crosses, has its lowest cell above the highest ray.
+    auto all_blocked = [&](const Block& p, const Block& q, int level, int64_t budget) {
+        double zHigh = std::max(p.zHigh, q.zHigh);
+        double slack = kAreaSlack * (1 + std::max(std::abs(zHigh),
+                                                  std::abs(std::min(p.zLow, q.zLow))));
+        for (int axis = 0; axis < 2; axis++) {
+            const Block* f = &p;
+            const Block* s = &q;
+            if (lo_of(s->rect, axis) < lo_of(f->rect, axis))
+                std::swap(f, s);
+            int g0 = hi_of(f->rect, axis) + 1, g1 = lo_of(s->rect, axis) - 1;
+            if (g0 > g1)
+                continue;
+
+            double corners[8][2];
+            hull(p, q, corners);
+
+            // Aligned strips that fit the gap (at least one of them), then
+            // narrower ones for walls thinner than a block while the lookups
+            // stay within `budget`.
+            int gap = g1 - g0 + 1, widest = 0;
+            while (widest < level && (4 << widest) <= gap)
+                widest++;
+            int span = std::max(hi_of(f->rect, 1 - axis), hi_of(s->rect, 1 - axis)) -
+                       std::min(lo_of(f->rect, 1 - axis), lo_of(s->rect, 1 - axis)) + 1 + 2 * pad;
+            for (int l = widest; l >= 0; l--) {
+                if (l < widest && (int64_t((gap >> l) + 1) * ((span >> l) + 2)) > budget)
+                    break;
+                int step = 1 << l;
+                for (int u0 = ((g0 + step - 1) >> l) << l; u0 + step - 1 <= g1; u0 += step) {
+                    int u1 = u0 + step - 1;
+                    double lo, hi;
+                    if (!slab(corners, axis, u0 - spill, u1 + 1 + spill, lo, hi))
+                        continue;
+                    CellRect r;
+                    if (!strip_rect(axis, u0, u1, lo, hi, r))
+                        continue;
+                    if (-area_rect_max(floor, negated, l, r) > zHigh + slack)
+                        return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    std::vector<Node> frontier{{a.levels(), 0, 0, b.levels(), 0, 0}};
+    while (!frontier.empty()) {
+        int64_t n = static_cast<int64_t>(frontier.size());
+        // Per node: visible and blocked pairs, rays traced, children.
+        std::vector<int64_t> visible(n, 0), blocked(n, 0), rays(n, 0);
+        std::vector<uint8_t> bounded(n, 0), kids(n, 0);
+        std::vector<Node> children(4 * static_cast<size_t>(n));
+
+        parallel_for(n, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const Node& node = frontier[i];
+                Block p = a.block(node.la, node.ax, node.ay);
+                Block q = b.block(node.lb, node.bx, node.by);
+                int64_t count = p.count * q.count;
+
+                if (count <= kAreaLeafRays) {
+                    const CellRect& ra = p.rect;
+                    const CellRect& rb = q.rect;
+                    for (int ya = ra.y0; ya <= ra.y1; ya++)
+                        for (int xa = ra.x0; xa <= ra.x1; xa++) {
+                            double za = a.z(xa - a.rect().x0, ya - a.rect().y0);
+                            if (std::isnan(za))
+                                continue;
+                            for (int yb = rb.y0; yb <= rb.y1; yb++)
+                                for (int xb = rb.x0; xb <= rb.x1; xb++) {
+                                    double zb = b.z(xb - b.rect().x0, yb - b.rect().y0);
+                                    if (std::isnan(zb))
+                                        continue;
+                                    rays[i]++;
+                                    if (trace(xa + 0.5, ya + 0.5, za, xb + 0.5, yb + 0.5, zb) > 0.5)
+                                        visible[i]++;
+                                    else
+                                        blocked[i]++;
+                                }
+                        }
+                    continue;
+                }
+
+                bounded[i] = 1;
+                int level = std::max(node.la, node.lb);
+                if (all_visible(p, q, level, count)) {
+                    visible[i] = count;
+                    continue;
+                }
+                if (all_blocked(p, q, level, count)) {
+                    blocked[i] = count;
+                    continue;
+                }
+
+                // Split the larger block (the observers' on a tie).
+                bool splitA = node.la >= node.lb;
+                const AreaEndpoints& e = splitA ? a : b;
+                int l = (splitA ? node.la : node.lb) - 1;
+                int bx = splitA ? node.ax : node.bx, by = splitA ? node.ay : node.by;
+                for (int cy = 2 * by; cy <= 2 * by + 1 && cy < e.blocks_y(l); cy++)
+                    for (int cx = 2 * bx; cx <= 2 * bx + 1 && cx < e.blocks_x(l); cx++) {
+                        if (e.block(l, cx, cy).count == 0)
+                            continue;
+                        Node c = node;
+                        if (splitA)
+                            c.la = l, c.ax = cx, c.ay = cy;
+                        else
+                            c.lb = l, c.bx = cx, c.by = cy;
+                        children[4 * i + kids[i]++] = c;
+                    }
+            }
+        });
+
+        std::vector<Node> next;
+        for (int64_t i = 0; i < n; i++) {
+            out.visible += visible[i];
+            out.blocked += blocked[i];
+            out.rays += rays[i];
+            out.blockPairs += bounded[i];
+            next.insert(next.end(), children.begin() + 4 * i, children.begin() + 4 * i + kids[i]);
+        }
+        frontier.swap(next);
+        if (stop_at_first && out.visible > 0)
+            break;
+        if (tolerance > 0 && out.unresolved() <= tolerance * out.pairs)
+            break;
+    }
+    return out;
+}
+
+} // namespace los
@@ -0,0 +1,285 @@
+// Google Benchmark suite for the line-of-sight kernels.
+//
+// Every terrain x ray set is run through each kernel, with los_boolean_raw
+// (the kernel behind los.los_boolean) as the baseline, and reports rays/s
+// and the cells the reference walk visits per ray. Compare two builds with
+// benchmark's tools/compare.py on --benchmark_format=json output.
+//
+// Environment:
+//   LOS_BENCH_SIZE     side of the flat and fractal grids (default 2048)
+//   LOS_BENCH_DEM      a float32 *_dem.npy to add as the "usgs" terrain
+//   LOS_BENCH_THREADS  pool threads for the batch kernels (default 1, so
+//                      numbers are per core; 0 uses all cores)
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "layout.h"
+#include "los_kernel.h"
+#include "packet.h"
+#include "pyramid.h"
+#include "quantized.h"
+#include "scenarios.h"
+#include "thread_pool.h"
+
+namespace {
+
+using los::bench::Grid;
+using los::bench::Height;
+using los::bench::Shape;
+
+constexpr int kBooleanRays = 4096;
+constexpr int kProbabilityRays = 256;
+constexpr int kSamples = 9;
+
+// The grid reordered into each non-row-major layout (layout.h), and
+// quantized to kQuantizeStep (quantized.h).
+constexpr float kQuantizeStep = 0.01f;
+
+struct Layouts {
+    std::vector<float> blocked;
+    std::vector<float> morton;
+    los::QuantizedHeightmap quantized;
+};
+
+struct Scenario {
+    const Grid* grid;
+    const los::MaxPyramid* pyramid;
+    const Layouts* layouts;
+    std::vector<double> rays;
+    double cells;  // per ray, reference walk
+};
+
+int env_int(const char* name, int fallback) {
+    const char* v = std::getenv(name);
+    return v && *v ? std::atoi(v) : fallback;
+}
+
+void report(benchmark::State& state, const Scenario& s, int64_t rays) {
+    state.counters["rays/s"] = benchmark::Counter(static_cast<double>(rays),
+                                                  benchmark::Counter::kIsIterationInvariantRate);
+    state.counters["cells/ray"] = s.cells;
+}
+
+int64_t count(const Scenario& s) { return static_cast<int64_t>(s.rays.size() / 6); }
+
+template <typename Real>
+void raw(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    for (auto _ : state) {
+        int clear = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            clear += los::los_boolean_raw<Real>(g.data.data(), g.width, g.height,
+                                                r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+        }
+        benchmark::DoNotOptimize(clear);
+    }
+    report(state, *s, count(*s));
+}
+
+// los_boolean_raw over the grid reordered into Index's layout.
+template <typename Index>
+void raw_layout(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    const Index index(g.width);
+    const float* cells = std::is_same<Index, los::BlockedIndex>::value ? s->layouts->blocked.data()
+                                                                       : s->layouts->morton.data();
+    for (auto _ : state) {
+        int clear = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            clear += los::los_boolean_raw(cells, index, g.width, g.height,
+                                          r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+        }
+        benchmark::DoNotOptimize(clear);
+    }
+    report(state, *s, count(*s));
+}
+
+// los_boolean_cells over the quantized grid. Answers may differ from the
+// baseline, towards blocked, for rays within a step of the ground.
+void raw_quantized(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    for (auto _ : state) {
+        int clear = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            clear += los::los_boolean_cells(s->layouts->quantized, g.width, g.height,
+                                            r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+        }
+        benchmark::DoNotOptimize(clear);
+    }
+    report(state, *s, count(*s));
+}
+
+template <typename Real>
+void pyramid(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    for (auto _ : state) {
+        int clear = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            clear += los::los_boolean_pyramid<Real>(g.data.data(), g.width, g.height, *s->pyramid,
+                                                    r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+        }
+        benchmark::DoNotOptimize(clear);
+    }
+    report(state, *s, count(*s));
+}
+
+template <typename Real>
+void packets(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    std::vector<uint8_t> out(count(*s));
+    for (auto _ : state) {
+        los::los_boolean_packets<Real>(g.data.data(), g.width, g.height,
+                                       s->rays.data(), count(*s), out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    report(state, *s, count(*s));
+}
+
+void probability_raw(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    for (auto _ : state) {
+        double sum = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            sum += los::los_probability_raw(g.data.data(), g.width, g.height,
+                                            r[0], r[1], r[2], r[3], r[4], r[5], kSamples);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    report(state, *s, count(*s) * kSamples);
+}
+
+template <typename Real>
+void probability_packets(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    for (auto _ : state) {
+        double sum = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            sum += los::los_probability_packets<Real>(g.data.data(), g.width, g.height,
+                                                      r[0], r[1], r[2], r[3], r[4], r[5],
+                                                      kSamples);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    report(state, *s, count(*s) * kSamples);
+}
+
+void probability_pyramid(benchmark::State& state, const Scenario* s) {
+    const Grid& g = *s->grid;
+    auto trace = [&](double ax, double ay, double az, double bx, double by, double bz) {
+        return los::los_boolean_pyramid(g.data.data(), g.width, g.height, *s->pyramid,
+                                        ax, ay, az, bx, by, bz);
+    };
+    for (auto _ : state) {
+        double sum = 0;
+        for (int64_t i = 0; i < count(*s); i++) {
+            const double* r = &s->rays[6 * i];
+            sum += los::los_probability_sampled(trace, r[0], r[1], r[2], r[3], r[4], r[5],
+                                                kSamples);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    report(state, *s, count(*s) * kSamples);
+}
+
+using Kernel = void (*)(benchmark::State&, const Scenario*);
+
+struct Named {
+    const char* name;
+    Kernel kernel;
+};
+
+const Named kBooleanKernels[] = {
+    {"raw_f64", raw<double>},  // baseline: los.los_boolean
+    {"raw_f32", raw<float>},
+    {"raw_blocked_f64", raw_layout<los::BlockedIndex>},
+    {"raw_morton_f64", raw_layout<los::MortonIndex>},
+    {"raw_quantized_f64", raw_quantized},
+    {"pyramid_f64", pyramid<double>},
+    {"pyramid_f32", pyramid<float>},
+    {"packets_f64", packets<double>},
+    {"packets_f32", packets<float>},
+};
+
+const Named kProbabilityKernels[] = {
+    {"raw_f64", probability_raw},  // baseline: los.los_probability before packets
+    {"packets_f64", probability_packets<double>},
+    {"packets_f32", probability_packets<float>},
+    {"pyramid_f64", probability_pyramid},
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    los::ThreadPool::instance().set_num_threads(env_int("LOS_BENCH_THREADS", 1));
+    const int size = env_int("LOS_BENCH_SIZE", 2048);
+
+    std::vector<std::unique_ptr<Grid>> grids;
+    grids.push_back(std::make_unique<Grid>(los::bench::flat_grid(size)));
+    grids.push_back(std::make_unique<Grid>(los::bench::fractal_grid(size)));
+    if (const char* dem = std::getenv("LOS_BENCH_DEM")) {
+        auto g = std::make_unique<Grid>();
+        if (los::bench::load_npy(dem, *g))
+            grids.push_back(std::move(g));
+        else
+            std::fprintf(stderr, "LOS_BENCH_DEM: cannot read %s as a float32 C-order .npy\n", dem);
+    }
+
+    std::vector<std::unique_ptr<los::MaxPyramid>> pyramids;
+    std::vector<std::unique_ptr<Layouts>> layouts;
+    std::vector<std::unique_ptr<Scenario>> scenarios;
+    const Shape shapes[] = {Shape::Short, Shape::Long, Shape::Diagonal, Shape::Axis,
+                            Shape::Vertical};
+    const Height heights[] = {Height::Clear, Height::Blocked};
+
+    for (const auto& g : grids) {
+        pyramids.push_back(std::make_unique<los::MaxPyramid>(g->data.data(), g->width, g->height));
+        layouts.push_back(std::make_unique<Layouts>(Layouts{
+            los::reorder_heightmap(g->data.data(), g->width, g->height, los::BlockedIndex(g->width)),
+            los::reorder_heightmap(g->data.data(), g->width, g->height, los::MortonIndex(g->width)),
+            los::QuantizedHeightmap(g->data.data(), g->width, g->height, kQuantizeStep)}));
+        for (Shape shape : shapes) {
+            for (Height height : heights) {
+                std::string suffix = g->name + "/" + los::bench::shape_name(shape) + "/" +
+                                     los::bench::height_name(height) + "/";
+
+                auto add = [&](int rays, const std::string& prefix, const Named* kernels, size_t n) {
+                    auto s = std::make_unique<Scenario>();
+                    s->grid = g.get();
+                    s->pyramid = pyramids.back().get();
+                    s->layouts = layouts.back().get();
+                    s->rays = los::bench::make_rays(*g, shape, height, rays);
+                    s->cells = los::bench::mean_cells_visited(*g, s->rays);
+                    for (size_t k = 0; k < n; k++)
+                        benchmark::RegisterBenchmark((prefix + suffix + kernels[k].name).c_str(),
+                                                     kernels[k].kernel, s.get())
+                            ->Unit(benchmark::kMicrosecond);
+                    scenarios.push_back(std::move(s));
+                };
+                add(kBooleanRays, "boolean/", kBooleanKernels, std::size(kBooleanKernels));
+                add(kProbabilityRays, "probability/", kProbabilityKernels,
+                    std::size(kProbabilityKernels));
+            }
+        }
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
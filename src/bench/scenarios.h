@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "los_kernel.h"
+
+// Reproducible terrains and ray sets for the benchmarks. Everything is
+// generated from integer hashes, so the C++ and Python harnesses
+// (scenarios.py) build the same DEMs and rays on every platform.
+namespace los {
+namespace bench {
+
+// splitmix64 finaliser.
+inline uint64_t mix(uint64_t k) {
+    k ^= k >> 30;
+    k *= 0xBF58476D1CE4E5B9ull;
+    k ^= k >> 27;
+    k *= 0x94D049BB133111EBull;
+    k ^= k >> 31;
+    return k;
+}
+
+// Uniform double in [0, 1) from a 64-bit hash.
+inline double unit(uint64_t k) { return static_cast<double>(mix(k) >> 11) * 0x1.0p-53; }
+
+inline double lattice(int64_t ix, int64_t iy, uint64_t seed) {
+    return unit(static_cast<uint64_t>(ix) * 0x9E3779B97F4A7C15ull ^
+                static_cast<uint64_t>(iy) * 0xC2B2AE3D27D4EB4Full ^
+                seed * 0x165667B19E3779F9ull);
+}
+
+struct Grid {
+    std::string name;
+    int width = 0;
+    int height = 0;
+    std::vector<float> data;
+    float max_height = 0;
+
+    float at(int x, int y) const { return data[static_cast<size_t>(y) * width + x]; }
+};
+
+inline void finish(Grid& g) {
+    g.max_height = -INFINITY;
+    for (float v : g.data)
+        if (v > g.max_height) g.max_height = v;
+}
+
+inline Grid flat_grid(int size) {
+    Grid g{"flat", size, size, std::vector<float>(static_cast<size_t>(size) * size, 0.0f)};
+    finish(g);
+    return g;
+}
+
+// Eight octaves of smoothstep value noise: 256-cell hills 100 m high down
+// to 2-cell bumps of under a metre.
+inline Grid fractal_grid(int size, uint64_t seed = 1) {
+    Grid g{"fractal", size, size, std::vector<float>(static_cast<size_t>(size) * size)};
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            double h = 0.0;
+            for (int o = 0; o < 8; o++) {
+                double period = 256.0 / (1 << o);
+                double amp = 100.0 / (1 << o);
+                double u = x / period, v = y / period;
+                double iu = std::floor(u), iv = std::floor(v);
+                double fu = u - iu, fv = v - iv;
+                double su = fu * fu * (3.0 - 2.0 * fu), sv = fv * fv * (3.0 - 2.0 * fv);
+                int64_t ix = static_cast<int64_t>(iu), iy = static_cast<int64_t>(iv);
+                double a = lattice(ix, iy, seed + o), b = lattice(ix + 1, iy, seed + o);
+                double c = lattice(ix, iy + 1, seed + o), d = lattice(ix + 1, iy + 1, seed + o);
+                double top = a + (b - a) * su, bottom = c + (d - c) * su;
+                h += amp * (top + (bottom - top) * sv);
+            }
+            g.data[static_cast<size_t>(y) * size + x] = static_cast<float>(h);
+        }
+    }
+    finish(g);
+    return g;
+}
+
+// Load a float32 C-order 2-D .npy (the *_dem.npy files fetch_usgs_lidar.py
+// writes).
+inline bool load_npy(const std::string& path, Grid& g) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    char magic[8];
+    bool ok = std::fread(magic, 1, 8, f) == 8 && std::memcmp(magic, "\x93NUMPY", 6) == 0;
+    uint32_t headerLen = 0;
+    if (ok) {
+        unsigned char len[4] = {0, 0, 0, 0};
+        int bytes = magic[6] == 1 ? 2 : 4;
+        ok = std::fread(len, 1, bytes, f) == static_cast<size_t>(bytes);
+        headerLen = len[0] | len[1] << 8 | len[2] << 16 | static_cast<uint32_t>(len[3]) << 24;
+    }
+    std::string header(headerLen, '\0');
+    ok = ok && std::fread(&header[0], 1, headerLen, f) == headerLen &&
+         header.find("'<f4'") != std::string::npos &&
+         header.find("'fortran_order': False") != std::string::npos;
+
+    long rows = 0, cols = 0;
+    size_t shape = header.find("'shape': (");
+    ok = ok && shape != std::string::npos &&
+         std::sscanf(header.c_str() + shape, "'shape': (%ld, %ld)", &rows, &cols) == 2 &&
+         rows > 0 && cols > 0;
+    if (ok) {
+        g.width = static_cast<int>(cols);
+        g.height = static_cast<int>(rows);
+        g.data.resize(static_cast<size_t>(rows) * cols);
+        ok = std::fread(g.data.data(), sizeof(float), g.data.size(), f) == g.data.size();
+    }
+    std::fclose(f);
+    if (!ok)
+        return false;
+    g.name = "usgs";
+    finish(g);
+    return true;
+}
+
+// Ray shapes: length in cells and the directions they may take. Vertical
+// rays run within 10 degrees of the y axis, where a row-major walk touches
+// a new cache line on nearly every step.
+enum class Shape { Short, Long, Diagonal, Axis, Vertical };
+// Clear rays run 10 m above the highest cell. Blocked rays start 2 m above
+// the ground and aim 50 m below the target cell, so they hit the terrain
+// early (about a tenth of the way on the fractal grid).
+enum class Height { Clear, Blocked };
+
+inline const char* shape_name(Shape s) {
+    switch (s) {
+    case Shape::Short: return "short";
+    case Shape::Long: return "long";
+    case Shape::Diagonal: return "diagonal";
+    case Shape::Axis: return "axis";
+    default: return "vertical";
+    }
+}
+
+inline const char* height_name(Height h) { return h == Height::Clear ? "clear" : "blocked"; }
+
+// n rows of (x0, y0, z0, x1, y1, z1), all inside the grid.
+inline std::vector<double> make_rays(const Grid& g, Shape shape, Height height, int n,
+                                     uint64_t seed = 7) {
+    const double kPi = 3.14159265358979323846;
+    double length = shape == Shape::Short ? 32.0 : std::min(1024.0, 0.7 * std::min(g.width, g.height));
+    std::vector<double> rays(6 * static_cast<size_t>(n));
+
+    for (int i = 0; i < n; i++) {
+        uint64_t k = seed * 0x9E3779B97F4A7C15ull + static_cast<uint64_t>(i) * 4;
+        double dx, dy;
+        if (shape == Shape::Axis) {
+            static const int dirs[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+            int d = static_cast<int>(mix(k) & 3);
+            dx = dirs[d][0] * length;
+            dy = dirs[d][1] * length;
+        } else if (shape == Shape::Diagonal) {
+            int d = static_cast<int>(mix(k) & 3);
+            dx = (d & 1 ? -1 : 1) * length / std::sqrt(2.0);
+            dy = (d & 2 ? -1 : 1) * length / std::sqrt(2.0);
+        } else if (shape == Shape::Vertical) {
+            double angle = (mix(k) & 1 ? 0.5 : 1.5) * kPi + (unit(k) - 0.5) * kPi / 9;
+            dx = length * std::cos(angle);
+            dy = length * std::sin(angle);
+        } else {
+            double angle = 2 * kPi * unit(k);
+            dx = length * std::cos(angle);
+            dy = length * std::sin(angle);
+        }
+
+        // Start anywhere the end still lands inside the grid.
+        double loX = std::max(0.0, -dx), hiX = g.width - std::max(0.0, dx);
+        double loY = std::max(0.0, -dy), hiY = g.height - std::max(0.0, dy);
+        double x0 = loX + (hiX - loX) * unit(k + 1) * 0.999;
+        double y0 = loY + (hiY - loY) * unit(k + 2) * 0.999;
+        double x1 = x0 + dx, y1 = y0 + dy;
+
+        double z0, z1;
+        if (height == Height::Clear) {
+            z0 = z1 = g.max_height + 10.0;
+        } else {
+            z0 = g.at(static_cast<int>(x0), static_cast<int>(y0)) + 2.0;
+            z1 = g.at(static_cast<int>(x1), static_cast<int>(y1)) - 50.0;
+        }
+
+        double* r = &rays[6 * static_cast<size_t>(i)];
+        r[0] = x0; r[1] = y0; r[2] = z0;
+        r[3] = x1; r[4] = y1; r[5] = z1;
+    }
+    return rays;
+}
+
+// Cells the reference walk (los_boolean_raw) tests before it returns.
+inline int64_t cells_visited(const Grid& g, const double* r) {
+    DDA d(r[0], r[1], r[2], r[3], r[4], r[5]);
+    int64_t cells = 0;
+    while (d.in_bounds(g.width, g.height)) {
+        cells++;
+        if (g.at(d.x, d.y) > d.ray_height(d.cell_t(d.x, d.y)) || d.at_end())
+            break;
+        d.step();
+    }
+    return cells;
+}
+
+inline double mean_cells_visited(const Grid& g, const std::vector<double>& rays) {
+    int64_t n = static_cast<int64_t>(rays.size() / 6), total = 0;
+    for (int64_t i = 0; i < n; i++)
+        total += cells_visited(g, &rays[6 * i]);
+    return n ? static_cast<double>(total) / n : 0.0;
+}
+
+} // namespace bench
+} // namespace los
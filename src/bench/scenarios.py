@@ -0,0 +1,159 @@
+"""Reproducible terrains and ray sets for the Python benchmarks.
+
+A port of scenarios.h: the same integer hashes give the same DEMs and rays
+as the C++ suite, so numbers from both harnesses are directly comparable.
+"""
+
+import glob
+import math
+import os
+
+import numpy as np
+
+_M64 = (1 << 64) - 1
+
+
+def mix(k):
+    """splitmix64 finaliser on a Python int."""
+    k &= _M64
+    k ^= k >> 30
+    k = (k * 0xBF58476D1CE4E5B9) & _M64
+    k ^= k >> 27
+    k = (k * 0x94D049BB133111EB) & _M64
+    k ^= k >> 31
+    return k
+
+
+def unit(k):
+    return (mix(k) >> 11) * 2.0 ** -53
+
+
+def _mix_array(k):
+    k = k ^ (k >> np.uint64(30))
+    k = k * np.uint64(0xBF58476D1CE4E5B9)
+    k = k ^ (k >> np.uint64(27))
+    k = k * np.uint64(0x94D049BB133111EB)
+    return k ^ (k >> np.uint64(31))
+
+
+def _lattice(ix, iy, seed):
+    with np.errstate(over="ignore"):
+        k = (ix.astype(np.uint64) * np.uint64(0x9E3779B97F4A7C15)
+             ^ iy.astype(np.uint64) * np.uint64(0xC2B2AE3D27D4EB4F)
+             ^ np.uint64((seed * 0x165667B19E3779F9) & _M64))
+        return (_mix_array(k) >> np.uint64(11)).astype(np.float64) * 2.0 ** -53
+
+
+def flat_grid(size):
+    return np.zeros((size, size), dtype=np.float32)
+
+
+def fractal_grid(size, seed=1):
+    """Eight octaves of smoothstep value noise, identical to fractal_grid()."""
+    y, x = np.mgrid[0:size, 0:size].astype(np.float64)
+    h = np.zeros((size, size))
+    for o in range(8):
+        period = 256.0 / (1 << o)
+        amp = 100.0 / (1 << o)
+        u, v = x / period, y / period
+        iu, iv = np.floor(u), np.floor(v)
+        fu, fv = u - iu, v - iv
+        su, sv = fu * fu * (3.0 - 2.0 * fu), fv * fv * (3.0 - 2.0 * fv)
+        ix, iy = iu.astype(np.int64), iv.astype(np.int64)
+        a, b = _lattice(ix, iy, seed + o), _lattice(ix + 1, iy, seed + o)
+        c, d = _lattice(ix, iy + 1, seed + o), _lattice(ix + 1, iy + 1, seed + o)
+        top, bottom = a + (b - a) * su, c + (d - c) * su
+        h += amp * (top + (bottom - top) * sv)
+    return h.astype(np.float32)
+
+
+def usgs_grid():
+    """The DEM named by LOS_BENCH_DEM, else the first lidar_data/*_dem.npy."""
+    path = os.environ.get("LOS_BENCH_DEM")
+    if not path:
+        here = os.path.dirname(os.path.abspath(__file__))
+        found = sorted(glob.glob(os.path.join(here, "..", "lidar_data", "*_dem.npy")))
+        path = found[0] if found else None
+    if not path or not os.path.exists(path):
+        return None
+    return np.ascontiguousarray(np.load(path), dtype=np.float32)
+
+
+SHAPES = ["short", "long", "diagonal", "axis", "vertical"]
+HEIGHTS = ["clear", "blocked"]
+
+
+def make_rays(dem, shape, height, n, seed=7):
+    """n rows of (x0, y0, z0, x1, y1, z1), as make_rays() in scenarios.h."""
+    h, w = dem.shape
+    length = 32.0 if shape == "short" else min(1024.0, 0.7 * min(w, h))
+    top = float(np.nanmax(dem))
+    rays = np.empty((n, 6))
+    for i in range(n):
+        k = (seed * 0x9E3779B97F4A7C15 + i * 4) & _M64
+        if shape == "axis":
+            dx, dy = [(1, 0), (0, 1), (-1, 0), (0, -1)][mix(k) & 3]
+            dx, dy = dx * length, dy * length
+        elif shape == "diagonal":
+            d = mix(k) & 3
+            dx = (-1 if d & 1 else 1) * length / math.sqrt(2.0)
+            dy = (-1 if d & 2 else 1) * length / math.sqrt(2.0)
+        elif shape == "vertical":
+            angle = (0.5 if mix(k) & 1 else 1.5) * math.pi + (unit(k) - 0.5) * math.pi / 9
+            dx, dy = length * math.cos(angle), length * math.sin(angle)
+        else:
+            angle = 2 * math.pi * unit(k)
+            dx, dy = length * math.cos(angle), length * math.sin(angle)
+
+        lo_x, hi_x = max(0.0, -dx), w - max(0.0, dx)
+        lo_y, hi_y = max(0.0, -dy), h - max(0.0, dy)
+        x0 = lo_x + (hi_x - lo_x) * unit(k + 1) * 0.999
+        y0 = lo_y + (hi_y - lo_y) * unit(k + 2) * 0.999
+        x1, y1 = x0 + dx, y0 + dy
+
+        if height == "clear":
+            z0 = z1 = top + 10.0
+        else:
+            z0 = float(dem[int(y0), int(x0)]) + 2.0
+            z1 = float(dem[int(y1), int(x1)]) - 50.0
+        rays[i] = (x0, y0, z0, x1, y1, z1)
+    return rays
+
+
+def _cross(c, step, origin, inv):
+    return ((c + 1.0 if step > 0 else float(c)) - origin) * inv
+
+
+def cells_visited(dem, ray):
+    """Cells los_boolean tests before it returns (the DDA in los_kernel.h)."""
+    h, w = dem.shape
+    x0, y0, z0, x1, y1, z1 = (float(v) for v in ray)
+    dx, dy, dz = x1 - x0, y1 - y0, z1 - z0
+    x, y = math.floor(x0), math.floor(y0)
+    end_x, end_y = math.floor(x1), math.floor(y1)
+    step_x = 1 if dx > 0 else -1
+    step_y = 1 if dy > 0 else -1
+    inv_x = 1.0 / dx if dx else math.inf
+    inv_y = 1.0 / dy if dy else math.inf
+    major_x = abs(dx) > abs(dy)
+    t_max_x = _cross(x, step_x, x0, inv_x) if dx else math.inf
+    t_max_y = _cross(y, step_y, y0, inv_y) if dy else math.inf
+
+    cells = 0
+    while 0 <= x < w and 0 <= y < h:
+        cells += 1
+        t = (x - x0) / dx if major_x else (y - y0) / dy
+        t = min(max(t, 0.0), 1.0)
+        if dem.item(y, x) > z0 + t * dz or (x == end_x and y == end_y):
+            break
+        if t_max_x < t_max_y:
+            x += step_x
+            t_max_x = _cross(x, step_x, x0, inv_x) if dx else math.inf
+        else:
+            y += step_y
+            t_max_y = _cross(y, step_y, y0, inv_y) if dy else math.inf
+    return cells
+
+
+def mean_cells_visited(dem, rays):
+    return sum(cells_visited(dem, r) for r in rays) / max(len(rays), 1)
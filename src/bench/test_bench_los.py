@@ -0,0 +1,148 @@
+"""pytest-benchmark harness for the los Python API.
+
+    pytest src/bench --benchmark-only                       # everything
+    pytest src/bench -k "fractal and long" --benchmark-only
+    pytest src/bench --benchmark-autosave                   # then --benchmark-compare
+
+Each case traces one terrain x ray set through one entry point, with the
+per-ray los.los_boolean / los.los_probability loop as the baseline. Every
+float64 kernel must return the baseline's answers. extra_info records
+rays/s, cells/ray (cells the reference walk visits) and the speedup over
+the baseline when it ran first in the same session.
+
+Correctness checks live in src/test_los.py and src/tests/, not here.
+
+Environment: LOS_BENCH_SIZE (grid side, default 1024), LOS_BENCH_RAYS (rays
+per set, default 1024), LOS_BENCH_DEM (a *_dem.npy; otherwise the first
+lidar_data/*_dem.npy is used and the usgs cases skip when there is none).
+"""
+
+import functools
+import os
+
+import numpy as np
+import pytest
+
+import los
+import scenarios
+
+SIZE = int(os.environ.get("LOS_BENCH_SIZE", 1024))
+RAYS = int(os.environ.get("LOS_BENCH_RAYS", 1024))
+SAMPLES = 9
+
+TERRAINS = ["flat", "fractal", "usgs"]
+
+_baseline_rate = {}
+
+
+@functools.lru_cache(maxsize=None)
+def dem(name):
+    if name == "flat":
+        return scenarios.flat_grid(SIZE)
+    if name == "fractal":
+        return scenarios.fractal_grid(SIZE)
+    grid = scenarios.usgs_grid()
+    if grid is None:
+        pytest.skip("no USGS DEM: set LOS_BENCH_DEM or run fetch_usgs_lidar.py")
+    return grid
+
+
+@functools.lru_cache(maxsize=None)
+def terrain(name, **kwargs):
+    return los.Terrain(dem(name), **kwargs)
+
+
+@functools.lru_cache(maxsize=None)
+def scenario(name, shape, height, n):
+    grid = dem(name)
+    rays = scenarios.make_rays(grid, shape, height, n)
+    return rays, scenarios.mean_cells_visited(grid, rays)
+
+
+def boolean_kernels(name):
+    grid = dem(name)
+    h, w = grid.shape
+    return {
+        "los_boolean": lambda rays: np.array(
+            [los.los_boolean(grid, w, h, *r) for r in rays.tolist()], dtype=np.uint8),
+        "batch": lambda rays: los.los_boolean_batch(grid, rays),
+        "terrain_pyramid": lambda rays: terrain(name).los_boolean_batch(rays),
+        "terrain_packets": lambda rays: terrain(name, pyramid=False).los_boolean_batch(rays),
+        "terrain_float32": lambda rays: terrain(name, pyramid=False,
+                                                precision="float32").los_boolean_batch(rays),
+        "terrain_blocked": lambda rays: terrain(name, pyramid=False,
+                                                layout="blocked").los_boolean_batch(rays),
+        "terrain_morton": lambda rays: terrain(name, pyramid=False,
+                                               layout="morton").los_boolean_batch(rays),
+        "terrain_quantized": lambda rays: terrain(name, pyramid=False,
+                                                  quantize=0.01).los_boolean_batch(rays),
+    }
+
+
+def probability_kernels(name):
+    grid = dem(name)
+    h, w = grid.shape
+    return {
+        "los_probability": lambda rays: np.array(
+            [los.los_probability(grid, w, h, *r, SAMPLES) for r in rays.tolist()]),
+        "batch": lambda rays: los.los_probability_batch(grid, rays, num_samples=SAMPLES),
+        "terrain_pyramid": lambda rays: terrain(name).los_probability_batch(
+            rays, num_samples=SAMPLES),
+        "terrain_float32": lambda rays: terrain(name, pyramid=False, precision="float32")
+            .los_probability_batch(rays, num_samples=SAMPLES),
+    }
+
+
+def record(benchmark, key, baseline, cells, traced):
+    benchmark.extra_info["rays"] = traced
+    benchmark.extra_info["cells/ray"] = round(cells, 2)
+    if benchmark.stats is None:  # --benchmark-disable
+        return
+    rate = traced / benchmark.stats.stats.mean
+    benchmark.extra_info["rays/s"] = round(rate)
+    if baseline:
+        _baseline_rate[key] = rate
+    elif key in _baseline_rate:
+        benchmark.extra_info["speedup"] = round(rate / _baseline_rate[key], 2)
+
+
+BOOLEAN = ["los_boolean", "batch", "terrain_pyramid", "terrain_packets", "terrain_float32",
+           "terrain_blocked", "terrain_morton", "terrain_quantized"]
+PROBABILITY = ["los_probability", "batch", "terrain_pyramid", "terrain_float32"]
+
+
+@pytest.mark.parametrize("kernel", BOOLEAN)
+@pytest.mark.parametrize("height", scenarios.HEIGHTS)
+@pytest.mark.parametrize("shape", scenarios.SHAPES)
+@pytest.mark.parametrize("name", TERRAINS)
+def test_boolean(benchmark, name, shape, height, kernel):
+    rays, cells = scenario(name, shape, height, RAYS)
+    kernels = boolean_kernels(name)
+    benchmark.group = f"boolean/{name}/{shape}/{height}"
+
+    result = benchmark(kernels[kernel], rays)
+
+    if kernel == "terrain_quantized":
+        # Quantized answers may only turn visible rays blocked.
+        assert not np.any(result > kernels["los_boolean"](rays))
+    elif kernel != "terrain_float32":
+        np.testing.assert_array_equal(result, kernels["los_boolean"](rays))
+    record(benchmark, ("boolean", name, shape, height), kernel == "los_boolean",
+           cells, len(rays))
+
+
+@pytest.mark.parametrize("kernel", PROBABILITY)
+@pytest.mark.parametrize("height", scenarios.HEIGHTS)
+@pytest.mark.parametrize("shape", scenarios.SHAPES)
+@pytest.mark.parametrize("name", TERRAINS)
+def test_probability(benchmark, name, shape, height, kernel):
+    rays, cells = scenario(name, shape, height, max(RAYS // 8, 1))
+    kernels = probability_kernels(name)
+    benchmark.group = f"probability/{name}/{shape}/{height}"
+
+    result = benchmark(kernels[kernel], rays)
+
+    if kernel != "terrain_float32":
+        np.testing.assert_array_equal(result, kernels["los_probability"](rays))
+    record(benchmark, ("probability", name, shape, height), kernel == "los_probability",
+           cells, len(rays) * SAMPLES)
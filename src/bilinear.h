@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "stats.h"
+
+namespace los {
+
+// How ray queries read the terrain between cell centres.
+enum class Interpolation { Nearest, Bilinear };
+
+// The bilinear surface puts cell (x, y)'s height at its centre
+// (x + 0.5, y + 0.5) and interpolates between the four nearest centres.
+// Patch (i, j) is the square between the centres of cells (i - 1, j - 1)
+// and (i, j), i.e. [i - 0.5, i + 0.5) x [j - 0.5, j + 0.5) in cell
+// coordinates, so a width x height grid has (width + 1) x (height + 1)
+// patches. Samples past the edge are clamped to it, so the border
+// half-cells are flat. A patch with a NaN sample never blocks.
+//
+// Largest sample of patch (i, j) through the cell reader `cells`, which
+// bounds the patch; -inf when all four are NaN. Build a MaxPyramid over
+// this (MaxPyramid::build_cells) for los_boolean_bilinear_cells.
+template <typename Cells>
+struct BilinearMax {
+    const Cells& cells;
+    int width, height;
+
+    float operator()(int i, int j) const {
+        int xa = std::max(i - 1, 0), xb = std::min(i, width - 1);
+        int ya = std::max(j - 1, 0), yb = std::min(j, height - 1);
+        float m = -std::numeric_limits<float>::infinity();
+        for (float v : {cells(xa, ya), cells(xb, ya), cells(xa, yb), cells(xb, yb)})
+            if (v > m) m = v;
+        return m;
+    }
+};
+
+// Whether the surface over the walk's current patch (r.x, r.y) rises above
+// the ray anywhere for t in [ta, tb]. r walks patch coordinates (cell
+// coordinates + 0.5). Along the ray both the surface and the ray height
+// are quadratic in t, so a minimum of ray minus surface inside the range
+// lies at either end or at one interior vertex; those are the only points
+// tested.
+template <typename Real, typename Cells>
+inline bool bilinear_patch_blocks(const Cells& cells, int width, int height,
+                                  const BasicDDA<Real>& r, Real ta, Real tb) {
+    const int i = r.x, j = r.y;
+    int xa = std::max(i - 1, 0), xb = std::min(i, width - 1);
+    int ya = std::max(j - 1, 0), yb = std::min(j, height - 1);
+    double h00 = cells(xa, ya), h10 = cells(xb, ya);
+    double h01 = cells(xa, yb), h11 = cells(xb, yb);
+    if (std::isnan(h00 + h10 + h01 + h11))
+        return false;
+    // Rounding in the lerps may not step past the top sample, so a block
+    // the pyramid clears never blocks here.
+    double top = std::max(std::max(h00, h10), std::max(h01, h11));
+    double x0 = r.x0, y0 = r.y0, dx = r.dx, dy = r.dy;
+
+    auto above = [&](Real t) {
+        double u = std::min(std::max(x0 + double(t) * dx - i, 0.0), 1.0);
+        double v = std::min(std::max(y0 + double(t) * dy - j, 0.0), 1.0);
+        double lo = h00 + u * (h10 - h00);
+        double hi = h01 + u * (h11 - h01);
+        double f = std::min(lo + v * (hi - lo), top);
+        return f > static_cast<double>(r.ray_height(t));
+    };
+    if (above(ta) || above(tb))
+        return true;
+
+    // ray - surface = g0 + g1 t + g2 t^2; an interior minimum needs g2 > 0.
+    double b = h10 - h00, c = h01 - h00, d = h00 - h10 - h01 + h11;
+    double bulge = r.bulge;
+    double g2 = bulge - d * dx * dy;
+    if (!(g2 > 0))
+        return false;
+    double g1 = (double(r.dz) - bulge) - (b * dx + c * dy + d * ((x0 - i) * dy + (y0 - j) * dx));
+    double tv = -g1 / (2.0 * g2);
+    if (!(tv > ta && tv < tb))
+        return false;
+    return above(static_cast<Real>(tv));
+}
+
+// t at which the walk r entered its current cell (0 for the first).
+template <typename Real>
+inline Real walk_enter_t(const BasicDDA<Real>& r) {
+    Real t = 0;
+    if (r.dx != 0) t = std::max(t, r.cross_x(r.x - r.stepX));
+    if (r.dy != 0) t = std::max(t, r.cross_y(r.y - r.stepY));
+    return t;
+}
+
+// t at which the walk r leaves block b, capped at 1.
+template <typename Real>
+inline Real walk_leave_t(const BasicDDA<Real>& r, const MaxPyramid::Block& b) {
+    Real tx = r.cross_x(r.stepX > 0 ? b.x1 : b.x0);
+    Real ty = r.cross_y(r.stepY > 0 ? b.y1 : b.y0);
+    return std::min(Real(1), std::min(tx, ty));
+}
+
+// los_boolean over the bilinear surface: the ray is blocked where the
+// surface rises strictly above it. The walk visits each patch the segment
+// crosses and tests it over the exact t range the segment spends inside
+// it (bilinear_patch_blocks), so sub-cell ridges and gaps are resolved
+// without upsampling. Endpoints must lie inside the grid, i.e.
+// [0, width) x [0, height), or the ray is blocked, as for
+// los_boolean_cells. `curvature` bends the ray as described at BasicDDA.
+//
+// A non-null `pyramid` over BilinearMax for the (width + 1) x
+// (height + 1) patches skips whole blocks whose max is at or below the
+// lowest ray height over the t range the segment spends inside them. The
+// walk stops after the first patch it leaves at t >= 1, so skipping a
+// block never changes the answer.
+template <typename Real = double, typename Pyramid = MaxPyramid, typename Cells>
+inline double los_boolean_bilinear_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    const Pyramid* pyramid,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    double curvature = 0.0
+) {
+    if (!(x0 >= 0 && x0 < width && y0 >= 0 && y0 < height &&
+          x1 >= 0 && x1 < width && y1 >= 0 && y1 < height))
+        return 0.0;
+
+    BasicDDA<Real> r(x0 + 0.5, y0 + 0.5, z0, x1 + 0.5, y1 + 0.5, z1, curvature);
+    const int top = pyramid ? pyramid->levels() : 0;
+    int level = 1;
+    LOS_STAT_CELLS(walked);
+
+    // The segment stays inside the patch grid; leaving it can only be a
+    // rounding step past the end.
+    while (r.in_bounds(width + 1, height + 1)) {
+        Real enter = walk_enter_t(r);
+
+        bool skipped = false;
+        for (int l = std::min(level, top); l >= 1; l--) {
+            MaxPyramid::Block b = pyramid->block(l, r.x, r.y);
+            Real leave = walk_leave_t(r, b);
+            if (pyramid->block_max(l, r.x, r.y) <= r.min_height_between(enter, leave)) {
+                LOS_STAT_SKIP(l);
+                if (!(leave < 1))
+                    return 1.0;
+                r.exit_block(b);
+                level = l + 1;
+                skipped = true;
+                break;
+            }
+        }
+        if (skipped)
+            continue;
+        level = 1;
+
+        Real leave = std::min(Real(1), std::min(r.tMaxX, r.tMaxY));
+        LOS_STAT_STEP(walked);
+        if (bilinear_patch_blocks(cells, width, height, r, enter, leave))
+            return 0.0;
+        if (!(leave < 1))
+            break;
+
+        r.step();
+    }
+
+    return 1.0;
+}
+
+} // namespace los
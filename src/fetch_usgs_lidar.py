@@ -5,56 +5,221 @@ Downloads LAZ files from USGS 3DEP and converts them to DEM rasters for los.cpp
 
 Usage:
     python fetch_usgs_lidar.py --lat 39.7392 --lon -104.9903 --sample
+    python fetch_usgs_lidar.py --lat 39.7392 --lon -104.9903 --download --max-tiles 8
 """
 
 import argparse
-import requests
+import hashlib
 import json
+import queue
+import requests
 import os
 import sys
+import threading
+from concurrent.futures import ThreadPoolExecutor, as_completed
 from pathlib import Path
 
 try:
     import laspy
     import numpy as np
+    import los
     import rasterio
     from rasterio.transform import from_bounds
-    from scipy.interpolate import griddata
+    from laz_ingest import rasterize_laz, read_bounds
 except ImportError as e:
     print(f"Missing required library: {e}")
     print("Install with conda:")
-    print("  conda install -c conda-forge laspy rasterio scipy")
+    print("  conda install -c conda-forge laspy rasterio")
+    print("and build los: python setup.py build_ext --inplace")
     sys.exit(1)
 
 
+def sha256_file(path, block=1 << 22):
+    """Hex sha256 of a file's contents."""
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(block), b""):
+            digest.update(chunk)
+    return digest.hexdigest()
+
+
+class LazCache:
+    """Content-addressed store of downloaded LAZ files and their DEMs.
+
+    Files live under <root>/laz/<sha256>.laz. manifest.json maps each URL
+    to the sha256, size and ETag it had when downloaded, so a tile whose
+    server ETag and size still match is not fetched again. Per-tile DEMs are
+    kept under <root>/dem/, keyed by the LAZ hash and the raster settings.
+    """
+
+    def __init__(self, root):
+        self.root = Path(root)
+        (self.root / "laz").mkdir(parents=True, exist_ok=True)
+        (self.root / "dem").mkdir(parents=True, exist_ok=True)
+        self.manifest_path = self.root / "manifest.json"
+        self._lock = threading.Lock()
+        self._manifest = {}
+        if self.manifest_path.exists():
+            with open(self.manifest_path) as f:
+                self._manifest = json.load(f)
+
+    def blob(self, sha):
+        return self.root / "laz" / f"{sha}.laz"
+
+    def lookup(self, url, size=None, etag=None):
+        """Cached path for url if the server still reports the same content."""
+        with self._lock:
+            entry = self._manifest.get(url)
+        if not entry:
+            return None
+        path = self.blob(entry["sha256"])
+        if not path.exists() or path.stat().st_size != entry["size"]:
+            return None
+        if size and size != entry["size"]:
+            return None
+        if etag and entry.get("etag") and etag != entry["etag"]:
+            return None
+        return path
+
+    def add(self, url, downloaded, etag=None):
+        """Move a finished download into the store; returns its path."""
+        sha = sha256_file(downloaded)
+        path = self.blob(sha)
+        os.replace(downloaded, path)
+        with self._lock:
+            self._manifest[url] = {"sha256": sha, "size": path.stat().st_size, "etag": etag}
+            tmp = self.manifest_path.with_name(self.manifest_path.name + ".tmp")
+            with open(tmp, "w") as f:
+                json.dump(self._manifest, f, indent=2)
+            os.replace(tmp, self.manifest_path)
+        return path
+
+    def dem_path(self, laz_path, key):
+        return self.root / "dem" / f"{Path(laz_path).stem}_{key}.npz"
+
+
+class RangeDownloader:
+    """HTTP download split into concurrent byte ranges, resumable.
+
+    Ranges are written in place into <dest>.part; <dest>.part.json records
+    how far each range got, so an interrupted download picks up where it
+    stopped as long as the server reports the same size and ETag. Servers
+    without range support get a single plain stream.
+    """
+
+    BLOCK = 1 << 20
+
+    def __init__(self, session=None, parts=4, timeout=60):
+        self.session = session or requests.Session()
+        self.parts = max(1, parts)
+        self.timeout = timeout
+
+    def head(self, url):
+        """(size, etag, accepts_ranges) from a HEAD request."""
+        r = self.session.head(url, allow_redirects=True, timeout=self.timeout)
+        r.raise_for_status()
+        size = int(r.headers.get("Content-Length", 0))
+        return size, r.headers.get("ETag"), r.headers.get("Accept-Ranges") == "bytes"
+
+    def download(self, url, dest, size=None, etag=None, ranges=True, progress=None):
+        dest = Path(dest)
+        part = dest.with_name(dest.name + ".part")
+        state_path = dest.with_name(dest.name + ".part.json")
+        if not size or not ranges:
+            return self._stream(url, part, dest)
+
+        n = min(self.parts, max(1, size // self.BLOCK))
+        bounds = [(i * size // n, (i + 1) * size // n) for i in range(n)]
+        state = {"size": size, "etag": etag, "done": [b[0] for b in bounds]}
+        if state_path.exists() and part.exists():
+            with open(state_path) as f:
+                old = json.load(f)
+            if old.get("size") == size and old.get("etag") == etag and len(old["done"]) == n:
+                state = old
+        if not part.exists() or part.stat().st_size != size:
+            with open(part, "wb") as f:
+                f.truncate(size)
+
+        lock = threading.Lock()
+
+        def save():
+            tmp = state_path.with_name(state_path.name + ".tmp")
+            with open(tmp, "w") as f:
+                json.dump(state, f)
+            os.replace(tmp, state_path)
+
+        def fetch(i):
+            start, end = state["done"][i], bounds[i][1]
+            if start >= end:
+                return
+            headers = {"Range": f"bytes={start}-{end - 1}"}
+            with self.session.get(url, headers=headers, stream=True, timeout=self.timeout) as r:
+                r.raise_for_status()
+                if r.status_code != 206:
+                    raise IOError(f"{url}: server ignored the Range request")
+                with open(part, "r+b") as f:
+                    f.seek(start)
+                    for chunk in r.iter_content(chunk_size=self.BLOCK):
+                        f.write(chunk)
+                        with lock:
+                            state["done"][i] += len(chunk)
+                            save()
+                            if progress:
+                                progress(sum(d - b[0] for d, b in zip(state["done"], bounds)), size)
+
+        with ThreadPoolExecutor(max_workers=n) as pool:
+            for future in [pool.submit(fetch, i) for i in range(n)]:
+                future.result()
+
+        if any(d < b[1] for d, b in zip(state["done"], bounds)):
+            raise IOError(f"{url}: download ended early")
+        os.replace(part, dest)
+        state_path.unlink(missing_ok=True)
+        return dest
+
+    def _stream(self, url, part, dest):
+        with self.session.get(url, stream=True, timeout=self.timeout) as r:
+            r.raise_for_status()
+            with open(part, "wb") as f:
+                for chunk in r.iter_content(chunk_size=self.BLOCK):
+                    f.write(chunk)
+        os.replace(part, dest)
+        return dest
+
+
 class USGSLidarFetcher:
     """Fetches and processes USGS 3DEP LiDAR data into DEM rasters"""
     
-    def __init__(self, lat, lon, output_dir="lidar_data", resolution=1.0):
+    def __init__(self, lat, lon, output_dir="lidar_data", resolution=1.0,
+                 stat="max", classes=None, returns="all", fill="push-pull"):
         self.lat = lat
         self.lon = lon
         self.output_dir = Path(output_dir)
         self.output_dir.mkdir(exist_ok=True)
         self.resolution = resolution  # meters per pixel
+        self.stat = stat  # per-cell statistic, see los.Rasterizer
+        self.classes = classes  # LAS classes to keep, e.g. [2] for ground
+        self.returns = returns  # 'all', 'first' or 'last'
+        self.fill = fill  # hole filling, 'push-pull' or 'nearest' (los.write_tiled_dem)
         
-    def find_lidar_tiles(self):
+    def find_lidar_tiles(self, max_tiles=10, bbox_size=0.01):
         """
         Query USGS The National Map API to find available LiDAR tiles
+        within bbox_size degrees of (lat, lon)
         """
         print(f"Searching for LiDAR data at ({self.lat}, {self.lon})...")
         
         # The National Map API endpoint
         base_url = "https://tnmaccess.nationalmap.gov/api/v1/products"
         
-        # Calculate bounding box (roughly 0.01 degrees ~ 1km)
-        bbox_size = 0.01
+        # Bounding box (0.01 degrees is roughly 1km)
         bbox = f"{self.lon - bbox_size},{self.lat - bbox_size},{self.lon + bbox_size},{self.lat + bbox_size}"
         
         params = {
             "datasets": "Lidar Point Cloud (LPC)",
             "bbox": bbox,
             "outputFormat": "JSON",
-            "max": 10
+            "max": max_tiles
         }
         
         try:
@@ -112,6 +277,147 @@ class USGSLidarFetcher:
             print(f"Error downloading file: {e}")
             return None
     
+    def raster_key(self):
+        """Name for this fetcher's raster settings, for cached DEMs."""
+        classes = "-".join(str(c) for c in self.classes) if self.classes else "all"
+        return f"{self.resolution:g}m_{self.stat}_{classes}_{self.returns}"
+    
+    def fetch_region(self, tiles, workers=4, range_parts=4, queue_size=2, cache_dir=None):
+        """
+        Download, convert and merge tiles into one tiled DEM, pipelined
+        
+        Up to `workers` tiles download at once, each in `range_parts`
+        concurrent HTTP ranges that resume after an interruption. Tiles
+        already in the cache with the same URL, size and ETag are not fetched
+        again. Finished files pass through a bounded queue of `queue_size`
+        to one converter thread, which streams each into los.Rasterizer
+        while the other downloads continue. Each tile's DEM is cached by its
+        content hash and the raster settings. All tiles share one grid
+        lattice and are merged into a single *_dem.npy / *_dem.ltd: max and
+        min combine overlapping cells, other stats keep the first tile's.
+        Tiles are assumed to share a CRS, as tiles of one USGS project do.
+        
+        Returns:
+            (npy_path, tiled_path, metadata), or None if no tile converted
+        """
+        cache = LazCache(cache_dir or self.output_dir / "cache")
+        downloader = RangeDownloader(parts=range_parts)
+        key = self.raster_key()
+        work = queue.Queue(maxsize=max(1, queue_size))
+        converted, errors = [], []
+        
+        def fetch(tile):
+            url = tile['downloadURL']
+            name = Path(url.split('?')[0]).name
+            size, etag, ranges = downloader.head(url)
+            path = cache.lookup(url, size, etag)
+            if path is None:
+                print(f"  Downloading {name} ({size / 1e6:.1f} MB)")
+                partial = downloader.download(url, cache.root / name, size, etag, ranges)
+                path = cache.add(url, partial, etag)
+            else:
+                print(f"  {name}: already cached")
+            work.put((name, path))  # blocks while the converter is behind
+        
+        def convert():
+            while True:
+                item = work.get()
+                if item is None:
+                    return
+                name, path = item
+                try:
+                    converted.append((name,) + self._convert_tile(path, cache.dem_path(path, key)))
+                    print(f"  {name}: converted")
+                except Exception as e:
+                    errors.append((name, e))
+        
+        converter = threading.Thread(target=convert, name="laz-converter")
+        converter.start()
+        try:
+            with ThreadPoolExecutor(max_workers=max(1, workers)) as pool:
+                futures = {pool.submit(fetch, t): t for t in tiles if t.get('downloadURL')}
+                for future in as_completed(futures):
+                    try:
+                        future.result()
+                    except Exception as e:
+                        errors.append((futures[future].get('title', 'tile'), e))
+        finally:
+            work.put(None)
+            converter.join()
+        
+        for name, e in errors:
+            print(f"  {name}: failed: {e}")
+        if not converted:
+            return None
+        return self._merge_tiles(converted, f"region_{self.lat}_{self.lon}_{key}")
+    
+    def _convert_tile(self, laz_path, dem_path):
+        """Rasterize one tile onto the shared lattice: (dem_path, x0, y1, h, w)."""
+        if dem_path.exists():
+            with np.load(dem_path) as f:
+                h, w = f["dem"].shape
+                return dem_path, float(f["x0"]), float(f["y1"]), h, w
+        
+        # Snap the grid's top-left corner to the lattice so tiles line up
+        x_min, y_min, x_max, y_max, *_ = read_bounds(laz_path)
+        res = self.resolution
+        x0 = np.floor(x_min / res) * res
+        y1 = np.ceil(y_max / res) * res
+        raster = rasterize_laz(laz_path, res, self.stat, self.classes, self.returns,
+                               bounds=(x0, y_min, x_max, y1))
+        dem = raster.finish(fill_holes=False)  # filled once, after the merge
+        
+        tmp = dem_path.with_suffix(".tmp.npz")
+        np.savez(tmp, dem=dem, x0=x0, y1=y1)
+        os.replace(tmp, dem_path)
+        return dem_path, x0, y1, dem.shape[0], dem.shape[1]
+    
+    def _merge_tiles(self, tiles, output_base):
+        """Mosaic per-tile DEMs into one .npy (memory-mapped) and .ltd."""
+        res = self.resolution
+        x0 = min(t[2] for t in tiles)
+        y1 = max(t[3] for t in tiles)
+        width = max(round((t[2] - x0) / res) + t[5] for t in tiles)
+        height = max(round((y1 - t[3]) / res) + t[4] for t in tiles)
+        print(f"  Merging {len(tiles)} tiles into {width}x{height} cells...")
+        
+        npy_path = self.output_dir / f"{output_base}_dem.npy"
+        mosaic = np.lib.format.open_memmap(npy_path, mode="w+", dtype=np.float32,
+                                           shape=(height, width))
+        mosaic[:] = np.nan
+        combine = {"max": np.fmax, "min": np.fmin}.get(self.stat)
+        for _, path, tx0, ty1, h, w in tiles:
+            col, row = round((tx0 - x0) / res), round((y1 - ty1) / res)
+            view = mosaic[row:row + h, col:col + w]
+            with np.load(path) as f:
+                dem = f["dem"]
+            if combine:
+                view[:] = combine(view, dem)
+            else:
+                np.copyto(view, dem, where=np.isnan(view))
+        
+        metadata = {
+            'width': width,
+            'height': height,
+            'resolution': res,
+            'stat': self.stat,
+            'bounds': {
+                'x_min': float(x0),
+                'x_max': float(x0 + width * res),
+                'y_min': float(y1 - height * res),
+                'y_max': float(y1)
+            },
+            'source_files': sorted(t[0] for t in tiles)
+        }
+        # Fills the mosaic in place and stores the z range, in one pass
+        tiled_path = npy_path.with_suffix(".ltd")
+        stats = los.write_tiled_dem(tiled_path, mosaic, metadata, fill=self.fill)
+        metadata['bounds'].update(z_min=stats['z_min'], z_max=stats['z_max'])
+        mosaic.flush()
+        print(f"  Saved numpy array: {npy_path}")
+        print(f"  Saved tiled DEM: {tiled_path}")
+        return npy_path, tiled_path, metadata
+    
     def create_sample_laz(self):
         """
         Create a sample LAZ file for testing purposes
@@ -153,6 +459,11 @@ class USGSLidarFetcher:
         # Add intensity values
         las.intensity = np.random.randint(0, 65535, n_points, dtype=np.uint16)
         
+        # Single-return ground points, so --ground and --first-returns keep them
+        las.classification = np.full(n_points, 2, dtype=np.uint8)
+        las.return_number = np.ones(n_points, dtype=np.uint8)
+        las.number_of_returns = np.ones(n_points, dtype=np.uint8)
+        
         output_path = self.output_dir / f"sample_lidar_{self.lat}_{self.lon}.laz"
         las.write(str(output_path))
         
@@ -168,9 +479,17 @@ class USGSLidarFetcher:
         """
         Convert LAZ point cloud to DEM raster
         
+        Points are streamed from the file in bounded chunks (laz_ingest) and
+        binned by los.Rasterizer: one cell per point, self.stat per cell.
+        los.write_tiled_dem then fills the holes (self.fill) and writes the
+        tiled DEM in one native pass. The grid is north-up at
+        self.resolution with no size cap; peak memory depends on the chunk
+        size, not the point count.
+        
         Args:
             laz_path: Path to LAZ file
-            grid_size: Tuple of (width, height) for output grid, or None for auto
+            grid_size: Tuple of (width, height) the grid must fit in, or None
+                to use self.resolution
         
         Returns:
             Path to DEM GeoTIFF file
@@ -178,57 +497,65 @@ class USGSLidarFetcher:
         print(f"\nConverting {laz_path.name} to DEM raster...")
         
         try:
-            # Read LAZ file
-            las = laspy.read(str(laz_path))
+            # The header has the extent, so no point is held beyond its chunk
+            x_min, y_min, x_max, y_max, z_min, z_max, n_points = read_bounds(laz_path)
             
-            x = las.x
-            y = las.y
-            z = las.z
+            print(f"  Points: {n_points}")
+            print(f"  X range: [{x_min:.2f}, {x_max:.2f}]")
+            print(f"  Y range: [{y_min:.2f}, {y_max:.2f}]")
+            print(f"  Z range: [{z_min:.2f}, {z_max:.2f}]")
             
-            print(f"  Points: {len(x)}")
-            print(f"  X range: [{x.min():.2f}, {x.max():.2f}]")
-            print(f"  Y range: [{y.min():.2f}, {y.max():.2f}]")
-            print(f"  Z range: [{z.min():.2f}, {z.max():.2f}]")
-            
-            # Calculate grid dimensions
-            x_min, x_max = x.min(), x.max()
-            y_min, y_max = y.min(), y.max()
-            
-            if grid_size is None:
-                # Auto-calculate based on resolution
-                width = int((x_max - x_min) / self.resolution)
-                height = int((y_max - y_min) / self.resolution)
-                # Limit to reasonable size
-                width = min(width, 2000)
-                height = min(height, 2000)
-            else:
+            resolution = self.resolution
+            if grid_size is not None:
+                # Coarsest cell that still fits the requested grid
                 width, height = grid_size
+                resolution = max((x_max - x_min) / max(width - 1, 1),
+                                 (y_max - y_min) / max(height - 1, 1))
             
-            print(f"  Creating {width}x{height} grid (resolution: {self.resolution}m)")
+            def progress(done, total):
+                print(f"\r  Binning points... {done}/{total}", end='', flush=True)
             
-            # Create grid
-            grid_x = np.linspace(x_min, x_max, width)
-            grid_y = np.linspace(y_min, y_max, height)
-            grid_x, grid_y = np.meshgrid(grid_x, grid_y)
+            raster = rasterize_laz(laz_path, resolution, self.stat, self.classes,
+                                   self.returns, progress=progress)
+            print()
+            height, width = raster.shape
+            print(f"  Created {width}x{height} grid (resolution: {resolution}m, "
+                  f"stat: {self.stat})")
+            print(f"  Binned {raster.points} points ({raster.skipped} filtered out)")
+            grid_z = raster.finish(fill_holes=False)
             
-            # Interpolate elevation values
-            print("  Interpolating elevation values...")
-            points = np.column_stack([x, y])
+            # Nothing survived the filters
+            if raster.points == 0:
+                grid_z[:] = 0.0
             
-            # Use nearest neighbor for speed, or linear for quality
-            grid_z = griddata(points, z, (grid_x, grid_y), method='nearest')
+            # Tiled copy for los.TiledTerrain; its header carries the
+            # metadata that used to go to *_dem_meta.json. Writing it fills
+            # grid_z's holes in place and gives the z range, so it goes first.
+            output_base = laz_path.stem
+            tiled_path = self.output_dir / f"{output_base}_dem.ltd"
+            metadata = {
+                'width': width,
+                'height': height,
+                'resolution': resolution,
+                'stat': self.stat,
+                'bounds': {
+                    'x_min': raster.bounds[0],
+                    'x_max': raster.bounds[2],
+                    'y_min': raster.bounds[1],
+                    'y_max': raster.bounds[3]
+                },
+                'source_points': n_points,
+                'source_file': str(laz_path.name)
+            }
             
-            # Handle any NaN values
-            if np.any(np.isnan(grid_z)):
-                print("  Filling NaN values...")
-                mask = np.isnan(grid_z)
-                grid_z[mask] = np.nanmean(grid_z)
+            stats = los.write_tiled_dem(tiled_path, grid_z, metadata, fill=self.fill)
+            metadata['bounds'].update(z_min=stats['z_min'], z_max=stats['z_max'])
+            print(f"  Saved tiled DEM: {tiled_path}")
             
             # Save as GeoTIFF
-            output_base = laz_path.stem
             geotiff_path = self.output_dir / f"{output_base}_dem.tif"
             
-            transform = from_bounds(x_min, y_min, x_max, y_max, width, height)
+            transform = from_bounds(*raster.bounds, width, height)
             
             with rasterio.open(
                 geotiff_path,
@@ -247,32 +574,9 @@ class USGSLidarFetcher:
             
             # Also save as numpy array for direct use
             npy_path = self.output_dir / f"{output_base}_dem.npy"
-            np.save(npy_path, grid_z.astype(np.float32))
+            np.save(npy_path, grid_z)
             print(f"  Saved numpy array: {npy_path}")
             
-            # Save metadata
-            meta_path = self.output_dir / f"{output_base}_dem_meta.json"
-            metadata = {
-                'width': width,
-                'height': height,
-                'resolution': self.resolution,
-                'bounds': {
-                    'x_min': float(x_min),
-                    'x_max': float(x_max),
-                    'y_min': float(y_min),
-                    'y_max': float(y_max),
-                    'z_min': float(grid_z.min()),
-                    'z_max': float(grid_z.max())
-                },
-                'source_points': len(x),
-                'source_file': str(laz_path.name)
-            }
-            
-            with open(meta_path, 'w') as f:
-                json.dump(metadata, f, indent=2)
-            
-            print(f"  Saved metadata: {meta_path}")
-            
             return geotiff_path, npy_path, metadata
             
         except Exception as e:
@@ -295,15 +599,38 @@ def main():
     parser.add_argument("--resolution", type=float, default=1.0,
                        help="DEM resolution in meters (default: 1.0)")
     parser.add_argument("--grid-size", type=int, nargs=2, default=None,
-                       help="Fixed grid size as 'width height' (default: auto)")
+                       help="Fit the grid in 'width height' cells (default: use --resolution)")
+    parser.add_argument("--stat", choices=["max", "min", "mean", "percentile"], default="max",
+                       help="Per-cell statistic (default: max)")
+    parser.add_argument("--ground", action="store_true",
+                       help="Bare-earth DEM: keep only ground points (LAS class 2)")
+    parser.add_argument("--first-returns", action="store_true",
+                       help="Surface model: keep only first returns")
     parser.add_argument("--sample", action="store_true",
                        help="Create sample data instead of downloading (for testing)")
+    parser.add_argument("--download", action="store_true",
+                       help="Download every tile found, convert and merge them into one DEM")
+    parser.add_argument("--max-tiles", type=int, default=10,
+                       help="Tiles to request from the USGS API (default: 10)")
+    parser.add_argument("--bbox-size", type=float, default=0.01,
+                       help="Search half-width in degrees (default: 0.01, about 1km)")
+    parser.add_argument("--workers", type=int, default=4,
+                       help="Tiles downloading at once (default: 4)")
+    parser.add_argument("--range-parts", type=int, default=4,
+                       help="Concurrent HTTP ranges per tile (default: 4)")
+    parser.add_argument("--cache-dir", default=None,
+                       help="Download and DEM cache (default: <output-dir>/cache)")
+    parser.add_argument("--fill", choices=["push-pull", "nearest"], default="push-pull",
+                       help="How cells with no points are filled (default: push-pull)")
     
     args = parser.parse_args()
     
     grid_size = tuple(args.grid_size) if args.grid_size else None
     
-    fetcher = USGSLidarFetcher(args.lat, args.lon, args.output_dir, args.resolution)
+    fetcher = USGSLidarFetcher(args.lat, args.lon, args.output_dir, args.resolution,
+                               stat=args.stat, classes=[2] if args.ground else None,
+                               returns="first" if args.first_returns else "all",
+                               fill=args.fill)
     
     if args.sample:
         # Create sample data for testing
@@ -316,7 +643,22 @@ def main():
         print("="*60)
         print("SEARCHING FOR USGS DATA")
         print("="*60)
-        tiles = fetcher.find_lidar_tiles()
+        tiles = fetcher.find_lidar_tiles(args.max_tiles, args.bbox_size)
+        
+        if tiles and args.download:
+            print("\n" + "="*60)
+            print(f"FETCHING AND MERGING {len(tiles)} TILES")
+            print("="*60)
+            merged = fetcher.fetch_region(tiles, args.workers, args.range_parts,
+                                          cache_dir=args.cache_dir)
+            if not merged:
+                print("\nNo tile could be downloaded and converted.")
+                return 1
+            npy_path, tiled_path, metadata = merged
+            print(f"\nMerged DEM: {metadata['width']}x{metadata['height']} pixels, "
+                  f"{metadata['resolution']}m/pixel")
+            print(f"  terrain = los.TiledTerrain('{tiled_path}')")
+            return 0
         
         if not tiles:
             print("\nNo data found. Creating sample data instead...")
@@ -328,7 +670,7 @@ def main():
             
             # For this demo, we'll create sample data
             # In a real scenario, you'd download from tile['downloadURL']
-            print("\nNote: Actual download requires specific USGS file URLs.")
+            print("\nPass --download to fetch and merge these tiles.")
             print("Creating sample data for demonstration...")
             laz_file = fetcher.create_sample_laz()
     
@@ -346,7 +688,7 @@ def main():
             print(f"\nDEM files created:")
             print(f"  GeoTIFF: {geotiff_path}")
             print(f"  NumPy:   {npy_path}")
-            print(f"  Metadata: {geotiff_path.parent / (geotiff_path.stem + '_meta.json')}")
+            print(f"  Tiled:   {npy_path.with_suffix('.ltd')} (with metadata)")
             print(f"\nDEM Info:")
             print(f"  Size: {metadata['width']}x{metadata['height']} pixels")
             print(f"  Resolution: {metadata['resolution']}m/pixel")
@@ -359,7 +701,8 @@ def main():
             print(f"  import los")
             print(f"  dem = np.load('{npy_path}')")
             print(f"  result = los.los_boolean(dem, {metadata['width']}, {metadata['height']}, x0, y0, z0, x1, y1, z1)")
+            print(f"  terrain = los.TiledTerrain('{npy_path.with_suffix('.ltd')}')  # no load, any size")
 
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    sys.exit(main())
\ No newline at end of file
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "stats.h"
+
+namespace los {
+
+constexpr double kSpeedOfLight = 299792458.0;
+
+// ITU-R P.526 single knife-edge diffraction loss J(v) in dB, for the
+// Fresnel-Kirchhoff parameter v (0 for v <= -0.78).
+inline double knife_edge_loss_db(double v) {
+    if (!(v > -0.78))
+        return 0.0;
+    double a = v - 0.1;
+    return 6.9 + 20.0 * std::log10(std::sqrt(a * a + 1.0) + a);
+}
+
+// First Fresnel zone clearance of a radio path, from one walk.
+//
+// ratio is clearance / r1 at each cell, with clearance the ray height minus
+// the terrain and r1 = sqrt(lambda * d1 * d2 / d) the first zone radius at
+// the cell's t (d1 = t * d, d2 = (1 - t) * d, d the 3-D path length in
+// metres). A path is conventionally clear at ratio >= 0.6 and grazes the
+// terrain at 0; the ratio varies continuously with the geometry, unlike
+// the fraction of sampled rays that los_probability counts.
+struct FresnelResult {
+    bool visible = true;  // los_boolean's answer for the same ray
+    // Lowest ratio over the ray and the first cell it occurs at; +inf and
+    // -1 when no cell had data. Cells at t = 0 or 1 (r1 = 0) count as +inf
+    // when clear and -inf when not.
+    double minRatio = std::numeric_limits<double>::infinity();
+    int minX = -1, minY = -1;
+    double minT = std::numeric_limits<double>::quiet_NaN();
+    // knife_edge_loss_db(-sqrt(2) * minRatio): the loss of the worst point
+    // treated as a single knife edge.
+    double lossDb = 0.0;
+};
+
+// Upper bound on the first zone radius over the cells the walk r visits in
+// block b: their t lies between the current cell's and that of the block's
+// last column or row, as in BasicDDA::min_height_in. Padded so rounding in
+// r1, the ratio and the skip test cannot skip a cell that would have set a
+// new minimum.
+template <typename Real>
+inline double zone_bound(const BasicDDA<Real>& r, const MaxPyramid::Block& b, double zone) {
+    double ta = static_cast<double>(r.cell_t(r.x, r.y));
+    double tb = static_cast<double>(r.majorX ? r.cell_t(r.stepX > 0 ? b.x1 : b.x0, r.y)
+                                             : r.cell_t(r.x, r.stepY > 0 ? b.y1 : b.y0));
+    double lo = std::min(ta, tb), hi = std::max(ta, tb);
+    double t = hi < 0.5 ? hi : (lo > 0.5 ? lo : 0.5);
+    return std::sqrt(zone * t * (1.0 - t)) * (1.0 + 1e-9);
+}
+
+// Fresnel clearance of (x0, y0, z0) -> (x1, y1, z1) at `wavelength` metres
+// on cells `cell_size` metres wide, walking the cells los_boolean_cells
+// does. The whole ray is walked, since the worst point may lie past the
+// first blocking cell. With a pyramid, blocks whose clearance is at least
+// best times zone_bound() are skipped, which never changes the result.
+// Clearance is measured from the ray bent by `curvature` (BasicDDA).
+template <typename Real = double, typename Pyramid = MaxPyramid, typename Cells>
+inline FresnelResult los_fresnel_cells(const Cells& cells, int width, int height,
+                                       const Pyramid* pyramid,
+                                       double x0, double y0, double z0,
+                                       double x1, double y1, double z1,
+                                       double wavelength, double cell_size,
+                                       double curvature = 0.0) {
+    FresnelResult out;
+    BasicDDA<Real> r(x0, y0, z0, x1, y1, z1, curvature);
+    const bool reachesEnd = r.reaches_end();
+    const int top = pyramid ? pyramid->levels() : 0;
+
+    double run = std::hypot(x1 - x0, y1 - y0) * cell_size;
+    double length = std::hypot(run, z1 - z0);
+    double zone = wavelength * length;  // r1^2 = zone * t * (1 - t)
+    double best = std::numeric_limits<double>::infinity();
+    int level = 1;
+    LOS_STAT_CELLS(walked);
+
+    auto finish = [&] {
+        out.lossDb = knife_edge_loss_db(-std::sqrt(2.0) * out.minRatio);
+        return out;
+    };
+
+    while (true) {
+
+        if (!r.in_bounds(width, height)) {
+            out.visible = false;
+            return finish();
+        }
+
+        bool skipped = false;
+        for (int l = std::min(level, top); l >= 1; l--) {
+            MaxPyramid::Block b = pyramid->block(l, r.x, r.y);
+            bool holdsEnd = b.contains(r.endX, r.endY);
+            if (holdsEnd && !reachesEnd)
+                continue;
+            double margin = static_cast<double>(r.min_height_in(b)) -
+                            pyramid->block_max(l, r.x, r.y);
+            if (margin >= 0 && best < std::numeric_limits<double>::infinity() &&
+                !(margin < best * zone_bound(r, b, zone))) {
+                LOS_STAT_SKIP(l);
+                if (holdsEnd)
+                    return finish();
+                r.exit_block(b);
+                level = l + 1;
+                skipped = true;
+                break;
+            }
+        }
+        if (skipped)
+            continue;
+        level = 1;
+
+        Real t = r.cell_t(r.x, r.y);
+        Real rayHeight = r.ray_height(t);
+        LOS_STAT_STEP(walked);
+        float terrain = cells(r.x, r.y);
+        if (terrain > rayHeight)
+            out.visible = false;
+
+        double clearance = static_cast<double>(rayHeight) - terrain;
+        double td = static_cast<double>(t);
+        double r1 = std::sqrt(zone * td * (1.0 - td));
+        double ratio = clearance / r1;  // NaN for cells without data
+        if (!(r1 > 0) && !std::isnan(clearance))
+            ratio = clearance >= 0 ? std::numeric_limits<double>::infinity()
+                                   : -std::numeric_limits<double>::infinity();
+        if (ratio < best) {
+            best = ratio;
+            out.minRatio = ratio;
+            out.minX = r.x;
+            out.minY = r.y;
+            out.minT = td;
+        }
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return finish();
+}
+
+} // namespace los
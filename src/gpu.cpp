@@ -0,0 +1,290 @@
+// OpenMP target-offload implementation of gpu.h. Built only with LOS_GPU
+// (CMake -DLOS_GPU=ON, setup.py LOS_GPU=1), which compiles this file with
+// -fopenmp plus the offload flags in LOS_GPU_OFFLOAD:
+//
+//   Clang  -fopenmp-targets=nvptx64-nvidia-cuda   (CUDA devices)
+//          -fopenmp-targets=amdgcn-amd-amdhsa     (HIP / ROCm devices)
+//   GCC    -foffload=nvptx-none or -foffload=amdgcn-amdhsa
+//
+// Functions the target regions call are device functions by OpenMP 5.0's
+// implicit declare target, so the shared kernels need no markers. With no
+// offload flags, or no visible device, every region runs on the host (the
+// OpenMP initial device) through the same code.
+
+#include "gpu.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "los_kernel.h"
+#include "viewshed.h"
+
+namespace los {
+namespace gpu {
+
+namespace {
+
+// Rays per chunk and chunks in flight. A chunk of rays is 3 MiB, large
+// enough to hide launch latency.
+constexpr int64_t kChunkRays = 1 << 16;
+constexpr int kChunksInFlight = 2;
+
+// A 2^31-cell grid has 31 levels.
+constexpr int kMaxLevels = 32;
+
+// MaxPyramid as the device sees it: every level packed into one buffer.
+// Passed to regions by value; provides what los_boolean_pyramid_cells calls.
+struct DevicePyramid {
+    const float* data;
+    int64_t offset[kMaxLevels];
+    int levelWidth[kMaxLevels];
+    int width, height;
+    int count;
+
+    int levels() const { return count; }
+
+    float block_max(int level, int x, int y) const {
+        return data[offset[level - 1] +
+                    static_cast<int64_t>(y >> level) * levelWidth[level - 1] + (x >> level)];
+    }
+
+    MaxPyramid::Block block(int level, int x, int y) const {
+        int bx0 = (x >> level) << level;
+        int by0 = (y >> level) << level;
+        int bx1 = bx0 + (1 << level) - 1;
+        int by1 = by0 + (1 << level) - 1;
+        return {bx0, by0, bx1 < width ? bx1 : width - 1, by1 < height ? by1 : height - 1};
+    }
+};
+
+template <typename Real>
+double trace(const float* dem, int width, int height, const DevicePyramid& pyramid,
+             const double* r, double curvature) {
+    IndexedCells<RowMajorIndex> cells{dem, RowMajorIndex(width)};
+    if (pyramid.count > 0)
+        return los_boolean_pyramid_cells<Real>(cells, width, height, pyramid,
+                                               r[0], r[1], r[2], r[3], r[4], r[5], curvature);
+    return los_boolean_cells<Real>(cells, width, height, r[0], r[1], r[2], r[3], r[4], r[5],
+                                   curvature);
+}
+
+template <typename Real>
+void boolean_chunk(int device, const float* dem, int width, int height, DevicePyramid pyramid,
+                   double curvature, const double* rays, int64_t n, uint8_t* out) {
+#pragma omp target teams distribute parallel for device(device) is_device_ptr(dem) \
+    map(to: rays[0:6 * n]) map(from: out[0:n]) nowait
+    for (int64_t i = 0; i < n; i++)
+        out[i] = trace<Real>(dem, width, height, pyramid, rays + 6 * i, curvature) > 0.5;
+}
+
+// One device thread per query walks all of its samples, so the clear-sample
+// count and hence the probability are exactly the CPU's
+// (los_probability_sampled, which also traces a single sample unshifted).
+template <typename Real>
+void probability_chunk(int device, const float* dem, int width, int height,
+                       DevicePyramid pyramid, double curvature, const double* rays, int64_t n,
+                       int num_samples, double* out) {
+#pragma omp target teams distribute parallel for device(device) is_device_ptr(dem) \
+    map(to: rays[0:6 * n]) map(from: out[0:n]) nowait
+    for (int64_t i = 0; i < n; i++) {
+        const double* r = rays + 6 * i;
+        if (num_samples == 1) {
+            out[i] = trace<Real>(dem, width, height, pyramid, r, curvature);
+            continue;
+        }
+        SamplePattern pattern(num_samples);
+        int clear = 0;
+        for (int s = 0; s < num_samples; s++) {
+            double sample[6];
+            pattern.ray(s, r[0], r[1], r[2], r[3], r[4], r[5], sample);
+            clear += trace<Real>(dem, width, height, pyramid, sample, curvature) > 0.5;
+        }
+        out[i] = static_cast<double>(clear) / num_samples;
+    }
+}
+
+// Run `chunk(rays, count, out)` over n rays, kChunksInFlight at a time.
+template <typename T, typename Chunk>
+void stream_batch(const double* pairs, int64_t n, T* out, const Chunk& chunk) {
+    int inFlight = 0;
+    for (int64_t begin = 0; begin < n; begin += kChunkRays) {
+        chunk(pairs + 6 * begin, std::min(kChunkRays, n - begin), out + begin);
+        if (++inFlight == kChunksInFlight) {
+#pragma omp taskwait
+            inFlight = 0;
+        }
+    }
+#pragma omp taskwait
+}
+
+} // namespace
+
+bool available() { return omp_get_num_devices() > 0; }
+
+struct DeviceTerrain::Impl {
+    int device = 0;  // a GPU, or the initial (host) device without one
+    int width = 0;
+    int height = 0;
+    Precision precision = Precision::Double;
+    float* dem = nullptr;
+    float* levels = nullptr;
+    DevicePyramid pyramid{};
+    size_t bytes = 0;
+
+    ~Impl() {
+        if (levels) omp_target_free(levels, device);
+        if (dem) omp_target_free(dem, device);
+    }
+
+    template <typename T>
+    T* alloc(size_t count, const char* what) const {
+        void* p = omp_target_alloc(sizeof(T) * count, device);
+        if (!p && count)
+            throw std::runtime_error(std::string("GPU ") + what + " allocation failed");
+        return static_cast<T*>(p);
+    }
+
+    void upload(void* dst, const void* src, size_t size, const char* what) const {
+        if (size && omp_target_memcpy(dst, const_cast<void*>(src), size, 0, 0, device,
+                                      omp_get_initial_device()) != 0)
+            throw std::runtime_error(std::string("GPU ") + what + " upload failed");
+    }
+
+    void download(void* dst, const void* src, size_t size, const char* what) const {
+        if (size && omp_target_memcpy(dst, const_cast<void*>(src), size, 0, 0,
+                                      omp_get_initial_device(), device) != 0)
+            throw std::runtime_error(std::string("GPU ") + what + " download failed");
+    }
+};
+
+DeviceTerrain::DeviceTerrain(const float* data, int width, int height,
+                             const MaxPyramid* pyramid, Precision precision)
+    : impl_(new Impl) {
+    Impl& d = *impl_;
+    d.device = available() ? omp_get_default_device() : omp_get_initial_device();
+    d.width = width;
+    d.height = height;
+    d.precision = precision;
+
+    size_t cells = static_cast<size_t>(width) * height;
+    d.dem = d.alloc<float>(cells, "DEM");
+    d.bytes += sizeof(float) * cells;
+    d.upload(d.dem, data, sizeof(float) * cells, "DEM");
+
+    d.pyramid.width = width;
+    d.pyramid.height = height;
+    if (pyramid && !pyramid->empty()) {
+        int64_t total = 0;
+        for (int l = 1; l <= pyramid->levels(); l++) {
+            auto dims = pyramid->level_dims(l);
+            d.pyramid.offset[l - 1] = total;
+            d.pyramid.levelWidth[l - 1] = dims.first;
+            total += static_cast<int64_t>(dims.first) * dims.second;
+        }
+        d.levels = d.alloc<float>(total, "pyramid");
+        d.bytes += sizeof(float) * total;
+        for (int l = 1; l <= pyramid->levels(); l++) {
+            auto dims = pyramid->level_dims(l);
+            d.upload(d.levels + d.pyramid.offset[l - 1], pyramid->level_data(l),
+                     sizeof(float) * dims.first * dims.second, "pyramid");
+        }
+        d.pyramid.data = d.levels;
+        d.pyramid.count = pyramid->levels();
+    }
+}
+
+DeviceTerrain::~DeviceTerrain() = default;
+
+void DeviceTerrain::los_boolean_batch(const double* pairs, int64_t n, uint8_t* out,
+                                      double curvature) const {
+    const Impl& d = *impl_;
+    stream_batch(pairs, n, out, [&](const double* rays, int64_t count, uint8_t* dst) {
+        if (d.precision == Precision::Float)
+            boolean_chunk<float>(d.device, d.dem, d.width, d.height, d.pyramid, curvature,
+                                 rays, count, dst);
+        else
+            boolean_chunk<double>(d.device, d.dem, d.width, d.height, d.pyramid, curvature,
+                                  rays, count, dst);
+    });
+}
+
+void DeviceTerrain::los_probability_batch(const double* pairs, int64_t n, int num_samples,
+                                          double* out, double curvature) const {
+    const Impl& d = *impl_;
+    stream_batch(pairs, n, out, [&](const double* rays, int64_t count, double* dst) {
+        if (d.precision == Precision::Float)
+            probability_chunk<float>(d.device, d.dem, d.width, d.height, d.pyramid, curvature,
+                                     rays, count, num_samples, dst);
+        else
+            probability_chunk<double>(d.device, d.dem, d.width, d.height, d.pyramid, curvature,
+                                      rays, count, num_samples, dst);
+    });
+}
+
+// Device version of viewshed_r2, one device thread per border ray. Only
+// the rows of the observer's window are cleared on the device and copied
+// back; out is cleared in full on the host.
+void DeviceTerrain::viewshed(double x0, double y0, double z0, double target_height,
+                             double max_radius, uint8_t* out, double curvature) const {
+    const Impl& d = *impl_;
+    const size_t cells = static_cast<size_t>(d.width) * d.height;
+    std::fill(out, out + cells, uint8_t(0));
+    if (!(x0 >= 0 && y0 >= 0 && x0 < d.width && y0 < d.height))
+        return;
+    int ox = static_cast<int>(std::floor(x0));
+    int oy = static_cast<int>(std::floor(y0));
+
+    ViewshedWindow w = viewshed_window(d.width, d.height, x0, y0, max_radius);
+    const size_t origin = static_cast<size_t>(w.y0) * d.width;
+    const size_t span = static_cast<size_t>(w.y1 - w.y0 + 1) * d.width;
+    const int64_t rays = viewshed_border_cells(w);
+    const double radius2 = max_radius * max_radius;
+    const float* dem = d.dem;
+    const int width = d.width;
+
+    uint8_t* mask = d.alloc<uint8_t>(cells, "viewshed mask");
+#pragma omp target teams distribute parallel for device(d.device) is_device_ptr(mask)
+    for (size_t i = origin; i < origin + span; i++)
+        mask[i] = 0;
+#pragma omp target teams distribute parallel for device(d.device) is_device_ptr(dem, mask)
+    for (int64_t k = 0; k < rays; k++) {
+        int px, py;
+        viewshed_border_cell(w, k, px, py);
+        viewshed_r2_ray(dem, width, w, x0, y0, z0, target_height, radius2, px, py,
+                        mask, curvature);
+    }
+    try {
+        d.download(out + origin, mask + origin, span, "viewshed mask");
+    } catch (...) {
+        omp_target_free(mask, d.device);
+        throw;
+    }
+    omp_target_free(mask, d.device);
+
+    out[static_cast<size_t>(oy) * d.width + ox] = 1;
+}
+
+void DeviceTerrain::update_region(const float* data, int, int y, int, int h,
+                                  const MaxPyramid* pyramid) {
+    Impl& d = *impl_;
+    // Whole rows, so each level is one contiguous copy.
+    size_t row = static_cast<size_t>(y) * d.width;
+    d.upload(d.dem + row, data + row, sizeof(float) * static_cast<size_t>(h) * d.width, "DEM");
+    for (int l = 1; l <= d.pyramid.count; l++) {
+        int levelWidth = d.pyramid.levelWidth[l - 1];
+        int r0 = y >> l, r1 = (y + h - 1) >> l;
+        size_t first = static_cast<size_t>(r0) * levelWidth;
+        d.upload(d.levels + d.pyramid.offset[l - 1] + first, pyramid->level_data(l) + first,
+                 sizeof(float) * static_cast<size_t>(r1 - r0 + 1) * levelWidth, "pyramid");
+    }
+}
+
+bool DeviceTerrain::on_device() const { return impl_->device != omp_get_initial_device(); }
+
+size_t DeviceTerrain::device_bytes() const { return impl_->bytes; }
+
+} // namespace gpu
+} // namespace los
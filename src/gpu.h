@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+
+namespace los {
+namespace gpu {
+
+// Optional GPU backend, implemented in gpu.cpp with OpenMP target offload
+// and compiled only when the extension is built with LOS_GPU (which defines
+// LOS_WITH_GPU). The offload flags pick the device: NVIDIA through CUDA
+// (nvptx) or AMD through HIP/ROCm (amdgcn); see gpu.cpp. This header needs
+// no GPU toolkit: without LOS_WITH_GPU available() is false and a
+// DeviceTerrain cannot be constructed.
+
+#ifdef LOS_WITH_GPU
+// Whether this build offloads to a GPU and one is visible to this process.
+bool available();
+#else
+inline bool available() { return false; }
+#endif
+
+// A heightmap (and optionally its max pyramid) resident in device memory.
+//
+// The DEM and pyramid are uploaded once at construction. Batches go up in
+// chunks of rays as asynchronous target tasks, so the copies of one chunk
+// overlap the kernel of the other and results stream back while later
+// chunks are still tracing. Every device thread runs the same
+// los_boolean_cells / los_boolean_pyramid_cells / viewshed_r2_ray code as
+// the CPU (built without FMA contraction), so answers match the CPU backend
+// bit for bit. Without a visible GPU the same code runs on the host, which
+// is how the tests check it. Queries may run concurrently; update_region()
+// may not run alongside them.
+class DeviceTerrain {
+public:
+    // `pyramid` may be null or empty. Throws std::runtime_error when the
+    // device cannot hold the terrain or the backend was not built.
+    DeviceTerrain(const float* data, int width, int height,
+                  const MaxPyramid* pyramid, Precision precision);
+    ~DeviceTerrain();
+
+    DeviceTerrain(const DeviceTerrain&) = delete;
+    DeviceTerrain& operator=(const DeviceTerrain&) = delete;
+
+    // Same contracts as the Terrain methods of the same name, with rays
+    // bent by `curvature` (earth_curvature()).
+    void los_boolean_batch(const double* pairs, int64_t n, uint8_t* out,
+                           double curvature) const;
+    void los_probability_batch(const double* pairs, int64_t n, int num_samples,
+                               double* out, double curvature) const;
+    void viewshed(double x0, double y0, double z0, double target_height,
+                  double max_radius, uint8_t* out, double curvature) const;
+
+    // Re-upload cells [x, x + w) x [y, y + h) of `data`, the full row-major
+    // DEM, and the blocks of `pyramid` (as updated) above them.
+    void update_region(const float* data, int x, int y, int w, int h,
+                       const MaxPyramid* pyramid);
+
+    // Whether this terrain runs on a GPU rather than the host fallback.
+    bool on_device() const;
+
+    // Device memory held for the DEM, pyramid and viewshed mask.
+    size_t device_bytes() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+#ifndef LOS_WITH_GPU
+struct DeviceTerrain::Impl {};
+
+inline DeviceTerrain::DeviceTerrain(const float*, int, int, const MaxPyramid*, Precision) {
+    throw std::runtime_error("los was built without GPU support (rebuild with LOS_GPU)");
+}
+inline DeviceTerrain::~DeviceTerrain() = default;
+inline void DeviceTerrain::los_boolean_batch(const double*, int64_t, uint8_t*, double) const {}
+inline void DeviceTerrain::los_probability_batch(const double*, int64_t, int, double*,
+                                                 double) const {}
+inline void DeviceTerrain::viewshed(double, double, double, double, double, uint8_t*,
+                                    double) const {}
+inline void DeviceTerrain::update_region(const float*, int, int, int, int, const MaxPyramid*) {}
+inline bool DeviceTerrain::on_device() const { return false; }
+inline size_t DeviceTerrain::device_bytes() const { return 0; }
+#endif
+
+} // namespace gpu
+} // namespace los
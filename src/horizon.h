@@ -0,0 +1,439 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+namespace los {
+
+// Horizon of a fixed observer, for answering many rays from it to targets
+// that move.
+//
+// Around the observer's cell the grid is cut into square rings (ring r
+// holds the cells r cells away along x or y, ring 0 the observer's own)
+// and the rings past kNearRings into bands of bandRings rings each. For
+// every azimuth bin and band the horizon keeps the largest
+//
+//   (terrain - z0) / a - curvature * a
+//
+// over the rings up to that band's outer edge, a being how far along the
+// walk's major axis the cell is tested (cell_t() times the ray length on
+// that axis). A ray from the observer is blocked at such a cell exactly
+// when this exceeds (dz - bulge) / A for the ray's own extent A on its
+// major axis, curvature only making the cell's side larger. So when the
+// bin the ray points into is at or below that, no cell it walks inside the
+// band blocks it: the walk tests the first rings one cell at a time, jumps
+// to the first cell past the band (exit_block(), as the pyramid walk does)
+// and walks the last rings before the target exactly. A cell is entered in
+// every bin its square (padded for rounding) overlaps, and only for the
+// axes a ray through it may be major on, so the jump never skips a cell
+// that would block.
+//
+// The cells of the first kNearRings rings can be tested at any small a,
+// where the ray's rounding error divided by a is unbounded; past them a
+// is at least 1. Answers are los_boolean's over the nearest cells, in the
+// precision the horizon was built for.
+//
+// On disk (save()) a horizon is a 128-byte HorizonHeader followed by
+// azimuths * bands float32 angles, little-endian.
+struct HorizonHeader {
+    char magic[8];  // "LOSHRZN1"
+    uint32_t version;
+    uint32_t azimuths, bands, bandRings;
+    uint32_t width, height;
+    uint32_t precision;  // 0 float64, 1 float32 walks
+    uint32_t reserved0;
+    double x, y, z;  // observer, rounded to the walk's precision
+    double curvature;
+    uint8_t reserved[56];
+};
+static_assert(sizeof(HorizonHeader) == 128, "HorizonHeader must be 128 bytes");
+
+constexpr char kHorizonMagic[8] = {'L', 'O', 'S', 'H', 'R', 'Z', 'N', '1'};
+constexpr uint32_t kHorizonVersion = 1;
+
+// Largest azimuths * bands a horizon may hold (1 GiB of angles).
+constexpr int64_t kMaxHorizonEntries = int64_t(1) << 28;
+
+class Horizon {
+public:
+    // Rings around the observer's cell every query walks cell by cell.
+    static constexpr int kNearRings = 2;
+
+    Horizon() = default;
+
+    // Horizon of an observer at (x, y, z) inside a width x height grid
+    // read through `cells`, over `azimuths` bins and up to `bands` bands
+    // covering every ring within max_range cells (fewer bands when there
+    // are fewer rings). Real is the precision queries will walk in.
+    // `revision` is the terrain revision the cells are at.
+    template <typename Real, typename Cells>
+    static Horizon build(const Cells& cells, int width, int height, double x, double y,
+                         double z, int azimuths, double max_range, int bands,
+                         double curvature, uint64_t revision = 0) {
+        if (!(x >= 0 && y >= 0 && x < width && y < height))
+            throw std::invalid_argument("observer must lie inside the terrain");
+        if (azimuths < 1 || bands < 1)
+            throw std::invalid_argument("azimuths and bands must be positive");
+        if (!(max_range > 0))
+            throw std::invalid_argument("max_range must be positive");
+
+        Horizon h;
+        h.x_ = static_cast<Real>(x);
+        h.y_ = static_cast<Real>(y);
+        h.z_ = static_cast<Real>(z);
+        h.curvature_ = curvature;
+        h.float_ = std::is_same<Real, float>::value;
+        h.width_ = width;
+        h.height_ = height;
+        h.azimuths_ = azimuths;
+        h.revision_ = revision;
+        h.locate();
+
+        // Rings past the grid hold no cells.
+        int edge = std::max({h.ox_, width - 1 - h.ox_, h.oy_, height - 1 - h.oy_});
+        int rings = static_cast<int>(std::min<double>(std::ceil(max_range), edge)) - kNearRings;
+        if (rings <= 0) {
+            h.bands_ = 0;
+            h.bandRings_ = 1;
+            return h;
+        }
+        bands = std::min(bands, rings);
+        h.bandRings_ = (rings + bands - 1) / bands;
+        h.bands_ = (rings + h.bandRings_ - 1) / h.bandRings_;
+        if (int64_t(azimuths) * h.bands_ > kMaxHorizonEntries)
+            throw std::invalid_argument("azimuths * bands is too large");
+        h.angles_.assign(static_cast<size_t>(azimuths) * h.bands_,
+                         -std::numeric_limits<float>::infinity());
+
+        // Cells a walk in Real visits lie within `pad` of its segment.
+        const double pad = 1e-3 + 16 * std::numeric_limits<Real>::epsilon() *
+                                      (std::abs(h.x_) + std::abs(h.y_) + width + height);
+        parallel_for(h.bands_, 1, [&](int64_t begin, int64_t end, int) {
+            std::vector<float> row(azimuths);
+            for (int j = static_cast<int>(begin); j < end; j++) {
+                std::fill(row.begin(), row.end(), -std::numeric_limits<float>::infinity());
+                int r0 = kNearRings + 1 + j * h.bandRings_;
+                for (int r = r0; r < r0 + h.bandRings_; r++)
+                    h.ring_cells(r, [&](int cx, int cy) {
+                        h.add_cell(cx, cy, cells(cx, cy), pad, row.data());
+                    });
+                for (int b = 0; b < azimuths; b++)
+                    h.angles_[static_cast<size_t>(b) * h.bands_ + j] = row[b];
+            }
+        });
+
+        // Each band then holds the horizon up to its outer ring.
+        parallel_for(azimuths, 256, [&](int64_t begin, int64_t end, int) {
+            for (int64_t b = begin; b < end; b++) {
+                float* a = &h.angles_[static_cast<size_t>(b) * h.bands_];
+                for (int j = 1; j < h.bands_; j++)
+                    a[j] = std::max(a[j], a[j - 1]);
+            }
+        });
+        return h;
+    }
+
+    double x() const { return x_; }
+    double y() const { return y_; }
+    double z() const { return z_; }
+    int cell_x() const { return ox_; }
+    int cell_y() const { return oy_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int azimuths() const { return azimuths_; }
+    int bands() const { return bands_; }
+    int band_rings() const { return bandRings_; }
+    double curvature() const { return curvature_; }
+    Precision precision() const { return float_ ? Precision::Float : Precision::Double; }
+    uint64_t revision() const { return revision_; }
+    size_t bytes() const { return angles_.size() * sizeof(float); }
+
+    // Last ring the bands cover (kNearRings with no bands).
+    int max_ring() const { return kNearRings + bands_ * bandRings_; }
+
+    // Angles, azimuths rows of bands, cumulative along each row.
+    const float* angles() const { return angles_.data(); }
+    float angle(int bin, int band) const {
+        return angles_[static_cast<size_t>(bin) * bands_ + band];
+    }
+
+    int ring(int x, int y) const { return std::max(std::abs(x - ox_), std::abs(y - oy_)); }
+
+    // Azimuth bin of direction (dx, dy); bin 0 starts at -pi.
+    int bin(double dx, double dy) const {
+        double w = 2 * kPi / azimuths_;
+        int b = static_cast<int>(std::floor((std::atan2(dy, dx) + kPi) / w));
+        return ((b % azimuths_) + azimuths_) % azimuths_;
+    }
+
+    // Last band a ray to a target in ring `rt` may jump over, keeping
+    // every ring it covers at least two short of the target's (so the ray
+    // has not reached t = 1 there); -1 if there is none.
+    int band_before(int rt) const {
+        if (bands_ == 0)
+            return -1;
+        return std::min(bands_, (rt - kNearRings - 2) / bandRings_) - 1;
+    }
+
+    // Outer ring of band j.
+    int band_end(int j) const { return kNearRings + (j + 1) * bandRings_; }
+
+    std::string serialize() const {
+        HorizonHeader hdr{};
+        std::memcpy(hdr.magic, kHorizonMagic, sizeof(kHorizonMagic));
+        hdr.version = kHorizonVersion;
+        hdr.azimuths = static_cast<uint32_t>(azimuths_);
+        hdr.bands = static_cast<uint32_t>(bands_);
+        hdr.bandRings = static_cast<uint32_t>(bandRings_);
+        hdr.width = static_cast<uint32_t>(width_);
+        hdr.height = static_cast<uint32_t>(height_);
+        hdr.precision = float_ ? 1 : 0;
+        hdr.x = x_;
+        hdr.y = y_;
+        hdr.z = z_;
+        hdr.curvature = curvature_;
+        std::string out(sizeof(hdr) + bytes(), '\0');
+        std::memcpy(&out[0], &hdr, sizeof(hdr));
+        if (!angles_.empty())
+            std::memcpy(&out[sizeof(hdr)], angles_.data(), bytes());
+        return out;
+    }
+
+    // A horizon read back at revision 0: it is taken to describe the
+    // terrain it is next used with, as that terrain is when loaded.
+    static Horizon deserialize(const char* data, size_t size) {
+        auto fail = [](const std::string& why) { return std::runtime_error("horizon: " + why); };
+        HorizonHeader hdr;
+        if (size < sizeof(hdr))
+            throw fail("too small to be a horizon");
+        std::memcpy(&hdr, data, sizeof(hdr));
+        if (std::memcmp(hdr.magic, kHorizonMagic, sizeof(kHorizonMagic)) != 0)
+            throw fail("not a horizon (bad magic)");
+        if (hdr.version != kHorizonVersion)
+            throw fail("unsupported horizon version " + std::to_string(hdr.version));
+        const uint32_t intMax = static_cast<uint32_t>(std::numeric_limits<int>::max());
+        if (hdr.width == 0 || hdr.height == 0 || hdr.width > intMax || hdr.height > intMax ||
+            hdr.azimuths == 0 || hdr.azimuths > intMax || hdr.bandRings == 0 ||
+            hdr.bandRings > intMax || hdr.precision > 1 ||
+            uint64_t(hdr.azimuths) * hdr.bands > uint64_t(kMaxHorizonEntries))
+            throw fail("bad header");
+
+        Horizon h;
+        h.x_ = hdr.x;
+        h.y_ = hdr.y;
+        h.z_ = hdr.z;
+        h.curvature_ = hdr.curvature;
+        h.float_ = hdr.precision == 1;
+        h.width_ = static_cast<int>(hdr.width);
+        h.height_ = static_cast<int>(hdr.height);
+        h.azimuths_ = static_cast<int>(hdr.azimuths);
+        h.bands_ = static_cast<int>(hdr.bands);
+        h.bandRings_ = static_cast<int>(hdr.bandRings);
+        if (!(h.x_ >= 0 && h.y_ >= 0 && h.x_ < h.width_ && h.y_ < h.height_) ||
+            !std::isfinite(h.z_) || !(h.curvature_ >= 0) ||
+            int64_t(h.bands_) * h.bandRings_ > std::numeric_limits<int>::max() / 2)
+            throw fail("bad header");
+        h.locate();
+
+        size_t n = static_cast<size_t>(h.azimuths_) * h.bands_;
+        if (size - sizeof(hdr) != n * sizeof(float))
+            throw fail("angle table does not match the header");
+        h.angles_.resize(n);
+        if (n)
+            std::memcpy(h.angles_.data(), data + sizeof(hdr), n * sizeof(float));
+        return h;
+    }
+
+    void save(const std::string& path) const {
+        std::string bytes = serialize();
+        std::ofstream f(path, std::ios::binary | std::ios::trunc);
+        if (!f.write(bytes.data(), static_cast<std::streamsize>(bytes.size())) || !f.flush())
+            throw std::runtime_error(path + ": cannot write horizon");
+    }
+
+    static Horizon load(const std::string& path) {
+        std::ifstream f(path, std::ios::binary);
+        if (!f)
+            throw std::runtime_error(path + ": cannot open horizon");
+        std::string bytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        try {
+            return deserialize(bytes.data(), bytes.size());
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(path + ": " + e.what());
+        }
+    }
+
+private:
+    static constexpr double kPi = 3.14159265358979323846;
+
+    // Bins are padded by this much for atan2 rounding.
+    static constexpr double kAnglePad = 1e-9;
+
+    void locate() {
+        ox_ = static_cast<int>(std::floor(x_));
+        oy_ = static_cast<int>(std::floor(y_));
+    }
+
+    // f(x, y) for the cells of ring r inside the grid.
+    template <typename F>
+    void ring_cells(int r, const F& f) const {
+        int x0 = std::max(ox_ - r, 0), x1 = std::min(ox_ + r, width_ - 1);
+        for (int cy : {oy_ - r, oy_ + r})
+            if (cy >= 0 && cy < height_)
+                for (int cx = x0; cx <= x1; cx++)
+                    f(cx, cy);
+        int y0 = std::max(oy_ - r + 1, 0), y1 = std::min(oy_ + r - 1, height_ - 1);
+        for (int cx : {ox_ - r, ox_ + r})
+            if (cx >= 0 && cx < width_)
+                for (int cy = y0; cy <= y1; cy++)
+                    f(cx, cy);
+    }
+
+    // Largest angle cell (cx, cy) of height t can present to a ray: over
+    // each axis a ray through the cell may be major on, and each direction
+    // along it that reaches the cell.
+    double cell_angle(int cx, int cy, float t) const {
+        double best = -std::numeric_limits<double>::infinity();
+        if (std::isnan(t))
+            return best;
+        for (int axis = 0; axis < 2; axis++) {
+            double c = axis ? cy : cx, o = axis ? y_ : x_;
+            double oc = axis ? cx : cy, oo = axis ? x_ : y_;
+            double far = std::max(std::abs(c - o), std::abs(c + 1 - o));
+            double near = std::max({oc - oo, 0.0, oo - (oc + 1)});
+            if (near > far)
+                continue;
+            for (int sign : {1, -1}) {
+                if (sign > 0 ? c + 1 <= o : c > o)
+                    continue;
+                double a = sign * (c - o);
+                if (a <= 0) {
+                    // Tested at t = 0, against z0 itself.
+                    if (t > z_)
+                        return std::numeric_limits<double>::infinity();
+                    continue;
+                }
+                best = std::max(best, (t - z_) / a - curvature_ * a);
+            }
+        }
+        return best;
+    }
+
+    // Raise the bins the square of cell (cx, cy), padded by `pad`, covers
+    // to its angle.
+    void add_cell(int cx, int cy, float t, double pad, float* row) const {
+        double v = cell_angle(cx, cy, t);
+        if (v == -std::numeric_limits<double>::infinity())
+            return;
+        float f = static_cast<float>(v);
+        if (f < v)
+            f = std::nextafter(f, std::numeric_limits<float>::infinity());
+
+        double px0 = cx - pad - x_, px1 = cx + 1 + pad - x_;
+        double py0 = cy - pad - y_, py1 = cy + 1 + pad - y_;
+        if (px0 <= 0 && px1 >= 0 && py0 <= 0 && py1 >= 0) {
+            for (int b = 0; b < azimuths_; b++)
+                row[b] = std::max(row[b], f);
+            return;
+        }
+        double mid = std::atan2(cy + 0.5 - y_, cx + 0.5 - x_);
+        double lo = 0, hi = 0;
+        for (double px : {px0, px1})
+            for (double py : {py0, py1}) {
+                double d = std::remainder(std::atan2(py, px) - mid, 2 * kPi);
+                lo = std::min(lo, d);
+                hi = std::max(hi, d);
+            }
+        double w = 2 * kPi / azimuths_;
+        int64_t b0 = static_cast<int64_t>(std::floor((mid + lo - kAnglePad + kPi) / w));
+        int64_t b1 = static_cast<int64_t>(std::floor((mid + hi + kAnglePad + kPi) / w));
+        b1 = std::min(b1, b0 + azimuths_ - 1);
+        for (int64_t b = b0; b <= b1; b++) {
+            float& slot = row[((b % azimuths_) + azimuths_) % azimuths_];
+            slot = std::max(slot, f);
+        }
+    }
+
+    double x_ = 0, y_ = 0, z_ = 0;
+    int ox_ = 0, oy_ = 0;
+    int width_ = 0, height_ = 0;
+    int azimuths_ = 0, bands_ = 0, bandRings_ = 1;
+    double curvature_ = 0.0;
+    bool float_ = false;
+    uint64_t revision_ = 0;
+    std::vector<float> angles_;
+};
+
+// los_boolean over the nearest cells from the horizon's observer to
+// (x1, y1, z1), or -1 when the horizon cannot clear the rings it covers
+// before the target and the caller should walk the whole ray. Cells and
+// Real are as for los_boolean_cells; the grid, Real and curvature must be
+// the ones the horizon was built for.
+template <typename Real, typename Cells>
+inline double los_horizon_cells(const Cells& cells, int width, int height, const Horizon& h,
+                                double x1, double y1, double z1, double curvature) {
+    BasicDDA<Real> r(h.x(), h.y(), h.z(), x1, y1, z1, curvature);
+    if (!(r.endX >= 0 && r.endY >= 0 && r.endX < width && r.endY < height))
+        return 0.0;
+    const int ox = h.cell_x(), oy = h.cell_y();
+    bool jumped = false;
+    LOS_STAT_CELLS(walked);
+
+    while (true) {
+        if (!r.in_bounds(width, height))
+            return 0.0;
+
+        if (!jumped && h.ring(r.x, r.y) > Horizon::kNearRings) {
+            jumped = true;
+            int j = h.band_before(h.ring(r.endX, r.endY));
+            if (j >= 0) {
+                // Blocked at a cell tested at a >= 1 only above (dz - bulge) / A,
+                // within the walk's rounding of the ray height.
+                double dx = r.dx, dy = r.dy;
+                double A = r.majorX ? std::abs(dx) : std::abs(dy);
+                double s = (static_cast<double>(r.dz) - static_cast<double>(r.bulge)) / A;
+                double e = float_height_error(h.x(), h.y(), h.z(), x1, y1, z1) +
+                           std::ldexp(std::abs(static_cast<double>(r.bulge)), -22);
+                if (!std::is_same<Real, float>::value)
+                    e = std::ldexp(e, -29);
+                e += std::ldexp(std::abs(s), -40);
+                if (!(h.angle(h.bin(dx, dy), j) <= s - e))
+                    return -1.0;
+                int rn = h.band_end(j);
+                r.exit_block(MaxPyramid::Block{ox - rn, oy - rn, ox + rn, oy + rn});
+                continue;
+            }
+        }
+
+        Real rayHeight = r.ray_height(r.cell_t(r.x, r.y));
+
+        LOS_STAT_STEP(walked);
+        float terrain = cells(r.x, r.y);
+
+        if (terrain > rayHeight)
+            return 0.0;
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return 1.0;
+}
+
+} // namespace los
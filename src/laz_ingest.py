@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""
+Streaming LAZ ingestion for los.Rasterizer
+
+laz_to_dem used to laspy.read() a whole tile, holding every point at once
+(several GB for one USGS tile). Here a reader thread decodes the file in
+chunks of `chunk_points` points and hands them to the rasterizer through a
+bounded queue, so peak memory is about (prefetch + 2) chunks whatever the
+point count. With the lazrs backend the LAZ chunks inside each read are
+decompressed in parallel, and Rasterizer.add() releases the GIL, so
+decoding the next chunk overlaps binning the current one.
+
+Usage:
+    python laz_ingest.py lidar_data/tile.laz --resolution 0.5 --stat max
+"""
+
+import argparse
+import queue
+import sys
+import threading
+from pathlib import Path
+
+import laspy
+import numpy as np
+
+import los
+
+CHUNK_POINTS = 2_000_000
+PREFETCH = 2
+
+_DONE = object()
+
+
+def laz_backend():
+    """Fastest laspy LAZ backend installed: parallel lazrs if available."""
+    for backend in (laspy.LazBackend.LazrsParallel, laspy.LazBackend.Lazrs,
+                    laspy.LazBackend.Laszip):
+        if backend.is_available():
+            return backend
+    return None
+
+
+def _arrays(points):
+    """The fields los.Rasterizer.add() takes, as contiguous arrays."""
+    return {
+        "x": np.ascontiguousarray(points.x, dtype=np.float64),
+        "y": np.ascontiguousarray(points.y, dtype=np.float64),
+        "z": np.ascontiguousarray(points.z, dtype=np.float64),
+        "classification": np.ascontiguousarray(points.classification, dtype=np.uint8),
+        "return_number": np.ascontiguousarray(points.return_number, dtype=np.uint8),
+        "number_of_returns": np.ascontiguousarray(points.number_of_returns, dtype=np.uint8),
+    }
+
+
+def iter_chunks(path, chunk_points=CHUNK_POINTS, prefetch=PREFETCH):
+    """Yield dicts of per-point arrays, at most chunk_points points each.
+
+    A background thread reads ahead up to `prefetch` chunks. Errors in the
+    reader are raised here; leaving the loop early stops the reader.
+    """
+    chunks = queue.Queue(maxsize=max(1, prefetch))
+    stop = threading.Event()
+
+    def put(item):
+        while not stop.is_set():
+            try:
+                chunks.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                pass
+        return False
+
+    def read():
+        try:
+            with laspy.open(str(path), laz_backend=laz_backend()) as reader:
+                for points in reader.chunk_iterator(chunk_points):
+                    if not put(_arrays(points)):
+                        return
+            put(_DONE)
+        except BaseException as e:  # handed to the consumer
+            put(e)
+
+    reader = threading.Thread(target=read, name="laz-reader", daemon=True)
+    reader.start()
+    try:
+        while True:
+            item = chunks.get()
+            if item is _DONE:
+                return
+            if isinstance(item, BaseException):
+                raise item
+            yield item
+    finally:
+        stop.set()
+        reader.join()
+
+
+def read_bounds(path):
+    """(x_min, y_min, x_max, y_max, z_min, z_max, point_count) from the header."""
+    with laspy.open(str(path)) as reader:
+        h = reader.header
+        return (float(h.mins[0]), float(h.mins[1]), float(h.maxs[0]), float(h.maxs[1]),
+                float(h.mins[2]), float(h.maxs[2]), int(h.point_count))
+
+
+def rasterize_laz(path, resolution=1.0, stat="max", classes=None, returns="all",
+                  bounds=None, chunk_points=CHUNK_POINTS, prefetch=PREFETCH, raster=None,
+                  progress=None):
+    """Bin a LAZ/LAS file into a los.Rasterizer, one chunk at a time.
+
+    bounds defaults to the file header's extent. Pass `raster` to add this
+    file to an existing rasterizer (e.g. one covering several tiles); the
+    other grid arguments are then ignored. progress(done, total) is called
+    after every chunk. Returns the rasterizer; call finish() for the DEM.
+    """
+    x_min, y_min, x_max, y_max, _, _, total = read_bounds(path)
+    if raster is None:
+        raster = los.Rasterizer(bounds or (x_min, y_min, x_max, y_max), resolution,
+                                stat=stat, classes=classes, returns=returns)
+
+    done = 0
+    for chunk in iter_chunks(path, chunk_points, prefetch):
+        raster.add(chunk["x"], chunk["y"], chunk["z"],
+                   classification=chunk["classification"],
+                   return_number=chunk["return_number"],
+                   number_of_returns=chunk["number_of_returns"])
+        done += len(chunk["x"])
+        if progress:
+            progress(done, total)
+    return raster
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Rasterize a LAZ file in bounded memory")
+    parser.add_argument("laz", help="Path to a .laz or .las file")
+    parser.add_argument("--resolution", type=float, default=1.0)
+    parser.add_argument("--stat", choices=["max", "min", "mean", "percentile"], default="max")
+    parser.add_argument("--chunk-points", type=int, default=CHUNK_POINTS)
+    parser.add_argument("--output", default=None,
+                        help="Output .npy (default: <laz stem>_dem.npy next to the input)")
+    args = parser.parse_args()
+
+    path = Path(args.laz)
+    raster = rasterize_laz(
+        path, args.resolution, args.stat, chunk_points=args.chunk_points,
+        progress=lambda done, total: print(f"\r  {done}/{total} points", end="", flush=True))
+    print()
+    out = Path(args.output) if args.output else path.with_name(f"{path.stem}_dem.npy")
+    np.save(out, raster.finish())
+    print(f"Saved {raster.shape[1]}x{raster.shape[0]} DEM: {out}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
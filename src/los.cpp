@@ -1,154 +1,1049 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "los_kernel.h"
+#include "preprocess.h"
+#include "rasterize.h"
+#include "stats.h"
+#include "task_queue.h"
+#include "terrain.h"
+#include "tiled.h"
 
 namespace py = pybind11;
 
+using heightmap_t = py::array_t<float, py::array::c_style | py::array::forcecast>;
+using pairs_t = py::array_t<double, py::array::c_style | py::array::forcecast>;
+using codes_t = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>;
+
+// `obj` as a numpy array, without a copy where it can be: numpy arrays as
+// they are, DLPack tensors (__dlpack__) through numpy.from_dlpack, and
+// anything else through numpy.asarray, which wraps the buffer protocol
+// without copying (a dask array is computed, an xarray one unwrapped).
+static py::array as_array(const py::object& obj, const char* name) {
+    if (py::isinstance<py::array>(obj))
+        return py::reinterpret_borrow<py::array>(obj);
+    py::module_ numpy = py::module_::import("numpy");
+    if (py::hasattr(obj, "__dlpack__")) {
+        try {
+            return numpy.attr("from_dlpack")(obj);
+        } catch (py::error_already_set& e) {
+            throw py::value_error(std::string(name) + " must be in host memory (" + e.what() + ")");
+        }
+    }
+    return numpy.attr("asarray")(obj);
+}
+
+// A heightmap passed to the module-level functions, read in place: float32,
+// float64 and int16 with any strides; other dtypes are converted to a
+// float32 copy. Either a (height, width) array, or a 1-D array holding at
+// least width * height cells row-major when width and height are given.
+class HeightmapView {
+public:
+    HeightmapView(const py::object& heightmap, std::optional<int> width = std::nullopt,
+                  std::optional<int> height = std::nullopt)
+        : array_(as_array(heightmap, "heightmap")) {
+        if (!py::isinstance<py::array_t<float>>(array_) &&
+            !py::isinstance<py::array_t<double>>(array_) &&
+            !py::isinstance<py::array_t<int16_t>>(array_)) {
+            heightmap_t converted = heightmap_t::ensure(array_);
+            if (!converted)
+                throw py::value_error("heightmap must be a numeric array");
+            array_ = converted;
+        }
+
+        if (array_.ndim() == 2) {
+            if ((width && *width != array_.shape(1)) || (height && *height != array_.shape(0)))
+                throw py::value_error("width and height must match heightmap.shape[1] and [0]");
+            width_ = static_cast<int>(array_.shape(1));
+            height_ = static_cast<int>(array_.shape(0));
+            rowStride_ = array_.strides(0);
+            colStride_ = array_.strides(1);
+        } else if (array_.ndim() == 1 && width && height) {
+            if (*width <= 0 || *height <= 0 || array_.shape(0) < int64_t(*width) * *height)
+                throw py::value_error("a 1-D heightmap must hold width * height cells");
+            width_ = *width;
+            height_ = *height;
+            colStride_ = array_.strides(0);
+            rowStride_ = colStride_ * width_;
+        } else {
+            throw py::value_error("heightmap must be a 2-D array");
+        }
+        if (width_ == 0 || height_ == 0)
+            throw py::value_error("heightmap must not be empty");
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Row-major float32 cells the packet kernels can read, or null.
+    const float* dense() const {
+        if (!py::isinstance<py::array_t<float>>(array_) || colStride_ != sizeof(float) ||
+            rowStride_ != static_cast<py::ssize_t>(sizeof(float)) * width_)
+            return nullptr;
+        return static_cast<const float*>(array_.data());
+    }
+
+    // f(cells) with a los::StridedCells reader of the array's dtype.
+    template <typename F>
+    auto visit(const F& f) const -> decltype(f(los::StridedCells<float>{})) {
+        const char* base = static_cast<const char*>(array_.data());
+        if (py::isinstance<py::array_t<double>>(array_))
+            return f(los::StridedCells<double>{base, rowStride_, colStride_});
+        if (py::isinstance<py::array_t<int16_t>>(array_))
+            return f(los::StridedCells<int16_t>{base, rowStride_, colStride_});
+        return f(los::StridedCells<float>{base, rowStride_, colStride_});
+    }
+
+private:
+    py::array array_;  // keeps the cells alive
+    int width_ = 0, height_ = 0;
+    py::ssize_t rowStride_ = 0, colStride_ = 0;
+};
+
+// `pairs` as a C-contiguous float64 array (converted only if it is not one).
+static pairs_t as_pairs(const py::object& pairs) {
+    pairs_t arr = pairs_t::ensure(as_array(pairs, "pairs"));
+    if (!arr)
+        throw py::value_error("pairs must be a numeric array");
+    return arr;
+}
+
 double los_boolean(
-    py::array_t<float, py::array::c_style | py::array::forcecast> heightmap,
+    py::object heightmap,
     int width,
     int height,
     double x0, double y0, double z0,
     double x1, double y1, double z1
 ) {
-    auto buf = heightmap.request();
-    float* ptr = static_cast<float*>(buf.ptr);
+    HeightmapView view(heightmap, width, height);
+    LOS_STAT_SCOPE(1);
+    if (const float* ptr = view.dense())
+        return los::los_boolean_raw(ptr, width, height, x0, y0, z0, x1, y1, z1);
+    return view.visit([&](const auto& cells) {
+        return los::los_boolean_cells(cells, width, height, x0, y0, z0, x1, y1, z1);
+    });
+}
+
+double los_probability(
+    py::object heightmap,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    int num_samples = 9
+) {
+    HeightmapView view(heightmap, width, height);
+    py::gil_scoped_release release;
+    LOS_STAT_SCOPE(1);
+    if (const float* ptr = view.dense())
+        return los::los_probability_packets(ptr, width, height, x0, y0, z0, x1, y1, z1,
+                                            num_samples);
+    return view.visit([&](const auto& cells) {
+        auto trace = [&](double ax, double ay, double az, double bx, double by, double bz) {
+            return los::los_boolean_cells(cells, width, height, ax, ay, az, bx, by, bz);
+        };
+        return los::los_probability_sampled(trace, x0, y0, z0, x1, y1, z1, num_samples);
+    });
+}
 
-    // Direction
-    double dx = x1 - x0;
-    double dy = y1 - y0;
-    double dz = z1 - z0;
+// Validate a [N, 6] array of (x0, y0, z0, x1, y1, z1) rows and return N.
+static py::ssize_t check_pairs(const pairs_t& pairs) {
+    if (pairs.ndim() != 2 || pairs.shape(1) != 6)
+        throw py::value_error("pairs must have shape (N, 6): x0, y0, z0, x1, y1, z1");
+    return pairs.shape(0);
+}
+
+static void check_num_samples(int num_samples) {
+    if (num_samples < 1)
+        throw py::value_error("num_samples must be >= 1");
+}
 
-    // Current grid cell
-    int x = static_cast<int>(std::floor(x0));
-    int y = static_cast<int>(std::floor(y0));
+// Return `out` if it is a writable C-contiguous array of T with the given
+// shape, otherwise allocate a fresh one when `out` is None.
+template <typename T>
+static py::array_t<T> prepare_out(const py::object& out, std::vector<py::ssize_t> shape) {
+    if (out.is_none())
+        return py::array_t<T>(shape);
 
-    int endX = static_cast<int>(std::floor(x1));
-    int endY = static_cast<int>(std::floor(y1));
+    if (!py::isinstance<py::array_t<T>>(out))
+        throw py::type_error("out must be a numpy array of dtype " +
+                             std::string(py::str(py::dtype::of<T>())));
 
-    int stepX = (dx > 0) ? 1 : -1;
-    int stepY = (dy > 0) ? 1 : -1;
+    auto arr = py::reinterpret_borrow<py::array_t<T>>(out);
+    bool same_shape = arr.ndim() == static_cast<py::ssize_t>(shape.size());
+    for (size_t i = 0; same_shape && i < shape.size(); i++)
+        same_shape = arr.shape(i) == shape[i];
+    if (!same_shape)
+        throw py::value_error(shape.size() == 1
+                                  ? "out must be a 1-D array with one element per pair"
+                                  : "out must have the same shape as the heightmap");
+    if (!(arr.flags() & py::array::c_style))
+        throw py::value_error("out must be C-contiguous");
+    if (!arr.writeable())
+        throw py::value_error("out must be writeable");
+    return arr;
+}
 
-    double tMaxX, tMaxY;
-    double tDeltaX, tDeltaY;
+static los::Terrain view_heightmap(const heightmap_t& heightmap, bool build_pyramid = false,
+                                   los::Precision precision = los::Precision::Double,
+                                   los::Device device = los::Device::CPU,
+                                   los::Layout layout = los::Layout::RowMajor,
+                                   std::optional<float> quantize = std::nullopt,
+                                   los::Interpolation interpolation = los::Interpolation::Nearest) {
+    if (heightmap.ndim() != 2)
+        throw py::value_error("heightmap must be a 2-D array");
+    const float* ptr = heightmap.data();
+    int width = static_cast<int>(heightmap.shape(1));
+    int height = static_cast<int>(heightmap.shape(0));
+    if (precision == los::Precision::Float && !los::fits_float_kernel(width, height))
+        throw py::value_error("precision='float32' needs fewer than 2^31 cells and "
+                              "at most 2^24 per side");
 
-    if (dx != 0) {
-        double nextGridX = (stepX > 0) ? (x + 1.0) : x;
-        tMaxX = (nextGridX - x0) / dx;
-        tDeltaX = 1.0 / std::abs(dx);
-    } else {
-        tMaxX = std::numeric_limits<double>::infinity();
-        tDeltaX = tMaxX;
+    if (device == los::Device::GPU && !los::gpu::available())
+        throw py::value_error("device='gpu' needs los built with LOS_GPU and a visible GPU");
+    if (quantize && !(*quantize > 0 && std::isfinite(*quantize)))
+        throw py::value_error("quantize must be a positive step in height units");
+    if (quantize && (device != los::Device::CPU || layout != los::Layout::RowMajor))
+        throw py::value_error("quantize needs device='cpu' and layout='row-major'");
+    if (interpolation == los::Interpolation::Bilinear && device != los::Device::CPU)
+        throw py::value_error("interpolation='bilinear' needs device='cpu'");
+
+    py::gil_scoped_release release;
+    return los::Terrain(ptr, width, height, build_pyramid, precision, device, layout,
+                        quantize.value_or(0.0f), interpolation);
+}
+
+static los::Precision parse_precision(const std::string& precision) {
+    if (precision == "float64")
+        return los::Precision::Double;
+    if (precision == "float32")
+        return los::Precision::Float;
+    throw py::value_error("precision must be 'float64' or 'float32', got '" + precision + "'");
+}
+
+static los::Device parse_device(const std::string& device) {
+    if (device == "cpu")
+        return los::Device::CPU;
+    if (device == "gpu")
+        return los::Device::GPU;
+    throw py::value_error("device must be 'cpu' or 'gpu', got '" + device + "'");
+}
+
+static los::Layout parse_layout(const std::string& layout) {
+    if (layout == "row-major")
+        return los::Layout::RowMajor;
+    if (layout == "blocked")
+        return los::Layout::Blocked;
+    if (layout == "morton")
+        return los::Layout::Morton;
+    throw py::value_error("layout must be 'row-major', 'blocked' or 'morton', got '" +
+                          layout + "'");
+}
+
+static los::Interpolation parse_interpolation(const std::string& interpolation) {
+    if (interpolation == "nearest")
+        return los::Interpolation::Nearest;
+    if (interpolation == "bilinear")
+        return los::Interpolation::Bilinear;
+    throw py::value_error("interpolation must be 'nearest' or 'bilinear', got '" +
+                          interpolation + "'");
+}
+
+static const char* layout_name(los::Layout layout) {
+    switch (layout) {
+    case los::Layout::Blocked: return "blocked";
+    case los::Layout::Morton: return "morton";
+    default: return "row-major";
     }
+}
 
-    if (dy != 0) {
-        double nextGridY = (stepY > 0) ? (y + 1.0) : y;
-        tMaxY = (nextGridY - y0) / dy;
-        tDeltaY = 1.0 / std::abs(dy);
-    } else {
-        tMaxY = std::numeric_limits<double>::infinity();
-        tDeltaY = tMaxY;
+// Terrain is los::Terrain or los::TiledTerrain.
+template <typename Terrain>
+static py::array_t<uint8_t> boolean_batch(const Terrain& terrain,
+                                          const pairs_t& pairs,
+                                          const py::object& out) {
+    py::ssize_t n = check_pairs(pairs);
+    auto result = prepare_out<uint8_t>(out, {n});
+    const double* p = pairs.data();
+    uint8_t* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    terrain.los_boolean_batch(p, n, dst);
+    return result;
+}
+
+template <typename Terrain>
+static py::array_t<double> probability_batch(const Terrain& terrain,
+                                             const pairs_t& pairs,
+                                             int num_samples,
+                                             const py::object& out) {
+    check_num_samples(num_samples);
+    py::ssize_t n = check_pairs(pairs);
+    auto result = prepare_out<double>(out, {n});
+    const double* p = pairs.data();
+    double* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    terrain.los_probability_batch(p, n, num_samples, dst);
+    return result;
+}
+
+static los::TraceResult trace(const los::Terrain& terrain,
+                              double x0, double y0, double z0,
+                              double x1, double y1, double z1,
+                              bool stop_at_block, const py::object& profile) {
+    double* rows = nullptr;
+    int64_t capacity = 0;
+    if (!profile.is_none()) {
+        if (!py::isinstance<py::array_t<double>>(profile))
+            throw py::type_error("profile must be a numpy array of dtype float64");
+        auto arr = py::reinterpret_borrow<py::array_t<double>>(profile);
+        if (arr.ndim() != 2 || arr.shape(1) != los::kProfileColumns)
+            throw py::value_error("profile must have shape (N, 5): x, y, t, terrain, ray height");
+        if (!(arr.flags() & py::array::c_style) || !arr.writeable())
+            throw py::value_error("profile must be writeable and C-contiguous");
+        rows = arr.mutable_data();
+        capacity = arr.shape(0);
     }
 
-    while (true) {
+    py::gil_scoped_release release;
+    return terrain.los_trace(x0, y0, z0, x1, y1, z1, stop_at_block, rows, capacity);
+}
 
-        if (x < 0 || y < 0 || x >= width || y >= height)
-            return 0.0;
+// (cell_size, k_factor) of set_earth_curvature(), None for flat rays.
+// Terrain is los::Terrain or los::TiledTerrain.
+template <typename Terrain>
+static py::object earth_curvature_of(const Terrain& terrain) {
+    if (terrain.curvature() == 0)
+        return py::none();
+    return py::make_tuple(terrain.curvature_cell_size(), terrain.curvature_k_factor());
+}
 
-        // Compute parametric t along ray
-        double t;
+// Wavelength in metres of a radio frequency in Hz.
+static double wavelength_of(double frequency, double cell_size) {
+    if (!(frequency > 0) || !std::isfinite(frequency))
+        throw py::value_error("frequency must be a positive number of Hz");
+    if (!(cell_size > 0) || !std::isfinite(cell_size))
+        throw py::value_error("cell_size must be a positive number of metres");
+    return los::kSpeedOfLight / frequency;
+}
 
-        if (std::abs(dx) > std::abs(dy))
-            t = (x - x0) / dx;
-        else
-            t = (y - y0) / dy;
+static py::array_t<double> fresnel_batch(const los::Terrain& terrain,
+                                         const pairs_t& pairs,
+                                         double frequency, double cell_size,
+                                         const py::object& out) {
+    double wavelength = wavelength_of(frequency, cell_size);
+    py::ssize_t n = check_pairs(pairs);
+    auto result = prepare_out<double>(out, {n});
+    const double* p = pairs.data();
+    double* dst = result.mutable_data();
 
-        if (t < 0) t = 0;
-        if (t > 1) t = 1;
+    py::gil_scoped_release release;
+    terrain.los_fresnel_batch(p, n, wavelength, cell_size, dst);
+    return result;
+}
 
-        double rayHeight = z0 + t * dz;
+// Validate a viewshed observer and return the radius to pass on.
+static double viewshed_radius(const los::Terrain& terrain, double x0, double y0,
+                              std::optional<double> max_radius) {
+    double radius = max_radius.value_or(std::numeric_limits<double>::infinity());
+    if (!(radius > 0))
+        throw py::value_error("max_radius must be positive");
+    if (!(x0 >= 0 && y0 >= 0 && x0 < terrain.width() && y0 < terrain.height()))
+        throw py::value_error("observer must lie inside the heightmap");
+    return radius;
+}
 
-        float terrain = ptr[y * width + x];
+static py::array_t<uint8_t> viewshed(const los::Terrain& terrain,
+                                     double x0, double y0, double z0,
+                                     double target_height,
+                                     std::optional<double> max_radius,
+                                     const py::object& out) {
+    double radius = viewshed_radius(terrain, x0, y0, max_radius);
+    auto result = prepare_out<uint8_t>(out, {terrain.height(), terrain.width()});
+    uint8_t* dst = result.mutable_data();
 
-        if (terrain > rayHeight)
-            return 0.0;
+    py::gil_scoped_release release;
+    terrain.viewshed(x0, y0, z0, target_height, radius, dst);
+    return result;
+}
 
-        if (x == endX && y == endY)
-            break;
+static py::array_t<uint16_t> cumulative_viewshed(const los::Terrain& terrain,
+                                                 pairs_t observers,
+                                                 double target_height,
+                                                 std::optional<double> max_radius,
+                                                 const py::object& out) {
+    double radius = max_radius.value_or(std::numeric_limits<double>::infinity());
+    if (!(radius > 0))
+        throw py::value_error("max_radius must be positive");
+    if (observers.ndim() != 2 || observers.shape(1) != 3)
+        throw py::value_error("observers must have shape (M, 3): x, y, z");
 
-        if (tMaxX < tMaxY) {
-            tMaxX += tDeltaX;
-            x += stepX;
-        } else {
-            tMaxY += tDeltaY;
-            y += stepY;
-        }
+    py::ssize_t m = observers.shape(0);
+    const double* o = observers.data();
+    for (py::ssize_t i = 0; i < m; i++) {
+        double x = o[3 * i], y = o[3 * i + 1];
+        if (!(x >= 0 && y >= 0 && x < terrain.width() && y < terrain.height()))
+            throw py::value_error("observer " + std::to_string(i) +
+                                  " lies outside the heightmap");
     }
 
-    return 1.0;
+    auto result = prepare_out<uint16_t>(out, {terrain.height(), terrain.width()});
+    uint16_t* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    terrain.cumulative_viewshed(o, m, target_height, radius, dst);
+    return result;
 }
 
-double los_probability(
-    py::array_t<float, py::array::c_style | py::array::forcecast> heightmap,
-    int width,
-    int height,
-    double x0, double y0, double z0,
-    double x1, double y1, double z1,
-    int num_samples = 9
+// An area_visibility region: (x, y, w, h), or (x, y, mask) for the cells of
+// a 2-D mask placed with its first cell at (x, y). `mask` keeps the uint8
+// copy the region points into, if one was needed.
+static los::AreaRegion area_region(const los::Terrain& terrain, const py::object& region,
+                                   codes_t& mask, const char* name) {
+    auto fail = [name]() {
+        return py::value_error(std::string(name) + " must be (x, y, w, h) or (x, y, mask)");
+    };
+    if (!py::isinstance<py::tuple>(region) && !py::isinstance<py::list>(region))
+        throw fail();
+    py::sequence seq = py::reinterpret_borrow<py::sequence>(region);
+    if (seq.size() != 3 && seq.size() != 4)
+        throw fail();
+    int x = seq[0].cast<int>(), y = seq[1].cast<int>(), w, h;
+    const uint8_t* cells = nullptr;
+    if (seq.size() == 4) {
+        w = seq[2].cast<int>();
+        h = seq[3].cast<int>();
+    } else {
+        mask = codes_t::ensure(as_array(seq[2], name));
+        if (!mask || mask.ndim() != 2)
+            throw py::value_error(std::string(name) + " mask must be a 2-D array");
+        w = static_cast<int>(mask.shape(1));
+        h = static_cast<int>(mask.shape(0));
+        cells = mask.data();
+    }
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || int64_t(x) + w > terrain.width() ||
+        int64_t(y) + h > terrain.height())
+        throw py::value_error(std::string(name) + " must be non-empty and lie inside the heightmap");
+    return {{x, y, x + w - 1, y + h - 1}, cells};
+}
+
+static los::AreaResult area_visibility(const los::Terrain& terrain, const py::object& a,
+                                       const py::object& b, double observer_height,
+                                       double target_height, double tolerance,
+                                       bool stop_at_first) {
+    if (!(tolerance >= 0 && tolerance <= 1))
+        throw py::value_error("tolerance must be between 0 and 1");
+    codes_t maskA, maskB;
+    los::AreaRegion ra = area_region(terrain, a, maskA, "a");
+    los::AreaRegion rb = area_region(terrain, b, maskB, "b");
+    py::gil_scoped_release release;
+    return terrain.area_visibility(ra, rb, observer_height, target_height, tolerance,
+                                   stop_at_first);
+}
+
+static los::Horizon precompute_horizon(const los::Terrain& terrain, const py::object& observer,
+                                       int n_azimuths, std::optional<double> max_range,
+                                       int n_bands) {
+    auto o = observer.cast<std::vector<double>>();
+    if (o.size() != 3)
+        throw py::value_error("observer must be (x, y, z)");
+    if (n_azimuths < 1 || n_bands < 1)
+        throw py::value_error("n_azimuths and n_bands must be positive");
+    double range = max_range.value_or(std::numeric_limits<double>::infinity());
+    if (!(range > 0))
+        throw py::value_error("max_range must be positive");
+    if (!(o[0] >= 0 && o[1] >= 0 && o[0] < terrain.width() && o[1] < terrain.height()))
+        throw py::value_error("observer must lie inside the heightmap");
+    py::gil_scoped_release release;
+    return terrain.precompute_horizon(o[0], o[1], o[2], n_azimuths, range, n_bands);
+}
+
+static py::array_t<uint8_t> horizon_batch(const los::Terrain& terrain, const los::Horizon& h,
+                                          pairs_t targets, const py::object& out) {
+    if (targets.ndim() != 2 || targets.shape(1) != 3)
+        throw py::value_error("targets must have shape (N, 3): x, y, z");
+    py::ssize_t n = targets.shape(0);
+    auto result = prepare_out<uint8_t>(out, {n});
+    const double* p = targets.data();
+    uint8_t* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    terrain.los_horizon_batch(h, p, n, dst);
+    return result;
+}
+
+// A row-major float32 heightmap goes through a los::Terrain and its SIMD
+// packet kernels; any other view is walked in place one ray per lane.
+py::array_t<uint8_t> los_boolean_batch(
+    py::object heightmap,
+    py::object pairs,
+    py::object out
 ) {
-    // Sample multiple rays in a pattern around the primary ray
-    // Returns probability as fraction of successful rays
-    
-    if (num_samples == 1) {
-        return los_boolean(heightmap, width, height, x0, y0, z0, x1, y1, z1);
-    }
-    
-    int successful_rays = 0;
-    
-    // Sample in a grid pattern around the endpoints
-    // For 9 samples: center + 8 surrounding points
-    // For 25 samples: 5x5 grid, etc.
-    
-    int grid_size = static_cast<int>(std::sqrt(num_samples));
-    if (grid_size * grid_size < num_samples) grid_size++;
-    
-    double offset_range = 2.0; // Sample within +/- 2 grid cells
-    
-    for (int i = 0; i < num_samples; i++) {
-        // Calculate offset pattern
-        int grid_x = i % grid_size;
-        int grid_y = i / grid_size;
-        
-        double offset_x = (grid_x - grid_size / 2.0) * (offset_range / grid_size);
-        double offset_y = (grid_y - grid_size / 2.0) * (offset_range / grid_size);
-        
-        // Apply offset to both endpoints
-        double sample_x0 = x0 + offset_x;
-        double sample_y0 = y0 + offset_y;
-        double sample_x1 = x1 + offset_x;
-        double sample_y1 = y1 + offset_y;
-        
-        // Check LOS for this sample
-        double result = los_boolean(heightmap, width, height,
-                                   sample_x0, sample_y0, z0,
-                                   sample_x1, sample_y1, z1);
-        
-        if (result > 0.5) {
-            successful_rays++;
+    HeightmapView view(heightmap);
+    pairs_t rays = as_pairs(pairs);
+    int w = view.width(), h = view.height();
+    if (const float* ptr = view.dense())
+        return boolean_batch(los::Terrain(ptr, w, h), rays, out);
+
+    py::ssize_t n = check_pairs(rays);
+    auto result = prepare_out<uint8_t>(out, {n});
+    const double* p = rays.data();
+    uint8_t* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    view.visit([&](const auto& cells) {
+        los::parallel_for(n, los::kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                LOS_STAT_SCOPE(1);
+                const double* r = p + 6 * i;
+                dst[i] = los::los_boolean_cells(cells, w, h, r[0], r[1], r[2],
+                                                r[3], r[4], r[5]) > 0.5;
+            }
+        });
+    });
+    return result;
+}
+
+py::array_t<double> los_probability_batch(
+    py::object heightmap,
+    py::object pairs,
+    int num_samples,
+    py::object out
+) {
+    HeightmapView view(heightmap);
+    pairs_t rays = as_pairs(pairs);
+    int w = view.width(), h = view.height();
+    if (const float* ptr = view.dense())
+        return probability_batch(los::Terrain(ptr, w, h), rays, num_samples, out);
+
+    check_num_samples(num_samples);
+    py::ssize_t n = check_pairs(rays);
+    auto result = prepare_out<double>(out, {n});
+    const double* p = rays.data();
+    double* dst = result.mutable_data();
+
+    py::gil_scoped_release release;
+    view.visit([&](const auto& cells) {
+        auto trace = [&](double ax, double ay, double az, double bx, double by, double bz) {
+            return los::los_boolean_cells(cells, w, h, ax, ay, az, bx, by, bz);
+        };
+        los::parallel_for(n, los::kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                LOS_STAT_SCOPE(1);
+                const double* r = p + 6 * i;
+                dst[i] = los::los_probability_sampled(trace, r[0], r[1], r[2],
+                                                      r[3], r[4], r[5], num_samples);
+            }
+        });
+    });
+    return result;
+}
+
+// Python-facing terrain. Holds the heightmap array (the caller's own array
+// when it is already float32 and C-contiguous, otherwise a converted copy)
+// for as long as the prepared los::Terrain points into it.
+class PyTerrain {
+public:
+    PyTerrain(const py::object& heightmap, std::optional<int> width,
+              std::optional<int> height, bool copy, bool pyramid,
+              const std::string& precision, const std::string& device,
+              const std::string& layout, std::optional<float> quantize,
+              const std::string& interpolation)
+        : array_(prepare(as_heightmap(heightmap), width, height, copy && !quantize)),
+          terrain_(view_heightmap(array_, pyramid, parse_precision(precision),
+                                  parse_device(device), parse_layout(layout), quantize,
+                                  parse_interpolation(interpolation))) {
+        // A quantized terrain keeps its own codes; drop the float array.
+        if (terrain_.quantized())
+            array_ = heightmap_t();
+    }
+
+    const los::Terrain& terrain() const { return terrain_; }
+    los::Terrain& terrain() { return terrain_; }
+    py::object array() const { return terrain_.quantized() ? py::none() : py::object(array_); }
+
+    void update_region(int x, int y, heightmap_t patch) {
+        if (patch.ndim() != 2 || patch.shape(0) == 0 || patch.shape(1) == 0)
+            throw py::value_error("patch must be a non-empty 2-D array");
+        int w = static_cast<int>(patch.shape(1)), h = static_cast<int>(patch.shape(0));
+        if (x < 0 || y < 0 || int64_t(x) + w > terrain_.width() ||
+            int64_t(y) + h > terrain_.height())
+            throw py::value_error("patch placed at (x, y) must lie inside the heightmap");
+        if (!terrain_.quantized() && !array_.writeable())
+            throw py::value_error("update_region needs a writeable heightmap "
+                                  "(build the Terrain with copy=True)");
+        const float* p = patch.data();
+        py::gil_scoped_release release;
+        terrain_.update_region(x, y, w, h, p, static_cast<size_t>(w));
+    }
+
+private:
+    // float32 C-contiguous view of `heightmap`, converted only if needed.
+    static heightmap_t as_heightmap(const py::object& heightmap) {
+        heightmap_t arr = heightmap_t::ensure(as_array(heightmap, "heightmap"));
+        if (!arr)
+            throw py::value_error("heightmap must be a numeric array");
+        return arr;
+    }
+
+    static heightmap_t prepare(heightmap_t heightmap, std::optional<int> width,
+                               std::optional<int> height, bool copy) {
+        if (heightmap.ndim() != 2)
+            throw py::value_error("heightmap must be a 2-D array");
+        if (width && *width != heightmap.shape(1))
+            throw py::value_error("width " + std::to_string(*width) +
+                                  " does not match heightmap.shape[1] = " +
+                                  std::to_string(heightmap.shape(1)));
+        if (height && *height != heightmap.shape(0))
+            throw py::value_error("height " + std::to_string(*height) +
+                                  " does not match heightmap.shape[0] = " +
+                                  std::to_string(heightmap.shape(0)));
+        if (heightmap.shape(0) == 0 || heightmap.shape(1) == 0)
+            throw py::value_error("heightmap must not be empty");
+
+        if (!copy)
+            return heightmap;
+
+        heightmap_t owned({heightmap.shape(0), heightmap.shape(1)});
+        std::memcpy(owned.mutable_data(), heightmap.data(),
+                    sizeof(float) * static_cast<size_t>(heightmap.size()));
+        return owned;
+    }
+
+    heightmap_t array_;  // empty once quantized
+    los::Terrain terrain_;
+};
+
+// Python side of a los::TaskQueue job (los.Future). `keep` holds the
+// terrain and arrays the job reads until it finishes; then the GIL is taken
+// on the finishing thread, `keep` dropped and the callbacks run.
+struct AsyncState {
+    std::shared_ptr<los::TaskQueue::Task> task;
+    py::object keep;
+    py::object result;
+    py::list callbacks;  // (fn, future) pairs
+    bool finished = false;
+};
+
+class PyFuture {
+public:
+    explicit PyFuture(std::shared_ptr<AsyncState> state) : state_(std::move(state)) {}
+
+    los::TaskQueue::State state() const { return state_->task->state(); }
+    bool done() const { return state_->task->finished(); }
+    bool cancel() { return los::TaskQueue::instance().cancel(state_->task); }
+
+    // Wait with the GIL released; TimeoutError after `timeout` seconds.
+    void wait(std::optional<double> timeout) const {
+        if (timeout && !(*timeout >= 0))
+            throw py::value_error("timeout must be >= 0 seconds");
+        bool finished;
+        {
+            py::gil_scoped_release release;
+            finished = state_->task->wait_for(timeout.value_or(-1.0));
+        }
+        if (!finished) {
+            PyErr_SetString(PyExc_TimeoutError, "the query did not finish in time");
+            throw py::error_already_set();
         }
     }
-    
-    return static_cast<double>(successful_rays) / num_samples;
+
+    py::object result(std::optional<double> timeout) const {
+        wait(timeout);
+        switch (state()) {
+        case los::TaskQueue::State::Cancelled: {
+            py::object error = py::module_::import("concurrent.futures").attr("CancelledError");
+            PyErr_SetNone(error.ptr());
+            throw py::error_already_set();
+        }
+        case los::TaskQueue::State::Failed:
+            std::rethrow_exception(state_->task->error());
+        default:
+            return state_->result;
+        }
+    }
+
+    // Call fn(future) once the job has finished: now if it already has,
+    // otherwise on the thread that finishes it.
+    void add_done_callback(const py::object& self, const py::object& fn) {
+        if (state_->finished)
+            fn(self);
+        else
+            state_->callbacks.append(py::make_tuple(fn, self));
+    }
+
+    // Queue work(task) on the shared TaskQueue. With the queue full this
+    // waits (up to timeout seconds) when block is set and raises queue.Full
+    // if no slot frees up.
+    static PyFuture submit(py::object keep, py::object result,
+                           std::function<void(const los::TaskQueue::Task&)> work,
+                           bool block, std::optional<double> timeout) {
+        if (timeout && !(*timeout >= 0))
+            throw py::value_error("timeout must be >= 0 seconds");
+        auto state = std::make_shared<AsyncState>();
+        state->keep = std::move(keep);
+        state->result = std::move(result);
+
+        std::function<void()> done = [state]() mutable {
+            py::gil_scoped_acquire gil;
+            state->finished = true;
+            state->keep = py::none();
+            py::list callbacks = std::move(state->callbacks);
+            for (py::handle entry : callbacks) {
+                try {
+                    entry[py::int_(0)](entry[py::int_(1)]);
+                } catch (py::error_already_set& e) {
+                    e.discard_as_unraisable("los.Future done callback");
+                }
+            }
+            state.reset();
+        };
+
+        double seconds = block ? timeout.value_or(-1.0) : 0.0;
+        std::shared_ptr<los::TaskQueue::Task> task;
+        {
+            py::gil_scoped_release release;
+            task = los::TaskQueue::instance().submit(std::move(work), std::move(done), seconds);
+        }
+        if (!task) {
+            py::object full = py::module_::import("queue").attr("Full");
+            PyErr_SetString(full.ptr(), "the query queue is full (see set_max_pending)");
+            throw py::error_already_set();
+        }
+        state->task = std::move(task);
+        return PyFuture(std::move(state));
+    }
+
+private:
+    std::shared_ptr<AsyncState> state_;
+};
+
+// Rays per slice of an async batch; cancellation is checked between slices.
+constexpr int64_t kAsyncSlice = int64_t(1) << 16;
+
+static PyFuture submit_batch(const py::object& self, pairs_t pairs, const std::string& op,
+                             int num_samples, const py::object& out, bool block,
+                             std::optional<double> timeout) {
+    const los::Terrain* terrain = &self.cast<const PyTerrain&>().terrain();
+    py::ssize_t n = check_pairs(pairs);
+    const double* p = pairs.data();
+    std::function<void(const los::TaskQueue::Task&)> work;
+    py::object result;
+
+    if (op == "boolean") {
+        auto arr = prepare_out<uint8_t>(out, {n});
+        uint8_t* dst = arr.mutable_data();
+        work = [terrain, p, n, dst](const los::TaskQueue::Task& task) {
+            for (int64_t i = 0; i < n && !task.cancelled(); i += kAsyncSlice)
+                terrain->los_boolean_batch(p + 6 * i, std::min(kAsyncSlice, n - i), dst + i);
+        };
+        result = arr;
+    } else if (op == "probability") {
+        check_num_samples(num_samples);
+        auto arr = prepare_out<double>(out, {n});
+        double* dst = arr.mutable_data();
+        work = [terrain, p, n, num_samples, dst](const los::TaskQueue::Task& task) {
+            for (int64_t i = 0; i < n && !task.cancelled(); i += kAsyncSlice)
+                terrain->los_probability_batch(p + 6 * i, std::min(kAsyncSlice, n - i),
+                                               num_samples, dst + i);
+        };
+        result = arr;
+    } else {
+        throw py::value_error("op must be 'boolean' or 'probability', got '" + op + "'");
+    }
+    return PyFuture::submit(py::make_tuple(self, pairs), result, std::move(work), block,
+                            timeout);
+}
+
+static PyFuture viewshed_async(const py::object& self, double x0, double y0, double z0,
+                               double target_height, std::optional<double> max_radius,
+                               const py::object& out, bool block,
+                               std::optional<double> timeout) {
+    const los::Terrain* terrain = &self.cast<const PyTerrain&>().terrain();
+    double radius = viewshed_radius(*terrain, x0, y0, max_radius);
+    auto arr = prepare_out<uint8_t>(out, {terrain->height(), terrain->width()});
+    uint8_t* dst = arr.mutable_data();
+    auto work = [=](const los::TaskQueue::Task&) {
+        terrain->viewshed(x0, y0, z0, target_height, radius, dst);
+    };
+    return PyFuture::submit(self, arr, work, block, timeout);
+}
+
+static py::dict result_cache_stats(const los::Terrain& t) {
+    py::dict d;
+    if (!t.result_cache())
+        return d;
+    los::ResultCache::Stats s = t.result_cache()->stats();
+    d["hits"] = s.hits;
+    d["misses"] = s.misses;
+    d["invalidated"] = s.invalidated;
+    d["evictions"] = s.evictions;
+    d["entries"] = s.entries;
+    d["capacity"] = s.capacity;
+    d["hit_rate"] = s.hits + s.misses ? static_cast<double>(s.hits) / (s.hits + s.misses) : 0.0;
+    return d;
+}
+
+static std::unique_ptr<los::TiledTerrain> open_tiled(const py::object& path,
+                                                     const std::string& precision,
+                                                     std::optional<int64_t> cache_bytes,
+                                                     int lookahead) {
+    if (cache_bytes && *cache_bytes <= 0)
+        throw py::value_error("cache_bytes must be positive (None reads the mapping directly)");
+    if (lookahead < 0)
+        throw py::value_error("lookahead must be >= 0");
+    std::string p = py::str(py::module_::import("os").attr("fspath")(path));
+    auto terrain = std::make_unique<los::TiledTerrain>(
+        p, parse_precision(precision), static_cast<size_t>(cache_bytes.value_or(0)), lookahead);
+    if (terrain->precision() == los::Precision::Float &&
+        !los::fits_float_kernel(terrain->width(), terrain->height()))
+        throw py::value_error("precision='float32' needs fewer than 2^31 cells and "
+                              "at most 2^24 per side");
+    return terrain;
+}
+
+// Directory field (max or min) of every tile as float32[tiles_y, tiles_x].
+static py::array_t<float> tile_stat(const los::TiledTerrain& t, float los::TileEntry::*field) {
+    const los::TiledDem& dem = t.dem();
+    py::array_t<float> result({dem.tiles_y(), dem.tiles_x()});
+    float* dst = result.mutable_data();
+    for (int ty = 0; ty < dem.tiles_y(); ty++)
+        for (int tx = 0; tx < dem.tiles_x(); tx++)
+            *dst++ = dem.entry(tx, ty).*field;
+    return result;
+}
+
+static py::dict cache_stats(const los::TiledTerrain& t) {
+    py::dict d;
+    if (!t.cache())
+        return d;
+    los::TileCache::Stats s = t.cache()->stats();
+    d["hits"] = s.hits;
+    d["misses"] = s.misses;
+    d["prefetched"] = s.prefetched;
+    d["evictions"] = s.evictions;
+    d["tiles"] = s.tiles;
+    d["bytes"] = s.bytes;
+    d["budget"] = s.budget;
+    return d;
+}
+
+static py::array_t<float> read_window(const los::TiledTerrain& t, int x, int y,
+                                      int width, int height) {
+    if (width <= 0 || height <= 0 || x < 0 || y < 0 ||
+        x > t.width() - width || y > t.height() - height)
+        throw py::value_error("window must lie inside the DEM");
+    py::array_t<float> result({height, width});
+    float* dst = result.mutable_data();
+    py::gil_scoped_release release;
+    t.read_window(x, y, width, height, dst);
+    return result;
+}
+
+static los::HoleFill parse_fill(const py::object& fill) {
+    if (fill.is_none())
+        return los::HoleFill::None;
+    std::string name = py::str(fill);
+    if (name == "nearest")
+        return los::HoleFill::Nearest;
+    if (name == "push-pull")
+        return los::HoleFill::PushPull;
+    throw py::value_error("fill must be 'push-pull', 'nearest' or None, got '" + name + "'");
+}
+
+// dem as the float32 C-contiguous 2-D array the hole fillers work on in
+// place. Nothing is converted: a converted copy would be filled and then
+// dropped, leaving the caller's array as it was.
+static py::array_t<float> float_grid(const py::object& dem) {
+    if (!py::isinstance<py::array_t<float>>(dem))
+        throw py::type_error("dem must be a numpy array of dtype float32");
+    auto grid = py::reinterpret_borrow<py::array_t<float>>(dem);
+    if (grid.ndim() != 2 || !(grid.flags() & py::array::c_style))
+        throw py::value_error("dem must be a C-contiguous float32 2-D array");
+    return grid;
 }
 
-PYBIND11_MODULE(los, m) {
+// Fill, tile and write dem in one native pass (see preprocess.h). A copy
+// of the metadata dict is serialized once the tiles are written, with its
+// bounds z_min/z_max set to the range of the written (filled) DEM.
+static py::dict write_tiled(const py::object& path, const py::object& array,
+                            std::optional<py::dict> metadata, int tile_size,
+                            const py::object& fill, std::optional<double> max_fill_distance) {
+    los::HoleFill method = parse_fill(fill);
+    py::array_t<float> dem = float_grid(array);
+    if (method != los::HoleFill::None && !dem.writeable())
+        throw py::value_error("dem must be writeable to fill its holes (or pass fill=None)");
+    if (max_fill_distance && method != los::HoleFill::Nearest)
+        throw py::value_error("max_fill_distance applies to fill='nearest' only");
+    double limit = max_fill_distance.value_or(std::numeric_limits<double>::infinity());
+    if (!(limit >= 0))
+        throw py::value_error("max_fill_distance must be >= 0");
+    if (dem.shape(0) > std::numeric_limits<int>::max() ||
+        dem.shape(1) > std::numeric_limits<int>::max())
+        throw py::value_error("dem is too large");
+
+    std::string p = py::str(py::module_::import("os").attr("fspath")(path));
+    // A read-only array is only read when nothing is filled
+    float* data = const_cast<float*>(dem.data());
+    int width = static_cast<int>(dem.shape(1)), height = static_cast<int>(dem.shape(0));
+    py::dict meta;
+    if (metadata)
+        meta = py::module_::import("copy").attr("deepcopy")(*metadata).cast<py::dict>();
+    py::object dumps = py::module_::import("json").attr("dumps");
+
+    los::TiledWriteStats stats;
+    {
+        py::gil_scoped_release release;
+        stats = los::write_tiled_dem(
+            p, data, width, height, tile_size, method, limit,
+            [&](const los::TiledWriteStats& s) {
+                py::gil_scoped_acquire gil;
+                if (meta.contains("bounds") && py::isinstance<py::dict>(meta["bounds"])) {
+                    py::dict bounds = meta["bounds"].cast<py::dict>();
+                    bounds["z_min"] = s.zMin;
+                    bounds["z_max"] = s.zMax;
+                }
+                return std::string(py::str(dumps(meta, py::arg("indent") = 2)));
+            });
+    }
+    py::dict d;
+    d["tiles"] = stats.tiles;
+    d["empty_tiles"] = stats.emptyTiles;
+    d["filled"] = stats.filled;
+    d["z_min"] = stats.zMin;
+    d["z_max"] = stats.zMax;
+    return d;
+}
+
+static std::unique_ptr<los::Rasterizer> make_rasterizer(
+    const std::tuple<double, double, double, double>& bounds, double resolution,
+    const std::string& stat, double percentile, std::optional<std::vector<int>> classes,
+    const std::string& returns) {
+    los::CellStat s;
+    if (stat == "max")
+        s = los::CellStat::Max;
+    else if (stat == "min")
+        s = los::CellStat::Min;
+    else if (stat == "mean")
+        s = los::CellStat::Mean;
+    else if (stat == "percentile")
+        s = los::CellStat::Percentile;
+    else
+        throw py::value_error("stat must be 'max', 'min', 'mean' or 'percentile', got '" +
+                              stat + "'");
+
+    los::Returns r;
+    if (returns == "all")
+        r = los::Returns::All;
+    else if (returns == "first")
+        r = los::Returns::First;
+    else if (returns == "last")
+        r = los::Returns::Last;
+    else
+        throw py::value_error("returns must be 'all', 'first' or 'last', got '" + returns + "'");
+
+    auto [xMin, yMin, xMax, yMax] = bounds;
+    auto raster = std::make_unique<los::Rasterizer>(xMin, yMin, xMax, yMax, resolution, s,
+                                                    percentile);
+    if (classes)
+        raster->set_classes(*classes);
+    raster->set_returns(r);
+    return raster;
+}
+
+static void rasterizer_add(los::Rasterizer& raster, pairs_t x, pairs_t y, pairs_t z,
+                           std::optional<codes_t> classification,
+                           std::optional<codes_t> return_number,
+                           std::optional<codes_t> number_of_returns) {
+    py::ssize_t n = x.size();
+    auto check = [n](const py::array& a, const char* name) {
+        if (a.ndim() != 1 || a.shape(0) != n)
+            throw py::value_error(std::string(name) + " must be 1-D with one entry per point");
+    };
+    check(x, "x");
+    check(y, "y");
+    check(z, "z");
+    if (classification) check(*classification, "classification");
+    if (return_number) check(*return_number, "return_number");
+    if (number_of_returns) check(*number_of_returns, "number_of_returns");
+    if (raster.returns() != los::Returns::All && !return_number)
+        throw py::value_error("returns='first' or 'last' needs return_number");
+    if (raster.returns() == los::Returns::Last && !number_of_returns)
+        throw py::value_error("returns='last' needs number_of_returns");
+
+    py::gil_scoped_release release;
+    raster.add(x.data(), y.data(), z.data(), n,
+               classification ? classification->data() : nullptr,
+               return_number ? return_number->data() : nullptr,
+               number_of_returns ? number_of_returns->data() : nullptr);
+}
+
+// Histogram counts up to the last non-empty bucket.
+static py::list trimmed(const uint64_t* counts, int n) {
+    while (n > 0 && counts[n - 1] == 0)
+        n--;
+    py::list out;
+    for (int i = 0; i < n; i++)
+        out.append(counts[i]);
+    return out;
+}
+
+// los.get_stats(): counters since the last reset_stats(), over all threads.
+static py::dict get_stats() {
+    namespace st = los::stats;
+    py::dict d;
+    d["enabled"] = st::kEnabled;
+    if (!st::kEnabled)
+        return d;
+    st::Totals t = st::collect();
+    uint64_t rays = t.counters[st::Rays], ns = t.counters[st::RayNs];
+    uint64_t walks = 0;
+    for (uint64_t c : t.cellsHistogram)
+        walks += c;
+    d["rays"] = rays;
+    d["samples"] = t.counters[st::Samples];
+    d["walks"] = walks;
+    d["cells"] = t.counters[st::Cells];
+    d["packet_rays"] = t.counters[st::PacketRays];
+    d["tile_hits"] = t.counters[st::TileHits];
+    d["tile_misses"] = t.counters[st::TileMisses];
+    d["ray_ns"] = ns;
+    d["ns_per_ray"] = rays ? static_cast<double>(ns) / rays : 0.0;
+    d["cells_per_walk"] = walks ? static_cast<double>(t.counters[st::Cells]) / walks : 0.0;
+    d["skipped"] = trimmed(t.skipped, st::kLevels);
+    d["cells_histogram"] = trimmed(t.cellsHistogram, st::kBuckets);
+    d["ns_histogram"] = trimmed(t.nsHistogram, st::kBuckets);
+    return d;
+}
+
+// setup.py builds a single module named los. The CMake build compiles this
+// file once per ISA variant (_los_baseline, _los_v3, ...) and the los
+// package imports the best one; see python/los/__init__.py.
+#ifndef LOS_MODULE_NAME
+#define LOS_MODULE_NAME los
+#endif
+
+PYBIND11_MODULE(LOS_MODULE_NAME, m) {
     m.def("los_boolean", &los_boolean, 
           py::arg("heightmap"),
           py::arg("width"),
           py::arg("height"),
           py::arg("x0"), py::arg("y0"), py::arg("z0"),
           py::arg("x1"), py::arg("y1"), py::arg("z1"),
-          "Check line-of-sight between two points (returns 0.0 or 1.0)");
+          "Check line-of-sight between two points (returns 0.0 or 1.0). heightmap is read in "
+          "place: a (height, width) or flat row-major float32, float64 or int16 array with any "
+          "strides, a DLPack tensor in host memory or any buffer; other dtypes are converted");
     
     m.def("los_probability", &los_probability,
           py::arg("heightmap"),
@@ -158,4 +1053,818 @@ PYBIND11_MODULE(los, m) {
           py::arg("x1"), py::arg("y1"), py::arg("z1"),
           py::arg("num_samples") = 9,
           "Compute line-of-sight probability by sampling multiple rays (returns 0.0 to 1.0)");
+    
+    m.def("los_boolean_batch", &los_boolean_batch,
+          py::arg("heightmap"),
+          py::arg("pairs"),
+          py::arg("out") = py::none(),
+          "Check line-of-sight for N (x0, y0, z0, x1, y1, z1) rows (returns uint8[N] of 0/1). "
+          "heightmap (2-D) and pairs may be numpy arrays, DLPack tensors in host memory or "
+          "buffers; heightmap is read in place as for los_boolean");
+    
+    m.def("los_probability_batch", &los_probability_batch,
+          py::arg("heightmap"),
+          py::arg("pairs"),
+          py::arg("num_samples") = 9,
+          py::arg("out") = py::none(),
+          "Compute line-of-sight probability for N (x0, y0, z0, x1, y1, z1) rows (returns float64[N])");
+    
+    m.def("set_num_threads", [](int n) { los::ThreadPool::instance().set_num_threads(n); },
+          py::arg("n"),
+          "Set the number of worker threads used by batch queries (n <= 0 uses all cores)");
+    
+    m.def("get_num_threads", []() { return los::ThreadPool::instance().num_threads(); },
+          "Return the number of worker threads used by batch queries");
+    
+    m.def("get_stats", &get_stats,
+          "Hot-path counters since the last reset_stats(), summed over threads. Only builds "
+          "with LOS_STATS=1 count; others return {'enabled': False}. rays: timed queries "
+          "(ray_ns, ns_per_ray); walks and samples: rays walked, including probability "
+          "samples; cells: cells tested one at a time (cells_per_walk); packet_rays: rays "
+          "traced as SIMD packets; tile_hits / tile_misses: TiledTerrain cache lookups; "
+          "skipped[l]: pyramid blocks of 2^l cells skipped; cells_histogram[k] and "
+          "ns_histogram[k]: walks testing and queries taking [2^k, 2^(k+1)) cells or ns");
+    
+    m.def("reset_stats", &los::stats::reset, "Start get_stats() counting from zero");
+    
+    m.def("set_max_pending", [](int n) {
+              if (n < 1)
+                  throw py::value_error("n must be >= 1");
+              los::TaskQueue::instance().set_capacity(static_cast<size_t>(n));
+          },
+          py::arg("n"),
+          "Set how many async queries (Terrain.submit_batch, viewshed_async) may wait behind "
+          "the running one before submitting blocks or raises queue.Full (default 64)");
+    
+    m.def("get_max_pending", []() { return los::TaskQueue::instance().capacity(); },
+          "Return how many async queries may wait behind the running one");
+    
+    // Finish the async queue before the interpreter goes: queued jobs are
+    // cancelled and the running one completes, so no job touches Python
+    // after finalization.
+    py::module_::import("atexit").attr("register")(py::cpp_function([] {
+        py::gil_scoped_release release;
+        los::TaskQueue::instance().shutdown();
+    }));
+    
+    m.def("float_height_error", &los::float_height_error,
+          py::arg("x0"), py::arg("y0"), py::arg("z0"),
+          py::arg("x1"), py::arg("y1"), py::arg("z1"),
+          "Bound on the ray height difference between float32 and float64 kernels for this ray");
+    
+    m.def("get_simd_isa", []() { return std::string(los::packet_kernel().isa); },
+          "Return the instruction set of the packet kernel picked for this CPU "
+          "(avx512, avx2 or scalar)");
+    
+    m.def("gpu_available", &los::gpu::available,
+          "Whether this build has the GPU backend and a GPU is visible (Terrain(device='gpu'))");
+    
+    py::class_<los::TraceResult>(m, "TraceResult",
+        "Result of Terrain.los_trace(). t is the ray parameter (0 at the observer, 1 at\n"
+        "the target) of the cell test, and clearance the ray height minus the terrain.")
+        .def_readonly("visible", &los::TraceResult::visible)
+        .def_property_readonly("hit", [](const los::TraceResult& r) -> py::object {
+            if (r.visible)
+                return py::none();
+            return py::make_tuple(r.hitX, r.hitY);
+        }, "(x, y) of the first blocking cell (or of the first cell outside the grid), None if visible")
+        .def_readonly("hit_t", &los::TraceResult::hitT, "t of the first blocking cell (NaN if visible)")
+        .def_readonly("min_clearance", &los::TraceResult::minClearance,
+             "Lowest clearance over the cells walked (inf if none had data)")
+        .def_property_readonly("min_clearance_cell", [](const los::TraceResult& r) -> py::object {
+            if (r.minX < 0)
+                return py::none();
+            return py::make_tuple(r.minX, r.minY);
+        }, "(x, y) of the first cell with min_clearance")
+        .def_readonly("min_clearance_t", &los::TraceResult::minT)
+        .def_readonly("cells", &los::TraceResult::cells,
+             "Cells tested one at a time; with a profile, the rows written (capped at its length)")
+        .def("__repr__", [](const los::TraceResult& r) {
+            return "TraceResult(visible=" + std::string(r.visible ? "True" : "False") +
+                   ", hit_t=" + std::to_string(r.hitT) +
+                   ", min_clearance=" + std::to_string(r.minClearance) +
+                   ", min_clearance_t=" + std::to_string(r.minT) + ")";
+        });
+
+    py::class_<los::AreaResult>(m, "AreaResult",
+        "Result of Terrain.area_visibility(). Every (observer, target) cell pair is\n"
+        "visible, blocked or, when the query stopped early, unresolved; fraction_low\n"
+        "and fraction_high bound the visible fraction and fraction is their midpoint.")
+        .def_readonly("pairs", &los::AreaResult::pairs, "Pairs of cells with data in both regions")
+        .def_readonly("visible", &los::AreaResult::visible)
+        .def_readonly("blocked", &los::AreaResult::blocked)
+        .def_property_readonly("unresolved", &los::AreaResult::unresolved)
+        .def_property_readonly("exact", &los::AreaResult::exact,
+             "Whether every pair was resolved")
+        .def_property_readonly("fraction", &los::AreaResult::fraction,
+             "Visible fraction, the midpoint of its bounds (NaN with no pairs)")
+        .def_property_readonly("fraction_low", &los::AreaResult::fraction_low)
+        .def_property_readonly("fraction_high", &los::AreaResult::fraction_high)
+        .def_readonly("rays", &los::AreaResult::rays, "Pairs traced one ray at a time")
+        .def_readonly("block_pairs", &los::AreaResult::blockPairs,
+             "Block pairs bounded without tracing")
+        .def("__repr__", [](const los::AreaResult& r) {
+            return "AreaResult(pairs=" + std::to_string(r.pairs) +
+                   ", visible=" + std::to_string(r.visible) +
+                   ", blocked=" + std::to_string(r.blocked) +
+                   ", fraction=" + std::to_string(r.fraction()) +
+                   ", rays=" + std::to_string(r.rays) + ")";
+        });
+
+    py::class_<los::Horizon>(m, "Horizon",
+        "Horizon of a fixed observer (Terrain.precompute_horizon()), for fast\n"
+        "repeated Terrain.los_horizon() queries to moving targets.\n\n"
+        "angles[a, b] is the highest elevation the terrain presents in azimuth bin a\n"
+        "(bin 0 starts due -x, bins run counter-clockwise in x, y) out to the outer\n"
+        "ring of distance band b, as (height - z) / distance less the earth's drop.\n"
+        "The table is n_azimuths * n_bands float32 and nothing else grows with the\n"
+        "number of queries. save() / Horizon.load() and pickle keep it; a loaded\n"
+        "horizon is taken to describe the terrain it is next used with.")
+        .def_property_readonly("observer", [](const los::Horizon& h) {
+            return py::make_tuple(h.x(), h.y(), h.z());
+        }, "(x, y, z) of the observer, rounded to the terrain's precision")
+        .def_property_readonly("n_azimuths", &los::Horizon::azimuths)
+        .def_property_readonly("n_bands", &los::Horizon::bands)
+        .def_property_readonly("band_rings", &los::Horizon::band_rings,
+             "Rings of cells per distance band")
+        .def_property_readonly("max_range", &los::Horizon::max_ring,
+             "Cells out from the observer's cell (along x or y) the bands cover")
+        .def_property_readonly("nbytes", &los::Horizon::bytes, "Memory used by angles")
+        .def_property_readonly("angles", [](const los::Horizon& h) {
+            py::array_t<float> result({h.azimuths(), h.bands()});
+            if (h.bytes())
+                std::memcpy(result.mutable_data(), h.angles(), h.bytes());
+            return result;
+        }, "Copy of the angle table, float32[n_azimuths, n_bands]")
+        .def("save",
+             [](const los::Horizon& h, const py::object& path) {
+                 h.save(py::str(py::module_::import("os").attr("fspath")(path)));
+             },
+             py::arg("path"), "Write the horizon to path")
+        .def_static("load",
+             [](const py::object& path) {
+                 return los::Horizon::load(py::str(py::module_::import("os").attr("fspath")(path)));
+             },
+             py::arg("path"), "Read a horizon written by save()")
+        .def(py::pickle(
+            [](const los::Horizon& h) { return py::bytes(h.serialize()); },
+            [](const py::bytes& state) {
+                std::string bytes = state;
+                return los::Horizon::deserialize(bytes.data(), bytes.size());
+            }))
+        .def("__repr__", [](const los::Horizon& h) {
+            return "Horizon(observer=(" + std::to_string(h.x()) + ", " + std::to_string(h.y()) +
+                   ", " + std::to_string(h.z()) + "), n_azimuths=" +
+                   std::to_string(h.azimuths()) + ", n_bands=" + std::to_string(h.bands()) +
+                   ", max_range=" + std::to_string(h.max_ring()) + ")";
+        });
+
+    py::class_<los::FresnelResult>(m, "FresnelResult",
+        "Result of Terrain.los_fresnel(). ratio is the clearance (ray height minus\n"
+        "terrain) over the first Fresnel zone radius at each cell; >= 0.6 is\n"
+        "conventionally clear, 0 grazing and negative obstructed.")
+        .def_readonly("visible", &los::FresnelResult::visible,
+             "Geometric line of sight (same as los_boolean)")
+        .def_readonly("min_ratio", &los::FresnelResult::minRatio,
+             "Lowest ratio over the ray (inf if no cell had data)")
+        .def_property_readonly("min_ratio_cell", [](const los::FresnelResult& r) -> py::object {
+            if (r.minX < 0)
+                return py::none();
+            return py::make_tuple(r.minX, r.minY);
+        }, "(x, y) of the first cell with min_ratio")
+        .def_readonly("min_ratio_t", &los::FresnelResult::minT)
+        .def_readonly("loss_db", &los::FresnelResult::lossDb,
+             "Knife-edge diffraction loss (ITU-R P.526) of the min_ratio cell, in dB")
+        .def("__repr__", [](const los::FresnelResult& r) {
+            return "FresnelResult(visible=" + std::string(r.visible ? "True" : "False") +
+                   ", min_ratio=" + std::to_string(r.minRatio) +
+                   ", min_ratio_t=" + std::to_string(r.minT) +
+                   ", loss_db=" + std::to_string(r.lossDb) + ")";
+        });
+
+    py::class_<PyFuture>(m, "Future",
+        "Pending result of Terrain.submit_batch() or Terrain.viewshed_async().\n\n"
+        "Jobs run one at a time in submission order on a background thread, each\n"
+        "over the shared worker pool. Await the future in asyncio, or use result()\n"
+        "and add_done_callback() as with concurrent.futures. Callbacks run on the\n"
+        "queue's thread (or at once, if already done) and must not block on other\n"
+        "futures or submit with block=True.")
+        .def("done", &PyFuture::done, "Whether the job has finished, been cancelled or failed")
+        .def("running", [](const PyFuture& f) {
+            return f.state() == los::TaskQueue::State::Running;
+        })
+        .def("cancelled", [](const PyFuture& f) {
+            return f.state() == los::TaskQueue::State::Cancelled;
+        })
+        .def("cancel", &PyFuture::cancel,
+             "Cancel the job: a queued one at once, a running batch at its next slice of "
+             "65536 rays (a running viewshed completes first). False if it already finished")
+        .def("result", &PyFuture::result,
+             py::arg("timeout") = py::none(),
+             "Wait for the result array; raises TimeoutError, CancelledError or the job's "
+             "error")
+        .def("exception",
+             [](const py::object& self, std::optional<double> timeout) -> py::object {
+                 const PyFuture& f = self.cast<const PyFuture&>();
+                 f.wait(timeout);
+                 if (f.state() == los::TaskQueue::State::Done)
+                     return py::none();
+                 try {
+                     self.attr("result")();
+                 } catch (py::error_already_set& e) {
+                     if (f.state() == los::TaskQueue::State::Cancelled)
+                         throw;
+                     return e.value();
+                 }
+                 return py::none();
+             },
+             py::arg("timeout") = py::none(),
+             "Wait for the job and return its error, or None")
+        .def("add_done_callback",
+             [](const py::object& self, const py::object& fn) {
+                 self.cast<PyFuture&>().add_done_callback(self, fn);
+             },
+             py::arg("fn"),
+             "Call fn(future) once the job has finished")
+        .def("__await__", [](const py::object& self) {
+            // Settle an asyncio future on the awaiting loop's thread, and
+            // cancel the job if the awaiting task is cancelled.
+            py::object loop = py::module_::import("asyncio").attr("get_running_loop")();
+            py::object waiter = loop.attr("create_future")();
+            py::cpp_function settle([waiter](const py::object& future) {
+                if (waiter.attr("done")().cast<bool>())
+                    return;
+                if (future.attr("cancelled")().cast<bool>()) {
+                    waiter.attr("cancel")();
+                    return;
+                }
+                try {
+                    waiter.attr("set_result")(future.attr("result")());
+                } catch (py::error_already_set& e) {
+                    waiter.attr("set_exception")(e.value());
+                }
+            });
+            waiter.attr("add_done_callback")(py::cpp_function([self](const py::object& w) {
+                if (w.attr("cancelled")().cast<bool>())
+                    self.attr("cancel")();
+            }));
+            self.attr("add_done_callback")(py::cpp_function([loop, settle](const py::object& f) {
+                loop.attr("call_soon_threadsafe")(settle, f);
+            }));
+            return waiter.attr("__await__")();
+        })
+        .def("__repr__", [](const PyFuture& f) {
+            static const char* names[] = {"queued", "running", "done", "failed", "cancelled"};
+            return std::string("<los.Future ") + names[static_cast<int>(f.state())] + ">";
+        });
+
+    py::class_<PyTerrain>(m, "Terrain",
+        "Prepared heightmap for repeated line-of-sight queries.\n\n"
+        "The DEM is validated once here. A float32 C-contiguous array is referenced\n"
+        "without copying (pass copy=True to own a private copy); any other dtype or\n"
+        "layout is converted once. Do not modify a referenced array while in use.\n\n"
+        "With pyramid=True (default) a max-height pyramid is built so rays skip\n"
+        "whole blocks that lie below them; answers are identical either way.\n\n"
+        "precision='float32' runs the ray kernels in float for twice the SIMD\n"
+        "width; answers can differ from float64 only within float_height_error()\n"
+        "of the terrain or at exact cell corners.\n\n"
+        "device='gpu' keeps the DEM and pyramid in GPU memory and runs batches and\n"
+        "viewshed() there (needs a GPU build, see gpu_available()); answers match\n"
+        "the CPU exactly.\n\n"
+        "layout='blocked' or 'morton' keeps a copy of the DEM in 32x32-cell blocks\n"
+        "(row-major or Z-order inside each block) for the CPU ray walks, so rays\n"
+        "stepping in y stay on one page for 32 rows. Answers are unchanged; batches\n"
+        "without a pyramid then skip the SIMD packet kernels.\n\n"
+        "quantize=step stores the DEM as 8- or 16-bit codes per 64x64 block (about\n"
+        "1-2 bytes per cell instead of 4) and does not keep the array. Decoding\n"
+        "rounds every cell up, so a ray reported visible is visible on the original\n"
+        "DEM; rays passing within quantization_error of the ground may be reported\n"
+        "blocked. Viewsheds likewise only lose visible cells. CPU, row-major only.\n\n"
+        "update_region(x, y, patch) splices new heights into the terrain and refreshes\n"
+        "only the pyramid blocks above them. It writes into heightmap, which is the\n"
+        "caller's array unless copy=True. Results cached by the caller stay valid\n"
+        "while ray_changed() / viewshed_changed() for the revision they were\n"
+        "computed at is False.\n\n"
+        "enable_result_cache() answers repeated los_boolean / los_probability rays\n"
+        "(single or batched) from a bounded thread-safe cache keyed on endpoints\n"
+        "snapped to cell_bin cells and height_bin heights. Rays in the same bins share\n"
+        "one answer. update_region() invalidates only entries whose rays cross it.\n\n"
+        "set_earth_curvature(cell_size) bends every ray and viewshed below the\n"
+        "straight chord by the earth's bulge d1 * d2 / (2 k R), with refraction in\n"
+        "k_factor (4/3 by default). The pyramid still skips blocks, against a bound\n"
+        "that includes the bulge, so answers match the walk over every cell; batches\n"
+        "then trace ray by ray without SIMD packets.\n\n"
+        "interpolation='bilinear' answers los_boolean, los_probability and their\n"
+        "batches over the surface interpolated between cell centres, testing each\n"
+        "segment exactly against every patch it crosses, instead of the height of the\n"
+        "nearest cell. The pyramid then bounds the patches, so answers are still the\n"
+        "same with or without it. CPU only; los_trace, los_fresnel and viewsheds keep\n"
+        "reading the nearest cell.")
+        .def(py::init<const py::object&, std::optional<int>, std::optional<int>, bool, bool,
+                      const std::string&, const std::string&, const std::string&,
+                      std::optional<float>, const std::string&>(),
+             py::arg("heightmap"),
+             py::arg("width") = py::none(),
+             py::arg("height") = py::none(),
+             py::arg("copy") = false,
+             py::arg("pyramid") = true,
+             py::arg("precision") = "float64",
+             py::arg("device") = "cpu",
+             py::arg("layout") = "row-major",
+             py::arg("quantize") = py::none(),
+             py::arg("interpolation") = "nearest")
+        .def_property_readonly("width", [](const PyTerrain& t) { return t.terrain().width(); })
+        .def_property_readonly("height", [](const PyTerrain& t) { return t.terrain().height(); })
+        .def_property_readonly("shape", [](const PyTerrain& t) {
+            return py::make_tuple(t.terrain().height(), t.terrain().width());
+        })
+        .def_property_readonly("heightmap", &PyTerrain::array,
+             "The float32 array queries run against (None when quantized)")
+        .def_property_readonly("precision", [](const PyTerrain& t) {
+            return t.terrain().precision() == los::Precision::Float ? "float32" : "float64";
+        }, "Arithmetic the ray kernels run in: 'float64' or 'float32'")
+        .def_property_readonly("device", [](const PyTerrain& t) {
+            return t.terrain().device() == los::Device::GPU ? "gpu" : "cpu";
+        }, "Where batches and viewsheds run: 'cpu' or 'gpu'")
+        .def_property_readonly("layout", [](const PyTerrain& t) {
+            return layout_name(t.terrain().layout());
+        }, "Cell order of the DEM the CPU ray walks read: 'row-major', 'blocked' or 'morton'")
+        .def_property_readonly("interpolation", [](const PyTerrain& t) {
+            return t.terrain().bilinear() ? "bilinear" : "nearest";
+        }, "How rays read heights between cell centres: 'nearest' or 'bilinear'")
+        .def_property_readonly("layout_bytes", [](const PyTerrain& t) { return t.terrain().layout_bytes(); },
+             "Memory used by the reordered copy of the DEM (0 for row-major)")
+        .def_property_readonly("quantized", [](const PyTerrain& t) { return t.terrain().quantized(); })
+        .def_property_readonly("quantized_bytes", [](const PyTerrain& t) {
+            return t.terrain().quantized_heightmap().bytes();
+        }, "Memory used by the quantized DEM (0 unless quantize was given)")
+        .def_property_readonly("quantization_error", [](const PyTerrain& t) {
+            return t.terrain().quantized_heightmap().max_error();
+        }, "Largest height step of the quantized DEM: decoded cells overstate the original by less")
+        .def_property_readonly("has_pyramid", [](const PyTerrain& t) { return t.terrain().has_pyramid(); })
+        .def_property_readonly("pyramid_bytes", [](const PyTerrain& t) { return t.terrain().pyramid().bytes(); },
+             "Memory used by the max pyramid")
+        .def_property_readonly("revision", [](const PyTerrain& t) { return t.terrain().revision(); },
+             "Number of update_region() calls so far")
+        .def("update_region", &PyTerrain::update_region,
+             py::arg("x"), py::arg("y"), py::arg("patch"),
+             "Replace the cells under patch (float32[h, w]) with its top-left corner at column x, "
+             "row y, refreshing the pyramid only above them. Not safe while queries run on this "
+             "terrain in other threads")
+        .def("ray_changed",
+             [](const PyTerrain& t, uint64_t revision, double x0, double y0, double x1, double y1) {
+                 return t.terrain().ray_changed_since(revision, x0, y0, x1, y1);
+             },
+             py::arg("revision"), py::arg("x0"), py::arg("y0"), py::arg("x1"), py::arg("y1"),
+             "Whether an update after revision touched cells a los_boolean or los_probability "
+             "query from (x0, y0) to (x1, y1) reads (True once revision is one of many updates "
+             "ago)")
+        .def("viewshed_changed",
+             [](const PyTerrain& t, uint64_t revision, double x0, double y0,
+                std::optional<double> max_radius) {
+                 return t.terrain().viewshed_changed_since(
+                     revision, x0, y0, max_radius.value_or(std::numeric_limits<double>::infinity()));
+             },
+             py::arg("revision"), py::arg("x0"), py::arg("y0"),
+             py::arg("max_radius") = py::none(),
+             "Whether an update after revision touched cells a viewshed from (x0, y0) reads")
+        .def("enable_result_cache",
+             [](PyTerrain& t, int64_t max_entries, double cell_bin, double height_bin) {
+                 if (max_entries <= 0)
+                     throw py::value_error("max_entries must be positive");
+                 if (!(cell_bin > 0 && std::isfinite(cell_bin)) ||
+                     !(height_bin > 0 && std::isfinite(height_bin)))
+                     throw py::value_error("cell_bin and height_bin must be positive");
+                 t.terrain().enable_result_cache(static_cast<size_t>(max_entries), cell_bin,
+                                                 height_bin);
+             },
+             py::arg("max_entries") = 1 << 20,
+             py::arg("cell_bin") = 0.25,
+             py::arg("height_bin") = 0.25,
+             "Cache ray answers keyed on endpoints snapped to cell_bin cells (x, y) and "
+             "height_bin (z); replaces any existing cache. Not safe while queries run on this "
+             "terrain in other threads")
+        .def("disable_result_cache", [](PyTerrain& t) { t.terrain().disable_result_cache(); })
+        .def("set_earth_curvature",
+             [](PyTerrain& t, double cell_size, double k_factor) {
+                 t.terrain().set_earth_curvature(cell_size, k_factor);
+             },
+             py::arg("cell_size"),
+             py::arg("k_factor") = 4.0 / 3.0,
+             "Bend rays over an earth of radius k_factor * 6371 km, on cells cell_size metres "
+             "wide; clears the result cache. Not safe while queries run on this terrain in "
+             "other threads")
+        .def("clear_earth_curvature", [](PyTerrain& t) { t.terrain().clear_earth_curvature(); },
+             "Go back to straight rays")
+        .def_property_readonly("earth_curvature",
+             [](const PyTerrain& t) { return earth_curvature_of(t.terrain()); },
+             "(cell_size, k_factor) of set_earth_curvature(), or None for straight rays")
+        .def("result_cache_stats",
+             [](const PyTerrain& t) { return result_cache_stats(t.terrain()); },
+             "Result cache counters: hits, misses, invalidated, evictions, entries, capacity, "
+             "hit_rate (empty without a cache)")
+        .def("reset_result_cache_stats",
+             [](const PyTerrain& t) {
+                 if (t.terrain().result_cache()) t.terrain().result_cache()->reset_stats();
+             },
+             "Zero the hit, miss, invalidation and eviction counters")
+        .def("clear_result_cache",
+             [](const PyTerrain& t) {
+                 if (t.terrain().result_cache()) t.terrain().result_cache()->clear();
+             },
+             "Drop every cached answer")
+        .def("los_boolean",
+             [](const PyTerrain& t, double x0, double y0, double z0,
+                double x1, double y1, double z1) {
+                 return t.terrain().los_boolean(x0, y0, z0, x1, y1, z1);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             "Check line-of-sight between two points (returns 0.0 or 1.0)")
+        .def("los_probability",
+             [](const PyTerrain& t, double x0, double y0, double z0,
+                double x1, double y1, double z1, int num_samples) {
+                 check_num_samples(num_samples);
+                 py::gil_scoped_release release;
+                 return t.terrain().los_probability(x0, y0, z0, x1, y1, z1, num_samples);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             py::arg("num_samples") = 9,
+             "Compute line-of-sight probability by sampling multiple rays (returns 0.0 to 1.0)")
+        .def("los_trace",
+             [](const PyTerrain& t, double x0, double y0, double z0,
+                double x1, double y1, double z1, bool stop_at_block, py::object profile) {
+                 return trace(t.terrain(), x0, y0, z0, x1, y1, z1, stop_at_block, profile);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             py::arg("stop_at_block") = true,
+             py::arg("profile") = py::none(),
+             "Walk the ray once and report the first blocking cell, its t and the minimum "
+             "clearance (TraceResult). stop_at_block=False walks to the end so min_clearance "
+             "covers the whole ray. profile, a float64[N, 5] array, receives one (x, y, t, "
+             "terrain, ray height) row per cell walked")
+        .def("los_fresnel",
+             [](const PyTerrain& t, double x0, double y0, double z0,
+                double x1, double y1, double z1, double frequency, double cell_size) {
+                 double wavelength = wavelength_of(frequency, cell_size);
+                 py::gil_scoped_release release;
+                 return t.terrain().los_fresnel(x0, y0, z0, x1, y1, z1, wavelength, cell_size);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             py::arg("frequency"),
+             py::arg("cell_size") = 1.0,
+             "First Fresnel zone clearance of the ray at frequency Hz on cells cell_size "
+             "metres wide (FresnelResult), from one walk")
+        .def("los_boolean_batch",
+             [](const PyTerrain& t, pairs_t pairs, py::object out) {
+                 return boolean_batch(t.terrain(), pairs, out);
+             },
+             py::arg("pairs"),
+             py::arg("out") = py::none(),
+             "Check line-of-sight for N (x0, y0, z0, x1, y1, z1) rows (returns uint8[N] of 0/1)")
+        .def("los_probability_batch",
+             [](const PyTerrain& t, pairs_t pairs, int num_samples, py::object out) {
+                 return probability_batch(t.terrain(), pairs, num_samples, out);
+             },
+             py::arg("pairs"),
+             py::arg("num_samples") = 9,
+             py::arg("out") = py::none(),
+             "Compute line-of-sight probability for N (x0, y0, z0, x1, y1, z1) rows (returns float64[N])")
+        .def("los_fresnel_batch",
+             [](const PyTerrain& t, pairs_t pairs, double frequency, double cell_size,
+                py::object out) {
+                 return fresnel_batch(t.terrain(), pairs, frequency, cell_size, out);
+             },
+             py::arg("pairs"),
+             py::arg("frequency"),
+             py::arg("cell_size") = 1.0,
+             py::arg("out") = py::none(),
+             "FresnelResult.min_ratio for N (x0, y0, z0, x1, y1, z1) rows (returns float64[N])")
+        .def("viewshed",
+             [](const PyTerrain& t, double x0, double y0, double z0,
+                double target_height, std::optional<double> max_radius, py::object out) {
+                 return viewshed(t.terrain(), x0, y0, z0, target_height, max_radius, out);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("target_height") = 0.0,
+             py::arg("max_radius") = py::none(),
+             py::arg("out") = py::none(),
+             "Visibility mask (uint8[H, W]) of targets target_height above each cell, seen from (x0, y0, z0)")
+        .def("cumulative_viewshed",
+             [](const PyTerrain& t, pairs_t observers, double target_height,
+                std::optional<double> max_radius, py::object out) {
+                 return cumulative_viewshed(t.terrain(), observers, target_height, max_radius, out);
+             },
+             py::arg("observers"),
+             py::arg("target_height") = 0.0,
+             py::arg("max_radius") = py::none(),
+             py::arg("out") = py::none(),
+             "Number of (x, y, z) observers that see each cell (uint16[H, W], saturating). "
+             "Scratch is one byte per cell per thread, 256 MiB at most")
+        .def("area_visibility",
+             [](const PyTerrain& t, const py::object& a, const py::object& b,
+                double observer_height, double target_height, double tolerance,
+                bool stop_at_first) {
+                 return area_visibility(t.terrain(), a, b, observer_height, target_height,
+                                        tolerance, stop_at_first);
+             },
+             py::arg("a"), py::arg("b"),
+             py::arg("observer_height") = 0.0,
+             py::arg("target_height") = 0.0,
+             py::arg("tolerance") = 0.0,
+             py::arg("stop_at_first") = false,
+             "How many cell pairs between regions a and b see each other (AreaResult), with "
+             "observers observer_height above a and targets target_height above b. A region is "
+             "(x, y, w, h) or (x, y, mask) for a 2-D mask with its first cell at (x, y). "
+             "Block pairs are bounded through the pyramids first and only ambiguous ones traced; "
+             "tolerance > 0 stops once at most that fraction of pairs is unresolved, "
+             "stop_at_first once any pair is visible")
+        .def("precompute_horizon",
+             [](const PyTerrain& t, const py::object& observer, int n_azimuths,
+                std::optional<double> max_range, int n_bands) {
+                 return precompute_horizon(t.terrain(), observer, n_azimuths, max_range, n_bands);
+             },
+             py::arg("observer"),
+             py::arg("n_azimuths") = 360,
+             py::arg("max_range") = py::none(),
+             py::arg("n_bands") = 64,
+             "Horizon of the (x, y, z) observer over n_azimuths bins and up to n_bands distance "
+             "bands covering max_range cells (the whole heightmap with None), for "
+             "los_horizon(). Built for this terrain's precision and earth curvature")
+        .def("los_horizon",
+             [](const PyTerrain& t, const los::Horizon& h, double x1, double y1, double z1) {
+                 return t.terrain().los_horizon(h, x1, y1, z1);
+             },
+             py::arg("horizon"), py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             "los_boolean from the horizon's observer to (x1, y1, z1) over the nearest cells "
+             "(0.0 or 1.0). Rays the horizon clears skip to the last band before the target; "
+             "others, and all rays once update_region() touched its range, walk in full")
+        .def("los_horizon_batch",
+             [](const PyTerrain& t, const los::Horizon& h, pairs_t targets, py::object out) {
+                 return horizon_batch(t.terrain(), h, targets, out);
+             },
+             py::arg("horizon"),
+             py::arg("targets"),
+             py::arg("out") = py::none(),
+             "los_horizon for N (x, y, z) target rows (returns uint8[N] of 0/1)")
+        .def("submit_batch", &submit_batch,
+             py::arg("pairs"),
+             py::arg("op") = "boolean",
+             py::arg("num_samples") = 9,
+             py::arg("out") = py::none(),
+             py::arg("block") = true,
+             py::arg("timeout") = py::none(),
+             "Queue los_boolean_batch (op='boolean') or los_probability_batch "
+             "(op='probability') and return a Future of its result at once. With max_pending "
+             "jobs already waiting, block=True waits up to timeout seconds for a slot and "
+             "block=False raises queue.Full. Do not update this terrain until it finishes")
+        .def("viewshed_async", &viewshed_async,
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("target_height") = 0.0,
+             py::arg("max_radius") = py::none(),
+             py::arg("out") = py::none(),
+             py::arg("block") = true,
+             py::arg("timeout") = py::none(),
+             "Queue viewshed() and return a Future of its mask at once; block and timeout "
+             "as for submit_batch");
+    
+    py::class_<los::Rasterizer>(m, "Rasterizer",
+        "Streaming point cloud to DEM rasterizer.\n\n"
+        "bounds is (x_min, y_min, x_max, y_max) in point units and resolution the\n"
+        "cell size; the grid is north-up (row 0 at y_max) with no size cap. add()\n"
+        "bins each chunk of points in one pass, so memory is one accumulator per\n"
+        "cell (plus 12 bytes per point for stat='percentile'). stat reduces each\n"
+        "cell to its 'max', 'min', 'mean' or `percentile`-th z. classes keeps only\n"
+        "those LAS classifications (e.g. [2] for ground); returns='first' or\n"
+        "'last' keeps only first or last returns. finish() fills empty cells from\n"
+        "the nearest binned cell with an exact Euclidean distance transform.")
+        .def(py::init(&make_rasterizer),
+             py::arg("bounds"),
+             py::arg("resolution") = 1.0,
+             py::arg("stat") = "max",
+             py::arg("percentile") = 50.0,
+             py::arg("classes") = py::none(),
+             py::arg("returns") = "all")
+        .def_property_readonly("width", &los::Rasterizer::width)
+        .def_property_readonly("height", &los::Rasterizer::height)
+        .def_property_readonly("shape", [](const los::Rasterizer& r) {
+            return py::make_tuple(r.height(), r.width());
+        })
+        .def_property_readonly("resolution", &los::Rasterizer::resolution)
+        .def_property_readonly("bounds", [](const los::Rasterizer& r) {
+            return py::make_tuple(r.x_min(), r.y_max() - r.height() * r.resolution(),
+                                  r.x_min() + r.width() * r.resolution(), r.y_max());
+        }, "Extent of the grid's cells (x_min, y_min, x_max, y_max), for a GeoTIFF transform")
+        .def_property_readonly("points", &los::Rasterizer::points, "Points binned so far")
+        .def_property_readonly("skipped", &los::Rasterizer::skipped,
+             "Points dropped: outside the bounds, NaN z or filtered out")
+        .def_property_readonly("counts", [](const los::Rasterizer& r) {
+            py::array_t<uint32_t> result({r.height(), r.width()});
+            std::memcpy(result.mutable_data(), r.counts().data(),
+                        sizeof(uint32_t) * r.counts().size());
+            return result;
+        }, "Points binned into each cell (uint32[H, W])")
+        .def("add", &rasterizer_add,
+             py::arg("x"), py::arg("y"), py::arg("z"),
+             py::arg("classification") = py::none(),
+             py::arg("return_number") = py::none(),
+             py::arg("number_of_returns") = py::none(),
+             "Bin one chunk of points (1-D arrays, e.g. laspy's x, y, z, classification)")
+        .def("finish",
+             [](const los::Rasterizer& r, bool fill_holes, std::optional<double> max_fill_distance) {
+                 double limit = max_fill_distance.value_or(std::numeric_limits<double>::infinity());
+                 if (!(limit >= 0))
+                     throw py::value_error("max_fill_distance must be >= 0");
+                 py::array_t<float> result({r.height(), r.width()});
+                 float* dst = result.mutable_data();
+                 py::gil_scoped_release release;
+                 r.finish(dst, fill_holes, limit);
+                 return result;
+             },
+             py::arg("fill_holes") = true,
+             py::arg("max_fill_distance") = py::none(),
+             "The DEM so far (float32[H, W]); empty cells are NaN unless filled from the "
+             "nearest binned cell within max_fill_distance cells");
+
+    m.def("fill_holes",
+          [](const py::object& array, std::optional<double> max_distance, const py::object& method) {
+              py::array_t<float> dem = float_grid(array);
+              if (!dem.writeable())
+                  throw py::value_error("dem must be writeable");
+              los::HoleFill fill = parse_fill(method);
+              if (fill == los::HoleFill::None)
+                  throw py::value_error("method must be 'nearest' or 'push-pull'");
+              if (max_distance && fill != los::HoleFill::Nearest)
+                  throw py::value_error("max_distance applies to method='nearest' only");
+              double limit = max_distance.value_or(std::numeric_limits<double>::infinity());
+              if (!(limit >= 0))
+                  throw py::value_error("max_distance must be >= 0");
+              float* data = dem.mutable_data();
+              int width = static_cast<int>(dem.shape(1)), height = static_cast<int>(dem.shape(0));
+              py::gil_scoped_release release;
+              if (fill == los::HoleFill::Nearest)
+                  los::Rasterizer::fill_nearest(data, width, height, limit);
+              else
+                  los::PushPull(data, width, height).fill_all(data);
+          },
+          py::arg("dem"),
+          py::arg("max_distance") = py::none(),
+          py::arg("method") = "nearest",
+          "Fill NaN cells of dem in place. method='nearest' copies the nearest non-NaN cell "
+          "within max_distance cells (what Rasterizer.finish() does); 'push-pull' blends a "
+          "multi-resolution pyramid of the data into each gap. dem must be a writeable "
+          "C-contiguous float32 array, such as an np.memmap mosaic");
+
+    m.def("write_tiled_dem", &write_tiled,
+          py::arg("path"), py::arg("dem"), py::arg("metadata") = py::none(),
+          py::arg("tile_size") = 256, py::arg("fill") = "push-pull",
+          py::arg("max_fill_distance") = py::none(),
+          "Fill the holes of dem in place and write it as a tiled DEM (*_dem.ltd, see\n"
+          "tiled_dem.py) in one multithreaded pass.\n\n"
+          "fill='push-pull' fills NaN cells from a multi-resolution pyramid of the\n"
+          "data, 'nearest' from the nearest non-NaN cell within max_fill_distance\n"
+          "cells, None leaves them NaN (then dem may be read-only). Each tile is\n"
+          "filled, copied and given its directory max/min as it is built, and\n"
+          "written while the next few are built. The file stores a copy of\n"
+          "metadata whose 'bounds', if present, gets z_min/z_max of the written\n"
+          "DEM; metadata itself is left unchanged. dem must be C-contiguous\n"
+          "float32 (an np.memmap works); other arrays raise rather than being\n"
+          "converted. Returns {'tiles', 'empty_tiles', 'filled', 'z_min', 'z_max'}.");
+
+    py::class_<los::TiledTerrain>(m, "TiledTerrain",
+        "Memory-mapped tiled DEM (*_dem.ltd, see tiled_dem.py) for DEMs too large\n"
+        "to load.\n\n"
+        "Opening reads only the header and tile directory, so it costs the same for\n"
+        "any DEM size. Rays skip tiles whose max height lies below them and page in\n"
+        "only the tiles they test; answers are identical to los_boolean on the full\n"
+        "array. precision works as for Terrain.\n\n"
+        "With cache_bytes=None the OS pages tiles in and out of the mapping. With a\n"
+        "byte budget, tiles are copied into a thread-safe LRU cache of about that\n"
+        "size instead, and each ray prefetches the next `lookahead` tiles it will\n"
+        "test; see cache_stats(). set_earth_curvature() works as for Terrain.")
+        .def(py::init(&open_tiled),
+             py::arg("path"),
+             py::arg("precision") = "float64",
+             py::arg("cache_bytes") = py::none(),
+             py::arg("lookahead") = 2)
+        .def_property_readonly("path", [](const los::TiledTerrain& t) { return t.dem().path(); })
+        .def_property_readonly("width", &los::TiledTerrain::width)
+        .def_property_readonly("height", &los::TiledTerrain::height)
+        .def_property_readonly("shape", [](const los::TiledTerrain& t) {
+            return py::make_tuple(t.height(), t.width());
+        })
+        .def_property_readonly("tile_size", [](const los::TiledTerrain& t) { return t.dem().tile_size(); })
+        .def_property_readonly("tiles", [](const los::TiledTerrain& t) {
+            return py::make_tuple(t.dem().tiles_y(), t.dem().tiles_x());
+        }, "Tile grid shape (tiles_y, tiles_x)")
+        .def_property_readonly("file_bytes", [](const los::TiledTerrain& t) { return t.dem().file_bytes(); })
+        .def_property_readonly("precision", [](const los::TiledTerrain& t) {
+            return t.precision() == los::Precision::Float ? "float32" : "float64";
+        }, "Arithmetic the ray kernels run in: 'float64' or 'float32'")
+        .def_property_readonly("metadata", [](const los::TiledTerrain& t) {
+            return py::module_::import("json").attr("loads")(t.dem().metadata());
+        }, "The JSON metadata stored with the DEM (formerly *_dem_meta.json)")
+        .def_property_readonly("tile_max", [](const los::TiledTerrain& t) {
+            return tile_stat(t, &los::TileEntry::max);
+        }, "Max height of every tile, float32[tiles_y, tiles_x] (-inf when empty)")
+        .def_property_readonly("tile_min", [](const los::TiledTerrain& t) {
+            return tile_stat(t, &los::TileEntry::min);
+        }, "Min height of every tile, float32[tiles_y, tiles_x] (inf when empty)")
+        .def_property_readonly("cache_bytes", [](const los::TiledTerrain& t) -> py::object {
+            if (!t.cache())
+                return py::none();
+            return py::int_(t.cache()->stats().budget);
+        }, "Tile cache budget, or None when reading the mapping directly")
+        .def("cache_stats", &cache_stats,
+             "Tile cache counters: hits, misses, prefetched, evictions, tiles, bytes, budget "
+             "(empty without a cache)")
+        .def("reset_cache_stats",
+             [](const los::TiledTerrain& t) {
+                 if (t.cache()) t.cache()->reset_stats();
+             },
+             "Zero the hit, miss, prefetch and eviction counters")
+        .def("clear_cache",
+             [](const los::TiledTerrain& t) {
+                 if (t.cache()) t.cache()->clear();
+             },
+             "Evict every cached tile")
+        .def("set_earth_curvature", &los::TiledTerrain::set_earth_curvature,
+             py::arg("cell_size"),
+             py::arg("k_factor") = 4.0 / 3.0,
+             "Bend rays over an earth of radius k_factor * 6371 km, on cells cell_size metres "
+             "wide. Not safe while queries run on this terrain in other threads")
+        .def("clear_earth_curvature", &los::TiledTerrain::clear_earth_curvature,
+             "Go back to straight rays")
+        .def_property_readonly("earth_curvature", &earth_curvature_of<los::TiledTerrain>,
+             "(cell_size, k_factor) of set_earth_curvature(), or None for straight rays")
+        .def("height_at",
+             [](const los::TiledTerrain& t, int x, int y) {
+                 if (x < 0 || y < 0 || x >= t.width() || y >= t.height())
+                     throw py::value_error("cell lies outside the DEM");
+                 return t.height_at(x, y);
+             },
+             py::arg("x"), py::arg("y"),
+             "Height of cell (x, y), NaN where there is no data")
+        .def("read_window", &read_window,
+             py::arg("x"), py::arg("y"), py::arg("width"), py::arg("height"),
+             "Copy the cells [y, y + height) x [x, x + width) into a float32[height, width] array")
+        .def("los_boolean", &los::TiledTerrain::los_boolean,
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             py::call_guard<py::gil_scoped_release>(),
+             "Check line-of-sight between two points (returns 0.0 or 1.0)")
+        .def("los_probability",
+             [](const los::TiledTerrain& t, double x0, double y0, double z0,
+                double x1, double y1, double z1, int num_samples) {
+                 check_num_samples(num_samples);
+                 py::gil_scoped_release release;
+                 return t.los_probability(x0, y0, z0, x1, y1, z1, num_samples);
+             },
+             py::arg("x0"), py::arg("y0"), py::arg("z0"),
+             py::arg("x1"), py::arg("y1"), py::arg("z1"),
+             py::arg("num_samples") = 9,
+             "Compute line-of-sight probability by sampling multiple rays (returns 0.0 to 1.0)")
+        .def("los_boolean_batch",
+             [](const los::TiledTerrain& t, pairs_t pairs, py::object out) {
+                 return boolean_batch(t, pairs, out);
+             },
+             py::arg("pairs"),
+             py::arg("out") = py::none(),
+             "Check line-of-sight for N (x0, y0, z0, x1, y1, z1) rows (returns uint8[N] of 0/1)")
+        .def("los_probability_batch",
+             [](const los::TiledTerrain& t, pairs_t pairs, int num_samples, py::object out) {
+                 return probability_batch(t, pairs, num_samples, out);
+             },
+             py::arg("pairs"),
+             py::arg("num_samples") = 9,
+             py::arg("out") = py::none(),
+             "Compute line-of-sight probability for N (x0, y0, z0, x1, y1, z1) rows (returns float64[N])");
+    
+    m.def("viewshed",
+          [](const PyTerrain& t, double x0, double y0, double z0,
+             double target_height, std::optional<double> max_radius, py::object out) {
+              return viewshed(t.terrain(), x0, y0, z0, target_height, max_radius, out);
+          },
+          py::arg("terrain"),
+          py::arg("x0"), py::arg("y0"), py::arg("z0"),
+          py::arg("target_height") = 0.0,
+          py::arg("max_radius") = py::none(),
+          py::arg("out") = py::none(),
+          "Single-observer R2 viewshed over a Terrain (returns uint8[H, W] of 0/1)");
+    
+    m.def("cumulative_viewshed",
+          [](const PyTerrain& t, pairs_t observers, double target_height,
+             std::optional<double> max_radius, py::object out) {
+              return cumulative_viewshed(t.terrain(), observers, target_height, max_radius, out);
+          },
+          py::arg("terrain"),
+          py::arg("observers"),
+          py::arg("target_height") = 0.0,
+          py::arg("max_radius") = py::none(),
+          py::arg("out") = py::none(),
+          "Count how many of M (x, y, z) observers see each cell (returns uint16[H, W]). "
+          "Scratch is one byte per cell per thread, 256 MiB at most");
 }
\ No newline at end of file
@@ -0,0 +1,516 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "layout.h"
+#include "pyramid.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+namespace los {
+
+// Rays per chunk handed to the thread pool. Workers steal half-ranges from
+// each other, so this only bounds scheduling overhead, not load balance.
+constexpr int64_t kBatchGrain = 64;
+
+// Minimum number of cells a single pool task should walk. Short rays are
+// grouped so that waking workers never costs more than the rays themselves.
+constexpr double kMinCellsPerTask = 4096.0;
+
+// Mean earth radius in metres.
+constexpr double kEarthRadius = 6371000.0;
+
+// Drop of a ray below its straight chord due to the earth's curvature, per
+// squared cell of horizontal ray length, on cells `cell_size` metres wide.
+// Between points d1 and d2 metres from the two ends the earth bulges by
+// d1 * d2 / (2 k R); `k_factor` folds atmospheric refraction into an
+// effective radius k * R (4/3 for the standard atmosphere).
+inline double earth_curvature(double cell_size, double k_factor) {
+    return cell_size * cell_size / (2.0 * k_factor * kEarthRadius);
+}
+
+// Arithmetic the ray kernels run in. Float doubles the SIMD width of the
+// packet kernels; see float_height_error() for what it costs in accuracy.
+enum class Precision { Double, Float };
+
+// Grid DDA state for one ray from (x0, y0, z0) to (x1, y1, z1).
+//
+// tMaxX/tMaxY are recomputed from the current cell instead of accumulated,
+// so the state depends only on (x, y). That lets the hierarchical traversal
+// jump across a whole block and continue exactly as if it had stepped there.
+//
+// Real is the type all ray arithmetic runs in. The endpoints are rounded to
+// Real first, so a float walk is self-consistent (and matches the float
+// packet kernel) rather than a rounded copy of the double one.
+//
+// A non-zero `curvature` (see earth_curvature()) lowers the ray by
+// bulge * t * (1 - t) at t, bulge being curvature times the squared ray
+// length in cells: the earth rising between the ends, measured from the
+// chord. With curvature 0 every height is exactly the planar one.
+template <typename Real>
+struct BasicDDA {
+    Real x0, y0, z0;
+    Real dx, dy, dz;
+    Real bulge;
+    Real invDx, invDy;
+    int x, y;
+    int endX, endY;
+    int stepX, stepY;
+    bool majorX;
+    Real tMaxX, tMaxY;
+
+    BasicDDA(double x0_, double y0_, double z0_, double x1_, double y1_, double z1_,
+                    double curvature = 0.0)
+        : x0(static_cast<Real>(x0_)), y0(static_cast<Real>(y0_)), z0(static_cast<Real>(z0_)),
+          bulge(static_cast<Real>(curvature * ((x1_ - x0_) * (x1_ - x0_) +
+                                               (y1_ - y0_) * (y1_ - y0_)))) {
+        Real x1 = static_cast<Real>(x1_);
+        Real y1 = static_cast<Real>(y1_);
+        dx = x1 - x0;
+        dy = y1 - y0;
+        dz = static_cast<Real>(z1_) - z0;
+
+        // Current grid cell
+        x = static_cast<int>(std::floor(x0));
+        y = static_cast<int>(std::floor(y0));
+
+        endX = static_cast<int>(std::floor(x1));
+        endY = static_cast<int>(std::floor(y1));
+
+        stepX = (dx > 0) ? 1 : -1;
+        stepY = (dy > 0) ? 1 : -1;
+
+        invDx = Real(1) / dx;
+        invDy = Real(1) / dy;
+        majorX = std::abs(dx) > std::abs(dy);
+
+        tMaxX = cross_x(x);
+        tMaxY = cross_y(y);
+    }
+
+    // Parametric t at which the ray leaves column cx / row cy.
+    Real cross_x(int cx) const {
+        if (dx == 0) return std::numeric_limits<Real>::infinity();
+        return ((stepX > 0 ? Real(cx) + 1 : Real(cx)) - x0) * invDx;
+    }
+
+    Real cross_y(int cy) const {
+        if (dy == 0) return std::numeric_limits<Real>::infinity();
+        return ((stepY > 0 ? Real(cy) + 1 : Real(cy)) - y0) * invDy;
+    }
+
+    // Parametric t used to test cell (cx, cy), measured at the cell corner
+    // along the major axis and clamped to the segment.
+    Real cell_t(int cx, int cy) const {
+        Real t;
+
+        if (majorX)
+            t = (Real(cx) - x0) / dx;
+        else
+            t = (Real(cy) - y0) / dy;
+
+        if (t < 0) t = 0;
+        if (t > 1) t = 1;
+        return t;
+    }
+
+    Real ray_height(Real t) const {
+        Real h = z0 + t * dz;
+        return bulge == 0 ? h : h - bulge * (t * (Real(1) - t));
+    }
+
+    bool in_bounds(int width, int height) const {
+        return x >= 0 && y >= 0 && x < width && y < height;
+    }
+
+    // One branch-free test: with `x == endX && y == endY` GCC merges the two
+    // compares into a 64-bit load of the freshly stored (x, y) pair, which
+    // stalls on store forwarding every step.
+    bool at_end() const { return ((x ^ endX) | (y ^ endY)) == 0; }
+
+    // Whether the walk from the current cell passes through the end cell.
+    // It can miss it when the segment ends on a cell edge and an exact
+    // corner tie sends it the other way. The walk merges the x and y
+    // crossings in t order, y first on ties, so it is in column endX and row
+    // endY at once iff it enters each before it leaves the other.
+    bool reaches_end() const {
+        const Real none = -std::numeric_limits<Real>::infinity();
+        Real inX = endX == x ? none : cross_x(endX - stepX);
+        Real inY = endY == y ? none : cross_y(endY - stepY);
+        return inX < cross_y(endY) && inY <= cross_x(endX);
+    }
+
+    void step() {
+        if (tMaxX < tMaxY) {
+            x += stepX;
+            tMaxX = cross_x(x);
+        } else {
+            y += stepY;
+            tMaxY = cross_y(y);
+        }
+    }
+
+    // Lower bound on the ray height tested at any cell still ahead of the
+    // ray inside block b. The planar height is monotonic in t, so only the
+    // current cell and the block's exit column/row along the major axis
+    // matter.
+    Real min_height_in(const MaxPyramid::Block& b) const {
+        Real ta, tb;
+        if (majorX) {
+            ta = cell_t(x, y);
+            tb = cell_t(stepX > 0 ? b.x1 : b.x0, y);
+        } else {
+            ta = cell_t(x, y);
+            tb = cell_t(x, stepY > 0 ? b.y1 : b.y0);
+        }
+        return min_height_between(ta, tb);
+    }
+
+    // Lower bound on ray_height(t) for t between ta and tb: the lower end
+    // of the planar height, less (with curvature) the largest drop over
+    // the range, padded for rounding.
+    Real min_height_between(Real ta, Real tb) const {
+        Real lowest = std::min(z0 + ta * dz, z0 + tb * dz);
+        if (bulge == 0)
+            return lowest;
+        Real lo = std::min(ta, tb), hi = std::max(ta, tb);
+        Real t = hi < Real(0.5) ? hi : (lo > Real(0.5) ? lo : Real(0.5));
+        Real drop = bulge * (t * (Real(1) - t));
+        return lowest - drop * (Real(1) + 8 * std::numeric_limits<Real>::epsilon());
+    }
+
+    // Move to the first cell after block b, reproducing the cell the
+    // step-by-step traversal would reach.
+    void exit_block(const MaxPyramid::Block& b) {
+        int edgeX = stepX > 0 ? b.x1 : b.x0;
+        int edgeY = stepY > 0 ? b.y1 : b.y0;
+        Real tx = cross_x(edgeX);
+        Real ty = cross_y(edgeY);
+
+        if (tx < ty) {
+            // Leaves through an x face. The traversal has taken every y step
+            // whose crossing is <= tx (y steps win ties).
+            y = advance(y, edgeY, stepY, y0 + tx * dy, [&](int cy) { return cross_y(cy) <= tx; });
+            x = edgeX + stepX;
+        } else {
+            // Leaves through a y face. Every x step with crossing < ty is taken.
+            x = advance(x, edgeX, stepX, x0 + ty * dx, [&](int cx) { return cross_x(cx) < ty; });
+            y = edgeY + stepY;
+        }
+
+        tMaxX = cross_x(x);
+        tMaxY = cross_y(y);
+    }
+
+private:
+    // Starting at `from` and moving towards `edge` in steps of `step`, return
+    // the first cell c for which taken(c) is false. `guess` is the analytic
+    // crossing position and only seeds the search.
+    template <typename Taken>
+    static int advance(int from, int edge, int step, Real guess, Taken taken) {
+        int lo = std::min(from, edge), hi = std::max(from, edge);
+        Real g = std::floor(guess);
+        int c = g < lo ? lo : (g > hi ? hi : static_cast<int>(g));
+
+        while (c != edge && taken(c))
+            c += step;
+        while (c != from && !taken(c - step))
+            c -= step;
+        return c;
+    }
+};
+
+using DDA = BasicDDA<double>;
+
+// Bound on how far the float walk's ray height at a cell can be from the
+// double walk's at the same cell, for the ray (x0, y0, z0) -> (x1, y1, z1).
+//
+// With a = the major axis coordinate and u = 2^-24 (float rounding), the
+// float path rounds the endpoints, t = (a - a0) / da and z0 + t * dz, which
+// gives to first order
+//
+//   |h_float - h_double| <= 4u * (|z0| + |z1| + |dz| * (|a0| + |a1| + |da|) / |da|)
+//
+// (the constant has about 2.5x headroom over a 3e8-cell random sweep). For
+// a near-level ray at 1000 m this is about half a millimetre.
+//
+// A float answer can therefore differ from the double one only where
+// terrain lies within this distance of the ray, where the ray passes within
+// about 4u * (|x| + |y|) cells of a grid corner and the two walks step
+// through different, equally adjacent cells, or where |dx| and |dy| agree to
+// float precision and the walks measure t along different axes.
+inline double float_height_error(double x0, double y0, double z0,
+                                 double x1, double y1, double z1) {
+    bool majorX = std::abs(x1 - x0) > std::abs(y1 - y0);
+    double a0 = majorX ? x0 : y0, a1 = majorX ? x1 : y1;
+    double da = std::abs(a1 - a0);
+    double dz = std::abs(z1 - z0);
+    double skew = da > 0 ? dz * (std::abs(a0) + std::abs(a1) + da) / da : 0.0;
+    return std::ldexp(1.0, -22) * (std::abs(z0) + std::abs(z1) + skew);
+}
+
+// Core DDA traversal over a raw row-major heightmap. Every cell on the ray is
+// tested; this is the exact reference the accelerated paths must agree with.
+// Callers are responsible for acquiring the buffer once and passing it in.
+// `curvature` bends the ray as described at BasicDDA.
+//
+// los_boolean_raw<float> is the fast path: same walk, float arithmetic. See
+// float_height_error() for how far its answers can drift from the double walk.
+//
+// los_boolean_cells reads heights through a cell reader (see IndexedCells
+// in layout.h), for reordered or quantized heightmaps; the overload taking
+// an Index reads cell (x, y) at ptr[index(x, y)].
+template <typename Real = double, typename Cells>
+inline double los_boolean_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    double curvature = 0.0
+) {
+    BasicDDA<Real> r(x0, y0, z0, x1, y1, z1, curvature);
+    LOS_STAT_CELLS(walked);
+
+    while (true) {
+
+        if (!r.in_bounds(width, height))
+            return 0.0;
+
+        Real rayHeight = r.ray_height(r.cell_t(r.x, r.y));
+
+        LOS_STAT_STEP(walked);
+        float terrain = cells(r.x, r.y);
+
+        if (terrain > rayHeight)
+            return 0.0;
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return 1.0;
+}
+
+template <typename Real = double, typename Index = RowMajorIndex>
+inline double los_boolean_raw(
+    const float* ptr,
+    const Index& index,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1
+) {
+    return los_boolean_cells<Real>(IndexedCells<Index>{ptr, index}, width, height,
+                                   x0, y0, z0, x1, y1, z1);
+}
+
+template <typename Real = double>
+inline double los_boolean_raw(
+    const float* ptr,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1
+) {
+    return los_boolean_raw<Real>(ptr, RowMajorIndex(width), width, height,
+                                 x0, y0, z0, x1, y1, z1);
+}
+
+// Same answer as los_boolean_raw, but skips whole pyramid blocks whose max
+// height is at or below the lowest ray height tested inside them. The block
+// level grows after every successful skip and falls back to single cells
+// near the terrain, so rays that clear the terrain by a wide margin cost
+// roughly log(length) block tests instead of one test per cell.
+//
+// Pyramid is MaxPyramid or any view with the same levels(), block() and
+// block_max().
+// Cells and Index are as for los_boolean_raw; the pyramid itself is always
+// row-major and must bound cells(x, y).
+template <typename Real = double, typename Pyramid = MaxPyramid, typename Cells>
+inline double los_boolean_pyramid_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    const Pyramid& pyramid,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    double curvature = 0.0
+) {
+    BasicDDA<Real> r(x0, y0, z0, x1, y1, z1, curvature);
+    const bool reachesEnd = r.reaches_end();
+    const int top = pyramid.levels();
+    int level = 1;
+    LOS_STAT_CELLS(walked);
+
+    while (true) {
+
+        if (!r.in_bounds(width, height))
+            return 0.0;
+
+        bool skipped = false;
+        for (int l = std::min(level, top); l >= 1; l--) {
+            MaxPyramid::Block b = pyramid.block(l, r.x, r.y);
+            bool holdsEnd = b.contains(r.endX, r.endY);
+            // A walk that misses the end cell carries on past it, so the
+            // block holding the end is then walked cell by cell.
+            if (holdsEnd && !reachesEnd)
+                continue;
+            if (pyramid.block_max(l, r.x, r.y) <= r.min_height_in(b)) {
+                LOS_STAT_SKIP(l);
+                if (holdsEnd)
+                    return 1.0;
+                r.exit_block(b);
+                level = l + 1;
+                skipped = true;
+                break;
+            }
+        }
+        if (skipped)
+            continue;
+        level = 1;
+
+        Real rayHeight = r.ray_height(r.cell_t(r.x, r.y));
+
+        LOS_STAT_STEP(walked);
+        float terrain = cells(r.x, r.y);
+
+        if (terrain > rayHeight)
+            return 0.0;
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return 1.0;
+}
+
+template <typename Real = double, typename Pyramid = MaxPyramid, typename Index = RowMajorIndex>
+inline double los_boolean_pyramid(
+    const float* ptr,
+    const Index& index,
+    int width,
+    int height,
+    const Pyramid& pyramid,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1
+) {
+    return los_boolean_pyramid_cells<Real>(IndexedCells<Index>{ptr, index}, width, height,
+                                           pyramid, x0, y0, z0, x1, y1, z1);
+}
+
+template <typename Real = double, typename Pyramid = MaxPyramid>
+inline double los_boolean_pyramid(
+    const float* ptr,
+    int width,
+    int height,
+    const Pyramid& pyramid,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1
+) {
+    return los_boolean_pyramid<Real>(ptr, RowMajorIndex(width), width, height, pyramid,
+                                     x0, y0, z0, x1, y1, z1);
+}
+
+// Grid of num_samples rays around the primary ray: the endpoints are
+// shifted together within +/- 2 cells. For 9 samples: center + 8 surrounding
+// points; for 25 samples: 5x5 grid, etc.
+struct SamplePattern {
+    int grid_size;
+    double spacing;
+
+    explicit SamplePattern(int num_samples) {
+        grid_size = static_cast<int>(std::sqrt(static_cast<double>(num_samples)));
+        if (grid_size * grid_size < num_samples) grid_size++;
+
+        double offset_range = 2.0; // Sample within +/- 2 grid cells
+        spacing = offset_range / grid_size;
+    }
+
+    // Write sample i of the ray as (x0, y0, z0, x1, y1, z1) into row.
+    void ray(int i, double x0, double y0, double z0,
+             double x1, double y1, double z1, double* row) const {
+        int grid_x = i % grid_size;
+        int grid_y = i / grid_size;
+
+        double offset_x = (grid_x - grid_size / 2.0) * spacing;
+        double offset_y = (grid_y - grid_size / 2.0) * spacing;
+
+        row[0] = x0 + offset_x;
+        row[1] = y0 + offset_y;
+        row[2] = z0;
+        row[3] = x1 + offset_x;
+        row[4] = y1 + offset_y;
+        row[5] = z1;
+    }
+};
+
+// Samples only run in parallel when each task has enough cells to walk.
+// Inside a batch the call is already on a worker and runs inline.
+inline int64_t probability_grain(double x0, double y0, double x1, double y1,
+                                 int num_samples) {
+    double cells = std::abs(x1 - x0) + std::abs(y1 - y0) + 1.0;
+    return static_cast<int64_t>(std::min<double>(
+        num_samples, std::ceil(kMinCellsPerTask / cells)));
+}
+
+// Sample multiple rays in a pattern around the primary ray and return the
+// fraction that are clear. `trace(x0, y0, z0, x1, y1, z1)` checks one ray.
+template <typename Trace>
+double los_probability_sampled(
+    const Trace& trace,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    int num_samples
+) {
+    LOS_STAT_ADD(Samples, num_samples);
+    if (num_samples == 1) {
+        return trace(x0, y0, z0, x1, y1, z1);
+    }
+    
+    std::atomic<int> successful_rays{0};
+    SamplePattern pattern(num_samples);
+    int64_t grain = probability_grain(x0, y0, x1, y1, num_samples);
+    
+    parallel_for(num_samples, grain, [&](int64_t begin, int64_t end, int) {
+        int local_successes = 0;
+        for (int i = static_cast<int>(begin); i < end; i++) {
+            double r[6];
+            pattern.ray(i, x0, y0, z0, x1, y1, z1, r);
+            
+            // Check LOS for this sample
+            double result = trace(r[0], r[1], r[2], r[3], r[4], r[5]);
+            
+            if (result > 0.5) {
+                local_successes++;
+            }
+        }
+        successful_rays += local_successes;
+    });
+    
+    return static_cast<double>(successful_rays.load()) / num_samples;
+}
+
+inline double los_probability_raw(
+    const float* ptr,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    int num_samples
+) {
+    auto trace = [&](double ax, double ay, double az, double bx, double by, double bz) {
+        return los_boolean_raw(ptr, width, height, ax, ay, az, bx, by, bz);
+    };
+    return los_probability_sampled(trace, x0, y0, z0, x1, y1, z1, num_samples);
+}
+
+} // namespace los
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "los_kernel.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+// Packet traversal: N rays walk the grid DDA in lockstep, one SIMD lane per
+// ray, and drop out of the packet as soon as they are blocked, leave the grid
+// or reach their end cell. Every lane does exactly the arithmetic of
+// los_boolean_raw, so answers are bit-for-bit the same as the scalar kernel
+// (the extension is built with -ffp-contract=off so no path fuses the
+// ray-height multiply-add differently).
+//
+// The kernel is written once against a small set of lane operations and
+// instantiated for AVX-512 and AVX2 inside functions carrying the matching
+// target attribute; packet_kernel() picks the widest one the CPU supports at
+// runtime. The double kernels run 8 / 4 lanes and match los_boolean_raw; the
+// float kernels run 16 / 8 lanes and match los_boolean_raw<float>. Other CPUs
+// and compilers trace one ray at a time with the scalar kernel.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LOS_X86_DISPATCH 1
+#include <immintrin.h>
+#define LOS_TARGET(isa) __attribute__((target(isa), flatten))
+#else
+#define LOS_X86_DISPATCH 0
+#endif
+
+namespace los {
+
+// Largest packet any kernel uses; callers size their staging buffers by it.
+constexpr int kMaxPacketLanes = 16;
+
+// Trace `count` (<= lanes) rays stored as rows of (x0, y0, z0, x1, y1, z1)
+// and write 0.0 or 1.0 per ray to out.
+using PacketFn = void (*)(const float* ptr, int width, int height,
+                          const double* rays, int count, double* out);
+
+struct PacketKernel {
+    const char* isa;
+    int lanes;
+    PacketFn trace;
+};
+
+namespace detail {
+
+template <typename Real>
+inline void trace_scalar(const float* ptr, int width, int height,
+                         const double* rays, int count, double* out) {
+    for (int l = 0; l < count; l++) {
+        const double* r = rays + 6 * l;
+        out[l] = los_boolean_raw<Real>(ptr, width, height, r[0], r[1], r[2], r[3], r[4], r[5]);
+    }
+}
+
+#if LOS_X86_DISPATCH
+
+// Wide vectors only ever cross calls between functions that are inlined into
+// the same target-specific wrapper, so GCC's ABI notes do not apply.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// The kernel body is shared by both ISAs. The wrappers are flattened, so the
+// lane operations below are inlined into code compiled for the wider target.
+template <typename S>
+inline void trace_packet(const float* ptr, int width, int height,
+                         const double* rays, int count, double* out) {
+    typedef typename S::Real Real;
+    typedef typename S::D D;
+    typedef typename S::M M;
+    constexpr int N = S::N;
+
+    // Transpose the rays into lanes, rounding to Real first exactly like
+    // BasicDDA. Idle lanes replay ray 0 so they never see garbage, but start
+    // inactive.
+    alignas(64) Real in[10][N];
+    for (int l = 0; l < N; l++) {
+        const double* r = rays + 6 * (l < count ? l : 0);
+        for (int k = 0; k < 6; k++)
+            in[k][l] = static_cast<Real>(r[k]);
+        in[6][l] = std::floor(in[0][l]);
+        in[7][l] = std::floor(in[1][l]);
+        in[8][l] = std::floor(in[3][l]);
+        in[9][l] = std::floor(in[4][l]);
+    }
+
+    const D zero = S::set1(0), one = S::set1(1);
+    const D inf = S::set1(std::numeric_limits<Real>::infinity());
+
+    const D x0 = S::load(in[0]), y0 = S::load(in[1]), z0 = S::load(in[2]);
+    const D dx = S::sub(S::load(in[3]), x0);
+    const D dy = S::sub(S::load(in[4]), y0);
+    const D dz = S::sub(S::load(in[5]), z0);
+    // Cell coordinates are carried as Real (exact for any grid this kernel
+    // accepts) so t and the crossings need no conversion.
+    D x = S::load(in[6]), y = S::load(in[7]);
+    const D endX = S::load(in[8]), endY = S::load(in[9]);
+
+    const M posX = S::gt(dx, zero), posY = S::gt(dy, zero);
+    const D stepX = S::select(posX, one, S::set1(-1));
+    const D stepY = S::select(posY, one, S::set1(-1));
+    const D nextX = S::select(posX, one, zero);
+    const D nextY = S::select(posY, one, zero);
+    const M flatX = S::eq(dx, zero), flatY = S::eq(dy, zero);
+    const D invDx = S::div(one, dx), invDy = S::div(one, dy);
+    // t is measured along the major axis; pick its origin and span once.
+    const M majorX = S::gt(S::abs(dx), S::abs(dy));
+    const D major0 = S::select(majorX, x0, y0);
+    const D majorD = S::select(majorX, dx, dy);
+    const D w = S::set1(static_cast<Real>(width)), h = S::set1(static_cast<Real>(height));
+
+    D tMaxX = S::select(flatX, inf, S::mul(S::sub(S::add(x, nextX), x0), invDx));
+    D tMaxY = S::select(flatY, inf, S::mul(S::sub(S::add(y, nextY), y0), invDy));
+
+    M active = S::first(count);
+    M result = S::none();
+#if LOS_STATS_ON
+    uint64_t laneCells = 0;
+#endif
+
+    // Finished lanes keep stepping. Only `active` depends on the terrain, so
+    // the next gather never waits for the previous compare; the cell walk
+    // runs ahead and the loop branch is the only consumer of the results.
+    while (true) {
+        M inBounds = S::mand(S::mand(S::ge(x, zero), S::ge(y, zero)),
+                             S::mand(S::lt(x, w), S::lt(y, h)));
+        active = S::mand(active, inBounds);
+        if (!S::any(active))
+            break;
+#if LOS_STATS_ON
+        laneCells += __builtin_popcount(S::bits(active));
+#endif
+
+        D t = S::div(S::sub(S::select(majorX, x, y), major0), majorD);
+        t = S::select(S::lt(t, zero), zero, t);
+        t = S::select(S::gt(t, one), one, t);
+        D rayHeight = S::add(z0, S::mul(t, dz));
+
+        D terrain = S::gather(ptr, x, y, width, inBounds);
+
+        M blocked = S::mand(S::gt(terrain, rayHeight), active);
+        active = S::mandnot(blocked, active);
+
+        M done = S::mand(S::mand(S::eq(x, endX), S::eq(y, endY)), active);
+        result = S::mor(result, done);
+        active = S::mandnot(done, active);
+
+        M sx = S::lt(tMaxX, tMaxY);
+        x = S::select(sx, S::add(x, stepX), x);
+        y = S::select(sx, y, S::add(y, stepY));
+        tMaxX = S::select(S::mandnot(flatX, sx),
+                          S::mul(S::sub(S::add(x, nextX), x0), invDx), tMaxX);
+        tMaxY = S::select(S::mor(flatY, sx), tMaxY,
+                          S::mul(S::sub(S::add(y, nextY), y0), invDy));
+    }
+
+    int bits = S::bits(result);
+    for (int l = 0; l < count; l++)
+        out[l] = (bits >> l) & 1 ? 1.0 : 0.0;
+    LOS_STAT_WALKED(laneCells, count);
+    LOS_STAT_ADD(PacketRays, count);
+}
+
+#define LOS_AVX512 __attribute__((target("avx512f,avx512dq"))) static inline
+
+template <typename Real>
+struct Avx512;
+
+// Lane operations on 8 doubles; masks live in k registers.
+template <>
+struct Avx512<double> {
+    typedef double Real;
+    typedef __m512d D;
+    typedef __mmask8 M;
+    static constexpr int N = 8;
+
+    LOS_AVX512 D set1(double v) { return _mm512_set1_pd(v); }
+    LOS_AVX512 D load(const double* p) { return _mm512_load_pd(p); }
+    LOS_AVX512 D add(D a, D b) { return _mm512_add_pd(a, b); }
+    LOS_AVX512 D sub(D a, D b) { return _mm512_sub_pd(a, b); }
+    LOS_AVX512 D mul(D a, D b) { return _mm512_mul_pd(a, b); }
+    LOS_AVX512 D div(D a, D b) { return _mm512_div_pd(a, b); }
+    LOS_AVX512 D abs(D a) { return _mm512_abs_pd(a); }
+    LOS_AVX512 M lt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    LOS_AVX512 M gt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+    LOS_AVX512 M ge(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ); }
+    LOS_AVX512 M eq(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    LOS_AVX512 D select(M m, D a, D b) { return _mm512_mask_blend_pd(m, b, a); }
+    LOS_AVX512 M mand(M a, M b) { return a & b; }
+    LOS_AVX512 M mor(M a, M b) { return a | b; }
+    LOS_AVX512 M mandnot(M a, M b) { return static_cast<M>(~a & b); }
+    LOS_AVX512 M first(int n) { return static_cast<M>((1u << n) - 1); }
+    LOS_AVX512 M none() { return 0; }
+    LOS_AVX512 bool any(M m) { return m != 0; }
+    LOS_AVX512 int bits(M m) { return m; }
+
+    // Cells of in-bounds lanes (row-major index y * width + x).
+    LOS_AVX512 D gather(const float* ptr, D x, D y, int width, M m) {
+        __m512i idx = _mm512_cvttpd_epi64(_mm512_add_pd(_mm512_mul_pd(y, set1(width)), x));
+        __m256 v = _mm512_mask_i64gather_ps(_mm256_setzero_ps(), m, idx, ptr, 4);
+        return _mm512_cvtps_pd(v);
+    }
+};
+
+// Lane operations on 16 floats.
+template <>
+struct Avx512<float> {
+    typedef float Real;
+    typedef __m512 D;
+    typedef __mmask16 M;
+    static constexpr int N = 16;
+
+    LOS_AVX512 D set1(float v) { return _mm512_set1_ps(v); }
+    LOS_AVX512 D load(const float* p) { return _mm512_load_ps(p); }
+    LOS_AVX512 D add(D a, D b) { return _mm512_add_ps(a, b); }
+    LOS_AVX512 D sub(D a, D b) { return _mm512_sub_ps(a, b); }
+    LOS_AVX512 D mul(D a, D b) { return _mm512_mul_ps(a, b); }
+    LOS_AVX512 D div(D a, D b) { return _mm512_div_ps(a, b); }
+    LOS_AVX512 D abs(D a) { return _mm512_abs_ps(a); }
+    LOS_AVX512 M lt(D a, D b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    LOS_AVX512 M gt(D a, D b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    LOS_AVX512 M ge(D a, D b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    LOS_AVX512 M eq(D a, D b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    LOS_AVX512 D select(M m, D a, D b) { return _mm512_mask_blend_ps(m, b, a); }
+    LOS_AVX512 M mand(M a, M b) { return a & b; }
+    LOS_AVX512 M mor(M a, M b) { return a | b; }
+    LOS_AVX512 M mandnot(M a, M b) { return static_cast<M>(~a & b); }
+    LOS_AVX512 M first(int n) { return static_cast<M>((1u << n) - 1); }
+    LOS_AVX512 M none() { return 0; }
+    LOS_AVX512 bool any(M m) { return m != 0; }
+    LOS_AVX512 int bits(M m) { return m; }
+
+    // 32-bit cell index; float terrains are limited to < 2^31 cells.
+    LOS_AVX512 D gather(const float* ptr, D x, D y, int width, M m) {
+        __m512i idx = _mm512_add_epi32(
+            _mm512_mullo_epi32(_mm512_cvttps_epi32(y), _mm512_set1_epi32(width)),
+            _mm512_cvttps_epi32(x));
+        return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, idx, ptr, 4);
+    }
+};
+
+#undef LOS_AVX512
+#define LOS_AVX2 __attribute__((target("avx2"))) static inline
+
+template <typename Real>
+struct Avx2;
+
+// Lane operations on 4 doubles; masks are all-ones / all-zeros lanes.
+template <>
+struct Avx2<double> {
+    typedef double Real;
+    typedef __m256d D;
+    typedef __m256d M;
+    static constexpr int N = 4;
+
+    LOS_AVX2 D set1(double v) { return _mm256_set1_pd(v); }
+    LOS_AVX2 D load(const double* p) { return _mm256_load_pd(p); }
+    LOS_AVX2 D add(D a, D b) { return _mm256_add_pd(a, b); }
+    LOS_AVX2 D sub(D a, D b) { return _mm256_sub_pd(a, b); }
+    LOS_AVX2 D mul(D a, D b) { return _mm256_mul_pd(a, b); }
+    LOS_AVX2 D div(D a, D b) { return _mm256_div_pd(a, b); }
+    LOS_AVX2 D abs(D a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    LOS_AVX2 M lt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    LOS_AVX2 M gt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    LOS_AVX2 M ge(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    LOS_AVX2 M eq(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    LOS_AVX2 D select(M m, D a, D b) { return _mm256_blendv_pd(b, a, m); }
+    LOS_AVX2 M mand(M a, M b) { return _mm256_and_pd(a, b); }
+    LOS_AVX2 M mor(M a, M b) { return _mm256_or_pd(a, b); }
+    LOS_AVX2 M mandnot(M a, M b) { return _mm256_andnot_pd(a, b); }
+    LOS_AVX2 M none() { return _mm256_setzero_pd(); }
+    LOS_AVX2 bool any(M m) { return _mm256_movemask_pd(m) != 0; }
+    LOS_AVX2 int bits(M m) { return _mm256_movemask_pd(m); }
+
+    LOS_AVX2 M first(int n) {
+        __m256i lane = _mm256_setr_epi64x(0, 1, 2, 3);
+        return _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(n), lane));
+    }
+
+    // AVX2 has no double -> int64 conversion; integers below 2^52 sit in the
+    // low mantissa bits once 2^52 is added. Masked-off lanes read cell 0.
+    LOS_AVX2 D gather(const float* ptr, D x, D y, int width, M m) {
+        const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+        __m256d index = _mm256_add_pd(_mm256_mul_pd(y, set1(width)), x);
+        __m256i idx = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(index, magic)),
+                                       _mm256_castpd_si256(magic));
+        idx = _mm256_and_si256(idx, _mm256_castpd_si256(m));
+        return _mm256_cvtps_pd(_mm256_i64gather_ps(ptr, idx, 4));
+    }
+};
+
+// Lane operations on 8 floats.
+template <>
+struct Avx2<float> {
+    typedef float Real;
+    typedef __m256 D;
+    typedef __m256 M;
+    static constexpr int N = 8;
+
+    LOS_AVX2 D set1(float v) { return _mm256_set1_ps(v); }
+    LOS_AVX2 D load(const float* p) { return _mm256_load_ps(p); }
+    LOS_AVX2 D add(D a, D b) { return _mm256_add_ps(a, b); }
+    LOS_AVX2 D sub(D a, D b) { return _mm256_sub_ps(a, b); }
+    LOS_AVX2 D mul(D a, D b) { return _mm256_mul_ps(a, b); }
+    LOS_AVX2 D div(D a, D b) { return _mm256_div_ps(a, b); }
+    LOS_AVX2 D abs(D a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    LOS_AVX2 M lt(D a, D b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    LOS_AVX2 M gt(D a, D b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    LOS_AVX2 M ge(D a, D b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    LOS_AVX2 M eq(D a, D b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    LOS_AVX2 D select(M m, D a, D b) { return _mm256_blendv_ps(b, a, m); }
+    LOS_AVX2 M mand(M a, M b) { return _mm256_and_ps(a, b); }
+    LOS_AVX2 M mor(M a, M b) { return _mm256_or_ps(a, b); }
+    LOS_AVX2 M mandnot(M a, M b) { return _mm256_andnot_ps(a, b); }
+    LOS_AVX2 M none() { return _mm256_setzero_ps(); }
+    LOS_AVX2 bool any(M m) { return _mm256_movemask_ps(m) != 0; }
+    LOS_AVX2 int bits(M m) { return _mm256_movemask_ps(m); }
+
+    LOS_AVX2 M first(int n) {
+        __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane));
+    }
+
+    // 32-bit cell index; float terrains are limited to < 2^31 cells.
+    LOS_AVX2 D gather(const float* ptr, D x, D y, int width, M m) {
+        __m256i idx = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_cvttps_epi32(y), _mm256_set1_epi32(width)),
+            _mm256_cvttps_epi32(x));
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), ptr, idx, m, 4);
+    }
+};
+
+#undef LOS_AVX2
+
+template <typename Real>
+LOS_TARGET("avx512f,avx512dq")
+inline void trace_avx512(const float* ptr, int width, int height,
+                         const double* rays, int count, double* out) {
+    trace_packet<Avx512<Real>>(ptr, width, height, rays, count, out);
+}
+
+template <typename Real>
+LOS_TARGET("avx2")
+inline void trace_avx2(const float* ptr, int width, int height,
+                       const double* rays, int count, double* out) {
+    trace_packet<Avx2<Real>>(ptr, width, height, rays, count, out);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+template <typename Real>
+inline PacketKernel select_packet_kernel() {
+    constexpr int wide = 64 / sizeof(Real);
+#if LOS_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        return {"avx512", wide, trace_avx512<Real>};
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", wide / 2, trace_avx2<Real>};
+#endif
+    return {"scalar", 1, trace_scalar<Real>};
+}
+
+} // namespace detail
+
+// Widest packet kernel supported by this CPU for Real, selected once.
+template <typename Real = double>
+inline const PacketKernel& packet_kernel() {
+    static const PacketKernel kernel = detail::select_packet_kernel<Real>();
+    return kernel;
+}
+
+// Trace n rays (rows of 6 doubles) through the packet kernel, writing
+// 0.0/1.0 per ray into out.
+template <typename Real = double>
+inline void trace_packets(const float* ptr, int width, int height,
+                          const double* rays, int64_t n, double* out) {
+    const PacketKernel& k = packet_kernel<Real>();
+    for (int64_t i = 0; i < n; i += k.lanes) {
+        int count = static_cast<int>(n - i < k.lanes ? n - i : k.lanes);
+        k.trace(ptr, width, height, rays + 6 * i, count, out + i);
+    }
+}
+
+// los_boolean_raw<Real> over n (x0, y0, z0, x1, y1, z1) rows, split over the
+// pool and traced a packet at a time. out[i] is 0 or 1.
+template <typename Real = double>
+inline void los_boolean_packets(const float* ptr, int width, int height,
+                                const double* pairs, int64_t n, uint8_t* out) {
+    parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+        double result[kMaxPacketLanes];
+        for (int64_t i = begin; i < end; i += kMaxPacketLanes) {
+            int64_t count = std::min<int64_t>(kMaxPacketLanes, end - i);
+            LOS_STAT_SCOPE(count);
+            trace_packets<Real>(ptr, width, height, pairs + 6 * i, count, result);
+            for (int64_t j = 0; j < count; j++)
+                out[i + j] = result[j] > 0.5;
+        }
+    });
+}
+
+// los_probability_raw with the sample rays traced as packets. The samples
+// of one query are parallel offsets of the same ray, so the lanes of a packet
+// walk nearly the same cells and finish together.
+template <typename Real = double>
+inline double los_probability_packets(
+    const float* ptr,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    int num_samples
+) {
+    LOS_STAT_ADD(Samples, num_samples);
+    if (num_samples == 1)
+        return los_boolean_raw<Real>(ptr, width, height, x0, y0, z0, x1, y1, z1);
+
+    const PacketKernel& k = packet_kernel<Real>();
+    const int lanes = k.lanes;
+    std::atomic<int> successful_rays{0};
+    SamplePattern pattern(num_samples);
+    int64_t grain = probability_grain(x0, y0, x1, y1, num_samples);
+    grain = (grain + lanes - 1) / lanes * lanes;
+
+    parallel_for(num_samples, grain, [&](int64_t begin, int64_t end, int) {
+        double rays[6 * kMaxPacketLanes];
+        double result[kMaxPacketLanes];
+        int local_successes = 0;
+        for (int i = static_cast<int>(begin); i < end; i += lanes) {
+            int count = static_cast<int>(std::min<int64_t>(lanes, end - i));
+            for (int j = 0; j < count; j++)
+                pattern.ray(i + j, x0, y0, z0, x1, y1, z1, rays + 6 * j);
+            k.trace(ptr, width, height, rays, count, result);
+            for (int j = 0; j < count; j++)
+                local_successes += result[j] > 0.5;
+        }
+        successful_rays += local_successes;
+    });
+
+    return static_cast<double>(successful_rays.load()) / num_samples;
+}
+
+} // namespace los
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rasterize.h"
+#include "thread_pool.h"
+#include "tiled.h"
+
+namespace los {
+
+// Push-pull hole filling (Gortler et al., "The Lumigraph", 1996) over a
+// row-major grid whose NaN cells are holes.
+//
+// Push halves the grid level by level: each coarse cell is the weighted
+// mean of its up to 2x2 children, with weight min(1, their weight sum), a
+// data cell weighing 1 and a hole 0. Pull then runs from the top down,
+// blending every coarse cell that lacks full weight with the bilinear
+// upsampling of the level above it. A hole takes the upsampled level-1
+// value, so it is filled from the data around it at the scale of the gap,
+// smoothly and with no dependence on where tiles are cut. Data cells are
+// never changed. The levels hold a third of the grid's cells as two floats
+// each; level 0 is the grid itself.
+class PushPull {
+public:
+    PushPull(const float* grid, int width, int height) : width_(width), height_(height) {
+        int w = width, h = height;
+        while (w > 1 || h > 1) {
+            int cw = (w + 1) / 2, ch = (h + 1) / 2;
+            Level level{cw, ch, std::vector<float>(static_cast<size_t>(cw) * ch),
+                        std::vector<float>(static_cast<size_t>(cw) * ch)};
+            if (levels_.empty())
+                push(level, w, h, [grid, width](int x, int y, float& v) {
+                    v = grid[static_cast<size_t>(y) * width + x];
+                    return std::isnan(v) ? 0.0f : 1.0f;
+                });
+            else
+                push(level, w, h, [&src = levels_.back()](int x, int y, float& v) {
+                    size_t i = static_cast<size_t>(y) * src.w + x;
+                    v = src.v[i];
+                    return src.wt[i];
+                });
+            levels_.push_back(std::move(level));
+            w = cw;
+            h = ch;
+        }
+        empty_ = levels_.empty() ? std::isnan(grid[0]) : !(levels_.back().wt[0] > 0);
+
+        for (int l = static_cast<int>(levels_.size()) - 2; l >= 0; l--) {
+            Level& fine = levels_[l];
+            const Level& coarse = levels_[l + 1];
+            parallel_for(fine.h, 16, [&](int64_t begin, int64_t end, int) {
+                for (int y = static_cast<int>(begin); y < end; y++)
+                    for (int x = 0; x < fine.w; x++) {
+                        size_t i = static_cast<size_t>(y) * fine.w + x;
+                        float a = fine.wt[i];
+                        if (a < 1)
+                            fine.v[i] = a * fine.v[i] + (1 - a) * upsample(coarse, x, y);
+                    }
+            });
+        }
+    }
+
+    // Whether the grid holds no data at all (then nothing can be filled).
+    bool empty() const { return empty_; }
+
+    // Value for hole (x, y) of the grid.
+    float fill(int x, int y) const {
+        if (empty_)
+            return std::numeric_limits<float>::quiet_NaN();
+        if (levels_.empty())
+            return 0.0f;  // 1x1 grid, never a hole here
+        return upsample(levels_[0], x, y);
+    }
+
+    // Fill every hole of `grid` (the grid this was built over) in place.
+    void fill_all(float* grid) const {
+        if (empty_)
+            return;
+        parallel_for(height_, 16, [&](int64_t begin, int64_t end, int) {
+            for (int y = static_cast<int>(begin); y < end; y++)
+                for (int x = 0; x < width_; x++) {
+                    float& v = grid[static_cast<size_t>(y) * width_ + x];
+                    if (std::isnan(v))
+                        v = fill(x, y);
+                }
+        });
+    }
+
+    size_t bytes() const {
+        size_t n = 0;
+        for (const Level& l : levels_)
+            n += (l.v.size() + l.wt.size()) * sizeof(float);
+        return n;
+    }
+
+private:
+    struct Level {
+        int w, h;
+        std::vector<float> v, wt;
+    };
+
+    // Fill `level` from the w x h level below, read through
+    // cell(x, y, value) -> weight.
+    template <typename Cell>
+    static void push(Level& level, int w, int h, const Cell& cell) {
+        parallel_for(level.h, 16, [&](int64_t begin, int64_t end, int) {
+            for (int by = static_cast<int>(begin); by < end; by++)
+                for (int bx = 0; bx < level.w; bx++) {
+                    double sum = 0, weight = 0;
+                    for (int y = 2 * by; y <= std::min(2 * by + 1, h - 1); y++)
+                        for (int x = 2 * bx; x <= std::min(2 * bx + 1, w - 1); x++) {
+                            float v;
+                            float a = cell(x, y, v);
+                            if (a > 0) {
+                                sum += a * static_cast<double>(v);
+                                weight += a;
+                            }
+                        }
+                    size_t i = static_cast<size_t>(by) * level.w + bx;
+                    level.v[i] = weight > 0 ? static_cast<float>(sum / weight) : 0.0f;
+                    level.wt[i] = static_cast<float>(std::min(weight, 1.0));
+                }
+        });
+    }
+
+    // Bilinear value of `coarse` at the centre of cell (x, y) one level
+    // below it, clamped at the edges.
+    static float upsample(const Level& coarse, int x, int y) {
+        double u = 0.5 * x - 0.25, t = 0.5 * y - 0.25;
+        int x0 = static_cast<int>(std::floor(u)), y0 = static_cast<int>(std::floor(t));
+        double fx = u - x0, fy = t - y0;
+        auto at = [&](int cx, int cy) {
+            cx = std::min(std::max(cx, 0), coarse.w - 1);
+            cy = std::min(std::max(cy, 0), coarse.h - 1);
+            return static_cast<double>(coarse.v[static_cast<size_t>(cy) * coarse.w + cx]);
+        };
+        double top = at(x0, y0) + fx * (at(x0 + 1, y0) - at(x0, y0));
+        double bottom = at(x0, y0 + 1) + fx * (at(x0 + 1, y0 + 1) - at(x0, y0 + 1));
+        return static_cast<float>(top + fy * (bottom - top));
+    }
+
+    int width_, height_;
+    bool empty_ = true;
+    std::vector<Level> levels_;
+};
+
+enum class HoleFill { None, Nearest, PushPull };
+
+// Tile order of a tiled DEM: the bits of tx interleaved with those of ty,
+// tx taking the even positions.
+inline uint64_t tiled_morton_key(uint32_t tx, uint32_t ty) {
+    uint64_t key = 0;
+    for (int bit = 0; bit < 32; bit++)
+        key |= uint64_t((tx >> bit) & 1) << (2 * bit) | uint64_t((ty >> bit) & 1) << (2 * bit + 1);
+    return key;
+}
+
+// What write_tiled_dem() wrote.
+struct TiledWriteStats {
+    int64_t tiles = 0;       // stored, i.e. holding some data
+    int64_t emptyTiles = 0;  // all NaN, not stored
+    int64_t filled = 0;      // holes filled
+    double zMin = std::numeric_limits<double>::quiet_NaN();
+    double zMax = std::numeric_limits<double>::quiet_NaN();
+};
+
+// Fill the holes of a row-major width x height grid in place and write it
+// as a tiled DEM (tiled.h; the same file tiled_dem.py writes, with the
+// metadata after the tiles), in one parallel pass over the tiles.
+//
+// With HoleFill::PushPull the push levels are built first (one read of
+// the grid); the tile pass then fills each hole from them as it copies
+// the tile, writes it back into `grid`, and takes the tile's max and min
+// for the directory, which TiledTerrain skips tiles by. The coarser levels
+// of the max/min pyramid (2 x 2 tiles, 4 x 4, ... up to the whole grid)
+// are reduced from those directory values once the tiles are written, so
+// no cell is read twice. HoleFill::Nearest runs Rasterizer::fill_nearest()
+// within max_fill_distance cells first. Tiles are built in batches of a
+// few per thread, in the file's Morton order, and written by the calling
+// thread while the next batch is built. `metadata(stats)` returns the JSON
+// to store, once the tiles are written. The file is written under
+// path + ".tmp" and renamed over path at the end.
+inline TiledWriteStats write_tiled_dem(
+    const std::string& path, float* grid, int width, int height, int tileSize,
+    HoleFill fill, double max_fill_distance,
+    const std::function<std::string(const TiledWriteStats&)>& metadata) {
+    if (tileSize < 16 || tileSize > 4096 || (tileSize & (tileSize - 1)))
+        throw std::invalid_argument("tile_size must be a power of two in [16, 4096]");
+    if (width <= 0 || height <= 0)
+        throw std::invalid_argument("dem must not be empty");
+
+    std::unique_ptr<PushPull> pushPull;
+    int64_t nearestFilled = 0;
+    if (fill == HoleFill::PushPull)
+        pushPull = std::make_unique<PushPull>(grid, width, height);
+    else if (fill == HoleFill::Nearest)
+        nearestFilled = Rasterizer::fill_nearest(grid, width, height, max_fill_distance);
+    const bool pull = pushPull && !pushPull->empty();
+
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    const int64_t tiles = int64_t(tilesX) * tilesY;
+    std::vector<std::pair<uint64_t, int64_t>> order(tiles);  // (Morton key, tile)
+    for (int ty = 0; ty < tilesY; ty++)
+        for (int tx = 0; tx < tilesX; tx++)
+            order[static_cast<size_t>(ty) * tilesX + tx] = {
+                tiled_morton_key(static_cast<uint32_t>(tx), static_cast<uint32_t>(ty)),
+                int64_t(ty) * tilesX + tx};
+    std::sort(order.begin(), order.end());
+
+    std::vector<TileEntry> directory(tiles);
+    const int pyramidLevels = tile_pyramid_levels(tilesX, tilesY);
+    int64_t pyramidRanges = 0;
+    for (int l = 1, w = tilesX, h = tilesY; l <= pyramidLevels; l++) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        pyramidRanges += int64_t(w) * h;
+    }
+    const uint64_t directoryOffset = sizeof(TiledHeader);
+    const uint64_t pyramidOffset = directoryOffset + tiles * sizeof(TileEntry);
+    const uint64_t page = 4096;
+    uint64_t pos = (pyramidOffset + pyramidRanges * sizeof(TileRange) + page - 1) / page * page;
+    const size_t tileCells = static_cast<size_t>(tileSize) * tileSize;
+
+    const std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error(tmp + ": cannot open for writing");
+    auto fail = [&](const std::string& why) {
+        out.close();
+        std::remove(tmp.c_str());
+        return std::runtime_error(tmp + ": " + why);
+    };
+
+    const int64_t batch =
+        std::max<int64_t>(1, std::min<int64_t>(tiles, 2 * ThreadPool::instance().num_threads()));
+    std::vector<float> buffers[2] = {std::vector<float>(batch * tileCells),
+                                     std::vector<float>(batch * tileCells)};
+    std::vector<int64_t> filled(tiles, 0);
+
+    // Build tiles order[first, first + n) into buffers[b].
+    auto build = [&](int64_t first, int64_t n, int b) {
+        parallel_for(n, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t k = begin; k < end; k++) {
+                int64_t i = order[first + k].second;
+                int tx = static_cast<int>(i % tilesX), ty = static_cast<int>(i / tilesX);
+                int x0 = tx * tileSize, y0 = ty * tileSize;
+                int w = std::min(tileSize, width - x0), h = std::min(tileSize, height - y0);
+                float* tile = buffers[b].data() + k * tileCells;
+                std::fill(tile, tile + tileCells, std::numeric_limits<float>::quiet_NaN());
+                float hi = -std::numeric_limits<float>::infinity();
+                float lo = std::numeric_limits<float>::infinity();
+                int64_t holes = 0;
+                for (int y = 0; y < h; y++) {
+                    float* row = grid + static_cast<size_t>(y0 + y) * width + x0;
+                    for (int x = 0; x < w; x++) {
+                        float v = row[x];
+                        if (std::isnan(v) && pull) {
+                            v = row[x] = pushPull->fill(x0 + x, y0 + y);
+                            holes++;
+                        }
+                        tile[static_cast<size_t>(y) * tileSize + x] = v;
+                        if (v > hi) hi = v;
+                        if (v < lo) lo = v;
+                    }
+                }
+                filled[i] = holes;
+                directory[i] = {hi >= lo ? uint64_t(1) : 0, hi, lo};
+            }
+        });
+    };
+
+    int64_t done = 0;
+    int cur = 0;
+    build(0, std::min(batch, tiles), cur);
+    out.seekp(static_cast<std::streamoff>(pos));
+    while (done < tiles) {
+        int64_t n = std::min(batch, tiles - done);
+        int64_t next = done + n;
+        // Build the next batch on the pool while this thread writes.
+        std::thread builder;
+        if (next < tiles)
+            builder = std::thread(build, next, std::min(batch, tiles - next), 1 - cur);
+        for (int64_t k = 0; k < n; k++) {
+            TileEntry& e = directory[order[done + k].second];
+            if (!e.offset)
+                continue;
+            e.offset = pos;
+            out.write(reinterpret_cast<const char*>(buffers[cur].data() + k * tileCells),
+                      static_cast<std::streamsize>(tileCells * sizeof(float)));
+            pos += tileCells * sizeof(float);
+        }
+        if (builder.joinable())
+            builder.join();
+        if (!out)
+            throw fail("write failed");
+        done = next;
+        cur = 1 - cur;
+    }
+
+    TiledWriteStats stats;
+    stats.filled = nearestFilled;
+    for (int64_t i = 0; i < tiles; i++) {
+        stats.filled += filled[i];
+        if (!directory[i].offset) {
+            stats.emptyTiles++;
+            directory[i].max = -std::numeric_limits<float>::infinity();
+            directory[i].min = std::numeric_limits<float>::infinity();
+            continue;
+        }
+        stats.tiles++;
+        if (!(directory[i].max <= stats.zMax)) stats.zMax = directory[i].max;
+        if (!(directory[i].min >= stats.zMin)) stats.zMin = directory[i].min;
+    }
+
+    // Each pyramid level from the one below it, starting at the directory.
+    std::vector<TileRange> pyramid;
+    pyramid.reserve(static_cast<size_t>(pyramidRanges));
+    int srcW = tilesX, srcH = tilesY;
+    size_t src = 0;
+    for (int l = 1; l <= pyramidLevels; l++) {
+        int w = (srcW + 1) / 2, h = (srcH + 1) / 2;
+        size_t first = pyramid.size();
+        for (int by = 0; by < h; by++)
+            for (int bx = 0; bx < w; bx++) {
+                TileRange r{-std::numeric_limits<float>::infinity(),
+                            std::numeric_limits<float>::infinity()};
+                for (int y = 2 * by; y <= std::min(2 * by + 1, srcH - 1); y++)
+                    for (int x = 2 * bx; x <= std::min(2 * bx + 1, srcW - 1); x++) {
+                        size_t i = static_cast<size_t>(y) * srcW + x;
+                        TileRange c = l == 1 ? TileRange{directory[i].max, directory[i].min}
+                                             : pyramid[src + i];
+                        r.max = std::max(r.max, c.max);
+                        r.min = std::min(r.min, c.min);
+                    }
+                pyramid.push_back(r);
+            }
+        src = first;
+        srcW = w;
+        srcH = h;
+    }
+
+    std::string meta;
+    try {
+        meta = metadata ? metadata(stats) : std::string("{}");
+    } catch (...) {
+        out.close();
+        std::remove(tmp.c_str());
+        throw;
+    }
+    TiledHeader header{};
+    std::memcpy(header.magic, kTiledMagic, sizeof(kTiledMagic));
+    header.version = kTiledVersion;
+    header.tileSize = static_cast<uint32_t>(tileSize);
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.tilesX = static_cast<uint32_t>(tilesX);
+    header.tilesY = static_cast<uint32_t>(tilesY);
+    header.directoryOffset = directoryOffset;
+    header.pyramidOffset = pyramidLevels ? pyramidOffset : 0;
+    header.pyramidLevels = static_cast<uint32_t>(pyramidLevels);
+    header.metaOffset = pos;
+    header.metaLength = meta.size();
+    out.write(meta.data(), static_cast<std::streamsize>(meta.size()));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(directory.data()),
+              static_cast<std::streamsize>(directory.size() * sizeof(TileEntry)));
+    out.write(reinterpret_cast<const char*>(pyramid.data()),
+              static_cast<std::streamsize>(pyramid.size() * sizeof(TileRange)));
+    out.flush();
+    if (!out)
+        throw fail("write failed");
+    out.close();
+
+    // std::rename replaces an existing file on POSIX but not on Windows.
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(path.c_str());
+        if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(path + ": cannot replace with " + tmp);
+        }
+    }
+    return stats;
+}
+
+} // namespace los
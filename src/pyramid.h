@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace los {
+
+// Max-height mip pyramid over a row-major heightmap.
+//
+// Level L (1 <= L <= levels()) stores, for every 2^L x 2^L block of cells,
+// the maximum height inside the block (clipped at the grid edge). Level 0 is
+// the heightmap itself and is not duplicated here. NaN cells never block a
+// ray, so they are ignored; an all-NaN block stores -inf.
+class MaxPyramid {
+public:
+    struct Block {
+        int x0, y0, x1, y1;  // inclusive cell bounds
+
+        bool contains(int x, int y) const {
+            return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+        }
+    };
+
+    MaxPyramid() = default;
+
+    MaxPyramid(const float* data, int width, int height) { build(data, width, height); }
+
+    void build(const float* data, int width, int height) {
+        build_cells([data, width](int x, int y) { return data[static_cast<size_t>(y) * width + x]; },
+                    width, height);
+    }
+
+    // Build over cells(x, y) for a width x height grid, which need not be
+    // stored anywhere (e.g. a per-patch max computed on the fly).
+    template <typename Cells>
+    void build_cells(const Cells& cells, int width, int height) {
+        width_ = width;
+        height_ = height;
+        dims_.clear();
+        levels_.clear();
+
+        int srcW = width, srcH = height;
+        auto next = [&](const auto& cell) {
+            int w = (srcW + 1) / 2;
+            int h = (srcH + 1) / 2;
+            std::vector<float> level(static_cast<size_t>(w) * h);
+
+            parallel_for(h, 16, [&](int64_t begin, int64_t end, int) {
+                for (int by = static_cast<int>(begin); by < end; by++)
+                    for (int bx = 0; bx < w; bx++)
+                        level[static_cast<size_t>(by) * w + bx] = reduce(cell, bx, by, srcW, srcH);
+            });
+
+            dims_.push_back({w, h});
+            levels_.push_back(std::move(level));
+            srcW = w;
+            srcH = h;
+        };
+        if (srcW > 1 || srcH > 1)
+            next(cells);
+        while (srcW > 1 || srcH > 1) {
+            const float* src = levels_.back().data();
+            int stride = srcW;
+            next([src, stride](int x, int y) { return src[static_cast<size_t>(y) * stride + x]; });
+        }
+    }
+
+    // Refresh the blocks over cells [x0, x1] x [y0, y1] (inclusive) and
+    // their ancestors up to the root after those cells changed; cells(x, y)
+    // reads the new heightmap. Every other block is left as is.
+    template <typename Cells>
+    void update(const Cells& cells, int x0, int y0, int x1, int y1) {
+        for (int l = 1; l <= levels(); l++) {
+            x0 >>= 1, y0 >>= 1, x1 >>= 1, y1 >>= 1;
+            int w = dims_[l - 1].first;
+            std::vector<float>& level = levels_[l - 1];
+            auto refresh = [&](const auto& cell, int srcW, int srcH) {
+                parallel_for(y1 - y0 + 1, 16, [&](int64_t begin, int64_t end, int) {
+                    for (int by = y0 + static_cast<int>(begin); by < y0 + end; by++)
+                        for (int bx = x0; bx <= x1; bx++)
+                            level[static_cast<size_t>(by) * w + bx] =
+                                reduce(cell, bx, by, srcW, srcH);
+                });
+            };
+            if (l == 1) {
+                refresh(cells, width_, height_);
+            } else {
+                const float* src = levels_[l - 2].data();
+                int srcW = dims_[l - 2].first;
+                refresh([src, srcW](int x, int y) { return src[static_cast<size_t>(y) * srcW + x]; },
+                        srcW, dims_[l - 2].second);
+            }
+        }
+    }
+
+    bool empty() const { return levels_.empty(); }
+
+    // Number of coarse levels above the heightmap.
+    int levels() const { return static_cast<int>(levels_.size()); }
+
+    // Maximum height of the level-L block containing cell (x, y).
+    float block_max(int level, int x, int y) const {
+        const auto& d = dims_[level - 1];
+        return levels_[level - 1][static_cast<size_t>(y >> level) * d.first + (x >> level)];
+    }
+
+    // Cell bounds of the level-L block containing cell (x, y).
+    Block block(int level, int x, int y) const {
+        int bx0 = (x >> level) << level;
+        int by0 = (y >> level) << level;
+        return {bx0, by0,
+                std::min(bx0 + (1 << level) - 1, width_ - 1),
+                std::min(by0 + (1 << level) - 1, height_ - 1)};
+    }
+
+    // Raw storage of level L (1 <= L <= levels()), row-major.
+    const float* level_data(int level) const { return levels_[level - 1].data(); }
+    std::pair<int, int> level_dims(int level) const { return dims_[level - 1]; }
+
+    size_t bytes() const {
+        size_t n = 0;
+        for (const auto& l : levels_)
+            n += l.size() * sizeof(float);
+        return n;
+    }
+
+private:
+    // Max of the up to 2x2 cells of `src` under block (bx, by).
+    template <typename Src>
+    static float reduce(const Src& src, int bx, int by, int srcW, int srcH) {
+        int xa = 2 * bx, xb = std::min(2 * bx + 1, srcW - 1);
+        int ya = 2 * by, yb = std::min(2 * by + 1, srcH - 1);
+        float m = -std::numeric_limits<float>::infinity();
+        for (int y = ya; y <= yb; y++)
+            for (int x = xa; x <= xb; x++) {
+                float v = src(x, y);
+                if (v > m) m = v;
+            }
+        return m;
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    std::vector<std::pair<int, int>> dims_;
+    std::vector<std::vector<float>> levels_;
+};
+
+} // namespace los
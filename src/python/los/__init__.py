@@ -0,0 +1,60 @@
+"""Line-of-sight queries over DEM heightmaps.
+
+The wheel ships one compiled module per x86-64 microarchitecture level
+(_los_baseline, _los_v3, _los_v4). The best level this CPU supports is
+imported here and re-exported, so ``import los`` behaves the same
+everywhere. Set LOS_ISA=baseline|v3|v4 to force a variant.
+"""
+
+import importlib
+import os
+import platform
+
+# /proc/cpuinfo flag names each level needs on top of the one below it.
+_LEVEL_FLAGS = {
+    "v3": {"avx", "avx2", "bmi1", "bmi2", "f16c", "fma", "abm", "movbe", "xsave"},
+    "v4": {"avx512f", "avx512bw", "avx512cd", "avx512dq", "avx512vl"},
+}
+_LEVELS = ["baseline", "v3", "v4"]
+
+
+def _cpu_flags():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("flags"):
+                    return set(line.split(":", 1)[1].split())
+    except OSError:
+        pass
+    return set()
+
+
+def _supported_levels():
+    if platform.machine().lower() not in ("x86_64", "amd64"):
+        return ["baseline"]
+    flags = _cpu_flags()
+    levels = ["baseline"]
+    for level in _LEVELS[1:]:
+        if not _LEVEL_FLAGS[level] <= flags:
+            break
+        levels.append(level)
+    return levels
+
+
+def _load():
+    forced = os.environ.get("LOS_ISA")
+    if forced:
+        if forced not in _LEVELS:
+            raise ImportError(f"LOS_ISA must be one of {_LEVELS}, got {forced!r}")
+        return forced, importlib.import_module(f"._los_{forced}", __name__)
+    for level in reversed(_supported_levels()):
+        try:
+            return level, importlib.import_module(f"._los_{level}", __name__)
+        except ImportError:
+            continue  # variant not built on this platform
+    raise ImportError("no los extension module found")
+
+
+isa_variant, _native = _load()
+globals().update({k: v for k, v in vars(_native).items() if not k.startswith("__")})
+__doc__ = _native.__doc__ or __doc__
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace los {
+
+// Lossy heightmap storage for DEMs that do not fit in memory as float32.
+//
+// The grid is cut into kQuantBlock x kQuantBlock blocks. Each block stores
+// a float base and scale, and per cell a code decoded as base + code * scale
+// (codes are biased once update() extends a block below its base):
+// 8-bit codes when the block's range fits in 254 steps, 16-bit codes
+// otherwise, and none when every cell is the same. The largest code of each
+// width marks a NaN cell.
+//
+// Codes round up. cells(x, y) is the smallest decoded height at or above the
+// original and lower(x, y) the next code down, at or below it, so the pair
+// brackets every cell within one step. Rays test cells(x, y): a ray that
+// clears it clears the original DEM, so quantizing never turns a blocked
+// ray visible, and only rays passing within a step of the ground can turn
+// blocked. Viewsheds keep the horizon on cells(x, y) and stand targets on
+// lower(x, y), so they only ever lose visible cells.
+constexpr int kQuantShift = 6;
+constexpr int kQuantBlock = 1 << kQuantShift;
+constexpr int kQuantMask = kQuantBlock - 1;
+
+class QuantizedHeightmap {
+public:
+    QuantizedHeightmap() = default;
+
+    // `step` is the height resolution asked for. Blocks whose range needs
+    // more than 65534 steps use a coarser scale; see max_error(). Heights
+    // must be finite or NaN.
+    QuantizedHeightmap(const float* data, int width, int height, float step)
+        : width_(width), height_(height), step_(step),
+          blocksX_((width + kQuantMask) >> kQuantShift),
+          blocksY_((height + kQuantMask) >> kQuantShift),
+          blocks_(static_cast<size_t>(blocksX_) * blocksY_) {
+        if (!(step > 0) || !std::isfinite(step))
+            throw std::invalid_argument("quantization step must be positive and finite");
+
+        // Each block is coded into its own buffer in parallel, then packed.
+        std::vector<std::vector<uint8_t>> codes(blocks_.size());
+        std::vector<uint8_t> finite(blocks_.size(), 1);
+        auto value = [data, width](int x, int y) { return data[static_cast<size_t>(y) * width + x]; };
+        parallel_for(blocksY_, 1, [&](int64_t begin, int64_t end, int) {
+            for (int by = static_cast<int>(begin); by < end; by++) {
+                for (int bx = 0; bx < blocksX_; bx++) {
+                    size_t i = static_cast<size_t>(by) * blocksX_ + bx;
+                    finite[i] = encode_block(value, bx, by, blocks_[i], codes[i]);
+                }
+            }
+        });
+        if (std::find(finite.begin(), finite.end(), 0) != finite.end())
+            throw std::invalid_argument("quantized heightmaps need finite or NaN heights");
+
+        size_t total = 0;
+        for (const std::vector<uint8_t>& c : codes)
+            total += c.size();
+        codes_.reserve(total);
+        for (size_t i = 0; i < blocks_.size(); i++) {
+            blocks_[i].offset = codes_.size();
+            blocks_[i].room = blocks_[i].bits;
+            codes_.insert(codes_.end(), codes[i].begin(), codes[i].end());
+            std::vector<uint8_t>().swap(codes[i]);
+        }
+    }
+
+    // Replace cells [x, x + w) x [y, y + h) with `patch` (row-major, `stride`
+    // floats per row) and re-code only the blocks it overlaps. Those blocks
+    // keep their base and scale, extending the codes below base if the patch
+    // goes lower, so the other cells decode exactly as before. A block whose
+    // new range no longer fits 16-bit codes is re-planned from their upper
+    // bounds, which may rise by a step. Heights must be finite or NaN;
+    // nothing changes if one is not.
+    void update(int x, int y, int w, int h, const float* patch, size_t stride) {
+        for (int j = 0; j < h; j++)
+            for (int i = 0; i < w; i++)
+                if (std::isinf(patch[j * stride + i]))
+                    throw std::invalid_argument("quantized heightmaps need finite or NaN heights");
+
+        int bx0 = x >> kQuantShift, bx1 = (x + w - 1) >> kQuantShift;
+        int by0 = y >> kQuantShift, by1 = (y + h - 1) >> kQuantShift;
+        int cols = bx1 - bx0 + 1;
+        std::vector<Block> planned(static_cast<size_t>(cols) * (by1 - by0 + 1));
+        std::vector<std::vector<uint8_t>> codes(planned.size());
+        auto value = [&](int cx, int cy) {
+            if (cx >= x && cx < x + w && cy >= y && cy < y + h)
+                return patch[(cy - y) * stride + (cx - x)];
+            return (*this)(cx, cy);
+        };
+        parallel_for(static_cast<int64_t>(planned.size()), 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t k = begin; k < end; k++) {
+                int bx = bx0 + static_cast<int>(k % cols), by = by0 + static_cast<int>(k / cols);
+                if (!recode_block(value, bx, by, planned[k], codes[k]))
+                    encode_block(value, bx, by, planned[k], codes[k]);
+            }
+        });
+
+        // Blocks that grew move to the end of codes_; compact once more
+        // than half of it is abandoned slots.
+        for (size_t k = 0; k < planned.size(); k++) {
+            Block& b = blocks_[static_cast<size_t>(by0 + k / cols) * blocksX_ + bx0 + k % cols];
+            Block nb = planned[k];
+            nb.offset = b.offset;
+            nb.room = b.room;
+            if (nb.bits > b.room) {
+                abandoned_ += slot_bytes(b.room);
+                nb.offset = codes_.size();
+                nb.room = nb.bits;
+                codes_.resize(codes_.size() + codes[k].size());
+            }
+            std::memcpy(codes_.data() + nb.offset, codes[k].data(), codes[k].size());
+            b = nb;
+        }
+        if (abandoned_ > codes_.size() / 2)
+            compact();
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    bool empty() const { return blocks_.empty(); }
+    size_t bytes() const { return codes_.size() + blocks_.size() * sizeof(Block); }
+
+    // Largest gap between cells(x, y) and lower(x, y) anywhere on the grid.
+    float max_error() const {
+        float e = 0.0f;
+        for (const Block& b : blocks_)
+            if (b.bits)
+                e = std::max(e, b.scale);
+        return e;
+    }
+
+    // Height a ray must clear at (x, y): at or above the original.
+    float operator()(int x, int y) const {
+        const Block& b = block(x, y);
+        if (!b.bits)
+            return b.base;
+        uint32_t q = code(b, x, y);
+        return q == nan_code(b) ? std::numeric_limits<float>::quiet_NaN() : decode(b, q);
+    }
+
+    // Height a target stands on at (x, y): at or below the original.
+    float lower(int x, int y) const {
+        const Block& b = block(x, y);
+        if (!b.bits)
+            return b.base;
+        uint32_t q = code(b, x, y);
+        if (q == nan_code(b))
+            return std::numeric_limits<float>::quiet_NaN();
+        return decode(b, q ? q - 1 : 0);
+    }
+
+    // operator() for every cell, row-major (what a pyramid over this grid
+    // must bound).
+    std::vector<float> decode_upper() const {
+        std::vector<float> out(static_cast<size_t>(width_) * height_);
+        parallel_for(height_, 16, [&](int64_t begin, int64_t end, int) {
+            for (int y = static_cast<int>(begin); y < end; y++)
+                for (int x = 0; x < width_; x++)
+                    out[static_cast<size_t>(y) * width_ + x] = (*this)(x, y);
+        });
+        return out;
+    }
+
+private:
+    struct Block {
+        float base = 0.0f;   // height of code `bias`; of every cell when bits is 0
+        float scale = 0.0f;  // height per code step
+        size_t offset = 0;   // into codes_
+        uint8_t bits = 0;    // 0, 8 or 16
+        uint8_t room = 0;    // code width the slot at offset has space for
+        uint16_t bias = 0;   // steps update() has extended the range below base
+    };
+
+    static size_t slot_bytes(int bits) { return static_cast<size_t>(bits / 8) * kQuantBlock * kQuantBlock; }
+
+    const Block& block(int x, int y) const {
+        return blocks_[static_cast<size_t>(y >> kQuantShift) * blocksX_ + (x >> kQuantShift)];
+    }
+
+    static size_t cell(int x, int y) {
+        return static_cast<size_t>((y & kQuantMask) << kQuantShift | (x & kQuantMask));
+    }
+
+    uint32_t code(const Block& b, int x, int y) const {
+        const uint8_t* p = codes_.data() + b.offset;
+        if (b.bits == 8)
+            return p[cell(x, y)];
+        uint16_t v;
+        std::memcpy(&v, p + 2 * cell(x, y), sizeof(v));
+        return v;
+    }
+
+    static uint32_t nan_code(const Block& b) { return b.bits == 8 ? 0xFFu : 0xFFFFu; }
+
+    static float decode(const Block& b, uint32_t q) {
+        return b.base + static_cast<float>(static_cast<int32_t>(q) - b.bias) * b.scale;
+    }
+
+    // Smallest code decoding at or above h. decode() is monotonic in q, so
+    // decode(q - 1) < h and lower() stays at or below h.
+    static uint32_t round_up(const Block& b, float h) {
+        double guess = std::ceil((static_cast<double>(h) - b.base) / b.scale) + b.bias;
+        uint32_t q = static_cast<uint32_t>(std::max(0.0, std::min(guess, 1e9)));
+        while (decode(b, q) < h)
+            q++;
+        while (q > 0 && decode(b, q - 1) >= h)
+            q--;
+        return q;
+    }
+
+    // Plans and codes block (bx, by) of value(x, y) into `b` and `out`;
+    // false if it holds an infinite height.
+    template <typename Value>
+    bool encode_block(const Value& value, int bx, int by, Block& b,
+                      std::vector<uint8_t>& out) const {
+        b = Block();
+        out.clear();
+        float lo = std::numeric_limits<float>::infinity();
+        float hi = -std::numeric_limits<float>::infinity();
+        bool nan = false;
+        for_cells(bx, by, [&](int x, int y) {
+            float h = value(x, y);
+            if (std::isnan(h)) {
+                nan = true;
+            } else {
+                lo = std::min(lo, h);
+                hi = std::max(hi, h);
+            }
+        });
+
+        if (lo > hi) {  // all NaN
+            b.base = std::numeric_limits<float>::quiet_NaN();
+            return true;
+        }
+        if (!std::isfinite(lo) || !std::isfinite(hi))
+            return false;
+
+        b.base = lo;
+        if (hi == lo && !nan)
+            return true;
+
+        double range = static_cast<double>(hi) - lo;
+        if (range <= 254.0 * step_) {
+            b.bits = 8;
+            b.scale = step_;
+        } else {
+            b.bits = 16;
+            b.scale = static_cast<float>(std::max<double>(step_, range / 65534.0));
+        }
+
+        std::vector<uint32_t> q;
+        while (true) {
+            q.assign(kQuantBlock * kQuantBlock, nan_code(b));
+            uint32_t top = 0;
+            for_cells(bx, by, [&](int x, int y) {
+                float h = value(x, y);
+                if (!std::isnan(h))
+                    top = std::max(top, q[cell(x, y)] = round_up(b, h));
+            });
+            if (top < nan_code(b))
+                break;
+            // Float rounding pushed the top code past the range planned for:
+            // widen 8-bit blocks, coarsen 16-bit ones.
+            if (b.bits == 8)
+                b.bits = 16;
+            else
+                b.scale = std::nextafter(b.scale * (1.0f + 1.0f / 4096), INFINITY);
+        }
+        pack(b, q, out);
+        return true;
+    }
+
+    // Codes block (bx, by) of value(x, y) on its current base and scale,
+    // biasing the codes to reach any new minimum. Cells whose value() is
+    // their current upper bound keep both bounds bit for bit. False when the
+    // block has no codes or the range no longer fits 16 bits; encode_block()
+    // then re-plans it.
+    template <typename Value>
+    bool recode_block(const Value& value, int bx, int by, Block& b,
+                      std::vector<uint8_t>& out) const {
+        b = blocks_[static_cast<size_t>(by) * blocksX_ + bx];
+        if (!b.bits)
+            return false;
+        float lo = std::numeric_limits<float>::infinity();
+        for_cells(bx, by, [&](int x, int y) { lo = std::min(lo, value(x, y)); });
+        double below = std::ceil((static_cast<double>(decode(b, 0)) - lo) / b.scale);
+        if (below > 0) {
+            if (below + b.bias >= 0xFFFF)
+                return false;
+            b.bias += static_cast<uint16_t>(below);
+            while (decode(b, 0) > lo) {  // float rounding of the step count
+                if (b.bias == 0xFFFE)
+                    return false;
+                b.bias++;
+            }
+        }
+
+        std::vector<uint32_t> q(kQuantBlock * kQuantBlock, 0xFFFFu);
+        uint32_t top = 0;
+        for_cells(bx, by, [&](int x, int y) {
+            float h = value(x, y);
+            if (!std::isnan(h))
+                top = std::max(top, q[cell(x, y)] = round_up(b, h));
+        });
+        if (top >= 0xFFFFu)
+            return false;
+        b.bits = top < 0xFFu ? 8 : 16;
+        for (uint32_t& c : q)
+            c = std::min(c, nan_code(b));
+        pack(b, q, out);
+        return true;
+    }
+
+    static void pack(const Block& b, const std::vector<uint32_t>& q, std::vector<uint8_t>& out) {
+        out.resize(q.size() * (b.bits / 8));
+        for (size_t i = 0; i < q.size(); i++) {
+            if (b.bits == 8) {
+                out[i] = static_cast<uint8_t>(q[i]);
+            } else {
+                uint16_t v = static_cast<uint16_t>(q[i]);
+                std::memcpy(&out[2 * i], &v, sizeof(v));
+            }
+        }
+    }
+
+    // Repack every block's codes without the slots update() abandoned.
+    void compact() {
+        std::vector<uint8_t> packed;
+        packed.reserve(codes_.size() - abandoned_);
+        for (Block& b : blocks_) {
+            size_t offset = packed.size();
+            packed.insert(packed.end(), codes_.begin() + b.offset,
+                          codes_.begin() + b.offset + slot_bytes(b.bits));
+            b.offset = offset;
+            b.room = b.bits;
+        }
+        codes_.swap(packed);
+        abandoned_ = 0;
+    }
+
+    template <typename F>
+    void for_cells(int bx, int by, F&& f) const {
+        int x0 = bx << kQuantShift, y0 = by << kQuantShift;
+        int x1 = std::min(width_, x0 + kQuantBlock), y1 = std::min(height_, y0 + kQuantBlock);
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                f(x, y);
+    }
+
+    int width_ = 0;
+    int height_ = 0;
+    float step_ = 0.0f;
+    int blocksX_ = 0;
+    int blocksY_ = 0;
+    std::vector<Block> blocks_;
+    std::vector<uint8_t> codes_;
+    size_t abandoned_ = 0;  // bytes of codes_ no block uses
+};
+
+} // namespace los
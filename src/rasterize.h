@@ -0,0 +1,379 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace los {
+
+// Per-cell statistic a Rasterizer reduces its points to.
+enum class CellStat { Max, Min, Mean, Percentile };
+
+// Which returns of a multi-return pulse a Rasterizer keeps.
+enum class Returns { All, First, Last };
+
+// Streaming point cloud to DEM binning.
+//
+// The grid covers [x_min, x_max] x [y_min, y_max] in cells of `resolution`
+// and is north-up: row 0 holds the cells just below y_max, so it matches a
+// GeoTIFF transform anchored at (x_min, y_max). Points are added in chunks
+// of any size and each one lands in exactly one cell, so memory is one
+// accumulator per cell whatever the point count. CellStat::Percentile also
+// keeps every accepted z (12 bytes per point) until finish().
+//
+// add() spreads each chunk over the thread pool but is not itself
+// thread-safe; feed chunks from one thread.
+class Rasterizer {
+public:
+    Rasterizer(double x_min, double y_min, double x_max, double y_max, double resolution,
+               CellStat stat = CellStat::Max, double percentile = 50.0)
+        : xMin_(x_min), yMax_(y_max), resolution_(resolution), stat_(stat),
+          percentile_(percentile) {
+        if (!(resolution > 0) || !std::isfinite(resolution))
+            throw std::invalid_argument("resolution must be positive");
+        if (!(x_max > x_min) || !(y_max > y_min) || !std::isfinite(x_max - x_min) ||
+            !std::isfinite(y_max - y_min))
+            throw std::invalid_argument("bounds must have x_max > x_min and y_max > y_min");
+        if (!(percentile >= 0 && percentile <= 100))
+            throw std::invalid_argument("percentile must be in [0, 100]");
+
+        // One cell past the last full one, so points on x_max and y_min land
+        // in the last column and row.
+        double w = std::floor((x_max - x_min) / resolution) + 1;
+        double h = std::floor((y_max - y_min) / resolution) + 1;
+        if (w >= std::numeric_limits<int>::max() || h >= std::numeric_limits<int>::max())
+            throw std::invalid_argument("grid is wider than 2^31 cells");
+        width_ = static_cast<int>(w);
+        height_ = static_cast<int>(h);
+
+        size_t cells = static_cast<size_t>(width_) * height_;
+        count_.assign(cells, 0);
+        if (stat_ == CellStat::Mean)
+            sum_.assign(cells, 0.0);
+        else if (stat_ != CellStat::Percentile)
+            value_.assign(cells, stat_ == CellStat::Max ? -std::numeric_limits<float>::infinity()
+                                                        : std::numeric_limits<float>::infinity());
+        keep_.set();
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    double resolution() const { return resolution_; }
+    double x_min() const { return xMin_; }
+    double y_max() const { return yMax_; }
+    CellStat stat() const { return stat_; }
+    Returns returns() const { return returns_; }
+    int64_t points() const { return points_; }    // accepted so far
+    int64_t skipped() const { return skipped_; }  // outside the grid, NaN or filtered out
+
+    // Keep only points whose LAS classification is in `classes` (e.g. {2}
+    // for ground); the default keeps every class. Points added without a
+    // classification array are always kept.
+    void set_classes(const std::vector<int>& classes) {
+        keep_.reset();
+        for (int c : classes)
+            if (c >= 0 && c < 256)
+                keep_.set(static_cast<size_t>(c));
+    }
+
+    // Returns::First keeps return_number == 1 and Returns::Last keeps
+    // return_number == number_of_returns; both need the matching arrays.
+    void set_returns(Returns returns) { returns_ = returns; }
+
+    // n points; classification, return_number and number_of_returns may be
+    // null.
+    void add(const double* x, const double* y, const double* z, int64_t n,
+             const uint8_t* classification = nullptr, const uint8_t* return_number = nullptr,
+             const uint8_t* number_of_returns = nullptr) {
+        if (returns_ == Returns::First && !return_number)
+            throw std::invalid_argument("returns='first' needs return_number");
+        if (returns_ == Returns::Last && (!return_number || !number_of_returns))
+            throw std::invalid_argument("returns='last' needs return_number and number_of_returns");
+
+        // Cell of every point (kSkip when it is dropped) in parallel, then
+        // accumulate. Each thread owns a band of rows, so the band pass
+        // needs no atomics and its result does not depend on scheduling.
+        chunk_.resize(static_cast<size_t>(n));
+        const double inv = 1.0 / resolution_;
+        parallel_for(n, kChunkGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                double cx = std::floor((x[i] - xMin_) * inv);
+                double cy = std::floor((yMax_ - y[i]) * inv);
+                bool keep = cx >= 0 && cy >= 0 && cx < width_ && cy < height_ && !std::isnan(z[i]) &&
+                            (!classification || keep_.test(classification[i])) &&
+                            (returns_ != Returns::First || return_number[i] == 1) &&
+                            (returns_ != Returns::Last || return_number[i] == number_of_returns[i]);
+                chunk_[i] = keep ? static_cast<size_t>(cy) * width_ + static_cast<size_t>(cx) : kSkip;
+            }
+        });
+
+        int64_t kept = 0;
+        for (size_t cell : chunk_)
+            kept += cell != kSkip;
+        points_ += kept;
+        skipped_ += n - kept;
+
+        if (stat_ == CellStat::Percentile) {
+            for (int64_t i = 0; i < n; i++) {
+                if (chunk_[i] == kSkip)
+                    continue;
+                count_[chunk_[i]]++;
+                sampleCell_.push_back(chunk_[i]);
+                sampleZ_.push_back(static_cast<float>(z[i]));
+            }
+            return;
+        }
+
+        auto accumulate = [&](int64_t i) {
+            size_t cell = chunk_[i];
+            count_[cell]++;
+            float h = static_cast<float>(z[i]);
+            if (stat_ == CellStat::Max)
+                value_[cell] = std::max(value_[cell], h);
+            else if (stat_ == CellStat::Min)
+                value_[cell] = std::min(value_[cell], h);
+            else
+                sum_[cell] += z[i];
+        };
+        const int bands = std::max(1, std::min(ThreadPool::instance().num_threads(), height_));
+        if (bands == 1) {
+            for (int64_t i = 0; i < n; i++)
+                if (chunk_[i] != kSkip)
+                    accumulate(i);
+            return;
+        }
+
+        // Bucket the kept points by band with a counting sort so each band
+        // walks only its own points: a histogram per slice of the chunk,
+        // an offset per (band, slice), then a scatter in slice order. Points
+        // keep their order within a band, so each cell sees them as before.
+        rowBand_.resize(static_cast<size_t>(height_));
+        for (int band = 0; band < bands; band++)
+            std::fill(rowBand_.begin() + int64_t(height_) * band / bands,
+                      rowBand_.begin() + int64_t(height_) * (band + 1) / bands, band);
+        const int slices = bands;
+        std::vector<int64_t> offset(static_cast<size_t>(slices) * bands, 0);  // [slice][band]
+        parallel_for(slices, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t s = begin; s < end; s++) {
+                int64_t* hist = offset.data() + s * bands;
+                for (int64_t i = n * s / slices; i < n * (s + 1) / slices; i++)
+                    if (chunk_[i] != kSkip)
+                        hist[rowBand_[chunk_[i] / width_]]++;
+            }
+        });
+        std::vector<int64_t> bandStart(static_cast<size_t>(bands) + 1);
+        int64_t pos = 0;
+        for (int band = 0; band < bands; band++) {
+            bandStart[band] = pos;
+            for (int s = 0; s < slices; s++) {
+                int64_t c = offset[static_cast<size_t>(s) * bands + band];
+                offset[static_cast<size_t>(s) * bands + band] = pos;
+                pos += c;
+            }
+        }
+        bandStart[bands] = pos;
+        order_.resize(static_cast<size_t>(pos));
+        parallel_for(slices, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t s = begin; s < end; s++) {
+                int64_t* next = offset.data() + s * bands;
+                for (int64_t i = n * s / slices; i < n * (s + 1) / slices; i++)
+                    if (chunk_[i] != kSkip)
+                        order_[next[rowBand_[chunk_[i] / width_]]++] = i;
+            }
+        });
+
+        parallel_for(bands, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t band = begin; band < end; band++) {
+                for (int64_t k = bandStart[band]; k < bandStart[band + 1]; k++)
+                    accumulate(order_[k]);
+            }
+        });
+    }
+
+    // Points binned into each cell, row-major.
+    const std::vector<uint32_t>& counts() const { return count_; }
+
+    // Writes the DEM so far to out (row-major, width x height). Empty cells
+    // are NaN unless `fill_holes`, which gives each one the value of the
+    // nearest non-empty cell (Euclidean, in cells) within
+    // `max_fill_distance` cells. add() may continue afterwards.
+    void finish(float* out, bool fill_holes = true,
+                double max_fill_distance = std::numeric_limits<double>::infinity()) const {
+        std::fill(out, out + count_.size(), std::numeric_limits<float>::quiet_NaN());
+
+        if (stat_ == CellStat::Percentile) {
+            percentiles(out);
+        } else {
+            parallel_for(height_, 16, [&](int64_t begin, int64_t end, int) {
+                for (size_t i = static_cast<size_t>(begin) * width_;
+                     i < static_cast<size_t>(end) * width_; i++) {
+                    if (!count_[i])
+                        continue;
+                    out[i] = stat_ == CellStat::Mean ? static_cast<float>(sum_[i] / count_[i])
+                                                     : value_[i];
+                }
+            });
+        }
+
+        if (fill_holes && points_ > 0)
+            fill_nearest(out, width_, height_, max_fill_distance);
+    }
+
+    std::vector<float> finish(bool fill_holes = true,
+                              double max_fill_distance = std::numeric_limits<double>::infinity()) const {
+        std::vector<float> out(count_.size());
+        finish(out.data(), fill_holes, max_fill_distance);
+        return out;
+    }
+
+    // Replace every NaN cell of a row-major grid with the nearest non-NaN
+    // cell within max_distance cells, using the exact Euclidean feature
+    // transform of Felzenszwalb & Huttenlocher: a column pass finds the
+    // nearest filled row, then a row pass takes the lower envelope of the
+    // resulting parabolas. O(cells), parallel over columns and rows, in
+    // place: only NaN cells are written and only original cells are read.
+    // Returns the number of cells filled.
+    static int64_t fill_nearest(float* grid, int width, int height, double max_distance) {
+        const size_t cells = static_cast<size_t>(width) * height;
+        std::vector<int> nearRow(cells, -1);
+
+        parallel_for(width, 64, [&](int64_t begin, int64_t end, int) {
+            for (int x = static_cast<int>(begin); x < end; x++) {
+                int last = -1;
+                for (int y = 0; y < height; y++) {
+                    size_t i = static_cast<size_t>(y) * width + x;
+                    if (!std::isnan(grid[i]))
+                        last = y;
+                    nearRow[i] = last;
+                }
+                last = -1;
+                for (int y = height - 1; y >= 0; y--) {
+                    size_t i = static_cast<size_t>(y) * width + x;
+                    if (!std::isnan(grid[i]))
+                        last = y;
+                    if (last >= 0 && (nearRow[i] < 0 || last - y < y - nearRow[i]))
+                        nearRow[i] = last;
+                }
+            }
+        });
+
+        const double maxD2 = max_distance * max_distance;
+        std::atomic<int64_t> filled{0};
+        parallel_for(height, 16, [&](int64_t begin, int64_t end, int) {
+            std::vector<int> site(width);       // envelope parabolas' columns
+            std::vector<double> bound(width + 1);
+            int64_t count = 0;
+            for (int y = static_cast<int>(begin); y < end; y++) {
+                const int* row = nearRow.data() + static_cast<size_t>(y) * width;
+                auto f = [&](int x) {
+                    double d = row[x] - y;
+                    return d * d;
+                };
+
+                int k = -1;
+                for (int q = 0; q < width; q++) {
+                    if (row[q] < 0)
+                        continue;
+                    double fq = f(q) + static_cast<double>(q) * q;
+                    double s = -std::numeric_limits<double>::infinity();
+                    while (k >= 0) {
+                        int p = site[k];
+                        s = (fq - f(p) - static_cast<double>(p) * p) / (2.0 * (q - p));
+                        if (s > bound[k])
+                            break;
+                        k--;
+                    }
+                    k++;
+                    site[k] = q;
+                    bound[k] = k ? s : -std::numeric_limits<double>::infinity();
+                }
+                if (k < 0)
+                    continue;
+
+                for (int q = 0, j = 0; q < width; q++) {
+                    while (j < k && bound[j + 1] <= q)
+                        j++;
+                    size_t i = static_cast<size_t>(y) * width + q;
+                    if (!std::isnan(grid[i]))
+                        continue;
+                    int p = site[j];
+                    double dx = q - p;
+                    if (dx * dx + f(p) <= maxD2) {
+                        grid[i] = grid[static_cast<size_t>(row[p]) * width + p];
+                        count++;
+                    }
+                }
+            }
+            filled.fetch_add(count, std::memory_order_relaxed);
+        });
+        return filled.load();
+    }
+
+private:
+    static constexpr size_t kSkip = ~size_t(0);
+    static constexpr int64_t kChunkGrain = 1 << 16;
+
+    // Linear-interpolated percentile (numpy's default) of each cell's
+    // samples: bucket them by cell, then select inside each bucket.
+    void percentiles(float* out) const {
+        const size_t cells = count_.size();
+        std::vector<size_t> start(cells + 1, 0);
+        for (size_t i = 0; i < cells; i++)
+            start[i + 1] = start[i] + count_[i];
+        std::vector<float> z(sampleZ_.size());
+        {
+            std::vector<size_t> pos(start.begin(), start.end() - 1);
+            for (size_t i = 0; i < sampleZ_.size(); i++)
+                z[pos[sampleCell_[i]]++] = sampleZ_[i];
+        }
+
+        const double p = percentile_ / 100.0;
+        parallel_for(height_, 16, [&](int64_t begin, int64_t end, int) {
+            for (size_t i = static_cast<size_t>(begin) * width_;
+                 i < static_cast<size_t>(end) * width_; i++) {
+                size_t n = count_[i];
+                if (!n)
+                    continue;
+                float* b = z.data() + start[i];
+                double rank = p * static_cast<double>(n - 1);
+                size_t lo = static_cast<size_t>(rank);
+                std::nth_element(b, b + lo, b + n);
+                double v = b[lo];
+                if (lo + 1 < n && rank > lo) {
+                    double next = *std::min_element(b + lo + 1, b + n);
+                    v += (next - v) * (rank - lo);
+                }
+                out[i] = static_cast<float>(v);
+            }
+        });
+    }
+
+    double xMin_;
+    double yMax_;
+    double resolution_;
+    CellStat stat_;
+    double percentile_;
+    Returns returns_ = Returns::All;
+    std::bitset<256> keep_;
+    int width_ = 0;
+    int height_ = 0;
+    int64_t points_ = 0;
+    int64_t skipped_ = 0;
+    std::vector<uint32_t> count_;
+    std::vector<float> value_;   // Max / Min
+    std::vector<double> sum_;    // Mean
+    std::vector<size_t> sampleCell_;  // Percentile: cell and z of every point
+    std::vector<float> sampleZ_;
+    std::vector<size_t> chunk_;       // add() scratch: cell of each point
+    std::vector<int64_t> order_;      // add() scratch: kept points grouped by band
+    std::vector<int> rowBand_;        // add() scratch: band of each row
+};
+
+} // namespace los
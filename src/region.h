@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+
+namespace los {
+
+// Inclusive cell bounds of a rectangle of the grid.
+struct CellRect {
+    int x0, y0, x1, y1;
+
+    // Whether the segment (ax, ay) -> (bx, by) passes within `pad` cells of
+    // the rectangle (cell x covers [x, x + 1)). NaN endpoints count as a hit.
+    bool near_segment(double ax, double ay, double bx, double by, double pad) const {
+        double lo[2] = {x0 - pad, y0 - pad};
+        double hi[2] = {x1 + 1 + pad, y1 + 1 + pad};
+        double a[2] = {ax, ay}, d[2] = {bx - ax, by - ay};
+        double t0 = 0.0, t1 = 1.0;
+        for (int k = 0; k < 2; k++) {
+            if (std::isnan(a[k]) || std::isnan(d[k]))
+                return true;
+            if (d[k] == 0.0) {
+                if (a[k] < lo[k] || a[k] > hi[k])
+                    return false;
+                continue;
+            }
+            double ta = (lo[k] - a[k]) / d[k], tb = (hi[k] - a[k]) / d[k];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        return t0 <= t1;
+    }
+
+    // Whether the disc of `radius` cells around (cx, cy) reaches within
+    // `pad` cells of the rectangle.
+    bool near_disc(double cx, double cy, double radius, double pad) const {
+        double dx = std::max({x0 - pad - cx, 0.0, cx - (x1 + 1 + pad)});
+        double dy = std::max({y0 - pad - cy, 0.0, cy - (y1 + 1 + pad)});
+        return !(dx * dx + dy * dy > radius * radius);
+    }
+};
+
+// Revision counter and the rectangles changed by the latest revisions, so
+// a result computed at revision r can tell whether anything it read has
+// changed since. Only the last kCapacity updates are kept; anything older
+// counts as changed everywhere.
+class UpdateLog {
+public:
+    static constexpr size_t kCapacity = 256;
+
+    uint64_t revision() const { return revision_; }
+
+    void record(const CellRect& rect) {
+        if (log_.size() == kCapacity)
+            log_.pop_front();
+        log_.push_back({++revision_, rect});
+    }
+
+    // Whether any update after `revision` satisfies touches(rect).
+    template <typename Touches>
+    bool changed_since(uint64_t revision, const Touches& touches) const {
+        if (revision >= revision_)
+            return false;
+        if (log_.empty() || revision + 1 < log_.front().revision)
+            return true;
+        for (auto it = log_.rbegin(); it != log_.rend() && it->revision > revision; ++it)
+            if (touches(it->rect))
+                return true;
+        return false;
+    }
+
+private:
+    struct Entry {
+        uint64_t revision;
+        CellRect rect;
+    };
+
+    uint64_t revision_ = 0;
+    std::deque<Entry> log_;
+};
+
+} // namespace los
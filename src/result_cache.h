@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace los {
+
+// Bounded cache of ray answers for services that ask the same question
+// again with sub-cell jitter.
+//
+// A query is keyed on its endpoints snapped to cell_bin cells in x and y and
+// height_bin in z, plus its sample count (0 for los_boolean). Any query in
+// the same bins gets the answer first computed for that bin. Each entry
+// records the terrain revision it was computed at and is checked against
+// the terrain's update log on a hit (see Terrain::ray_changed_since), so
+// update_region() invalidates only entries whose rays cross the region.
+//
+// The cache is split into shards by key, each with its own lock and LRU
+// list holding capacity / shards entries, so pool threads rarely contend.
+class ResultCache {
+public:
+    struct Key {
+        int64_t bins[6];
+        int32_t samples;
+
+        bool operator==(const Key& o) const {
+            return samples == o.samples && std::memcmp(bins, o.bins, sizeof(bins)) == 0;
+        }
+    };
+
+    struct Stats {
+        uint64_t hits, misses, invalidated, evictions;
+        size_t entries, capacity;
+    };
+
+    ResultCache(size_t capacity, double cell_bin, double height_bin)
+        : capacity_(std::max<size_t>(capacity, 1)), cellBin_(cell_bin), heightBin_(height_bin) {
+        // Keep at least 64 entries per shard so LRU order still means something.
+        size_t shards = std::min<size_t>(kMaxShards, capacity_ / 64);
+        shards_ = std::vector<Shard>(std::max<size_t>(shards, 1));
+        shardCapacity_ = std::max<size_t>(capacity_ / shards_.size(), 1);
+    }
+
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    double cell_bin() const { return cellBin_; }
+    double height_bin() const { return heightBin_; }
+
+    // Key of the ray r = (x0, y0, z0, x1, y1, z1); false for rays with
+    // NaN or huge coordinates, which are not cached.
+    bool key(const double* r, int samples, Key& k) const {
+        for (int i = 0; i < 6; i++) {
+            double b = std::floor(r[i] / ((i == 2 || i == 5) ? heightBin_ : cellBin_));
+            if (!(std::abs(b) < 9e18))
+                return false;
+            k.bins[i] = static_cast<int64_t>(b);
+        }
+        k.samples = samples;
+        return true;
+    }
+
+    // Cached answer for `key` into `value`. An entry older than `revision`
+    // is dropped when stale(entry_revision) says its cells changed, and
+    // otherwise re-stamped with `revision`.
+    template <typename Stale>
+    bool lookup(const Key& key, uint64_t revision, const Stale& stale, double& value) const {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Entry& e = *it->second;
+        if (e.revision < revision) {
+            if (stale(e.revision)) {
+                shard.lru.erase(it->second);
+                shard.index.erase(it);
+                invalidated_.fetch_add(1, std::memory_order_relaxed);
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            e.revision = revision;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        value = e.value;
+        return true;
+    }
+
+    // Store an answer computed at `revision`. Two threads may compute the
+    // same key; the later insert wins, and both answers are the same.
+    void insert(const Key& key, uint64_t revision, double value) const {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            it->second->revision = revision;
+            it->second->value = value;
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return;
+        }
+        shard.lru.push_front({key, revision, value});
+        shard.index.emplace(key, shard.lru.begin());
+        while (shard.lru.size() > shardCapacity_) {
+            shard.index.erase(shard.lru.back().key);
+            shard.lru.pop_back();
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Stats stats() const {
+        Stats s{hits_.load(), misses_.load(), invalidated_.load(), evictions_.load(), 0,
+                shardCapacity_ * shards_.size()};
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            s.entries += shard.lru.size();
+        }
+        return s;
+    }
+
+    void reset_stats() {
+        hits_ = 0;
+        misses_ = 0;
+        invalidated_ = 0;
+        evictions_ = 0;
+    }
+
+    void clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.lru.clear();
+            shard.index.clear();
+        }
+    }
+
+private:
+    static constexpr size_t kMaxShards = 16;
+
+    struct Entry {
+        Key key;
+        uint64_t revision;
+        double value;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = static_cast<uint64_t>(k.samples);
+            for (int64_t b : k.bins)
+                h = (h ^ static_cast<uint64_t>(b)) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h ^ h >> 29);
+        }
+    };
+
+    using Lru = std::list<Entry>;
+
+    struct Shard {
+        std::mutex mutex;
+        Lru lru;  // most recently used first
+        std::unordered_map<Key, Lru::iterator, KeyHash> index;
+    };
+
+    Shard& shard_of(const Key& key) const {
+        return shards_[(KeyHash()(key) >> 32) % shards_.size()];
+    }
+
+    size_t capacity_;
+    double cellBin_;
+    double heightBin_;
+    size_t shardCapacity_;
+    mutable std::vector<Shard> shards_;
+
+    mutable std::atomic<uint64_t> hits_{0}, misses_{0}, invalidated_{0}, evictions_{0};
+};
+
+} // namespace los
@@ -1,18 +1,81 @@
 #!/usr/bin/env python3
 
-from setuptools import setup, Extension
-import pybind11
+import os
+import sys
+
+from setuptools import setup
+from pybind11.setup_helpers import Pybind11Extension, build_ext
+
+# std::thread needs -pthread on older glibc toolchains
+thread_args = [] if sys.platform == "win32" else ["-pthread"]
+
+# The SIMD packet kernel matches the scalar kernel bit for bit only if
+# neither contracts the ray height into a fused multiply-add.
+fp_args = [] if sys.platform == "win32" else ["-ffp-contract=off"]
+
+# Optimization knobs for this single-module build (the CMake build in
+# CMakeLists.txt also ships per-ISA variants):
+#   LOS_MARCH=native|x86-64-v3|...  target one microarchitecture
+#   LOS_LTO=1                       link-time optimization
+#   LOS_FAST_MATH=1                 -ffast-math, keeping infinities; answers
+#                                   may then differ from the exact kernels
+#   LOS_STATS=1                     hot-path counters for los.get_stats()
+opt_args, lto_args = [], []
+if sys.platform != "win32":
+    opt_args = ["-O3"]
+    if os.environ.get("LOS_MARCH"):
+        opt_args.append(f"-march={os.environ['LOS_MARCH']}")
+    if os.environ.get("LOS_LTO") == "1":
+        lto_args = ["-flto"]
+    if os.environ.get("LOS_FAST_MATH") == "1":
+        fp_args = ["-ffast-math", "-fno-finite-math-only"]
+
+# Optional GPU backend (gpu.cpp, OpenMP target offload): LOS_GPU=1 compiles
+# it with -fopenmp plus the offload flags in LOS_GPU_OFFLOAD, e.g.
+# "-fopenmp-targets=nvptx64-nvidia-cuda" (Clang, CUDA devices) or
+# "-foffload=amdgcn-amdhsa" (GCC, HIP/ROCm devices). Without LOS_GPU
+# nothing here changes and no offload toolchain is needed.
+gpu = os.environ.get("LOS_GPU") == "1"
+gpu_args = ["-fopenmp", *os.environ.get("LOS_GPU_OFFLOAD", "").split()] if gpu else []
+
+
+class build_ext_gpu(build_ext):
+    """build_ext that first compiles gpu.cpp and links it into the module."""
+
+    def build_extensions(self):
+        if gpu:
+            objects = self.compiler.compile(
+                ["gpu.cpp"], output_dir=self.build_temp, include_dirs=["."],
+                macros=define_macros,
+                extra_postargs=["-std=c++17", "-fPIC"] + thread_args + fp_args + opt_args
+                + gpu_args)
+            for ext in self.extensions:
+                ext.extra_objects.extend(objects)
+        super().build_extensions()
+
+
+define_macros = [("LOS_ENABLE_STATS", "1")] if os.environ.get("LOS_STATS") == "1" else []
+if gpu:
+    define_macros.append(("LOS_WITH_GPU", "1"))
 
 ext_modules = [
-    Extension(
+    Pybind11Extension(
         "los",
         ["los.cpp"],
-        include_dirs=[pybind11.get_include()],
-        language="c++"
+        depends=["area.h", "bilinear.h", "fresnel.h", "gpu.cpp", "gpu.h", "horizon.h",
+                 "layout.h", "los_kernel.h", "packet.h", "preprocess.h", "pyramid.h",
+                 "quantized.h", "rasterize.h", "region.h", "result_cache.h", "stats.h",
+                 "task_queue.h", "terrain.h", "thread_pool.h", "tiled.h", "trace.h",
+                 "viewshed.h"],
+        cxx_std=17,
+        define_macros=define_macros,
+        extra_compile_args=thread_args + fp_args + opt_args + lto_args,
+        extra_link_args=thread_args + lto_args + gpu_args,
     ),
 ]
 
 setup(
     name="los",
     ext_modules=ext_modules,
-)
\ No newline at end of file
+    cmdclass={"build_ext": build_ext_gpu},
+)
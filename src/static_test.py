@@ -1,5 +1,10 @@
 #!/usr/bin/env python3
 
+import asyncio
+import os
+import pickle
+import tempfile
+
 import numpy as np
 import los
 
@@ -34,4 +39,112 @@ print("LOS?:", los_runtime())
 
 z0, z1 = 100.0, 100.0
 print("\n=== Test 3: Raise observers above hill (should be visible) ===")
-print("LOS?:", los_runtime())
\ No newline at end of file
+print("LOS?:", los_runtime())
+
+# Every Terrain entry point once, on a small DEM with known answers:
+# 0-5 m noise cut by a 40 m wall along row 64.
+rng = np.random.default_rng(5)
+hills = (rng.random((128, 128)) * 5).astype(np.float32)
+hills[64, :] = 40.0
+terrain = los.Terrain(hills)
+over = (10.5, 10.5, 20.0, 10.5, 110.5, 20.0)   # crosses the wall
+beside = (10.5, 10.5, 20.0, 100.5, 30.5, 20.0)  # stays south of it
+pairs = np.array([over, beside])
+
+print("\n=== Test 4: los_trace / los_fresnel ===")
+r = terrain.los_trace(*over)
+print(r)
+assert not r.visible and r.hit[1] == 64
+profile = np.zeros((256, 5))
+r = terrain.los_trace(*beside, stop_at_block=False, profile=profile)
+assert r.visible and 0 < r.cells <= len(profile) and r.min_clearance > 0
+f = terrain.los_fresnel(*beside, frequency=2.4e9, cell_size=1.0)
+print(f)
+assert f.visible and not terrain.los_fresnel(*over, frequency=2.4e9).visible
+ratios = terrain.los_fresnel_batch(pairs, frequency=2.4e9)
+assert ratios.shape == (2,) and ratios[0] < 0 < ratios[1]
+assert list(terrain.los_boolean_batch(pairs)) == [0, 1]
+
+print("\n=== Test 5: earth curvature, bilinear, strided heightmaps ===")
+terrain.set_earth_curvature(1.0)
+assert terrain.earth_curvature == (1.0, 4.0 / 3.0)
+assert list(terrain.los_boolean_batch(pairs)) == [0, 1]
+terrain.clear_earth_curvature()
+assert terrain.earth_curvature is None
+bilinear = los.Terrain(hills, interpolation="bilinear")
+assert bilinear.interpolation == "bilinear"
+assert list(bilinear.los_boolean_batch(pairs)) == [0, 1]
+for view in (hills.astype(np.float64), hills.astype(np.int16), np.asfortranarray(hills)):
+    assert list(los.los_boolean_batch(view, pairs)) == [0, 1]
+    assert los.los_boolean(view, 128, 128, *over) == 0.0
+
+print("\n=== Test 6: async queries and stats ===")
+future = terrain.submit_batch(pairs)
+assert list(future.result(timeout=10)) == [0, 1] and future.done()
+called = []
+future.add_done_callback(called.append)
+assert called == [future]
+mask = terrain.viewshed_async(64.5, 20.5, 30.0).result()
+assert np.array_equal(mask, terrain.viewshed(64.5, 20.5, 30.0))
+
+
+async def awaited():
+    return await terrain.submit_batch(pairs, op="probability")
+
+
+assert np.array_equal(asyncio.run(awaited()), terrain.los_probability_batch(pairs))
+assert los.get_max_pending() >= 1
+los.reset_stats()
+print("get_stats:", los.get_stats())
+
+print("\n=== Test 7: area_visibility ===")
+r = terrain.area_visibility((0, 0, 8, 8), (0, 100, 8, 8), observer_height=10.0)
+print(r)
+assert r.pairs == 64 * 64 and r.visible == 0 and r.exact
+r = terrain.area_visibility((0, 0, 8, 8), (100, 0, 8, 8), observer_height=10.0,
+                            target_height=10.0)
+assert r.visible == r.pairs and r.fraction == 1.0
+
+print("\n=== Test 8: horizons ===")
+horizon = terrain.precompute_horizon((64.5, 20.5, 30.0), n_azimuths=90, n_bands=16)
+print(horizon)
+targets = np.array([[10.5, 110.5, 20.0], [100.5, 30.5, 20.0], [64.5, 127.5, 100.0]])
+rays = np.hstack([np.tile([64.5, 20.5, 30.0], (len(targets), 1)), targets])
+expected = terrain.los_boolean_batch(rays)
+assert list(expected) == [0, 1, 1]
+assert np.array_equal(terrain.los_horizon_batch(horizon, targets), expected)
+assert terrain.los_horizon(horizon, *targets[0]) == 0.0
+assert np.array_equal(pickle.loads(pickle.dumps(horizon)).angles, horizon.angles)
+
+with tempfile.TemporaryDirectory() as tmp:
+    horizon.save(os.path.join(tmp, "h.bin"))
+    assert np.array_equal(los.Horizon.load(os.path.join(tmp, "h.bin")).angles, horizon.angles)
+
+    print("\n=== Test 9: write_tiled_dem / fill_holes ===")
+    holed = hills.copy()
+    holed[20:30, 40:90] = np.nan
+    meta = {"bounds": {"x_min": 0.0}}
+    stats = los.write_tiled_dem(os.path.join(tmp, "t.ltd"), holed, meta, tile_size=32)
+    print(stats)
+    assert not np.isnan(holed).any() and stats["filled"] == 10 * 50
+    assert "z_min" not in meta["bounds"]
+    tiled = los.TiledTerrain(os.path.join(tmp, "t.ltd"))
+    assert tiled.metadata["bounds"]["z_max"] == stats["z_max"] == 40.0
+    assert np.array_equal(tiled.read_window(0, 0, 128, 128), holed)
+    assert np.array_equal(tiled.los_boolean_batch(pairs), los.Terrain(holed).los_boolean_batch(pairs))
+    tiled.set_earth_curvature(1.0)
+    assert tiled.earth_curvature == (1.0, 4.0 / 3.0)
+    del tiled
+
+    filled = hills.copy()
+    filled[20:30, 40:90] = np.nan
+    los.fill_holes(filled, method="push-pull")
+    assert np.array_equal(filled, holed)
+    try:
+        los.fill_holes(filled.astype(np.float64))
+    except TypeError:
+        pass
+    else:
+        raise AssertionError("fill_holes converted a float64 DEM")
+
+print("\nAll entry points ran.")
@@ -0,0 +1,231 @@
+#pragma once
+
+// Hot-path counters for finding out why queries are slow, compiled in only
+// with -DLOS_ENABLE_STATS (LOS_STATS=1 for setup.py, -DLOS_STATS=ON for
+// CMake). Without it every LOS_STAT_* macro expands to nothing, so release
+// kernels are unchanged, and device code (gpu.cpp offloaded) never counts.
+//
+// Each thread counts into its own block of relaxed atomics that only it
+// writes; collect() sums the live blocks plus those of exited threads.
+// reset() records the current sums as a baseline instead of zeroing other
+// threads' blocks, so it never races a running query.
+//
+//   cells    cells tested one at a time, by every walk and packet lane
+//   rays     queries timed by LOS_STAT_SCOPE (a probability query is one)
+//   samples  sample rays traced for los_probability
+//   packet_rays        rays traced as SIMD packets
+//   tile_hits, tile_misses   TileCache lookups
+//   skipped[l]         pyramid blocks of level l skipped without a cell test
+//   cells_histogram[k] rays that tested [2^k, 2^(k+1)) cells (k = 0: 0 or 1)
+//   ns_histogram[k]    queries that took [2^k, 2^(k+1)) ns
+
+#if defined(LOS_ENABLE_STATS) && !defined(__NVPTX__) && !defined(__nvptx__) && \
+    !defined(__AMDGCN__)
+#define LOS_STATS_ON 1
+#else
+#define LOS_STATS_ON 0
+#endif
+
+#include <cstdint>
+
+#if LOS_STATS_ON
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace los {
+namespace stats {
+
+constexpr bool kEnabled = LOS_STATS_ON;
+
+enum Counter { Cells, Rays, Samples, PacketRays, TileHits, TileMisses, RayNs, kCounters };
+
+constexpr int kLevels = 32;
+constexpr int kBuckets = 48;
+
+// Plain sums of every counter, as collect() returns them.
+struct Totals {
+    uint64_t counters[kCounters] = {};
+    uint64_t skipped[kLevels] = {};
+    uint64_t cellsHistogram[kBuckets] = {};
+    uint64_t nsHistogram[kBuckets] = {};
+};
+
+// Histogram bucket of v: floor(log2(v)), with 0 and 1 in bucket 0.
+inline int bucket_of(uint64_t v) {
+    int b = 0;
+    while (v > 1 && b < kBuckets - 1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+#if LOS_STATS_ON
+
+class Registry {
+public:
+    struct Block {
+        std::atomic<uint64_t> counters[kCounters] = {};
+        std::atomic<uint64_t> skipped[kLevels] = {};
+        std::atomic<uint64_t> cellsHistogram[kBuckets] = {};
+        std::atomic<uint64_t> nsHistogram[kBuckets] = {};
+    };
+
+    // Never destroyed: pool threads may exit during static destruction.
+    static Registry& instance() {
+        static Registry* registry = new Registry;
+        return *registry;
+    }
+
+    // The calling thread's block.
+    static Block& local() {
+        thread_local Local local;
+        return local.block;
+    }
+
+    // Current sums minus the baseline of the last reset().
+    Totals collect() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Totals t = sum_locked();
+        subtract(t, baseline_);
+        return t;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        baseline_ = sum_locked();
+    }
+
+private:
+    struct Local {
+        Block block;
+        Local() {
+            Registry& r = instance();
+            std::lock_guard<std::mutex> lock(r.mutex_);
+            r.live_.push_back(&block);
+        }
+        ~Local() {
+            Registry& r = instance();
+            std::lock_guard<std::mutex> lock(r.mutex_);
+            add(r.retired_, block);
+            for (size_t i = 0; i < r.live_.size(); i++)
+                if (r.live_[i] == &block) {
+                    r.live_[i] = r.live_.back();
+                    r.live_.pop_back();
+                    break;
+                }
+        }
+    };
+
+    static void add(Totals& t, const Block& b) {
+        for (int i = 0; i < kCounters; i++)
+            t.counters[i] += b.counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < kLevels; i++)
+            t.skipped[i] += b.skipped[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < kBuckets; i++) {
+            t.cellsHistogram[i] += b.cellsHistogram[i].load(std::memory_order_relaxed);
+            t.nsHistogram[i] += b.nsHistogram[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static void subtract(Totals& t, const Totals& base) {
+        for (int i = 0; i < kCounters; i++)
+            t.counters[i] -= base.counters[i];
+        for (int i = 0; i < kLevels; i++)
+            t.skipped[i] -= base.skipped[i];
+        for (int i = 0; i < kBuckets; i++) {
+            t.cellsHistogram[i] -= base.cellsHistogram[i];
+            t.nsHistogram[i] -= base.nsHistogram[i];
+        }
+    }
+
+    Totals sum_locked() const {
+        Totals t = retired_;
+        for (const Block* b : live_)
+            add(t, *b);
+        return t;
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<const Block*> live_;
+    Totals retired_;
+    Totals baseline_;
+};
+
+// Single-writer increment: no locked instruction on the hot path.
+inline void bump(std::atomic<uint64_t>& c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void add(Counter c, uint64_t n) { bump(Registry::local().counters[c], n); }
+
+inline void skipped(int level) {
+    bump(Registry::local().skipped[level < kLevels ? level : kLevels - 1], 1);
+}
+
+// Cells tested by `rays` rays that tested `cells` between them, each
+// counted in the histogram at the mean.
+inline void walked(uint64_t cells, uint64_t rays = 1) {
+    Registry::Block& b = Registry::local();
+    bump(b.counters[Cells], cells);
+    if (rays)
+        bump(b.cellsHistogram[bucket_of(cells / rays)], rays);
+}
+
+// Cell count of one walk, kept in a register and published on return.
+struct CellCount {
+    uint64_t n = 0;
+    ~CellCount() { walked(n); }
+};
+
+// Times `rays` queries from construction to destruction, crediting each
+// with the mean.
+class RayScope {
+public:
+    explicit RayScope(uint64_t rays = 1)
+        : rays_(rays), start_(std::chrono::steady_clock::now()) {}
+    ~RayScope() {
+        if (!rays_)
+            return;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start_).count();
+        Registry::Block& b = Registry::local();
+        bump(b.counters[Rays], rays_);
+        bump(b.counters[RayNs], static_cast<uint64_t>(ns));
+        bump(b.nsHistogram[bucket_of(static_cast<uint64_t>(ns) / rays_)], rays_);
+    }
+
+private:
+    uint64_t rays_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline Totals collect() { return Registry::instance().collect(); }
+inline void reset() { Registry::instance().reset(); }
+
+#define LOS_STAT_CELLS(var) ::los::stats::CellCount var
+#define LOS_STAT_STEP(var) (var.n++)
+#define LOS_STAT_ADD(counter, n) ::los::stats::add(::los::stats::counter, n)
+#define LOS_STAT_WALKED(cells, rays) ::los::stats::walked(cells, rays)
+#define LOS_STAT_SKIP(level) ::los::stats::skipped(level)
+#define LOS_STAT_SCOPE(rays) ::los::stats::RayScope losStatScope(rays)
+
+#else
+
+inline Totals collect() { return Totals(); }
+inline void reset() {}
+
+#define LOS_STAT_CELLS(var)
+#define LOS_STAT_STEP(var) ((void)0)
+#define LOS_STAT_ADD(counter, n) ((void)0)
+#define LOS_STAT_WALKED(cells, rays) ((void)0)
+#define LOS_STAT_SKIP(level) ((void)0)
+#define LOS_STAT_SCOPE(rays)
+
+#endif
+
+} // namespace stats
+} // namespace los
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace los {
+
+// Background jobs for callers that must not block, such as an event loop.
+//
+// submit() appends a job to a bounded FIFO and returns at once. One
+// dispatcher thread runs the jobs in order, and each job spreads its work
+// over the shared ThreadPool like the blocking calls do. Running one job
+// at a time means any number of submitters share the pool's threads
+// instead of oversubscribing the cores. Once `capacity` jobs are queued,
+// submitters wait for a free slot or give up, so a backlog stays bounded.
+class TaskQueue {
+public:
+    enum class State { Queued, Running, Done, Failed, Cancelled };
+
+    // One submitted job. Its work reads cancelled() between slices and
+    // returns early once it is set.
+    class Task {
+    public:
+        State state() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return state_;
+        }
+
+        bool finished() const { return is_final(state()); }
+        bool cancelled() const { return cancel_.load(std::memory_order_relaxed); }
+
+        // Exception thrown by the work, when state() is Failed.
+        std::exception_ptr error() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return error_;
+        }
+
+        // Wait until the job has finished; seconds < 0 waits forever.
+        // False on timeout.
+        bool wait_for(double seconds) const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto done = [&] { return is_final(state_); };
+            if (seconds < 0) {
+                cv_.wait(lock, done);
+                return true;
+            }
+            return cv_.wait_for(lock, std::chrono::duration<double>(seconds), done);
+        }
+
+    private:
+        friend class TaskQueue;
+
+        static bool is_final(State s) {
+            return s == State::Done || s == State::Failed || s == State::Cancelled;
+        }
+
+        std::function<void(const Task&)> work_;
+        std::function<void()> done_;
+        std::atomic<bool> cancel_{false};
+        mutable std::mutex mutex_;
+        mutable std::condition_variable cv_;
+        State state_ = State::Queued;
+        std::exception_ptr error_;
+    };
+
+    static TaskQueue& instance() {
+        static TaskQueue queue;
+        return queue;
+    }
+
+    ~TaskQueue() { shutdown(); }
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    // Most jobs queued (not counting the running one) before submit() waits.
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_;
+    }
+
+    void set_capacity(size_t n) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            capacity_ = std::max<size_t>(n, 1);
+        }
+        space_cv_.notify_all();
+    }
+
+    // Queue work(task), then done() once the task has finished in any way,
+    // on the thread that finished it: the dispatcher, a cancel() caller or
+    // shutdown(). With the queue full this waits up to `seconds` for a slot
+    // (forever when negative, not at all when 0) and returns null if none
+    // freed up.
+    std::shared_ptr<Task> submit(std::function<void(const Task&)> work,
+                                 std::function<void()> done, double seconds = -1) {
+        auto task = std::make_shared<Task>();
+        task->work_ = std::move(work);
+        task->done_ = std::move(done);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto space = [&] { return stop_ || queue_.size() < capacity_; };
+        if (seconds < 0)
+            space_cv_.wait(lock, space);
+        else if (!space_cv_.wait_for(lock, std::chrono::duration<double>(seconds), space))
+            return nullptr;
+        if (stop_)
+            throw std::runtime_error("the task queue has been shut down");
+
+        if (!dispatcher_.joinable())
+            dispatcher_ = std::thread([this] { dispatch(); });
+        queue_.push_back(task);
+        lock.unlock();
+        work_cv_.notify_one();
+        return task;
+    }
+
+    // Cancel `task`: a queued one finishes at once, a running one at its
+    // next cancelled() check. False when it has already finished.
+    bool cancel(const std::shared_ptr<Task>& task) {
+        {
+            std::lock_guard<std::mutex> lock(task->mutex_);
+            if (Task::is_final(task->state_))
+                return false;
+            task->cancel_ = true;
+        }
+
+        bool dequeued = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = std::find(queue_.begin(), queue_.end(), task);
+            if (it != queue_.end()) {
+                queue_.erase(it);
+                dequeued = true;
+            }
+        }
+        if (dequeued) {
+            space_cv_.notify_one();
+            finish(*task, State::Cancelled, nullptr);
+        }
+        return true;
+    }
+
+    // Cancel every queued job, let the running one finish and stop the
+    // dispatcher. Later submit() calls throw.
+    void shutdown() {
+        std::deque<std::shared_ptr<Task>> dropped;
+        std::shared_ptr<Task> running;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            dropped.swap(queue_);
+            running = running_;
+        }
+        work_cv_.notify_all();
+        space_cv_.notify_all();
+        if (running)
+            cancel(running);
+        for (auto& task : dropped) {
+            task->cancel_ = true;
+            finish(*task, State::Cancelled, nullptr);
+        }
+        if (dispatcher_.joinable())
+            dispatcher_.join();
+    }
+
+private:
+    TaskQueue() = default;
+
+    // A task that finished Done after cancel() was accepted counts as
+    // Cancelled, so cancel() returning true always means no result.
+    static void finish(Task& task, State state, std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(task.mutex_);
+            if (state == State::Done && task.cancel_)
+                state = State::Cancelled;
+            task.state_ = state;
+            task.error_ = std::move(error);
+        }
+        task.cv_.notify_all();
+
+        task.work_ = nullptr;
+        std::function<void()> done = std::move(task.done_);
+        if (done)
+            done();
+    }
+
+    void dispatch() {
+        while (true) {
+            std::shared_ptr<Task> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+                if (queue_.empty())
+                    return;
+                task = std::move(queue_.front());
+                queue_.pop_front();
+                running_ = task;
+            }
+            space_cv_.notify_one();
+
+            {
+                std::lock_guard<std::mutex> lock(task->mutex_);
+                task->state_ = State::Running;
+            }
+            State state = State::Done;
+            std::exception_ptr error;
+            try {
+                if (!task->cancelled())
+                    task->work_(*task);
+            } catch (...) {
+                state = State::Failed;
+                error = std::current_exception();
+            }
+            finish(*task, state, std::move(error));
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_.reset();
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable space_cv_;
+    std::deque<std::shared_ptr<Task>> queue_;
+    std::shared_ptr<Task> running_;
+    std::thread dispatcher_;
+    size_t capacity_ = 64;
+    bool stop_ = false;
+};
+
+} // namespace los
@@ -0,0 +1,683 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "area.h"
+#include "bilinear.h"
+#include "fresnel.h"
+#include "gpu.h"
+#include "horizon.h"
+#include "layout.h"
+#include "los_kernel.h"
+#include "packet.h"
+#include "pyramid.h"
+#include "quantized.h"
+#include "region.h"
+#include "result_cache.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "viewshed.h"
+
+namespace los {
+
+// Where batch queries and viewsheds run. GPU needs a build with LOS_GPU;
+// without a visible GPU it runs the device code on the host.
+enum class Device { CPU, GPU };
+
+// Largest grid the float kernels accept: cell coordinates must be exact in a
+// float and the packet gathers use 32-bit cell indices.
+inline bool fits_float_kernel(int width, int height) {
+    return width <= (1 << 24) && height <= (1 << 24) &&
+           static_cast<int64_t>(width) * height < (int64_t(1) << 31);
+}
+
+// A prepared heightmap that every query hangs off.
+//
+// Dimensions are validated once when the terrain is built, so the query
+// path below is plain pointer arithmetic. With `build_pyramid` the max
+// pyramid is built here too and every ray uses the hierarchical traversal;
+// without it, batches and probability samples are traced as SIMD packets.
+// `precision` picks the double or float instantiation of every ray kernel;
+// float needs fits_float_kernel(width, height). Viewsheds always use double.
+// A Blocked or Morton `layout` keeps a reordered copy of the DEM for the
+// CPU ray walks (see layout.h); those walks then run one ray per lane
+// instead of as SIMD packets. Viewsheds and the GPU read `data` as is.
+// With Device::GPU the DEM and pyramid are also uploaded to the GPU, and
+// batches and single-observer viewsheds run there; single-ray queries stay
+// on the CPU, where latency is lower. A positive `quantize_step` stores the
+// DEM as a QuantizedHeightmap instead (CPU and row-major only): rays and
+// viewsheds read its conservative bounds, the pyramid is built over its
+// upper bounds, and `data` is not read after construction (data() is null).
+// Otherwise the terrain does not own `data`; whoever builds it must keep
+// the buffer alive and change it only through update_region(), which writes
+// into it (so a terrain that is updated needs a writable buffer).
+// Interpolation::Bilinear answers los_boolean, los_probability and their
+// batches over the bilinear surface (see bilinear.h), on the CPU only; the
+// pyramid then bounds its patches instead of the cells, and los_trace,
+// los_fresnel and viewsheds keep reading the nearest cell.
+class Terrain {
+public:
+    Terrain(const float* data, int width, int height, bool build_pyramid = false,
+            Precision precision = Precision::Double, Device device = Device::CPU,
+            Layout layout = Layout::RowMajor, float quantize_step = 0.0f,
+            Interpolation interpolation = Interpolation::Nearest)
+        : data_(data), width_(width), height_(height), precision_(precision), layout_(layout),
+          interpolation_(interpolation) {
+        if (interpolation == Interpolation::Bilinear && device != Device::CPU)
+            throw std::invalid_argument("bilinear terrains run on the CPU only");
+        if (quantize_step > 0) {
+            if (layout != Layout::RowMajor || device != Device::CPU)
+                throw std::invalid_argument("quantized terrains run on the CPU, row-major only");
+            quantized_ = QuantizedHeightmap(data, width, height, quantize_step);
+            if (build_pyramid && bilinear())
+                pyramid_.build_cells(BilinearMax<QuantizedHeightmap>{quantized_, width, height},
+                                     width + 1, height + 1);
+            else if (build_pyramid)
+                pyramid_.build(quantized_.decode_upper().data(), width, height);
+            data_ = nullptr;
+            return;
+        }
+        if (build_pyramid && bilinear()) {
+            IndexedCells<RowMajorIndex> cells{data, RowMajorIndex(width)};
+            pyramid_.build_cells(BilinearMax<IndexedCells<RowMajorIndex>>{cells, width, height},
+                                 width + 1, height + 1);
+        } else if (build_pyramid) {
+            pyramid_.build(data, width, height);
+        }
+        if (layout == Layout::Blocked)
+            cells_ = reorder_heightmap(data, width, height, BlockedIndex(width));
+        else if (layout == Layout::Morton)
+            cells_ = reorder_heightmap(data, width, height, MortonIndex(width));
+        if (device == Device::GPU)
+            gpu_ = std::make_shared<gpu::DeviceTerrain>(data, width, height, &pyramid_, precision);
+    }
+
+    const float* data() const { return data_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const MaxPyramid& pyramid() const { return pyramid_; }
+    bool has_pyramid() const { return !pyramid_.empty(); }
+    Precision precision() const { return precision_; }
+    Layout layout() const { return layout_; }
+    Interpolation interpolation() const { return interpolation_; }
+    bool bilinear() const { return interpolation_ == Interpolation::Bilinear; }
+    size_t layout_bytes() const { return cells_.size() * sizeof(float); }
+    bool quantized() const { return !quantized_.empty(); }
+    const QuantizedHeightmap& quantized_heightmap() const { return quantized_; }
+    Device device() const { return gpu_ ? Device::GPU : Device::CPU; }
+    const gpu::DeviceTerrain* gpu() const { return gpu_.get(); }
+
+    // Replace cells [x, x + w) x [y, y + h) with `patch` (row-major, `stride`
+    // floats per row). Only what reads those cells is refreshed: the DEM or
+    // its quantized blocks, the reordered copy, the pyramid blocks above the
+    // region up to the root, and the GPU copy. Each update bumps revision().
+    // Not safe to call while queries run on this terrain.
+    void update_region(int x, int y, int w, int h, const float* patch, size_t stride) {
+        if (x < 0 || y < 0 || w <= 0 || h <= 0 ||
+            int64_t(x) + w > width_ || int64_t(y) + h > height_)
+            throw std::invalid_argument("region must lie inside the terrain");
+        CellRect rect{x, y, x + w - 1, y + h - 1};
+
+        if (quantized()) {
+            // Re-coding a block can move the bounds of all its cells.
+            quantized_.update(x, y, w, h, patch, stride);
+            rect = {rect.x0 & ~kQuantMask, rect.y0 & ~kQuantMask,
+                    std::min(rect.x1 | kQuantMask, width_ - 1),
+                    std::min(rect.y1 | kQuantMask, height_ - 1)};
+            if (has_pyramid())
+                update_pyramid(quantized_, rect);
+            update_area_index(rect);
+            updates_.record(rect);
+            return;
+        }
+
+        float* dst = const_cast<float*>(data_);
+        parallel_for(h, 64, [&](int64_t begin, int64_t end, int) {
+            for (int64_t j = begin; j < end; j++)
+                std::memcpy(dst + static_cast<size_t>(y + j) * width_ + x, patch + j * stride,
+                            sizeof(float) * w);
+        });
+        if (layout_ == Layout::Blocked)
+            reorder_region(BlockedIndex(width_), rect);
+        else if (layout_ == Layout::Morton)
+            reorder_region(MortonIndex(width_), rect);
+        if (has_pyramid())
+            update_pyramid(IndexedCells<RowMajorIndex>{data_, RowMajorIndex(width_)}, rect);
+        if (gpu_)
+            gpu_->update_region(data_, x, y, w, h, &pyramid_);
+        update_area_index(rect);
+        updates_.record(rect);
+    }
+
+    // Count of update_region() calls so far. A result computed at revision
+    // r is still valid while the *_changed_since(r, ...) test for it is
+    // false.
+    uint64_t revision() const { return updates_.revision(); }
+
+    // Whether an update after `revision` touched a cell the ray (or a
+    // los_probability sample of it) could read.
+    // `margin` widens the test for rays up to that many cells from this one.
+    bool ray_changed_since(uint64_t revision, double x0, double y0,
+                           double x1, double y1, double margin = 0.0) const {
+        return updates_.changed_since(revision, [&](const CellRect& r) {
+            return r.near_segment(x0, y0, x1, y1, kUpdateReach + margin);
+        });
+    }
+
+    // Whether an update after `revision` touched a cell a viewshed from
+    // (x0, y0) within max_radius could read.
+    bool viewshed_changed_since(uint64_t revision, double x0, double y0,
+                                double max_radius) const {
+        return updates_.changed_since(revision, [&](const CellRect& r) {
+            return r.near_disc(x0, y0, max_radius, kUpdateReach);
+        });
+    }
+
+    // Answer repeated rays from a ResultCache of `capacity` entries keyed
+    // on cell_bin / height_bin bins (see result_cache.h). Replaces any
+    // cache already enabled. Not safe to call while queries run.
+    void enable_result_cache(size_t capacity, double cell_bin, double height_bin) {
+        cache_ = std::make_shared<ResultCache>(capacity, cell_bin, height_bin);
+    }
+    void disable_result_cache() { cache_.reset(); }
+    ResultCache* result_cache() const { return cache_.get(); }
+
+    // Bend every ray and viewshed by the earth's curvature on cells
+    // `cell_size` metres wide, with refraction folded into `k_factor` (see
+    // earth_curvature()). Batches then walk rays one by one rather than as
+    // SIMD packets. Clears the result cache, whose answers
+    // were computed for the old rays. Not safe to call while queries run.
+    void set_earth_curvature(double cell_size, double k_factor) {
+        if (!(cell_size > 0) || !std::isfinite(cell_size) ||
+            !(k_factor > 0) || !std::isfinite(k_factor))
+            throw std::invalid_argument("cell_size and k_factor must be positive");
+        curvature_ = earth_curvature(cell_size, k_factor);
+        cellSize_ = cell_size;
+        kFactor_ = k_factor;
+        if (cache_)
+            cache_->clear();
+    }
+
+    void clear_earth_curvature() {
+        curvature_ = cellSize_ = kFactor_ = 0.0;
+        if (cache_)
+            cache_->clear();
+    }
+
+    // Ray drop per squared cell of length; 0 for flat rays.
+    double curvature() const { return curvature_; }
+    double curvature_cell_size() const { return cellSize_; }
+    double curvature_k_factor() const { return kFactor_; }
+
+    double los_boolean(double x0, double y0, double z0,
+                       double x1, double y1, double z1) const {
+        if (cache_) {
+            const double r[6] = {x0, y0, z0, x1, y1, z1};
+            return cached(r, 0, [&] { return trace_boolean(x0, y0, z0, x1, y1, z1); });
+        }
+        return trace_boolean(x0, y0, z0, x1, y1, z1);
+    }
+
+    double los_probability(double x0, double y0, double z0,
+                           double x1, double y1, double z1,
+                           int num_samples) const {
+        if (cache_) {
+            const double r[6] = {x0, y0, z0, x1, y1, z1};
+            return cached(r, num_samples, [&] {
+                return trace_probability(x0, y0, z0, x1, y1, z1, num_samples);
+            });
+        }
+        return trace_probability(x0, y0, z0, x1, y1, z1, num_samples);
+    }
+
+    // Where and by how much the ray is blocked (see trace.h); walks every
+    // cell into `profile` (capacity rows of kProfileColumns) when given.
+    TraceResult los_trace(double x0, double y0, double z0,
+                          double x1, double y1, double z1, bool stop_at_block,
+                          double* profile = nullptr, int64_t capacity = 0) const {
+        LOS_STAT_SCOPE(1);
+        const MaxPyramid* pyramid = cell_pyramid();
+        return with_cells([&](const auto& cells) {
+            if (precision_ == Precision::Float)
+                return los_trace_cells<float>(cells, width_, height_, pyramid, x0, y0, z0,
+                                              x1, y1, z1, stop_at_block, profile, capacity,
+                                              curvature_);
+            return los_trace_cells<double>(cells, width_, height_, pyramid, x0, y0, z0,
+                                           x1, y1, z1, stop_at_block, profile, capacity,
+                                           curvature_);
+        });
+    }
+
+    // First Fresnel zone clearance of the ray at `wavelength` metres on
+    // cells `cell_size` metres wide (see fresnel.h).
+    FresnelResult los_fresnel(double x0, double y0, double z0,
+                              double x1, double y1, double z1,
+                              double wavelength, double cell_size) const {
+        LOS_STAT_SCOPE(1);
+        const MaxPyramid* pyramid = cell_pyramid();
+        return with_cells([&](const auto& cells) {
+            if (precision_ == Precision::Float)
+                return los_fresnel_cells<float>(cells, width_, height_, pyramid, x0, y0, z0,
+                                                x1, y1, z1, wavelength, cell_size, curvature_);
+            return los_fresnel_cells<double>(cells, width_, height_, pyramid, x0, y0, z0,
+                                             x1, y1, z1, wavelength, cell_size, curvature_);
+        });
+    }
+
+    // out[i] is FresnelResult::minRatio of row i of `pairs`.
+    void los_fresnel_batch(const double* pairs, int64_t n, double wavelength,
+                           double cell_size, double* out) const {
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                out[i] = los_fresnel(r[0], r[1], r[2], r[3], r[4], r[5],
+                                     wavelength, cell_size).minRatio;
+            }
+        });
+    }
+
+    // R2 viewshed from (x0, y0, z0); out is a width x height row-major mask.
+    void viewshed(double x0, double y0, double z0, double target_height,
+                  double max_radius, uint8_t* out) const {
+        if (on_gpu())
+            return gpu_->viewshed(x0, y0, z0, target_height, max_radius, out, curvature_);
+        if (quantized())
+            return viewshed_r2_cells(quantized_, width_, height_, x0, y0, z0,
+                                     target_height, max_radius, out, curvature_);
+        viewshed_r2(data_, width_, height_, x0, y0, z0, target_height, max_radius, out,
+                    curvature_);
+    }
+
+    // Per-cell count of the m (x, y, z) observers that see a target there.
+    void cumulative_viewshed(const double* observers, int64_t m, double target_height,
+                             double max_radius, uint16_t* out) const {
+        if (quantized())
+            return cumulative_viewshed_r2_cells(quantized_, width_, height_, observers, m,
+                                                target_height, max_radius, out, curvature_);
+        cumulative_viewshed_r2(data_, width_, height_, observers, m,
+                               target_height, max_radius, out, curvature_);
+    }
+
+    // `pairs` holds n rows of (x0, y0, z0, x1, y1, z1); out[i] is 0 or 1.
+    void los_boolean_batch(const double* pairs, int64_t n, uint8_t* out) const {
+        if (cache_)
+            return cached_batch(pairs, n, 0, out, [this](const double* p, int64_t m, uint8_t* o) {
+                trace_boolean_batch(p, m, o);
+            });
+        trace_boolean_batch(pairs, n, out);
+    }
+
+    void los_probability_batch(const double* pairs, int64_t n, int num_samples,
+                               double* out) const {
+        if (cache_)
+            return cached_batch(pairs, n, num_samples, out,
+                                [this, num_samples](const double* p, int64_t m, double* o) {
+                                    trace_probability_batch(p, m, num_samples, o);
+                                });
+        trace_probability_batch(pairs, n, num_samples, out);
+    }
+
+    // Visible pairs between observers in region `a`, observer_height above
+    // the ground, and targets target_height above region `b` (see area.h).
+    // Pairs are traced as los_boolean would, including curvature and
+    // bilinear patches. The first query builds a min pyramid over the
+    // cells, and a max one too unless the terrain's pyramid bounds cells.
+    AreaResult area_visibility(const AreaRegion& a, const AreaRegion& b,
+                               double observer_height, double target_height,
+                               double tolerance = 0.0, bool stop_at_first = false) const {
+        const AreaIndex& index = area_index();
+        const MaxPyramid& top = cell_pyramid() ? *cell_pyramid() : index.top;
+        return with_cells([&](const auto& cells) {
+            AreaEndpoints observers(cells, width_, height_, a, observer_height);
+            AreaEndpoints targets(cells, width_, height_, b, target_height);
+            auto trace = [this](double ax, double ay, double az,
+                                double bx, double by, double bz) {
+                return trace_boolean(ax, ay, az, bx, by, bz);
+            };
+            return area_visibility_cells(cells, width_, height_, top, index.floor, observers,
+                                         targets, curvature_, bilinear() ? 2 : 1, tolerance,
+                                         stop_at_first, trace);
+        });
+    }
+
+    // Horizon of the observer at (x, y, z) over `azimuths` bins and up to
+    // `bands` distance bands within max_range cells, for los_horizon(); see
+    // horizon.h. Built at the current revision for this terrain's precision
+    // and curvature.
+    Horizon precompute_horizon(double x, double y, double z, int azimuths, double max_range,
+                               int bands) const {
+        return with_cells([&](const auto& cells) {
+            if (precision_ == Precision::Float)
+                return Horizon::build<float>(cells, width_, height_, x, y, z, azimuths,
+                                             max_range, bands, curvature_, revision());
+            return Horizon::build<double>(cells, width_, height_, x, y, z, azimuths,
+                                          max_range, bands, curvature_, revision());
+        });
+    }
+
+    // los_boolean from the horizon's observer to (x1, y1, z1) over the
+    // nearest cells, like viewsheds. The horizon answers for the rings it
+    // clears; rays it cannot clear, and every ray once an update has
+    // touched the cells it covers, are walked in full.
+    double los_horizon(const Horizon& h, double x1, double y1, double z1) const {
+        check_horizon(h);
+        LOS_STAT_SCOPE(1);
+        if (precision_ == Precision::Float)
+            return los_horizon_as<float>(h, x1, y1, z1);
+        return los_horizon_as<double>(h, x1, y1, z1);
+    }
+
+    // targets holds n (x, y, z) rows.
+    void los_horizon_batch(const Horizon& h, const double* targets, int64_t n,
+                           uint8_t* out) const {
+        check_horizon(h);
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* t = targets + 3 * i;
+                LOS_STAT_SCOPE(1);
+                out[i] = (precision_ == Precision::Float
+                              ? los_horizon_as<float>(h, t[0], t[1], t[2])
+                              : los_horizon_as<double>(h, t[0], t[1], t[2])) > 0.5;
+            }
+        });
+    }
+
+private:
+    // Pyramids of area_visibility(), built by the first query. Shared so
+    // the terrain stays movable.
+    struct AreaIndex {
+        std::once_flag once;
+        std::atomic<bool> built{false};
+        MaxPyramid top;    // over the cells; empty if cell_pyramid() is one
+        MaxPyramid floor;  // over NegatedCells
+    };
+
+    const AreaIndex& area_index() const {
+        std::call_once(area_->once, [this] {
+            with_cells([this](const auto& cells) {
+                using Cells = std::decay_t<decltype(cells)>;
+                if (!cell_pyramid())
+                    area_->top.build_cells(cells, width_, height_);
+                area_->floor.build_cells(NegatedCells<Cells>{cells}, width_, height_);
+            });
+            area_->built = true;
+        });
+        return *area_;
+    }
+
+    // Refresh the area pyramids, if built, over changed cells r.
+    void update_area_index(const CellRect& r) {
+        if (!area_->built)
+            return;
+        with_cells([&](const auto& cells) {
+            using Cells = std::decay_t<decltype(cells)>;
+            if (!cell_pyramid())
+                area_->top.update(cells, r.x0, r.y0, r.x1, r.y1);
+            area_->floor.update(NegatedCells<Cells>{cells}, r.x0, r.y0, r.x1, r.y1);
+        });
+    }
+
+    void check_horizon(const Horizon& h) const {
+        if (h.width() != width_ || h.height() != height_)
+            throw std::invalid_argument("horizon was built for a terrain of another size");
+        if (h.precision() != precision_)
+            throw std::invalid_argument("horizon was built for another precision");
+        if (h.curvature() != curvature_)
+            throw std::invalid_argument("horizon was built for another earth curvature");
+    }
+
+    template <typename Real>
+    double los_horizon_as(const Horizon& h, double x1, double y1, double z1) const {
+        // Cells of the rings the horizon covers lie within this of the observer.
+        double reach = (h.max_ring() + 1) * std::sqrt(2.0);
+        bool stale = viewshed_changed_since(h.revision(), h.x(), h.y(), reach);
+        return with_cells([&](const auto& cells) {
+            if (!stale) {
+                double v = los_horizon_cells<Real>(cells, width_, height_, h, x1, y1, z1,
+                                                   curvature_);
+                if (v >= 0)
+                    return v;
+            }
+            if (const MaxPyramid* p = cell_pyramid())
+                return los_boolean_pyramid_cells<Real>(cells, width_, height_, *p, h.x(), h.y(),
+                                                       h.z(), x1, y1, z1, curvature_);
+            return los_boolean_cells<Real>(cells, width_, height_, h.x(), h.y(), h.z(), x1, y1,
+                                           z1, curvature_);
+        });
+    }
+
+    // Cells around a segment a query may read: sample offsets stay within
+    // one cell, and the walk reads the cells either side of a corner.
+    static constexpr double kUpdateReach = 2.0;
+
+    // Refresh the pyramid over changed cells r; a cell feeds the bilinear
+    // patches at its own index and one past it.
+    template <typename Cells>
+    void update_pyramid(const Cells& cells, const CellRect& r) {
+        if (bilinear())
+            pyramid_.update(BilinearMax<Cells>{cells, width_, height_}, r.x0, r.y0,
+                            r.x1 + 1, r.y1 + 1);
+        else
+            pyramid_.update(cells, r.x0, r.y0, r.x1, r.y1);
+    }
+
+    template <typename Index>
+    void reorder_region(const Index& index, const CellRect& r) {
+        parallel_for(r.y1 - r.y0 + 1, kLayoutBlock, [&](int64_t begin, int64_t end, int) {
+            for (int y = r.y0 + static_cast<int>(begin); y < r.y0 + end; y++)
+                for (int x = r.x0; x <= r.x1; x++)
+                    cells_[index(x, y)] = data_[static_cast<size_t>(y) * width_ + x];
+        });
+    }
+
+    double trace_boolean(double x0, double y0, double z0,
+                         double x1, double y1, double z1) const {
+        LOS_STAT_SCOPE(1);
+        if (precision_ == Precision::Float)
+            return los_boolean_as<float>(x0, y0, z0, x1, y1, z1);
+        return los_boolean_as<double>(x0, y0, z0, x1, y1, z1);
+    }
+
+    double trace_probability(double x0, double y0, double z0,
+                             double x1, double y1, double z1,
+                             int num_samples) const {
+        LOS_STAT_SCOPE(1);
+        if (precision_ == Precision::Float)
+            return los_probability_as<float>(x0, y0, z0, x1, y1, z1, num_samples);
+        return los_probability_as<double>(x0, y0, z0, x1, y1, z1, num_samples);
+    }
+
+    void trace_boolean_batch(const double* pairs, int64_t n, uint8_t* out) const {
+        if (on_gpu()) {
+            LOS_STAT_SCOPE(n);
+            return gpu_->los_boolean_batch(pairs, n, out, curvature_);
+        }
+        if (packets()) {
+            if (precision_ == Precision::Float)
+                return los_boolean_packets<float>(data_, width_, height_, pairs, n, out);
+            return los_boolean_packets<double>(data_, width_, height_, pairs, n, out);
+        }
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                out[i] = trace_boolean(r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+            }
+        });
+    }
+
+    void trace_probability_batch(const double* pairs, int64_t n, int num_samples,
+                                 double* out) const {
+        if (on_gpu()) {
+            LOS_STAT_SCOPE(n);
+            return gpu_->los_probability_batch(pairs, n, num_samples, out, curvature_);
+        }
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                out[i] = trace_probability(r[0], r[1], r[2], r[3], r[4], r[5], num_samples);
+            }
+        });
+    }
+
+    // Whether the cached answer for ray r, computed at `since`, may have
+    // changed. Rays sharing its bins lie up to a bin away from r.
+    bool cached_changed(uint64_t since, const double* r) const {
+        return ray_changed_since(since, r[0], r[1], r[3], r[4], cache_->cell_bin());
+    }
+
+    template <typename Trace>
+    double cached(const double* r, int samples, const Trace& trace) const {
+        ResultCache::Key key;
+        if (!cache_->key(r, samples, key))
+            return trace();
+        uint64_t rev = revision();
+        double value;
+        if (cache_->lookup(key, rev, [&](uint64_t since) { return cached_changed(since, r); },
+                           value))
+            return value;
+        value = trace();
+        cache_->insert(key, rev, value);
+        return value;
+    }
+
+    // Answer the rays the cache holds, then trace the rest as one batch
+    // through the usual kernels (packets, pyramid or GPU) and store them.
+    template <typename T, typename Batch>
+    void cached_batch(const double* pairs, int64_t n, int samples, T* out,
+                      const Batch& batch) const {
+        uint64_t rev = revision();
+        std::vector<ResultCache::Key> keys(n);
+        std::vector<uint8_t> state(n);  // 0 hit, 1 miss, 2 not cacheable
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                double value;
+                if (!cache_->key(r, samples, keys[i]))
+                    state[i] = 2;
+                else if (cache_->lookup(keys[i], rev,
+                                        [&](uint64_t since) { return cached_changed(since, r); },
+                                        value))
+                    out[i] = static_cast<T>(value);
+                else
+                    state[i] = 1;
+            }
+        });
+
+        std::vector<int64_t> misses;
+        for (int64_t i = 0; i < n; i++)
+            if (state[i])
+                misses.push_back(i);
+        if (misses.empty())
+            return;
+        int64_t m = static_cast<int64_t>(misses.size());
+        std::vector<double> missPairs(6 * misses.size());
+        std::vector<T> missOut(misses.size());
+        for (int64_t k = 0; k < m; k++)
+            std::memcpy(&missPairs[6 * k], pairs + 6 * misses[k], 6 * sizeof(double));
+        batch(missPairs.data(), m, missOut.data());
+
+        parallel_for(m, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t k = begin; k < end; k++) {
+                int64_t i = misses[k];
+                out[i] = missOut[k];
+                if (state[i] == 1)
+                    cache_->insert(keys[i], rev, static_cast<double>(missOut[k]));
+            }
+        });
+    }
+
+    // The SIMD packet kernels gather from the row-major float array only,
+    // and do not bend rays.
+    bool packets() const {
+        return !has_pyramid() && layout_ == Layout::RowMajor && !quantized() && curvature_ == 0 &&
+               !bilinear();
+    }
+
+    // The pyramid over cells, for the nearest-cell walks; null if there is
+    // none or it bounds bilinear patches.
+    const MaxPyramid* cell_pyramid() const {
+        return has_pyramid() && !bilinear() ? &pyramid_ : nullptr;
+    }
+    bool on_gpu() const { return gpu_ != nullptr; }
+
+    // f(cells) with the cell reader the CPU walks use for this terrain.
+    template <typename F>
+    auto with_cells(const F& f) const
+        -> decltype(f(IndexedCells<RowMajorIndex>{nullptr, RowMajorIndex(0)})) {
+        if (quantized())
+            return f(quantized_);
+        switch (layout_) {
+        case Layout::Blocked:
+            return f(IndexedCells<BlockedIndex>{cells_.data(), BlockedIndex(width_)});
+        case Layout::Morton:
+            return f(IndexedCells<MortonIndex>{cells_.data(), MortonIndex(width_)});
+        default:
+            return f(IndexedCells<RowMajorIndex>{data_, RowMajorIndex(width_)});
+        }
+    }
+
+    template <typename Real>
+    double los_boolean_as(double x0, double y0, double z0,
+                          double x1, double y1, double z1) const {
+        return with_cells([&](const auto& cells) {
+            return walk<Real>(cells, x0, y0, z0, x1, y1, z1);
+        });
+    }
+
+    template <typename Real, typename Cells>
+    double walk(const Cells& cells, double x0, double y0, double z0,
+                double x1, double y1, double z1) const {
+        if (bilinear())
+            return los_boolean_bilinear_cells<Real>(cells, width_, height_,
+                                                    has_pyramid() ? &pyramid_ : nullptr,
+                                                    x0, y0, z0, x1, y1, z1, curvature_);
+        if (has_pyramid())
+            return los_boolean_pyramid_cells<Real>(cells, width_, height_, pyramid_,
+                                                   x0, y0, z0, x1, y1, z1, curvature_);
+        return los_boolean_cells<Real>(cells, width_, height_, x0, y0, z0, x1, y1, z1,
+                                       curvature_);
+    }
+
+    template <typename Real>
+    double los_probability_as(double x0, double y0, double z0,
+                              double x1, double y1, double z1,
+                              int num_samples) const {
+        if (packets())
+            return los_probability_packets<Real>(data_, width_, height_,
+                                                 x0, y0, z0, x1, y1, z1, num_samples);
+        auto trace = [this](double ax, double ay, double az,
+                            double bx, double by, double bz) {
+            return los_boolean_as<Real>(ax, ay, az, bx, by, bz);
+        };
+        return los_probability_sampled(trace, x0, y0, z0, x1, y1, z1, num_samples);
+    }
+
+    const float* data_;
+    int width_;
+    int height_;
+    Precision precision_;
+    Layout layout_;
+    Interpolation interpolation_;
+    std::vector<float> cells_;  // reordered copy unless layout_ is RowMajor
+    QuantizedHeightmap quantized_;  // empty unless quantize_step was given
+    MaxPyramid pyramid_;
+    std::shared_ptr<gpu::DeviceTerrain> gpu_;
+    UpdateLog updates_;
+    std::shared_ptr<ResultCache> cache_;  // null unless enable_result_cache()
+    std::shared_ptr<AreaIndex> area_ = std::make_shared<AreaIndex>();
+    double curvature_ = 0.0;  // set_earth_curvature()
+    double cellSize_ = 0.0;
+    double kFactor_ = 0.0;
+};
+
+} // namespace los
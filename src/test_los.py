@@ -0,0 +1,594 @@
+"""Correctness tests for the los Python API and the LiDAR pipeline.
+
+    PYTHONPATH=build pytest src/test_los.py
+
+Everything runs on small seeded inputs in a temporary directory: no
+network, no USGS data. The LAZ cases need laspy, the pipeline cases
+fetch_usgs_lidar's imports (rasterio, requests); they skip without them.
+"""
+
+import itertools
+import threading
+
+import numpy as np
+import pytest
+
+import los
+from bench import scenarios
+
+
+# --- Heightmap views (los.los_boolean and batches on strided arrays) ---
+
+def view_dem():
+    """A 190 x 140 crop of a fractal DEM in whole metres, so that float64 and
+    int16 copies hold the same heights as the float32 one."""
+    return np.round(scenarios.fractal_grid(256, 6)[50:190, 30:220])
+
+
+def strided_views(grid):
+    """Views of grid's cells that are not C-contiguous float32, by name."""
+    h, w = grid.shape
+    big = np.full((2 * h + 3, 2 * w + 5), -1000.0, dtype=np.float32)
+    big[1:2 * h:2, 3:2 * w + 3:2] = grid
+    return {
+        "transposed": np.ascontiguousarray(grid.T).T,
+        "sliced": big[1:2 * h:2, 3:2 * w + 3:2],
+        "reversed": np.ascontiguousarray(grid[::-1])[::-1],
+        "float64": grid.astype(np.float64),
+        "float64-transposed": np.asfortranarray(grid, dtype=np.float64),
+        "int16": grid.astype(np.int16),
+        "int16-sliced": big.astype(np.int16)[1:2 * h:2, 3:2 * w + 3:2],
+    }
+
+
+@pytest.mark.parametrize("name", ["transposed", "sliced", "reversed", "float64",
+                                  "float64-transposed", "int16", "int16-sliced"])
+def test_strided_views_match_contiguous_float32(name):
+    grid = view_dem()
+    view = strided_views(grid)[name]
+    assert view.shape == grid.shape and np.array_equal(view, grid)
+    assert view.dtype != np.float32 or not view.flags.c_contiguous
+    rays = np.vstack([scenarios.make_rays(grid, shape, height, 500)
+                      for shape in ("long", "diagonal", "axis")
+                      for height in scenarios.HEIGHTS])
+    expected = los.los_boolean_batch(grid, rays)
+    assert 0.2 < np.mean(expected) < 0.8
+    np.testing.assert_array_equal(los.los_boolean_batch(view, rays), expected)
+    np.testing.assert_array_equal(los.los_probability_batch(view, rays[::20], num_samples=9),
+                                  los.los_probability_batch(grid, rays[::20], num_samples=9))
+    h, w = grid.shape
+    for ray, want in zip(rays[::100], expected[::100]):
+        assert los.los_boolean(view, w, h, *ray) == want
+        assert los.los_probability(view, w, h, *ray) == los.los_probability(grid, w, h, *ray)
+
+
+# --- Viewsheds (Terrain.viewshed) ---
+
+def los_to_cells(t, grid, x0, y0, z0, target_height):
+    """Terrain.los_boolean from (x0, y0, z0) to target_height above every cell centre."""
+    h, w = grid.shape
+    ys, xs = np.mgrid[0:h, 0:w]
+    n = xs.size
+    rays = np.column_stack([np.full(n, x0), np.full(n, y0), np.full(n, z0),
+                            xs.ravel() + 0.5, ys.ravel() + 0.5,
+                            grid.ravel().astype(np.float64) + target_height])
+    return t.los_boolean_batch(rays).reshape(h, w)
+
+
+OBSERVERS = [(64.5, 64.5), (10.5, 20.5), (100.25, 90.75)]
+
+
+def convex_grids(size=128):
+    y, x = np.mgrid[0:size, 0:size].astype(np.float64)
+    c = size / 2
+    return {
+        "flat": scenarios.flat_grid(size),
+        "plane": (0.3 * x + 0.1 * y).astype(np.float32),
+        "bowl": (0.01 * ((x + 0.5 - c) ** 2 + (y + 0.5 - c) ** 2)).astype(np.float32),
+    }
+
+
+@pytest.mark.parametrize("height", [2.0, 10.0, 30.0])
+@pytest.mark.parametrize("observer", OBSERVERS)
+@pytest.mark.parametrize("seed", [1, 2, 3])
+def test_viewshed_matches_los_boolean(seed, observer, height):
+    # R2 measures slopes to cell centres, los_boolean tests the corner-sampled
+    # segment, so they may differ near horizons. The lowest agreement over
+    # these cases is 0.949.
+    grid = scenarios.fractal_grid(128, seed)
+    t = los.Terrain(grid)
+    x0, y0 = observer
+    z0 = float(grid[int(y0), int(x0)]) + height
+    mask = t.viewshed(x0, y0, z0, target_height=2.0)
+    expected = los_to_cells(t, grid, x0, y0, z0, 2.0)
+    assert np.mean(mask == expected) >= 0.94
+
+
+@pytest.mark.parametrize("observer", OBSERVERS)
+@pytest.mark.parametrize("name", ["flat", "plane", "bowl"])
+def test_viewshed_matches_los_boolean_without_occluders(name, observer):
+    # Nothing hides a cell from the observer, so the two must agree exactly.
+    grid = convex_grids()[name]
+    t = los.Terrain(grid)
+    x0, y0 = observer
+    z0 = float(grid[int(y0), int(x0)]) + 2.0
+    mask = t.viewshed(x0, y0, z0, target_height=2.0)
+    np.testing.assert_array_equal(mask, los_to_cells(t, grid, x0, y0, z0, 2.0))
+
+
+# --- In-place updates (Terrain.update_region) ---
+
+def apply_patches(t, grid):
+    """Splice the same patches into Terrain t and into grid: a wall, a crater,
+    noise across block edges and a one-column strip on the east border."""
+    rng = np.random.default_rng(99)
+    patches = [(100, 50, np.full((3, 40), 200.0, np.float32)),
+               (150, 150, np.zeros((60, 60), np.float32)),
+               (0, 0, (rng.random((23, 17)) * 150).astype(np.float32)),
+               (grid.shape[1] - 1, 200, np.full((56, 1), 300.0, np.float32))]
+    for x, y, patch in patches:
+        t.update_region(x, y, patch)
+        grid[y:y + patch.shape[0], x:x + patch.shape[1]] = patch
+
+
+UPDATED = {
+    "pyramid": {},
+    "packets": {"pyramid": False},
+    "blocked": {"layout": "blocked"},
+    "bilinear": {"interpolation": "bilinear"},
+    "quantized": {"quantize": 0.01},
+}
+
+
+@pytest.mark.parametrize("kind", list(UPDATED))
+def test_update_region_matches_fresh_terrain(kind):
+    grid = scenarios.fractal_grid(256, 4)
+    rays = np.vstack([scenarios.make_rays(grid, shape, height, 512)
+                      for shape in ("short", "long", "diagonal", "axis")
+                      for height in scenarios.HEIGHTS])
+    t = los.Terrain(grid, copy=True, **UPDATED[kind])
+    before = t.los_boolean_batch(rays)
+    apply_patches(t, grid)
+    assert t.revision == 4
+    after = t.los_boolean_batch(rays)
+    assert np.count_nonzero(after != before) > 100  # the patches did change answers
+    if kind == "quantized":
+        # Re-coded blocks keep their scale, so a fresh quantization may round
+        # differently; both only ever turn rays of the exact DEM blocked.
+        exact = los.Terrain(grid).los_boolean_batch(rays)
+        assert not np.any(after & ~exact)
+        assert np.mean(after == exact) > 0.99
+        return
+    fresh = los.Terrain(grid, **UPDATED[kind])
+    np.testing.assert_array_equal(after, fresh.los_boolean_batch(rays))
+    np.testing.assert_array_equal(t.los_probability_batch(rays[::16], num_samples=9),
+                                  fresh.los_probability_batch(rays[::16], num_samples=9))
+
+
+# --- Bilinear interpolation (Terrain(interpolation="bilinear")) ---
+
+def grazing_rays(grid, n, seed=1000):
+    """n rays between hashed in-grid points, 1-5 m above the observer's cell
+    and 0-4 m above the target's, so that many of them graze the terrain."""
+    h, w = grid.shape
+    rays = np.empty((n, 6))
+    for i in range(n):
+        k = seed + 8 * i
+        x0, y0 = scenarios.unit(k) * w, scenarios.unit(k + 1) * h
+        x1, y1 = scenarios.unit(k + 2) * w, scenarios.unit(k + 3) * h
+        z0 = float(grid[int(y0), int(x0)]) + 1.0 + 4.0 * scenarios.unit(k + 4)
+        z1 = float(grid[int(y1), int(x1)]) + 4.0 * scenarios.unit(k + 5)
+        rays[i] = (x0, y0, z0, x1, y1, z1)
+    return rays
+
+
+def bilinear_surface(grid, px, py):
+    """The surface Terrain(interpolation='bilinear') reads: each cell's height
+    at its centre, clamped past the border half-cells."""
+    h, w = grid.shape
+    g = grid.astype(np.float64)
+    p, q = px + 0.5, py + 0.5
+    i, j = np.floor(p).astype(np.int64), np.floor(q).astype(np.int64)
+    xa, xb = np.maximum(i - 1, 0), np.minimum(i, w - 1)
+    ya, yb = np.maximum(j - 1, 0), np.minimum(j, h - 1)
+    u, v = p - i, q - j
+    lo = g[ya, xa] + u * (g[ya, xb] - g[ya, xa])
+    hi = g[yb, xa] + u * (g[yb, xb] - g[yb, xa])
+    return lo + v * (hi - lo)
+
+
+@pytest.mark.parametrize("seed", [2, 5])
+def test_bilinear_matches_dense_sampling(seed):
+    grid = scenarios.fractal_grid(128, seed)
+    rays = grazing_rays(grid, 1000)
+    exact = los.Terrain(grid, interpolation="bilinear").los_boolean_batch(rays)
+    np.testing.assert_array_equal(
+        exact, los.Terrain(grid, pyramid=False, interpolation="bilinear").los_boolean_batch(rays))
+    assert np.any(exact != los.Terrain(grid).los_boolean_batch(rays))
+
+    # 64 samples per cell along the ray. A sample under the surface must block;
+    # a block no sample sees must come from a peak between two samples.
+    for (x0, y0, z0, x1, y1, z1), visible in zip(rays, exact):
+        t = np.linspace(0.0, 1.0, int(np.ceil(np.hypot(x1 - x0, y1 - y0) * 64)) + 2)
+        surface = bilinear_surface(grid, x0 + t * (x1 - x0), y0 + t * (y1 - y0))
+        clearance = (z0 + t * (z1 - z0) - surface).min()
+        assert visible == (clearance >= 0) or (not visible and clearance < 0.01)
+
+
+def test_bilinear_pyramid_matches_walk_with_curvature():
+    grid = scenarios.fractal_grid(128, 2)
+    rays = grazing_rays(grid, 1000)
+    walked = los.Terrain(grid, pyramid=False, interpolation="bilinear")
+    skipped = los.Terrain(grid, interpolation="bilinear")
+    flat = skipped.los_boolean_batch(rays)
+    for t in (walked, skipped):
+        t.set_earth_curvature(30.0)
+    bent = skipped.los_boolean_batch(rays)
+    np.testing.assert_array_equal(bent, walked.los_boolean_batch(rays))
+    assert np.any(bent != flat)
+
+
+# --- Area-to-area visibility (Terrain.area_visibility) ---
+
+def region_cells(region):
+    """Columns and rows of the cells in an area_visibility region."""
+    if len(region) == 4:
+        x, y, w, h = region
+        mask = np.ones((h, w), dtype=bool)
+    else:
+        x, y, mask = region
+    ys, xs = np.nonzero(mask)
+    return xs + x, ys + y
+
+
+def brute_force_area(t, grid, a, b, observer_height, target_height):
+    """(pairs, visible pairs) of los_boolean between every cell of a and of b."""
+    ax, ay = region_cells(a)
+    bx, by = region_cells(b)
+    ia, ib = (i.ravel() for i in np.meshgrid(np.arange(len(ax)), np.arange(len(bx)),
+                                             indexing="ij"))
+    g = grid.astype(np.float64)
+    rays = np.column_stack([ax[ia] + 0.5, ay[ia] + 0.5, g[ay[ia], ax[ia]] + observer_height,
+                            bx[ib] + 0.5, by[ib] + 0.5, g[by[ib], bx[ib]] + target_height])
+    return len(rays), int(t.los_boolean_batch(rays).sum())
+
+
+def area_cases():
+    y, x = np.mgrid[0:20, 0:24]
+    disc = (x - 11.5) ** 2 / 144 + (y - 9.5) ** 2 / 100 <= 1
+    y, x = np.mgrid[0:16, 0:16]
+    stripes = (x + 2 * y) % 5 != 0
+    return [((10, 12, 16, 16), (90, 70, 20, 24)),
+            ((10, 12, stripes), (90, 70, disc)),
+            ((60, 5, 16, 16), (50, 100, disc))]
+
+
+AREA_TERRAINS = {
+    "pyramid": {},
+    "walk": {"pyramid": False},
+    "bilinear": {"interpolation": "bilinear"},
+    "curvature": {},
+}
+
+
+@pytest.mark.parametrize("observer_height", [2.0, 15.0])
+@pytest.mark.parametrize("kind", list(AREA_TERRAINS))
+def test_area_visibility_matches_brute_force(kind, observer_height):
+    grid = scenarios.fractal_grid(128, 3)
+    t = los.Terrain(grid, **AREA_TERRAINS[kind])
+    if kind == "curvature":
+        t.set_earth_curvature(30.0)
+    for a, b in area_cases():
+        r = t.area_visibility(a, b, observer_height=observer_height, target_height=3.0)
+        assert r.exact
+        assert (r.pairs, r.visible) == brute_force_area(t, grid, a, b, observer_height, 3.0)
+
+
+# --- Precomputed horizons (Terrain.precompute_horizon) ---
+
+def horizon_targets(grid, n, seed):
+    """n hashed in-grid targets 0.5-8.5 m above their cells."""
+    h, w = grid.shape
+    targets = np.empty((n, 3))
+    for i in range(n):
+        k = seed + 4 * i
+        x, y = scenarios.unit(k) * w, scenarios.unit(k + 1) * h
+        targets[i] = (x, y, float(grid[int(y), int(x)]) + 0.5 + 8.0 * scenarios.unit(k + 2))
+    return targets
+
+
+def los_from(t, observer, targets):
+    """los_boolean_batch from observer to every target."""
+    rays = np.hstack([np.tile(observer, (len(targets), 1)), targets])
+    return t.los_boolean_batch(rays)
+
+
+HORIZON_OBSERVERS = [(64.5, 128.5, 10.0), (200.25, 40.75, 25.0), (30.5, 220.5, 3.0)]
+HORIZON_TERRAINS = {
+    "pyramid": {},
+    "walk": {"pyramid": False},
+    "float32": {"precision": "float32"},
+    "curvature": {},
+}
+
+
+@pytest.mark.parametrize("seed", [1, 2])
+@pytest.mark.parametrize("kind", list(HORIZON_TERRAINS))
+def test_los_horizon_matches_los_boolean(kind, seed):
+    grid = scenarios.fractal_grid(256, seed)
+    targets = horizon_targets(grid, 4000, 500 + seed)
+    t = los.Terrain(grid, **HORIZON_TERRAINS[kind])
+    if kind == "curvature":
+        t.set_earth_curvature(30.0)
+    for x, y, height in HORIZON_OBSERVERS:
+        observer = (x, y, float(grid[int(y), int(x)]) + height)
+        for max_range in (None, 60.0):
+            h = t.precompute_horizon(observer, max_range=max_range)
+            got = t.los_horizon_batch(h, targets)
+            assert np.array_equal(got, los_from(t, h.observer, targets))
+            assert t.los_horizon(h, *targets[0]) == got[0]
+
+
+@pytest.mark.parametrize("seed", [1, 2])
+def test_los_horizon_after_update_region(seed):
+    """A horizon built before update_region() still answers as los_boolean
+    does on the updated terrain, whether or not the update lies within its
+    range."""
+    grid = scenarios.fractal_grid(256, seed)
+    targets = horizon_targets(grid, 4000, 500 + seed)
+    t = los.Terrain(grid.copy())
+    x, y, height = HORIZON_OBSERVERS[0]
+    observer = (x, y, float(grid[int(y), int(x)]) + height)
+    horizons = [t.precompute_horizon(observer), t.precompute_horizon(observer, max_range=60.0)]
+    before = los_from(t, observer, targets)
+
+    t.update_region(80, 110, np.full((40, 3), 250.0, dtype=np.float32))
+    t.update_region(180, 200, np.full((20, 20), -50.0, dtype=np.float32))
+    expected = los_from(t, observer, targets)
+    assert (expected != before).sum() > 1000
+    for h in horizons + [t.precompute_horizon(observer)]:
+        assert np.array_equal(t.los_horizon_batch(h, targets), expected)
+
+
+# --- Result cache (Terrain.enable_result_cache) ---
+
+def test_result_cache_invalidated_only_by_crossing_updates():
+    t = los.Terrain(scenarios.flat_grid(128), copy=True)
+    t.enable_result_cache(1024)
+    a = (10.5, 64.5, 5.0, 120.5, 64.5, 5.0)
+    b = (10.5, 10.5, 5.0, 120.5, 10.5, 5.0)
+    pairs = np.array([a, b])
+    assert (t.los_boolean(*a), t.los_boolean(*b)) == (1.0, 1.0)
+
+    t.update_region(60, 40, np.full((50, 3), 50.0, np.float32))  # a wall across a only
+    assert (t.los_boolean(*a), t.los_boolean(*b)) == (0.0, 1.0)
+    stats = t.result_cache_stats()
+    assert (stats["hits"], stats["misses"], stats["invalidated"]) == (1, 3, 1)
+    assert list(t.los_boolean_batch(pairs)) == [0, 1]
+    assert t.result_cache_stats()["hits"] == 3
+
+    t.update_region(120, 120, np.full((4, 4), 80.0, np.float32))  # far from both
+    assert list(t.los_boolean_batch(pairs)) == [0, 1]
+    stats = t.result_cache_stats()
+    assert (stats["hits"], stats["invalidated"]) == (5, 1)
+
+    t.update_region(70, 10, np.full((1, 1), 80.0, np.float32))  # a pole on b
+    assert list(t.los_boolean_batch(pairs)) == [0, 0]
+    stats = t.result_cache_stats()
+    assert (stats["hits"], stats["misses"], stats["invalidated"]) == (6, 4, 2)
+    assert list(t.los_boolean_batch(pairs)) == list(
+        los.Terrain(t.heightmap).los_boolean_batch(pairs))
+
+
+# --- Streaming LAZ ingestion (laz_ingest.py) ---
+
+def point_cloud(n, seed, x_range=(0.0, 37.5), y_range=(0.0, 40.0)):
+    """n LAS-style points; z is stored in 1/8 m steps, so every sum is exact."""
+    rng = np.random.default_rng(seed)
+    number_of_returns = rng.integers(1, 4, n).astype(np.uint8)
+    return {
+        "x": rng.uniform(*x_range, n),
+        "y": rng.uniform(*y_range, n),
+        "z": rng.integers(0, 800, n) / 8.0,
+        "classification": rng.integers(0, 7, n).astype(np.uint8),
+        "return_number": (1 + rng.integers(0, 3, n) % number_of_returns).astype(np.uint8),
+        "number_of_returns": number_of_returns,
+    }
+
+
+def write_las(path, points):
+    """Write points as an uncompressed .las; returns them as stored (scaled)."""
+    laspy = pytest.importorskip("laspy")
+    header = laspy.LasHeader(point_format=1, version="1.2")
+    header.offsets = [0.0, 0.0, 0.0]
+    header.scales = [0.01, 0.01, 0.125]
+    las = laspy.LasData(header)
+    for name, values in points.items():
+        setattr(las, name, values)
+    las.write(str(path))
+    stored = laspy.read(str(path))
+    return {name: np.asarray(getattr(stored, name)) for name in points}
+
+
+def one_shot(points, bounds, stat, returns="all", classes=None):
+    """The DEM of points added to one Rasterizer in a single call."""
+    raster = los.Rasterizer(bounds, 1.0, stat=stat, classes=classes, returns=returns)
+    raster.add(np.ascontiguousarray(points["x"], dtype=np.float64),
+               np.ascontiguousarray(points["y"], dtype=np.float64),
+               np.ascontiguousarray(points["z"], dtype=np.float64),
+               classification=np.ascontiguousarray(points["classification"], dtype=np.uint8),
+               return_number=np.ascontiguousarray(points["return_number"], dtype=np.uint8),
+               number_of_returns=np.ascontiguousarray(points["number_of_returns"],
+                                                      dtype=np.uint8))
+    return raster
+
+
+def test_iter_chunks_yields_every_point_in_bounded_chunks(tmp_path):
+    laz_ingest = pytest.importorskip("laz_ingest")
+    stored = write_las(tmp_path / "cloud.las", point_cloud(10007, 1))
+    chunks = list(laz_ingest.iter_chunks(tmp_path / "cloud.las", chunk_points=1000, prefetch=1))
+    assert [len(c["x"]) for c in chunks] == [1000] * 10 + [7]
+    for name, values in stored.items():
+        assert np.array_equal(np.concatenate([c[name] for c in chunks]), values), name
+    assert chunks[0]["x"].dtype == np.float64 and chunks[0]["classification"].dtype == np.uint8
+
+
+def test_iter_chunks_stops_the_reader_and_raises_its_errors(tmp_path):
+    laz_ingest = pytest.importorskip("laz_ingest")
+    write_las(tmp_path / "cloud.las", point_cloud(5000, 2))
+    chunks = laz_ingest.iter_chunks(tmp_path / "cloud.las", chunk_points=100, prefetch=1)
+    assert len(next(chunks)["x"]) == 100
+    chunks.close()  # with the reader blocked on a full queue
+    assert not any(t.name == "laz-reader" for t in threading.enumerate())
+    with pytest.raises(Exception):
+        list(laz_ingest.iter_chunks(tmp_path / "missing.las"))
+
+
+@pytest.mark.parametrize("stat", ["max", "min", "mean", "percentile"])
+@pytest.mark.parametrize("returns", ["all", "first"])
+def test_rasterize_laz_matches_one_shot_for_any_chunking(tmp_path, stat, returns):
+    laz_ingest = pytest.importorskip("laz_ingest")
+    stored = write_las(tmp_path / "cloud.las", point_cloud(6000, 3))
+    bounds = (0.0, 0.0, 50.0, 40.0)  # the right quarter gets no points
+    want = one_shot(stored, bounds, stat, returns, classes=[1, 2, 5])
+    for chunk_points in (7, 1000, 1_000_000):
+        progress = []
+        got = laz_ingest.rasterize_laz(tmp_path / "cloud.las", 1.0, stat, [1, 2, 5], returns,
+                                       bounds=bounds, chunk_points=chunk_points,
+                                       progress=lambda done, total: progress.append(done))
+        assert got.points == want.points and got.skipped == want.skipped
+        assert np.array_equal(got.counts, want.counts)
+        np.testing.assert_array_equal(got.finish(fill_holes=False), want.finish(fill_holes=False))
+        assert progress[-1] == len(stored["x"])
+
+
+@pytest.mark.parametrize("stat", ["max", "mean"])
+def test_rasterize_laz_adds_files_to_one_raster_in_any_order(tmp_path, stat):
+    laz_ingest = pytest.importorskip("laz_ingest")
+    west = write_las(tmp_path / "west.las", point_cloud(3000, 4, x_range=(0.0, 30.0)))
+    east = write_las(tmp_path / "east.las", point_cloud(3000, 5, x_range=(20.0, 50.0)))
+    bounds = (0.0, 0.0, 50.0, 40.0)
+    both = {name: np.concatenate([west[name], east[name]]) for name in west}
+    want = one_shot(both, bounds, stat).finish(fill_holes=False)
+    for files in (["west.las", "east.las"], ["east.las", "west.las"]):
+        raster = los.Rasterizer(bounds, 1.0, stat=stat)
+        for name in files:
+            laz_ingest.rasterize_laz(tmp_path / name, chunk_points=500, raster=raster)
+        np.testing.assert_array_equal(raster.finish(fill_holes=False), want)
+
+
+# --- Tile pipeline (fetch_usgs_lidar.py) ---
+
+@pytest.fixture
+def fetch_usgs_lidar():
+    pytest.importorskip("laspy")
+    pytest.importorskip("rasterio")
+    pytest.importorskip("requests")
+    import fetch_usgs_lidar
+    return fetch_usgs_lidar
+
+
+def tile_dems(tmp_path, stat):
+    """Three per-tile DEMs on a 1 m lattice, overlapping each other, in the
+    (name, path, x0, y1, h, w) form _convert_tile returns."""
+    rng = np.random.default_rng(6)
+    tiles = []
+    for i, (x0, y1, h, w) in enumerate([(100.0, 240.0, 30, 40), (125.0, 230.0, 35, 30),
+                                        (90.0, 215.0, 20, 50)]):
+        dem = rng.uniform(0, 100, (h, w)).astype(np.float32)
+        dem[rng.random((h, w)) < 0.2] = np.nan
+        path = tmp_path / f"tile{i}_{stat}.npz"
+        np.savez(path, dem=dem, x0=x0, y1=y1)
+        tiles.append((f"tile{i}.laz", path, x0, y1, h, w))
+    return tiles
+
+
+def mosaic_of(tiles, stat):
+    """The merge by its definition: cell by cell, over the tiles in order."""
+    x0, y1 = min(t[2] for t in tiles), max(t[3] for t in tiles)
+    width = max(int(t[2] - x0) + t[5] for t in tiles)
+    height = max(int(y1 - t[3]) + t[4] for t in tiles)
+    out = np.full((height, width), np.nan, dtype=np.float32)
+    for _, path, tx0, ty1, h, w in tiles:
+        dem = np.load(path)["dem"]
+        row, col = int(y1 - ty1), int(tx0 - x0)
+        for r, c in itertools.product(range(h), range(w)):
+            old, new = out[row + r, col + c], dem[r, c]
+            if np.isnan(old):
+                out[row + r, col + c] = new
+            elif not np.isnan(new) and stat in ("max", "min"):
+                out[row + r, col + c] = max(old, new) if stat == "max" else min(old, new)
+    return out
+
+
+@pytest.mark.parametrize("stat", ["max", "min", "mean"])
+def test_merge_tiles_places_and_combines_tiles(tmp_path, fetch_usgs_lidar, stat):
+    fetcher = fetch_usgs_lidar.USGSLidarFetcher(0.0, 0.0, output_dir=tmp_path, stat=stat,
+                                                fill=None)
+    tiles = tile_dems(tmp_path, stat)
+    for order in itertools.permutations(tiles):
+        order = list(order)
+        npy_path, tiled_path, metadata = fetcher._merge_tiles(order, f"merge_{stat}")
+        got = np.load(npy_path)
+        # max and min give one mosaic whatever the order; other stats keep
+        # the first tile's cells where tiles overlap.
+        np.testing.assert_array_equal(got, mosaic_of(order, stat))
+        assert metadata["bounds"]["x_min"] == 90.0 and metadata["bounds"]["y_max"] == 240.0
+        assert (metadata["height"], metadata["width"]) == got.shape == (45, 65)
+        assert metadata["source_files"] == ["tile0.laz", "tile1.laz", "tile2.laz"]
+        np.testing.assert_array_equal(los.TiledTerrain(tiled_path).read_window(0, 0, 65, 45),
+                                      got)
+
+
+class LocalDownloader:
+    """RangeDownloader over a dict of url -> local file; counts downloads."""
+
+    downloads = 0
+
+    def __init__(self, files, parts=4):
+        self.files = files
+
+    def head(self, url):
+        return self.files[url].stat().st_size, '"v1"', True
+
+    def download(self, url, dest, size=None, etag=None, ranges=True, progress=None):
+        type(self).downloads += 1
+        dest.write_bytes(self.files[url].read_bytes())
+        return dest
+
+
+def test_fetch_region_merges_local_tiles_and_reuses_the_cache(tmp_path, fetch_usgs_lidar,
+                                                               monkeypatch):
+    # Four overlapping tiles, converted in whatever order they finish.
+    files, clouds = {}, []
+    for i, (x, y) in enumerate([(0, 0), (30, 5), (10, 35), (45, 40)]):
+        path = tmp_path / "source" / f"tile{i}.las"
+        path.parent.mkdir(exist_ok=True)
+        clouds.append(write_las(path, point_cloud(4000, 10 + i, (x + 0.3, x + 40.0),
+                                                  (y + 0.6, y + 40.0))))
+        files[f"https://example.invalid/{path.name}?sig=1"] = path
+    monkeypatch.setattr(fetch_usgs_lidar, "RangeDownloader",
+                        lambda parts: LocalDownloader(files, parts))
+    LocalDownloader.downloads = 0
+
+    fetcher = fetch_usgs_lidar.USGSLidarFetcher(0.0, 0.0, output_dir=tmp_path / "out",
+                                                stat="max", fill=None)
+    tiles = [{"downloadURL": url, "title": url} for url in files]
+    npy_path, _, metadata = fetcher.fetch_region(tiles, workers=3, queue_size=1)
+    first = np.load(npy_path)
+    assert LocalDownloader.downloads == 4
+    assert len(metadata["source_files"]) == 4
+
+    # The mosaic is the per-cell max over all points, on the merged lattice.
+    b = metadata["bounds"]
+    want = np.full(first.shape, np.nan, dtype=np.float32)
+    for cloud in clouds:
+        col = np.floor(cloud["x"] - b["x_min"]).astype(int)
+        row = np.floor(b["y_max"] - cloud["y"]).astype(int)
+        np.fmax.at(want, (row, col), cloud["z"].astype(np.float32))
+    np.testing.assert_array_equal(first, want)
+
+    # Again: every tile and its DEM come from the cache.
+    npy_path, _, _ = fetcher.fetch_region(tiles, workers=3, queue_size=1)
+    assert LocalDownloader.downloads == 4
+    np.testing.assert_array_equal(np.load(npy_path), first)
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bench/scenarios.h"
+
+// Ray sets shared by the tests, built from the benchmark scenarios' hashes
+// so every platform sees the same rays.
+namespace los {
+namespace test {
+
+// n rays between random points of g, each end 0-30 m above the ground
+// there, so roughly half are blocked.
+inline std::vector<double> random_rays(const bench::Grid& g, int n, uint64_t seed = 1) {
+    std::vector<double> rays(6 * static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        uint64_t k = seed * 0x9E3779B97F4A7C15ull + static_cast<uint64_t>(i) * 8;
+        double* r = &rays[6 * static_cast<size_t>(i)];
+        for (int end = 0; end < 2; end++) {
+            double x = bench::unit(k + 3 * end) * g.width * 0.9999;
+            double y = bench::unit(k + 3 * end + 1) * g.height * 0.9999;
+            r[3 * end] = x;
+            r[3 * end + 1] = y;
+            r[3 * end + 2] = g.at(static_cast<int>(x), static_cast<int>(y)) +
+                             30.0 * bench::unit(k + 3 * end + 2);
+        }
+    }
+    return rays;
+}
+
+} // namespace test
+} // namespace los
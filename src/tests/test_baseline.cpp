@@ -0,0 +1,209 @@
+// Every double-precision walk, with or without the pyramid and in every
+// layout, against a frozen copy of the original los_boolean DDA.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "terrain.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::Layout;
+using los::Terrain;
+using los::bench::Grid;
+
+// The first release's los_boolean, as it was, reading `ptr` row-major.
+// Do not change it: it is what the kernels must keep answering.
+double baseline_los_boolean(const float* ptr, int width, int height, double x0, double y0,
+                            double z0, double x1, double y1, double z1) {
+    double dx = x1 - x0;
+    double dy = y1 - y0;
+    double dz = z1 - z0;
+
+    int x = static_cast<int>(std::floor(x0));
+    int y = static_cast<int>(std::floor(y0));
+
+    int endX = static_cast<int>(std::floor(x1));
+    int endY = static_cast<int>(std::floor(y1));
+
+    int stepX = (dx > 0) ? 1 : -1;
+    int stepY = (dy > 0) ? 1 : -1;
+
+    double tMaxX, tMaxY;
+    double tDeltaX, tDeltaY;
+
+    if (dx != 0) {
+        double nextGridX = (stepX > 0) ? (x + 1.0) : x;
+        tMaxX = (nextGridX - x0) / dx;
+        tDeltaX = 1.0 / std::abs(dx);
+    } else {
+        tMaxX = std::numeric_limits<double>::infinity();
+        tDeltaX = tMaxX;
+    }
+
+    if (dy != 0) {
+        double nextGridY = (stepY > 0) ? (y + 1.0) : y;
+        tMaxY = (nextGridY - y0) / dy;
+        tDeltaY = 1.0 / std::abs(dy);
+    } else {
+        tMaxY = std::numeric_limits<double>::infinity();
+        tDeltaY = tMaxY;
+    }
+
+    while (true) {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return 0.0;
+
+        double t;
+        if (std::abs(dx) > std::abs(dy))
+            t = (x - x0) / dx;
+        else
+            t = (y - y0) / dy;
+
+        if (t < 0) t = 0;
+        if (t > 1) t = 1;
+
+        double rayHeight = z0 + t * dz;
+        float terrain = ptr[y * width + x];
+        if (terrain > rayHeight)
+            return 0.0;
+
+        if (x == endX && y == endY)
+            break;
+
+        if (tMaxX < tMaxY) {
+            tMaxX += tDeltaX;
+            x += stepX;
+        } else {
+            tMaxY += tDeltaY;
+            y += stepY;
+        }
+    }
+
+    return 1.0;
+}
+
+// Rays along a row or column and at exactly 45 degrees, from cell corners,
+// centres and edges, so the walk's tMaxX == tMaxY ties and t clamping are
+// exercised; the heights graze the terrain under the segment.
+std::vector<double> aligned_rays(const Grid& g, int n) {
+    std::vector<double> rays;
+    static const int dirs[8][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1},
+                                   {1, 1}, {-1, 1}, {1, -1}, {-1, -1}};
+    static const double offsets[3] = {0.0, 0.5, 0.25};
+    for (int i = 0; i < n; i++) {
+        uint64_t k = 900 + 8 * static_cast<uint64_t>(i);
+        const int* d = dirs[los::bench::mix(k) % 8];
+        double off = offsets[los::bench::mix(k + 1) % 3];
+        int length = 1 + static_cast<int>(los::bench::unit(k + 2) * (g.width / 2));
+        int cx = static_cast<int>(los::bench::unit(k + 3) * g.width);
+        int cy = static_cast<int>(los::bench::unit(k + 4) * g.height);
+        double x0 = cx + off, y0 = cy + off;
+        double x1 = x0 + d[0] * length, y1 = y0 + d[1] * length;
+        if (x1 < 0 || y1 < 0 || x1 >= g.width || y1 >= g.height)
+            continue;
+        double z0 = g.at(cx, cy) + 4.0 * los::bench::unit(k + 5);
+        double z1 = g.at(static_cast<int>(x1), static_cast<int>(y1)) +
+                    4.0 * los::bench::unit(k + 6);
+        rays.insert(rays.end(), {x0, y0, z0, x1, y1, z1});
+    }
+    return rays;
+}
+
+struct RaySet {
+    std::string name;
+    std::vector<double> rays;
+};
+
+std::vector<RaySet> ray_sets(const Grid& g) {
+    std::vector<RaySet> sets;
+    sets.push_back({"random", los::test::random_rays(g, 4000, 3)});
+    sets.push_back({"aligned", aligned_rays(g, 4000)});
+    for (auto shape : {los::bench::Shape::Axis, los::bench::Shape::Diagonal,
+                       los::bench::Shape::Short})
+        for (auto height : {los::bench::Height::Clear, los::bench::Height::Blocked})
+            sets.push_back({std::string(los::bench::shape_name(shape)) +
+                                (height == los::bench::Height::Clear ? " clear" : " blocked"),
+                            los::bench::make_rays(g, shape, height, 1000)});
+    // Degenerate and edge cases: a single cell, ends on the far border, and
+    // rays that leave the grid.
+    double top = g.at(10, 10) + 1.0;
+    sets.push_back({"edges",
+                    {10.5, 10.5, top, 10.5, 10.5, top,
+                     0.0, 0.0, 300.0, g.width - 1e-9, g.height - 1e-9, 300.0,
+                     0.0, g.height - 0.5, 300.0, g.width - 0.5, 0.0, 300.0,
+                     5.5, 5.5, 300.0, -3.0, 5.5, 300.0,
+                     5.5, 5.5, 300.0, 5.5, g.height + 2.0, 300.0}});
+    return sets;
+}
+
+struct Config {
+    const char* name;
+    bool pyramid;
+    Layout layout;
+};
+
+class Baseline : public ::testing::TestWithParam<Config> {};
+
+TEST_P(Baseline, MatchesFrozenDDA) {
+    const Config c = GetParam();
+    Grid g = los::bench::fractal_grid(200, 11);
+    Terrain t(g.data.data(), g.width, g.height, c.pyramid, los::Precision::Double,
+              los::Device::CPU, c.layout);
+    int blocked = 0, total = 0;
+    for (const RaySet& set : ray_sets(g)) {
+        int64_t n = static_cast<int64_t>(set.rays.size() / 6);
+        std::vector<uint8_t> batch(n);
+        t.los_boolean_batch(set.rays.data(), n, batch.data());
+        for (int64_t i = 0; i < n; i++) {
+            const double* r = &set.rays[6 * i];
+            double want = baseline_los_boolean(g.data.data(), g.width, g.height, r[0], r[1],
+                                               r[2], r[3], r[4], r[5]);
+            ASSERT_EQ(t.los_boolean(r[0], r[1], r[2], r[3], r[4], r[5]), want)
+                << set.name << " ray " << i;
+            ASSERT_EQ(batch[i], want) << set.name << " ray " << i << " (batch)";
+            blocked += want == 0.0;
+            total++;
+        }
+    }
+    EXPECT_GT(blocked, total / 5);
+    EXPECT_LT(blocked, total * 4 / 5);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Configs, Baseline,
+    ::testing::Values(Config{"Pyramid", true, Layout::RowMajor},
+                      Config{"Packets", false, Layout::RowMajor},
+                      Config{"Blocked", true, Layout::Blocked},
+                      Config{"Morton", false, Layout::Morton}),
+    [](const ::testing::TestParamInfo<Config>& info) { return std::string(info.param.name); });
+
+// The free kernels, without a Terrain around them.
+TEST(Baseline, RawKernelsMatchFrozenDDA) {
+    Grid g = los::bench::fractal_grid(160, 12);
+    los::MaxPyramid pyramid(g.data.data(), g.width, g.height);
+    for (const RaySet& set : ray_sets(g))
+        for (size_t i = 0; i < set.rays.size() / 6; i++) {
+            const double* r = &set.rays[6 * i];
+            double want = baseline_los_boolean(g.data.data(), g.width, g.height, r[0], r[1],
+                                               r[2], r[3], r[4], r[5]);
+            ASSERT_EQ(los::los_boolean_raw(g.data.data(), g.width, g.height, r[0], r[1], r[2],
+                                           r[3], r[4], r[5]),
+                      want)
+                << set.name << " ray " << i;
+            ASSERT_EQ(los::los_boolean_pyramid(g.data.data(), g.width, g.height, pyramid, r[0],
+                                               r[1], r[2], r[3], r[4], r[5]),
+                      want)
+                << set.name << " ray " << i << " (pyramid)";
+        }
+}
+
+} // namespace
@@ -0,0 +1,115 @@
+// Bilinear terrains: los_boolean against the bilinear surface sampled
+// densely along each ray, and the pyramid against the plain walk once rays
+// bend with the earth.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bench/scenarios.h"
+#include "terrain.h"
+
+namespace {
+
+using los::Interpolation;
+using los::Layout;
+using los::Precision;
+using los::Terrain;
+using los::bench::Grid;
+
+Terrain bilinear_terrain(const Grid& g, bool pyramid) {
+    return Terrain(g.data.data(), g.width, g.height, pyramid, Precision::Double, los::Device::CPU,
+                   Layout::RowMajor, 0.0f, Interpolation::Bilinear);
+}
+
+// n rays between hashed in-grid points, 1-5 m above the observer's cell and
+// 0-4 m above the target's, so that many of them graze the terrain.
+std::vector<double> grazing_rays(const Grid& g, int n, uint64_t seed = 1000) {
+    std::vector<double> rays(6 * static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        uint64_t k = seed + 8 * static_cast<uint64_t>(i);
+        double x0 = los::bench::unit(k) * g.width, y0 = los::bench::unit(k + 1) * g.height;
+        double x1 = los::bench::unit(k + 2) * g.width, y1 = los::bench::unit(k + 3) * g.height;
+        double z0 = g.at(static_cast<int>(x0), static_cast<int>(y0)) + 1.0 +
+                    4.0 * los::bench::unit(k + 4);
+        double z1 = g.at(static_cast<int>(x1), static_cast<int>(y1)) +
+                    4.0 * los::bench::unit(k + 5);
+        double* r = &rays[6 * static_cast<size_t>(i)];
+        r[0] = x0, r[1] = y0, r[2] = z0, r[3] = x1, r[4] = y1, r[5] = z1;
+    }
+    return rays;
+}
+
+// The surface a bilinear terrain reads at (px, py): each cell's height at
+// its centre, clamped past the border half-cells.
+double bilinear_surface(const Grid& g, double px, double py) {
+    double p = px + 0.5, q = py + 0.5;
+    int i = static_cast<int>(std::floor(p)), j = static_cast<int>(std::floor(q));
+    int xa = std::max(i - 1, 0), xb = std::min(i, g.width - 1);
+    int ya = std::max(j - 1, 0), yb = std::min(j, g.height - 1);
+    double u = p - i, v = q - j;
+    double lo = g.at(xa, ya) + u * (double(g.at(xb, ya)) - g.at(xa, ya));
+    double hi = g.at(xa, yb) + u * (double(g.at(xb, yb)) - g.at(xa, yb));
+    return lo + v * (hi - lo);
+}
+
+class BilinearSeed : public ::testing::TestWithParam<int> {};
+
+TEST_P(BilinearSeed, MatchesDenseSampling) {
+    Grid g = los::bench::fractal_grid(128, GetParam());
+    std::vector<double> rays = grazing_rays(g, 1000);
+    const int64_t n = 1000;
+    std::vector<uint8_t> exact(n), walked(n), nearest(n);
+    bilinear_terrain(g, true).los_boolean_batch(rays.data(), n, exact.data());
+    bilinear_terrain(g, false).los_boolean_batch(rays.data(), n, walked.data());
+    Terrain(g.data.data(), g.width, g.height, true).los_boolean_batch(rays.data(), n,
+                                                                      nearest.data());
+    EXPECT_EQ(exact, walked);
+    EXPECT_NE(exact, nearest);
+
+    // 64 samples per cell along the ray. A sample under the surface must
+    // block; a block no sample sees must come from a peak between two
+    // samples.
+    for (int64_t i = 0; i < n; i++) {
+        const double* r = &rays[6 * i];
+        int steps = static_cast<int>(std::ceil(std::hypot(r[3] - r[0], r[4] - r[1]) * 64)) + 1;
+        double clearance = std::numeric_limits<double>::infinity();
+        for (int s = 0; s <= steps; s++) {
+            double t = static_cast<double>(s) / steps;
+            double x = r[0] + t * (r[3] - r[0]), y = r[1] + t * (r[4] - r[1]);
+            clearance = std::min(clearance, r[2] + t * (r[5] - r[2]) - bilinear_surface(g, x, y));
+        }
+        if (exact[i])
+            ASSERT_GE(clearance, 0.0) << "ray " << i;
+        else
+            ASSERT_LT(clearance, 0.01) << "ray " << i;
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Seeds, BilinearSeed, ::testing::Values(2, 5));
+
+TEST(Bilinear, PyramidMatchesWalkWithCurvature) {
+    Grid g = los::bench::fractal_grid(128, 2);
+    std::vector<double> rays = grazing_rays(g, 1000);
+    const int64_t n = 1000;
+    Terrain walked = bilinear_terrain(g, false), skipped = bilinear_terrain(g, true);
+    std::vector<uint8_t> flat(n), bent(n), want(n);
+    skipped.los_boolean_batch(rays.data(), n, flat.data());
+    for (Terrain* t : {&walked, &skipped})
+        t->set_earth_curvature(30.0, 4.0 / 3.0);
+    skipped.los_boolean_batch(rays.data(), n, bent.data());
+    walked.los_boolean_batch(rays.data(), n, want.data());
+    EXPECT_EQ(bent, want);
+    EXPECT_NE(bent, flat);
+    for (int64_t i = 0; i < n; i += 7) {
+        const double* r = &rays[6 * i];
+        ASSERT_EQ(skipped.los_boolean(r[0], r[1], r[2], r[3], r[4], r[5]), want[i])
+            << "ray " << i;
+    }
+}
+
+} // namespace
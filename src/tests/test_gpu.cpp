@@ -0,0 +1,194 @@
+// The GPU backend against the CPU kernels. Without a visible GPU the
+// offloaded regions run on the host, through the same device code, so this
+// checks the backend's chunking, pyramid packing, viewshed windows and
+// region uploads everywhere; on a GPU runner it checks the device itself.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "terrain.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::Device;
+using los::Precision;
+using los::Terrain;
+using los::bench::Grid;
+
+#ifndef LOS_WITH_GPU
+#define SKIP_WITHOUT_GPU() GTEST_SKIP() << "built without the GPU backend (OpenMP not found)"
+#else
+#define SKIP_WITHOUT_GPU() (void)0
+#endif
+
+// Random rays plus axis-aligned and 45 degree ones, whose walks tie at
+// cell corners.
+std::vector<double> test_rays(const Grid& g) {
+    std::vector<double> rays = los::test::random_rays(g, 3000);
+    for (auto shape : {los::bench::Shape::Axis, los::bench::Shape::Diagonal}) {
+        std::vector<double> more = los::bench::make_rays(g, shape, los::bench::Height::Blocked, 500);
+        rays.insert(rays.end(), more.begin(), more.end());
+    }
+    return rays;
+}
+
+struct Config {
+    bool pyramid;
+    Precision precision;
+    bool curvature;
+};
+
+class GpuBatch : public ::testing::TestWithParam<Config> {};
+
+TEST_P(GpuBatch, MatchesCpu) {
+    SKIP_WITHOUT_GPU();
+    const Config c = GetParam();
+    Grid g = los::bench::fractal_grid(300, 3);
+    Terrain cpu(g.data.data(), g.width, g.height, c.pyramid, c.precision);
+    Terrain gpu(g.data.data(), g.width, g.height, c.pyramid, c.precision, Device::GPU);
+    ASSERT_EQ(gpu.device(), Device::GPU);
+    if (c.curvature) {
+        cpu.set_earth_curvature(30.0, 4.0 / 3.0);
+        gpu.set_earth_curvature(30.0, 4.0 / 3.0);
+    }
+
+    std::vector<double> rays = test_rays(g);
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+
+    std::vector<uint8_t> want(n), got(n);
+    cpu.los_boolean_batch(rays.data(), n, want.data());
+    gpu.los_boolean_batch(rays.data(), n, got.data());
+    int64_t visible = 0;
+    for (int64_t i = 0; i < n; i++) {
+        ASSERT_EQ(got[i], want[i]) << "ray " << i;
+        visible += want[i];
+    }
+    EXPECT_GT(visible, n / 10);
+    EXPECT_LT(visible, n - n / 10);
+
+    for (int samples : {1, 9}) {
+        std::vector<double> pw(n), pg(n);
+        cpu.los_probability_batch(rays.data(), n, samples, pw.data());
+        gpu.los_probability_batch(rays.data(), n, samples, pg.data());
+        for (int64_t i = 0; i < n; i++)
+            ASSERT_EQ(pg[i], pw[i]) << "ray " << i << ", " << samples << " samples";
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Configs, GpuBatch,
+    ::testing::Values(Config{false, Precision::Double, false},
+                      Config{true, Precision::Double, false},
+                      Config{false, Precision::Float, false},
+                      Config{true, Precision::Float, false},
+                      Config{true, Precision::Double, true},
+                      Config{false, Precision::Float, true}),
+    [](const ::testing::TestParamInfo<Config>& info) {
+        const Config& c = info.param;
+        return std::string(c.pyramid ? "Pyramid" : "Flat") +
+               (c.precision == Precision::Float ? "Float" : "Double") +
+               (c.curvature ? "Curved" : "");
+    });
+
+TEST(Gpu, BatchLargerThanOneChunk) {
+    SKIP_WITHOUT_GPU();
+    Grid g = los::bench::fractal_grid(128, 5);
+    Terrain cpu(g.data.data(), g.width, g.height, true);
+    Terrain gpu(g.data.data(), g.width, g.height, true, Precision::Double, Device::GPU);
+
+    // Past two chunks of 2^16 rays, so some chunks wait on a taskwait.
+    std::vector<double> rays = los::test::random_rays(g, 150000, 2);
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+    std::vector<uint8_t> want(n), got(n);
+    cpu.los_boolean_batch(rays.data(), n, want.data());
+    gpu.los_boolean_batch(rays.data(), n, got.data());
+    EXPECT_EQ(got, want);
+}
+
+TEST(Gpu, ViewshedMatchesCpu) {
+    SKIP_WITHOUT_GPU();
+    Grid g = los::bench::fractal_grid(200, 7);
+    Terrain cpu(g.data.data(), g.width, g.height, true);
+    Terrain gpu(g.data.data(), g.width, g.height, true, Precision::Double, Device::GPU);
+    size_t cells = g.data.size();
+
+    struct Observer {
+        double x, y, radius;
+    };
+    // Full grid, windows clipped at every edge and corner, and the
+    // observers viewshed() ignores: off the grid and NaN.
+    const Observer observers[] = {{100.5, 100.5, INFINITY}, {3.2, 150.7, 40.0},
+                                  {196.9, 2.1, 55.0},       {120.0, 199.5, 25.0},
+                                  {60.3, 80.8, 0.5},        {-1.0, 50.0, 30.0},
+                                  {50.0, 200.0, 30.0},      {NAN, 10.0, 30.0}};
+    for (int curved = 0; curved < 2; curved++) {
+        if (curved) {
+            cpu.set_earth_curvature(50.0, 4.0 / 3.0);
+            gpu.set_earth_curvature(50.0, 4.0 / 3.0);
+        }
+        for (const Observer& o : observers) {
+            double z = 10.0;
+            if (o.x >= 0 && o.y >= 0 && o.x < g.width && o.y < g.height)
+                z += g.at(static_cast<int>(o.x), static_cast<int>(o.y));
+            std::vector<uint8_t> want(cells, 7), got(cells, 7);
+            if (std::isnan(o.x))
+                std::fill(want.begin(), want.end(), uint8_t(0));
+            else
+                cpu.viewshed(o.x, o.y, z, 2.0, o.radius, want.data());
+            gpu.viewshed(o.x, o.y, z, 2.0, o.radius, got.data());
+            EXPECT_EQ(got, want) << "observer (" << o.x << ", " << o.y << "), r " << o.radius
+                                 << (curved ? ", curved" : "");
+        }
+    }
+}
+
+TEST(Gpu, UpdateRegionMatchesRebuild) {
+    SKIP_WITHOUT_GPU();
+    Grid g = los::bench::fractal_grid(256, 11);
+    Grid patch = los::bench::fractal_grid(64, 12);
+    std::vector<float> dem = g.data;
+    Terrain gpu(dem.data(), g.width, g.height, true, Precision::Double, Device::GPU);
+
+    // Raised patches, so the new pyramid blocks decide many rays: inside the
+    // grid, overlapping it, ending on an even row (whose parent block also
+    // covers the row below) and running into the corner.
+    for (float& v : patch.data)
+        v += 100.0f;
+    gpu.update_region(30, 70, 50, 40, patch.data.data(), patch.width);
+    gpu.update_region(60, 90, 30, 30, patch.data.data() + 1, patch.width);
+    gpu.update_region(10, 11, 20, 20, patch.data.data() + 2, patch.width);
+    gpu.update_region(200, 192, 56, 64, patch.data.data() + 8, patch.width);
+
+    std::vector<float> fresh = dem;
+    Terrain cpu(fresh.data(), g.width, g.height, true);
+
+    std::vector<double> rays = test_rays(g);
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+    std::vector<uint8_t> want(n), got(n);
+    cpu.los_boolean_batch(rays.data(), n, want.data());
+    gpu.los_boolean_batch(rays.data(), n, got.data());
+    EXPECT_EQ(got, want);
+
+    std::vector<uint8_t> vw(fresh.size()), vg(fresh.size());
+    cpu.viewshed(60.5, 90.5, fresh[90 * 256 + 60] + 5.0, 0.0, 120.0, vw.data());
+    gpu.viewshed(60.5, 90.5, fresh[90 * 256 + 60] + 5.0, 0.0, 120.0, vg.data());
+    EXPECT_EQ(vg, vw);
+}
+
+TEST(Gpu, RejectsCpuOnlyTerrains) {
+    SKIP_WITHOUT_GPU();
+    Grid g = los::bench::fractal_grid(64, 1);
+    EXPECT_THROW(Terrain(g.data.data(), g.width, g.height, true, Precision::Double, Device::GPU,
+                         los::Layout::RowMajor, 0.5f),
+                 std::invalid_argument);
+    EXPECT_THROW(Terrain(g.data.data(), g.width, g.height, true, Precision::Double, Device::GPU,
+                         los::Layout::RowMajor, 0.0f, los::Interpolation::Bilinear),
+                 std::invalid_argument);
+}
+
+} // namespace
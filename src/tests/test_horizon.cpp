@@ -0,0 +1,131 @@
+// Precomputed horizons: los_horizon from a fixed observer against
+// los_boolean from it, before and after update_region().
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "bench/scenarios.h"
+#include "horizon.h"
+#include "terrain.h"
+
+namespace {
+
+using los::Horizon;
+using los::Precision;
+using los::Terrain;
+using los::bench::Grid;
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// n hashed in-grid targets 0.5-8.5 m above their cells, as (x, y, z).
+std::vector<double> horizon_targets(const Grid& g, int n, uint64_t seed) {
+    std::vector<double> targets(3 * static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        uint64_t k = seed + 4 * static_cast<uint64_t>(i);
+        double x = los::bench::unit(k) * g.width, y = los::bench::unit(k + 1) * g.height;
+        double* t = &targets[3 * static_cast<size_t>(i)];
+        t[0] = x, t[1] = y;
+        t[2] = g.at(static_cast<int>(x), static_cast<int>(y)) + 0.5 + 8.0 * los::bench::unit(k + 2);
+    }
+    return targets;
+}
+
+// los_boolean_batch from (x, y, z) to every target.
+std::vector<uint8_t> los_from(const Terrain& t, double x, double y, double z,
+                              const std::vector<double>& targets) {
+    int64_t n = static_cast<int64_t>(targets.size() / 3);
+    std::vector<double> rays;
+    for (int64_t i = 0; i < n; i++)
+        rays.insert(rays.end(), {x, y, z, targets[3 * i], targets[3 * i + 1], targets[3 * i + 2]});
+    std::vector<uint8_t> out(n);
+    t.los_boolean_batch(rays.data(), n, out.data());
+    return out;
+}
+
+std::vector<uint8_t> horizon_batch(const Terrain& t, const Horizon& h,
+                                   const std::vector<double>& targets) {
+    std::vector<uint8_t> out(targets.size() / 3);
+    t.los_horizon_batch(h, targets.data(), static_cast<int64_t>(out.size()), out.data());
+    return out;
+}
+
+struct Observer {
+    double x, y, height;
+};
+
+// Mid-grid, off-centre in its cell near a corner, and low near an edge.
+const Observer kObservers[] = {{64.5, 128.5, 10.0}, {200.25, 40.75, 25.0}, {30.5, 220.5, 3.0}};
+
+struct Config {
+    const char* name;
+    bool pyramid;
+    Precision precision;
+    bool curvature;
+};
+
+class LosHorizon : public ::testing::TestWithParam<Config> {};
+
+TEST_P(LosHorizon, MatchesLosBoolean) {
+    const Config c = GetParam();
+    for (uint64_t seed : {1, 2}) {
+        Grid g = los::bench::fractal_grid(256, seed);
+        std::vector<double> targets = horizon_targets(g, 4000, 500 + seed);
+        Terrain t(g.data.data(), g.width, g.height, c.pyramid, c.precision);
+        if (c.curvature)
+            t.set_earth_curvature(30.0, 4.0 / 3.0);
+        for (const Observer& o : kObservers) {
+            double z = g.at(static_cast<int>(o.x), static_cast<int>(o.y)) + o.height;
+            for (double range : {kInf, 60.0}) {
+                Horizon h = t.precompute_horizon(o.x, o.y, z, 360, range, 64);
+                std::vector<uint8_t> got = horizon_batch(t, h, targets);
+                ASSERT_EQ(got, los_from(t, h.x(), h.y(), h.z(), targets))
+                    << "seed " << seed << ", observer (" << o.x << ", " << o.y << "), range "
+                    << range;
+                EXPECT_EQ(t.los_horizon(h, targets[0], targets[1], targets[2]), got[0]);
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Configs, LosHorizon,
+    ::testing::Values(Config{"Pyramid", true, Precision::Double, false},
+                      Config{"Walk", false, Precision::Double, false},
+                      Config{"Float", true, Precision::Float, false},
+                      Config{"Curvature", true, Precision::Double, true}),
+    [](const ::testing::TestParamInfo<Config>& info) { return std::string(info.param.name); });
+
+// A horizon built before update_region() still answers as los_boolean does
+// on the updated terrain, whether or not the update lies within its range.
+TEST(LosHorizon, FollowsUpdateRegion) {
+    for (uint64_t seed : {1, 2}) {
+        Grid g = los::bench::fractal_grid(256, seed);
+        std::vector<double> targets = horizon_targets(g, 4000, 500 + seed);
+        std::vector<float> dem = g.data;
+        Terrain t(dem.data(), g.width, g.height, true);
+        const Observer& o = kObservers[0];
+        double z = g.at(static_cast<int>(o.x), static_cast<int>(o.y)) + o.height;
+        std::vector<Horizon> horizons;
+        horizons.push_back(t.precompute_horizon(o.x, o.y, z, 360, kInf, 64));
+        horizons.push_back(t.precompute_horizon(o.x, o.y, z, 360, 60.0, 64));
+        std::vector<uint8_t> before = los_from(t, o.x, o.y, z, targets);
+
+        std::vector<float> wall(40 * 3, 250.0f), pit(20 * 20, -50.0f);
+        t.update_region(80, 110, 3, 40, wall.data(), 3);
+        t.update_region(180, 200, 20, 20, pit.data(), 20);
+        std::vector<uint8_t> want = los_from(t, o.x, o.y, z, targets);
+        int changed = 0;
+        for (size_t i = 0; i < want.size(); i++)
+            changed += want[i] != before[i];
+        EXPECT_GT(changed, 1000);
+        horizons.push_back(t.precompute_horizon(o.x, o.y, z, 360, kInf, 64));
+        for (const Horizon& h : horizons)
+            EXPECT_EQ(horizon_batch(t, h, targets), want) << "seed " << seed;
+    }
+}
+
+} // namespace
@@ -0,0 +1,264 @@
+// Rasterizer: binning independent of how points are chunked and ordered,
+// against per-cell reductions done directly, and the nearest-cell hole fill
+// against a brute-force search.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "bench/scenarios.h"
+#include "rasterize.h"
+#include "thread_pool.h"
+
+namespace {
+
+using los::CellStat;
+using los::Rasterizer;
+using los::Returns;
+
+struct Points {
+    std::vector<double> x, y, z;
+    std::vector<uint8_t> classification, returnNumber, numberOfReturns;
+    size_t size() const { return x.size(); }
+};
+
+// n points over [0, 50] x [0, 40] plus a few outside it, on its far edges
+// and with NaN z. Heights are multiples of 1/8 so every sum is exact and a
+// mean does not depend on the order it was added in. The right quarter of
+// the area gets no points, leaving holes.
+Points make_points(int n) {
+    Points p;
+    for (int i = 0; i < n; i++) {
+        uint64_t k = 77 + 8 * static_cast<uint64_t>(i);
+        double x = 37.5 * los::bench::unit(k), y = 40.0 * los::bench::unit(k + 1);
+        if (i % 97 == 0)
+            x = -1.0 - x;               // outside
+        else if (i % 89 == 0)
+            x = 50.0, y = 0.0;          // the corner cell of the last row and column
+        double z = std::floor(800.0 * los::bench::unit(k + 2)) / 8.0;
+        if (i % 101 == 0)
+            z = std::numeric_limits<double>::quiet_NaN();
+        uint8_t returns = static_cast<uint8_t>(1 + los::bench::mix(k + 3) % 3);
+        p.x.push_back(x);
+        p.y.push_back(y);
+        p.z.push_back(z);
+        p.classification.push_back(static_cast<uint8_t>(los::bench::mix(k + 4) % 7));
+        p.numberOfReturns.push_back(returns);
+        p.returnNumber.push_back(static_cast<uint8_t>(1 + los::bench::mix(k + 5) % returns));
+    }
+    return p;
+}
+
+// Runs a test body on a pool of `threads`, restoring the pool after.
+class PoolSize {
+public:
+    explicit PoolSize(int threads) : saved_(los::ThreadPool::instance().num_threads()) {
+        los::ThreadPool::instance().set_num_threads(threads);
+    }
+    ~PoolSize() { los::ThreadPool::instance().set_num_threads(saved_); }
+
+private:
+    int saved_;
+};
+
+void configure(Rasterizer& r, Returns returns) {
+    r.set_classes({1, 2, 5});
+    r.set_returns(returns);
+}
+
+// Adds points order[begin, end) as one chunk.
+void add_chunk(Rasterizer& r, const Points& p, const std::vector<size_t>& order, size_t begin,
+               size_t end) {
+    Points c;
+    for (size_t k = begin; k < end; k++) {
+        size_t i = order[k];
+        c.x.push_back(p.x[i]);
+        c.y.push_back(p.y[i]);
+        c.z.push_back(p.z[i]);
+        c.classification.push_back(p.classification[i]);
+        c.returnNumber.push_back(p.returnNumber[i]);
+        c.numberOfReturns.push_back(p.numberOfReturns[i]);
+    }
+    r.add(c.x.data(), c.y.data(), c.z.data(), static_cast<int64_t>(c.size()),
+          c.classification.data(), c.returnNumber.data(), c.numberOfReturns.data());
+}
+
+bool same_grid(const std::vector<float>& a, const std::vector<float>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+TEST(Rasterizer, ChunkOrderDoesNotChangeTheGrid) {
+    const Points p = make_points(30000);
+    std::vector<size_t> inOrder(p.size());
+    std::iota(inOrder.begin(), inOrder.end(), 0);
+
+    for (CellStat stat : {CellStat::Max, CellStat::Min, CellStat::Mean, CellStat::Percentile}) {
+        for (Returns returns : {Returns::All, Returns::First, Returns::Last}) {
+            Rasterizer once(0.0, 0.0, 50.0, 40.0, 1.0, stat, 75.0);
+            configure(once, returns);
+            add_chunk(once, p, inOrder, 0, p.size());
+            const std::vector<float> want = once.finish(false);
+
+            // Chunks of uneven sizes, in a shuffled order of points, on 1
+            // and 4 threads (one band, then the banded scatter).
+            for (int threads : {1, 4}) {
+                PoolSize pool(threads);
+                for (uint64_t seed : {1, 2, 3}) {
+                    std::vector<size_t> order = inOrder;
+                    for (size_t i = order.size() - 1; i > 0; i--)
+                        std::swap(order[i], order[los::bench::mix(seed * 1000003 + i) % (i + 1)]);
+                    Rasterizer chunked(0.0, 0.0, 50.0, 40.0, 1.0, stat, 75.0);
+                    configure(chunked, returns);
+                    size_t begin = 0;
+                    for (int c = 0; begin < order.size(); c++) {
+                        size_t size = 1 + los::bench::mix(seed + 17 * c) % 4000;
+                        size_t end = std::min(order.size(), begin + size);
+                        add_chunk(chunked, p, order, begin, end);
+                        begin = end;
+                    }
+                    EXPECT_EQ(chunked.points(), once.points());
+                    EXPECT_EQ(chunked.skipped(), once.skipped());
+                    EXPECT_EQ(chunked.counts(), once.counts());
+                    EXPECT_TRUE(same_grid(chunked.finish(false), want))
+                        << "stat " << static_cast<int>(stat) << ", returns "
+                        << static_cast<int>(returns) << ", " << threads << " threads, seed "
+                        << seed;
+                }
+            }
+        }
+    }
+}
+
+TEST(Rasterizer, CellsHoldTheirPointsStatistic) {
+    const Points p = make_points(20000);
+    std::vector<size_t> order(p.size());
+    std::iota(order.begin(), order.end(), 0);
+    Rasterizer max(0.0, 0.0, 50.0, 40.0, 1.0, CellStat::Max);
+    Rasterizer mean(0.0, 0.0, 50.0, 40.0, 1.0, CellStat::Mean);
+    Rasterizer median(0.0, 0.0, 50.0, 40.0, 1.0, CellStat::Percentile, 50.0);
+    for (Rasterizer* r : {&max, &mean, &median}) {
+        configure(*r, Returns::First);
+        add_chunk(*r, p, order, 0, p.size());
+    }
+
+    // The same reductions, point by point.
+    const int w = max.width(), h = max.height();
+    ASSERT_EQ(w, 51);
+    ASSERT_EQ(h, 41);
+    std::vector<std::vector<double>> cells(static_cast<size_t>(w) * h);
+    int64_t kept = 0;
+    for (size_t i = 0; i < p.size(); i++) {
+        double cx = std::floor(p.x[i]), cy = std::floor(40.0 - p.y[i]);
+        int c = p.classification[i];
+        if (cx < 0 || cy < 0 || cx >= w || cy >= h || std::isnan(p.z[i]) ||
+            !(c == 1 || c == 2 || c == 5) || p.returnNumber[i] != 1)
+            continue;
+        cells[static_cast<size_t>(cy) * w + static_cast<size_t>(cx)].push_back(p.z[i]);
+        kept++;
+    }
+    EXPECT_EQ(max.points(), kept);
+    EXPECT_EQ(max.skipped(), static_cast<int64_t>(p.size()) - kept);
+    EXPECT_FALSE(cells[static_cast<size_t>(h - 1) * w + (w - 1)].empty());
+
+    std::vector<float> gotMax = max.finish(false), gotMean = mean.finish(false),
+                       gotMedian = median.finish(false);
+    int holes = 0;
+    for (size_t i = 0; i < cells.size(); i++) {
+        std::vector<double>& v = cells[i];
+        if (v.empty()) {
+            EXPECT_TRUE(std::isnan(gotMax[i]) && std::isnan(gotMean[i]) && std::isnan(gotMedian[i]));
+            holes++;
+            continue;
+        }
+        std::sort(v.begin(), v.end());
+        EXPECT_EQ(gotMax[i], static_cast<float>(v.back()));
+        EXPECT_EQ(gotMean[i], static_cast<float>(std::accumulate(v.begin(), v.end(), 0.0) /
+                                                 v.size()));
+        double rank = 0.5 * (v.size() - 1);
+        size_t lo = static_cast<size_t>(rank);
+        double median = v[lo] + (rank - lo) * (v[std::min(lo + 1, v.size() - 1)] - v[lo]);
+        EXPECT_FLOAT_EQ(gotMedian[i], static_cast<float>(median));
+    }
+    EXPECT_GT(holes, w * h / 5);
+}
+
+// Nearest filled cell by brute force: every candidate at the least
+// squared distance, within max_distance.
+std::vector<std::vector<float>> nearest_values(const std::vector<float>& grid, int w, int h,
+                                               double max_distance) {
+    std::vector<std::vector<float>> out(grid.size());
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            size_t i = static_cast<size_t>(y) * w + x;
+            if (!std::isnan(grid[i]))
+                continue;
+            double best = max_distance * max_distance;
+            for (int sy = 0; sy < h; sy++)
+                for (int sx = 0; sx < w; sx++) {
+                    float v = grid[static_cast<size_t>(sy) * w + sx];
+                    if (std::isnan(v))
+                        continue;
+                    double d2 = double(sx - x) * (sx - x) + double(sy - y) * (sy - y);
+                    if (d2 < best)
+                        out[i].clear(), best = d2;
+                    if (d2 <= best)
+                        out[i].push_back(v);
+                }
+        }
+    return out;
+}
+
+TEST(Rasterizer, FillNearestTakesTheNearestCell) {
+    const int w = 48, h = 36;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<float> grid(static_cast<size_t>(w) * h, nan);
+
+    // Scattered data with a 20 x 14 hole in the middle and an empty band
+    // along the bottom rows. Every value is distinct.
+    for (int y = 0; y < h - 6; y++)
+        for (int x = 0; x < w; x++) {
+            bool inHole = x >= 14 && x < 34 && y >= 8 && y < 22;
+            if (!inHole && los::bench::mix(5 + static_cast<uint64_t>(y) * w + x) % 3 == 0)
+                grid[static_cast<size_t>(y) * w + x] = static_cast<float>(y * w + x);
+        }
+
+    for (double maxDistance : {std::numeric_limits<double>::infinity(), 4.0, 1.0}) {
+        std::vector<float> filled = grid;
+        Rasterizer::fill_nearest(filled.data(), w, h, maxDistance);
+        std::vector<std::vector<float>> want = nearest_values(grid, w, h, maxDistance);
+        int filledCells = 0, left = 0;
+        for (size_t i = 0; i < grid.size(); i++) {
+            if (!std::isnan(grid[i])) {
+                EXPECT_EQ(filled[i], grid[i]);
+                continue;
+            }
+            if (want[i].empty()) {
+                EXPECT_TRUE(std::isnan(filled[i])) << "cell " << i;
+                left++;
+                continue;
+            }
+            EXPECT_NE(std::find(want[i].begin(), want[i].end(), filled[i]), want[i].end())
+                << "cell " << i << " got " << filled[i] << ", max distance " << maxDistance;
+            filledCells++;
+        }
+        EXPECT_GT(filledCells, 0);
+        if (std::isinf(maxDistance))
+            EXPECT_EQ(left, 0);
+        else
+            EXPECT_GT(left, 0);
+    }
+
+    // The centre of the hole is 7 cells from its edge: with a limit of 4 it
+    // stays empty, without one it takes one of its nearest data cells.
+    std::vector<float> limited = grid;
+    Rasterizer::fill_nearest(limited.data(), w, h, 4.0);
+    EXPECT_TRUE(std::isnan(limited[static_cast<size_t>(15) * w + 24]));
+}
+
+} // namespace
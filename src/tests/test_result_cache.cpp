@@ -0,0 +1,108 @@
+// The result cache: update_region() drops exactly the entries whose rays
+// it crosses, so cached answers always match the current terrain.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "terrain.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::ResultCache;
+using los::Terrain;
+using los::bench::Grid;
+
+TEST(ResultCache, InvalidatedOnlyByCrossingUpdates) {
+    Grid g = los::bench::flat_grid(128);
+    Terrain t(g.data.data(), g.width, g.height);
+    t.enable_result_cache(1024, 0.25, 0.25);
+    const double a[6] = {10.5, 64.5, 5.0, 120.5, 64.5, 5.0};
+    const double b[6] = {10.5, 10.5, 5.0, 120.5, 10.5, 5.0};
+    std::vector<double> pairs(a, a + 6);
+    pairs.insert(pairs.end(), b, b + 6);
+    auto los_of = [&](const double* r) { return t.los_boolean(r[0], r[1], r[2], r[3], r[4], r[5]); };
+    auto batch = [&] {
+        std::vector<uint8_t> out(2);
+        t.los_boolean_batch(pairs.data(), 2, out.data());
+        return out;
+    };
+    auto update = [&](int x, int y, int w, int h, float v) {
+        std::vector<float> patch(static_cast<size_t>(w) * h, v);
+        t.update_region(x, y, w, h, patch.data(), static_cast<size_t>(w));
+    };
+    EXPECT_EQ(los_of(a), 1.0);
+    EXPECT_EQ(los_of(b), 1.0);
+
+    update(60, 40, 3, 50, 50.0f);  // a wall across a only
+    EXPECT_EQ(los_of(a), 0.0);
+    EXPECT_EQ(los_of(b), 1.0);
+    ResultCache::Stats s = t.result_cache()->stats();
+    EXPECT_EQ(s.hits, 1u);
+    EXPECT_EQ(s.misses, 3u);
+    EXPECT_EQ(s.invalidated, 1u);
+    EXPECT_EQ(batch(), (std::vector<uint8_t>{0, 1}));
+    EXPECT_EQ(t.result_cache()->stats().hits, 3u);
+
+    update(120, 120, 4, 4, 80.0f);  // far from both
+    EXPECT_EQ(batch(), (std::vector<uint8_t>{0, 1}));
+    s = t.result_cache()->stats();
+    EXPECT_EQ(s.hits, 5u);
+    EXPECT_EQ(s.invalidated, 1u);
+
+    update(70, 10, 1, 1, 80.0f);  // a pole on b
+    EXPECT_EQ(batch(), (std::vector<uint8_t>{0, 0}));
+    s = t.result_cache()->stats();
+    EXPECT_EQ(s.hits, 6u);
+    EXPECT_EQ(s.misses, 4u);
+    EXPECT_EQ(s.invalidated, 2u);
+}
+
+// The same rays asked again between updates, on a pyramid terrain: every
+// answer, cached or not, is the fresh terrain's.
+TEST(ResultCache, RepeatedRaysFollowUpdates) {
+    Grid g = los::bench::fractal_grid(200, 8);
+    std::vector<float> dem = g.data;
+    Terrain t(dem.data(), g.width, g.height, true);
+    t.enable_result_cache(1 << 14, 0.25, 0.25);
+    std::vector<double> rays = los::test::random_rays(g, 3000, 4);
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+
+    for (int round = 0; round < 6; round++) {
+        if (round > 0) {
+            // A raised or lowered block somewhere, some rounds over the edge.
+            uint64_t k = 7000 + 8 * static_cast<uint64_t>(round);
+            int w = 5 + static_cast<int>(40 * los::bench::unit(k));
+            int h = 5 + static_cast<int>(40 * los::bench::unit(k + 1));
+            int x = static_cast<int>((g.width - w) * los::bench::unit(k + 2));
+            int y = static_cast<int>((g.height - h) * los::bench::unit(k + 3));
+            float lift = round % 2 ? 60.0f : -60.0f;
+            std::vector<float> patch(static_cast<size_t>(w) * h);
+            for (int j = 0; j < h; j++)
+                for (int i = 0; i < w; i++)
+                    patch[static_cast<size_t>(j) * w + i] = g.at(x + i, y + j) + lift;
+            t.update_region(x, y, w, h, patch.data(), static_cast<size_t>(w));
+            for (int j = 0; j < h; j++)
+                for (int i = 0; i < w; i++)
+                    g.data[static_cast<size_t>(y + j) * g.width + x + i] =
+                        patch[static_cast<size_t>(j) * w + i];
+        }
+        Terrain fresh(g.data.data(), g.width, g.height, true);
+        std::vector<uint8_t> got(n), want(n);
+        t.los_boolean_batch(rays.data(), n, got.data());
+        fresh.los_boolean_batch(rays.data(), n, want.data());
+        ASSERT_EQ(got, want) << "round " << round;
+        for (int64_t i = 0; i < n; i += 37) {
+            const double* r = &rays[6 * i];
+            ASSERT_EQ(t.los_boolean(r[0], r[1], r[2], r[3], r[4], r[5]), want[i])
+                << "round " << round << ", ray " << i;
+        }
+    }
+    ResultCache::Stats s = t.result_cache()->stats();
+    EXPECT_GT(s.hits, static_cast<uint64_t>(n));
+    EXPECT_GT(s.invalidated, 0u);
+}
+
+} // namespace
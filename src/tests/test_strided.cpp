@@ -0,0 +1,116 @@
+// Strided heightmap views (StridedCells, what the module-level functions
+// walk in place): transposed, sliced, reversed, float64 and int16 views
+// answer as a contiguous float32 copy of the same cells.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "layout.h"
+#include "los_kernel.h"
+#include "terrain.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::StridedCells;
+using los::bench::Grid;
+
+// A 190 x 140 crop of a fractal DEM, rounded to whole metres so int16 and
+// float64 hold the same heights as float32.
+Grid dem() {
+    Grid big = los::bench::fractal_grid(256, 6);
+    Grid g{"crop", 190, 140, std::vector<float>(190 * 140)};
+    for (int y = 0; y < g.height; y++)
+        for (int x = 0; x < g.width; x++)
+            g.data[static_cast<size_t>(y) * g.width + x] = std::round(big.at(x + 30, y + 50));
+    return g;
+}
+
+// Cells of g stored in `storage` as a view sees them: cell (x, y) at
+// byte (origin + y * rowStride + x * colStride).
+template <typename T>
+struct View {
+    std::vector<T> storage;
+    ptrdiff_t origin, rowStride, colStride;
+
+    View(const Grid& g, size_t cells, ptrdiff_t origin_, ptrdiff_t rowStep, ptrdiff_t colStep)
+        : storage(cells, T(-1000)), origin(origin_), rowStride(rowStep * ptrdiff_t(sizeof(T))),
+          colStride(colStep * ptrdiff_t(sizeof(T))) {
+        for (int y = 0; y < g.height; y++)
+            for (int x = 0; x < g.width; x++)
+                storage[origin + y * rowStep + x * colStep] = static_cast<T>(g.at(x, y));
+    }
+
+    StridedCells<T> cells() const {
+        return {reinterpret_cast<const char*>(storage.data()) +
+                    origin * static_cast<ptrdiff_t>(sizeof(T)),
+                rowStride, colStride};
+    }
+};
+
+// Contiguous, transposed (column-major), every other cell of a larger
+// array with a margin, and rows stored bottom-up (a negative stride).
+template <typename T>
+std::vector<View<T>> views(const Grid& g) {
+    const ptrdiff_t w = g.width, h = g.height, wide = 2 * w + 5;
+    std::vector<View<T>> out;
+    out.emplace_back(g, size_t(w * h), 0, w, 1);
+    out.emplace_back(g, size_t(w * h), 0, 1, h);
+    out.emplace_back(g, size_t(wide * (2 * h + 3)), wide + 3, 2 * wide, 2);
+    out.emplace_back(g, size_t(w * h), (h - 1) * w, -w, 1);
+    return out;
+}
+
+const char* const kViewNames[] = {"contiguous", "transposed", "sliced", "reversed"};
+
+template <typename T>
+class Strided : public ::testing::Test {};
+
+using Types = ::testing::Types<float, double, int16_t>;
+TYPED_TEST_SUITE(Strided, Types);
+
+TYPED_TEST(Strided, MatchesContiguousFloat32) {
+    Grid g = dem();
+    std::vector<double> rays = los::test::random_rays(g, 3000, 9);
+    for (auto shape : {los::bench::Shape::Long, los::bench::Shape::Diagonal,
+                       los::bench::Shape::Axis}) {
+        std::vector<double> more =
+            los::bench::make_rays(g, shape, los::bench::Height::Blocked, 500);
+        rays.insert(rays.end(), more.begin(), more.end());
+    }
+    const int64_t n = static_cast<int64_t>(rays.size() / 6);
+
+    std::vector<uint8_t> want(n);
+    los::Terrain(g.data.data(), g.width, g.height).los_boolean_batch(rays.data(), n, want.data());
+    int blocked = 0;
+    for (uint8_t v : want)
+        blocked += !v;
+    EXPECT_GT(blocked, n / 5);
+    EXPECT_LT(blocked, n * 4 / 5);
+
+    std::vector<View<TypeParam>> vs = views<TypeParam>(g);
+    for (size_t v = 0; v < vs.size(); v++) {
+        const StridedCells<TypeParam> cells = vs[v].cells();
+        auto trace = [&](double ax, double ay, double az, double bx, double by, double bz) {
+            return los::los_boolean_cells(cells, g.width, g.height, ax, ay, az, bx, by, bz);
+        };
+        for (int64_t i = 0; i < n; i++) {
+            const double* r = &rays[6 * i];
+            ASSERT_EQ(trace(r[0], r[1], r[2], r[3], r[4], r[5]), want[i])
+                << kViewNames[v] << " view, ray " << i;
+            if (i % 50 == 0)
+                ASSERT_EQ(los::los_probability_sampled(trace, r[0], r[1], r[2], r[3], r[4], r[5],
+                                                       9),
+                          los::los_probability_raw(g.data.data(), g.width, g.height, r[0],
+                                                   r[1], r[2], r[3], r[4], r[5], 9))
+                    << kViewNames[v] << " view, ray " << i;
+        }
+    }
+}
+
+} // namespace
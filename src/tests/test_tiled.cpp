@@ -0,0 +1,402 @@
+// TiledTerrain and TileCache over a .ltd written by write_tiled_dem():
+// answers against the in-memory kernels, the tile pyramid, the cache's
+// budget and eviction, prefetching along rays, and releasing mapped tiles;
+// and write_tiled_dem()'s hole filling against the fillers run alone.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "preprocess.h"
+#include "terrain.h"
+#include "tiled.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::Precision;
+using los::TileCache;
+using los::TiledDem;
+using los::TiledTerrain;
+using los::bench::Grid;
+
+constexpr int kTile = 32;
+constexpr size_t kTileBytes = sizeof(float) * kTile * kTile;
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// A 300 x 260 fractal DEM (10 x 9 tiles, the last column and row padded)
+// with tile (2, 2) left empty, written once for the whole suite.
+class Tiled : public ::testing::Test {
+protected:
+    static void SetUpTestSuite() {
+        grid_ = new Grid(los::bench::fractal_grid(300, 21));
+        grid_->height = 260;
+        grid_->data.resize(static_cast<size_t>(grid_->width) * grid_->height);
+        for (int y = 2 * kTile; y < 3 * kTile; y++)
+            for (int x = 2 * kTile; x < 3 * kTile; x++)
+                grid_->data[static_cast<size_t>(y) * grid_->width + x] =
+                    std::numeric_limits<float>::quiet_NaN();
+        path_ = new std::string(::testing::TempDir() + "los_test_tiled.ltd");
+        std::vector<float> copy = grid_->data;
+        los::write_tiled_dem(*path_, copy.data(), grid_->width, grid_->height, kTile,
+                             los::HoleFill::None, 0.0, nullptr);
+    }
+
+    static void TearDownTestSuite() {
+        std::remove(path_->c_str());
+        delete path_;
+        delete grid_;
+    }
+
+    static double reference(const double* r, double curvature = 0.0) {
+        los::IndexedCells<los::RowMajorIndex> cells{grid_->data.data(),
+                                                    los::RowMajorIndex(grid_->width)};
+        return los::los_boolean_cells<double>(cells, grid_->width, grid_->height, r[0], r[1],
+                                              r[2], r[3], r[4], r[5], curvature);
+    }
+
+    // Wait for the prefetch thread to load `count` tiles.
+    static bool wait_prefetched(const TileCache& cache, uint64_t count) {
+        for (int i = 0; i < 2000 && cache.stats().prefetched < count; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return cache.stats().prefetched >= count;
+    }
+
+    static Grid* grid_;
+    static std::string* path_;
+};
+
+Grid* Tiled::grid_ = nullptr;
+std::string* Tiled::path_ = nullptr;
+
+TEST_F(Tiled, CachedBatchesMatchTerrainWithinBudget) {
+    const size_t budget = 6 * kTileBytes;  // of 89 stored tiles
+    std::vector<double> rays = los::test::random_rays(*grid_, 4000, 5);
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+
+    for (Precision precision : {Precision::Double, Precision::Float}) {
+        los::Terrain terrain(grid_->data.data(), grid_->width, grid_->height, false, precision);
+        TiledTerrain tiled(*path_, precision, budget, 2);
+        ASSERT_NE(tiled.cache(), nullptr);
+        std::vector<uint8_t> want(n), got(n);
+        terrain.los_boolean_batch(rays.data(), n, want.data());
+        tiled.los_boolean_batch(rays.data(), n, got.data());
+        EXPECT_EQ(got, want);
+
+        TileCache::Stats s = tiled.cache()->stats();
+        EXPECT_GT(s.misses, 0u);
+        EXPECT_GT(s.hits, 0u);
+        EXPECT_GT(s.evictions, 0u);
+        EXPECT_EQ(s.budget, budget);
+        EXPECT_LE(s.bytes, budget + kTileBytes);
+        EXPECT_EQ(s.bytes, s.tiles * kTileBytes);
+        EXPECT_TRUE(wait_prefetched(*tiled.cache(), 1));
+    }
+
+    // Probabilities go through the same walk.
+    los::Terrain terrain(grid_->data.data(), grid_->width, grid_->height);
+    TiledTerrain tiled(*path_, Precision::Double, budget, 2);
+    std::vector<double> pw(n), pg(n);
+    terrain.los_probability_batch(rays.data(), n, 5, pw.data());
+    tiled.los_probability_batch(rays.data(), n, 5, pg.data());
+    EXPECT_EQ(pg, pw);
+}
+
+TEST_F(Tiled, WalkThroughCacheMatchesRaw) {
+    TiledDem dem(*path_);
+    TileCache cache(dem, 4 * kTileBytes, 3);
+    std::vector<double> rays = los::test::random_rays(*grid_, 2000, 9);
+    std::vector<double> axis =
+        los::bench::make_rays(*grid_, los::bench::Shape::Axis, los::bench::Height::Blocked, 300);
+    rays.insert(rays.end(), axis.begin(), axis.end());
+    const double curvature = los::earth_curvature(30.0, 4.0 / 3.0);
+
+    for (size_t i = 0; i < rays.size() / 6; i++) {
+        const double* r = &rays[6 * i];
+        double want = los::los_boolean_raw(grid_->data.data(), grid_->width, grid_->height,
+                                           r[0], r[1], r[2], r[3], r[4], r[5]);
+        ASSERT_EQ((los::los_boolean_tiled<double, TileCache>(cache, r[0], r[1], r[2], r[3],
+                                                              r[4], r[5])),
+                  want)
+            << "ray " << i;
+        ASSERT_EQ((los::los_boolean_tiled<double, TiledDem>(dem, r[0], r[1], r[2], r[3], r[4],
+                                                             r[5])),
+                  want)
+            << "ray " << i;
+        ASSERT_EQ((los::los_boolean_tiled<double, TileCache>(cache, r[0], r[1], r[2], r[3],
+                                                              r[4], r[5], curvature)),
+                  reference(r, curvature))
+            << "curved ray " << i;
+    }
+    EXPECT_GT(cache.stats().evictions, 0u);
+    EXPECT_LE(cache.stats().bytes, 4 * kTileBytes + kTileBytes);
+}
+
+TEST_F(Tiled, PyramidLevelsBoundTheirCells) {
+    TiledDem dem(*path_);
+    ASSERT_EQ(dem.pyramid_levels(), 4);  // 10 x 9 tiles: 5 x 5, 3 x 3, 2 x 2, 1 x 1
+
+    for (int l = 1; l <= dem.pyramid_levels(); l++)
+        for (int ty = 0; ty < dem.tiles_y(); ty++)
+            for (int tx = 0; tx < dem.tiles_x(); tx++) {
+                los::MaxPyramid::Block b = dem.block(l, tx, ty);
+                int size = kTile << l;
+                EXPECT_EQ(b.x0, (tx >> l) * size) << "level " << l;
+                EXPECT_EQ(b.y0, (ty >> l) * size);
+                EXPECT_EQ(b.x1, std::min(b.x0 + size, grid_->width) - 1);
+                EXPECT_EQ(b.y1, std::min(b.y0 + size, grid_->height) - 1);
+                float hi = -std::numeric_limits<float>::infinity();
+                float lo = std::numeric_limits<float>::infinity();
+                for (int y = b.y0; y <= b.y1; y++)
+                    for (int x = b.x0; x <= b.x1; x++) {
+                        float v = grid_->at(x, y);
+                        if (v > hi) hi = v;
+                        if (v < lo) lo = v;
+                    }
+                EXPECT_EQ(dem.block_range(l, tx, ty).max, hi);
+                EXPECT_EQ(dem.block_range(l, tx, ty).min, lo);
+            }
+}
+
+// A TiledDem that counts the max tests a walk makes, with its pyramid
+// cut to `levels`.
+struct CountingTiles {
+    const TiledDem& dem;
+    int levels;
+    mutable int tileTests = 0, blockTests = 0;
+
+    int width() const { return dem.width(); }
+    int height() const { return dem.height(); }
+    int tile_size() const { return dem.tile_size(); }
+    int tile_shift() const { return dem.tile_shift(); }
+    float tile_max(int tx, int ty) const { return tileTests++, dem.tile_max(tx, ty); }
+    los::MaxPyramid::Block tile_block(int tx, int ty) const { return dem.tile_block(tx, ty); }
+    int pyramid_levels() const { return levels; }
+    float block_max(int l, int tx, int ty) const { return blockTests++, dem.block_max(l, tx, ty); }
+    los::MaxPyramid::Block block(int l, int tx, int ty) const { return dem.block(l, tx, ty); }
+    const float* tile(int tx, int ty) const { return dem.tile(tx, ty); }
+    int lookahead() const { return 0; }
+    void prefetch(int, int) const {}
+};
+
+TEST_F(Tiled, WalkSkipsRunsOfTilesByThePyramid) {
+    TiledDem dem(*path_);
+
+    // High above the terrain across the grid: 19 tiles by the directory
+    // alone, a handful of blocks with the pyramid.
+    CountingTiles flat{dem, 0}, full{dem, dem.pyramid_levels()};
+    const double high[6] = {0.5, 0.5, 1e4, 299.5, 259.5, 1e4};
+    EXPECT_EQ(los::los_boolean_tiled(flat, high[0], high[1], high[2], high[3], high[4], high[5]),
+              1.0);
+    EXPECT_EQ(los::los_boolean_tiled(full, high[0], high[1], high[2], high[3], high[4], high[5]),
+              1.0);
+    EXPECT_GE(flat.tileTests, 18);
+    EXPECT_EQ(flat.blockTests, 0);
+    EXPECT_LT(full.tileTests + full.blockTests, flat.tileTests / 2);
+
+    // Every level count gives the raw walk's answers.
+    std::vector<double> rays = los::test::random_rays(*grid_, 1500, 13);
+    std::vector<double> diagonal =
+        los::bench::make_rays(*grid_, los::bench::Shape::Diagonal, los::bench::Height::Clear, 200);
+    rays.insert(rays.end(), diagonal.begin(), diagonal.end());
+    for (int levels = 0; levels <= dem.pyramid_levels(); levels++) {
+        CountingTiles tiles{dem, levels};
+        for (size_t i = 0; i < rays.size() / 6; i++) {
+            const double* r = &rays[6 * i];
+            ASSERT_EQ(los::los_boolean_tiled(tiles, r[0], r[1], r[2], r[3], r[4], r[5]),
+                      los::los_boolean_raw(grid_->data.data(), grid_->width, grid_->height, r[0],
+                                           r[1], r[2], r[3], r[4], r[5]))
+                << "ray " << i << ", " << levels << " levels";
+        }
+    }
+}
+
+TEST_F(Tiled, FilesWithoutAPyramidStillOpen) {
+    std::ifstream in(*path_, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    los::TiledHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    ASSERT_EQ(header.pyramidLevels, 4u);
+    auto write = [&](const los::TiledHeader& h) {
+        std::string path = ::testing::TempDir() + "los_test_tiled_header.ltd";
+        std::memcpy(bytes.data(), &h, sizeof(h));
+        std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+        return path;
+    };
+
+    // As tiled_dem.py writes them: no pyramid, skipping by the directory.
+    los::TiledHeader none = header;
+    none.pyramidOffset = 0;
+    none.pyramidLevels = 0;
+    std::string path = write(none);
+    {
+        TiledTerrain tiled(path);
+        EXPECT_EQ(tiled.dem().pyramid_levels(), 0);
+        std::vector<double> rays = los::test::random_rays(*grid_, 500, 17);
+        int64_t n = static_cast<int64_t>(rays.size() / 6);
+        std::vector<uint8_t> got(n), want(n);
+        tiled.los_boolean_batch(rays.data(), n, got.data());
+        TiledTerrain(*path_).los_boolean_batch(rays.data(), n, want.data());
+        EXPECT_EQ(got, want);
+    }
+
+    los::TiledHeader wrong = header;
+    wrong.pyramidLevels = 3;
+    write(wrong);
+    EXPECT_THROW(TiledDem{path}, std::runtime_error);
+    los::TiledHeader outside = header;
+    outside.pyramidOffset = bytes.size() - 8;
+    write(outside);
+    EXPECT_THROW(TiledDem{path}, std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST_F(Tiled, PrefetchAlongQueuesTheTilesARayMustTest) {
+    TiledDem dem(*path_);
+
+    // Below the ground along row 16: every tile ahead must be tested, so the
+    // next three are prefetched and the fourth is not.
+    {
+        TileCache cache(dem, 32 * kTileBytes, 3);
+        los::BasicDDA<double> r(0.5, 16.5, -1000.0, 299.5, 16.5, -1000.0);
+        los::prefetch_along(cache, r, cache.tile_block(0, 0), r.reaches_end());
+        ASSERT_TRUE(wait_prefetched(cache, 3));
+        for (int tx = 1; tx <= 3; tx++)
+            EXPECT_NE(cache.tile(tx, 0), nullptr);
+        EXPECT_EQ(cache.stats().hits, 3u);
+        EXPECT_EQ(cache.stats().misses, 0u);
+        cache.tile(4, 0);
+        EXPECT_EQ(cache.stats().misses, 1u);
+    }
+
+    // High above it the ray clears every tile: nothing to prefetch.
+    {
+        TileCache cache(dem, 32 * kTileBytes, 3);
+        los::BasicDDA<double> r(0.5, 16.5, 1e6, 299.5, 16.5, 1e6);
+        los::prefetch_along(cache, r, cache.tile_block(0, 0), r.reaches_end());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_EQ(cache.stats().prefetched, 0u);
+        EXPECT_EQ(cache.stats().tiles, 0u);
+    }
+
+    // The empty tile is never queued or loaded: along row 80 from tile
+    // (1, 2) the next tiles ahead are (2, 2), empty, then (3, 2) and (4, 2).
+    {
+        TileCache cache(dem, 32 * kTileBytes, 2);
+        los::BasicDDA<double> r(40.5, 80.5, -1000.0, 299.5, 80.5, -1000.0);
+        los::prefetch_along(cache, r, cache.tile_block(1, 2), r.reaches_end());
+        ASSERT_TRUE(wait_prefetched(cache, 2));
+        EXPECT_EQ(cache.tile(2, 2), nullptr);
+        EXPECT_NE(cache.tile(3, 2), nullptr);
+        EXPECT_NE(cache.tile(4, 2), nullptr);
+        EXPECT_EQ(cache.stats().hits, 2u);
+        EXPECT_EQ(cache.stats().tiles, 2u);
+    }
+}
+
+TEST_F(Tiled, ReleasedAndEvictedTilesKeepTheirCells) {
+    TiledDem dem(*path_);
+    EXPECT_EQ(dem.tile(2, 2), nullptr);
+
+    // madvise(MADV_DONTNEED) drops the mapping; the cells fault back in.
+    auto tile_matches = [&](const float* tile, int tx, int ty) {
+        for (int y = 0; y < kTile; y++)
+            for (int x = 0; x < kTile; x++) {
+                int gx = tx * kTile + x, gy = ty * kTile + y;
+                float v = tile[y * kTile + x];
+                if (gx >= grid_->width || gy >= grid_->height) {
+                    if (!std::isnan(v))
+                        return false;
+                } else if (v != grid_->at(gx, gy)) {
+                    return false;
+                }
+            }
+        return true;
+    };
+    for (int ty = 0; ty < dem.tiles_y(); ty++)
+        for (int tx = 0; tx < dem.tiles_x(); tx++) {
+            if (!dem.tile(tx, ty))
+                continue;
+            dem.release(tx, ty);
+            ASSERT_TRUE(tile_matches(dem.tile(tx, ty), tx, ty)) << tx << ", " << ty;
+        }
+
+    // A held tile outlives its eviction and clear().
+    TileCache cache(dem, 2 * kTileBytes, 0);
+    TileCache::Tile held = cache.tile(9, 8);
+    for (int tx = 0; tx < 5; tx++)
+        cache.tile(tx, 0);
+    cache.clear();
+    EXPECT_EQ(cache.stats().tiles, 0u);
+    EXPECT_TRUE(tile_matches(held.get(), 9, 8));
+    EXPECT_EQ(cache.stats().prefetched, 0u);
+}
+
+// write_tiled_dem() fills holes as the fillers do when run alone (what
+// los.fill_holes() runs), and stores the filled grid.
+TEST(WriteTiledDem, FillsAsTheFillersDo) {
+    Grid g = los::bench::fractal_grid(200, 31);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    int64_t holes = 0;
+    for (int y = 0; y < g.height; y++)
+        for (int x = 0; x < g.width; x++) {
+            bool gap = (x >= 40 && x < 110 && y >= 70 && y < 95) ||
+                       los::bench::mix(3 + static_cast<uint64_t>(y) * g.width + x) % 11 == 0;
+            if (gap) {
+                g.data[static_cast<size_t>(y) * g.width + x] = nan;
+                holes++;
+            }
+        }
+    const std::string path = ::testing::TempDir() + "los_test_fill.ltd";
+
+    struct Case {
+        los::HoleFill fill;
+        double limit;
+    };
+    for (Case c : {Case{los::HoleFill::PushPull, 0.0}, Case{los::HoleFill::Nearest, kInf},
+                   Case{los::HoleFill::Nearest, 3.0}}) {
+        std::vector<float> want = g.data, got = g.data;
+        int64_t filled = holes;
+        if (c.fill == los::HoleFill::PushPull)
+            los::PushPull(want.data(), g.width, g.height).fill_all(want.data());
+        else
+            filled = los::Rasterizer::fill_nearest(want.data(), g.width, g.height, c.limit);
+        los::TiledWriteStats stats =
+            los::write_tiled_dem(path, got.data(), g.width, g.height, 32, c.fill, c.limit, nullptr);
+
+        EXPECT_EQ(std::memcmp(got.data(), want.data(), want.size() * sizeof(float)), 0)
+            << "fill " << static_cast<int>(c.fill) << ", limit " << c.limit;
+        EXPECT_EQ(stats.filled, filled);
+        if (std::isinf(c.limit) || c.fill == los::HoleFill::PushPull)
+            EXPECT_EQ(filled, holes);
+        else
+            EXPECT_LT(filled, holes);
+        float hi = -std::numeric_limits<float>::infinity();
+        float lo = std::numeric_limits<float>::infinity();
+        for (float v : want) {
+            if (v > hi) hi = v;
+            if (v < lo) lo = v;
+        }
+        EXPECT_EQ(stats.zMax, hi);
+        EXPECT_EQ(stats.zMin, lo);
+
+        TiledTerrain tiled(path);
+        std::vector<float> stored(want.size());
+        tiled.read_window(0, 0, g.width, g.height, stored.data());
+        EXPECT_EQ(std::memcmp(stored.data(), want.data(), want.size() * sizeof(float)), 0);
+    }
+    std::remove(path.c_str());
+}
+
+} // namespace
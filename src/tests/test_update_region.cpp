@@ -0,0 +1,165 @@
+// update_region(): a terrain patched in place answers as one built fresh
+// over the patched grid, in every layout, precision and interpolation. A
+// quantized terrain keeps the scale of the blocks it re-codes, so it is
+// held to what quantizing promises instead.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "terrain.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::Interpolation;
+using los::Layout;
+using los::Precision;
+using los::Terrain;
+using los::bench::Grid;
+
+struct Config {
+    const char* name;
+    bool pyramid;
+    Precision precision;
+    Layout layout;
+    float quantize;
+    Interpolation interpolation;
+};
+
+Terrain make_terrain(const Config& c, const std::vector<float>& data, int size) {
+    return Terrain(data.data(), size, size, c.pyramid, c.precision, los::Device::CPU, c.layout,
+                   c.quantize, c.interpolation);
+}
+
+// The same patches into the terrain and into `grid`: a wall, a crater,
+// noise across block edges and a one-column strip on the east border.
+void apply_patches(Terrain& t, Grid& grid) {
+    struct Patch {
+        int x, y, w, h;
+        std::vector<float> cells;
+    };
+    std::vector<float> noise(17 * 23);
+    for (size_t i = 0; i < noise.size(); i++)
+        noise[i] = static_cast<float>(150.0 * los::bench::unit(99 + i));
+    const Patch patches[] = {{100, 50, 40, 3, std::vector<float>(40 * 3, 200.0f)},
+                             {150, 150, 60, 60, std::vector<float>(60 * 60, 0.0f)},
+                             {0, 0, 17, 23, noise},
+                             {grid.width - 1, 200, 1, 56, std::vector<float>(56, 300.0f)}};
+    for (const Patch& p : patches) {
+        t.update_region(p.x, p.y, p.w, p.h, p.cells.data(), static_cast<size_t>(p.w));
+        for (int y = 0; y < p.h; y++)
+            for (int x = 0; x < p.w; x++)
+                grid.data[static_cast<size_t>(p.y + y) * grid.width + p.x + x] =
+                    p.cells[static_cast<size_t>(y) * p.w + x];
+    }
+}
+
+class UpdateRegion : public ::testing::TestWithParam<Config> {};
+
+TEST_P(UpdateRegion, MatchesFreshTerrain) {
+    const Config c = GetParam();
+    Grid grid = los::bench::fractal_grid(256, 4);
+    std::vector<double> rays;
+    for (auto shape : {los::bench::Shape::Short, los::bench::Shape::Long,
+                       los::bench::Shape::Diagonal, los::bench::Shape::Axis})
+        for (auto height : {los::bench::Height::Clear, los::bench::Height::Blocked}) {
+            std::vector<double> more = los::bench::make_rays(grid, shape, height, 512);
+            rays.insert(rays.end(), more.begin(), more.end());
+        }
+    int64_t n = static_cast<int64_t>(rays.size() / 6);
+
+    std::vector<float> dem = grid.data;  // the patched terrain writes into it
+    Terrain t = make_terrain(c, dem, grid.width);
+    std::vector<uint8_t> before(n);
+    t.los_boolean_batch(rays.data(), n, before.data());
+    apply_patches(t, grid);
+    EXPECT_EQ(t.revision(), 4u);
+
+    // Rays test the decoded upper bounds; a fresh quantization may code the
+    // re-coded blocks differently, so quantized terrains are compared with
+    // a plain terrain over the cells they decode to.
+    std::vector<float> upper;
+    if (c.quantize > 0) {
+        const los::QuantizedHeightmap& q = t.quantized_heightmap();
+        upper = q.decode_upper();
+        // One step, give or take rounding at the DEM's magnitude.
+        float top = 0.0f;
+        for (float v : grid.data)
+            top = std::max(top, std::fabs(v));
+        const float step = q.max_error() + 4 * std::numeric_limits<float>::epsilon() * top;
+        for (int y = 0; y < grid.height; y++)
+            for (int x = 0; x < grid.width; x++) {
+                float v = grid.at(x, y);
+                ASSERT_GE(q(x, y), v) << "cell (" << x << ", " << y << ")";
+                ASSERT_LE(q.lower(x, y), v);
+                ASSERT_LE(q(x, y) - q.lower(x, y), step);
+            }
+    }
+    Terrain fresh = c.quantize > 0
+                        ? Terrain(upper.data(), grid.width, grid.height, c.pyramid, c.precision)
+                        : make_terrain(c, grid.data, grid.width);
+
+    std::vector<uint8_t> after(n), want(n);
+    t.los_boolean_batch(rays.data(), n, after.data());
+    fresh.los_boolean_batch(rays.data(), n, want.data());
+    EXPECT_EQ(after, want);
+    int changed = 0;
+    for (int64_t i = 0; i < n; i++)
+        changed += after[i] != before[i];
+    EXPECT_GT(changed, 100);  // the patches did change answers
+    if (c.quantize > 0) {
+        // Quantizing only ever turns rays of the patched grid blocked.
+        std::vector<uint8_t> exact(n);
+        Terrain(grid.data.data(), grid.width, grid.height).los_boolean_batch(rays.data(), n,
+                                                                           exact.data());
+        int agree = 0;
+        for (int64_t i = 0; i < n; i++) {
+            ASSERT_LE(after[i], exact[i]) << "ray " << i;
+            agree += after[i] == exact[i];
+        }
+        EXPECT_GT(agree, n * 99 / 100);
+    }
+
+    int64_t m = n / 16;
+    std::vector<double> pa(m), pw(m);
+    t.los_probability_batch(rays.data(), m, 9, pa.data());
+    fresh.los_probability_batch(rays.data(), m, 9, pw.data());
+    EXPECT_EQ(pa, pw);
+
+    // Quantized viewsheds stand targets on the lower bounds, so they may
+    // only lose cells the patched grid shows.
+    std::vector<uint8_t> va(grid.data.size()), vw(grid.data.size());
+    double z0 = grid.at(120, 60) + 10.0;
+    t.viewshed(120.5, 60.5, z0, 2.0, 150.0, va.data());
+    if (c.quantize > 0) {
+        Terrain exact(grid.data.data(), grid.width, grid.height);
+        exact.viewshed(120.5, 60.5, z0, 2.0, 150.0, vw.data());
+        for (size_t i = 0; i < va.size(); i++)
+            ASSERT_LE(va[i], vw[i]) << "cell " << i;
+    } else {
+        fresh.viewshed(120.5, 60.5, z0, 2.0, 150.0, vw.data());
+        EXPECT_EQ(va, vw);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Configs, UpdateRegion,
+    ::testing::Values(
+        Config{"Pyramid", true, Precision::Double, Layout::RowMajor, 0.0f, Interpolation::Nearest},
+        Config{"Packets", false, Precision::Double, Layout::RowMajor, 0.0f, Interpolation::Nearest},
+        Config{"Float", true, Precision::Float, Layout::RowMajor, 0.0f, Interpolation::Nearest},
+        Config{"Blocked", true, Precision::Double, Layout::Blocked, 0.0f, Interpolation::Nearest},
+        Config{"Morton", false, Precision::Double, Layout::Morton, 0.0f, Interpolation::Nearest},
+        Config{"Bilinear", true, Precision::Double, Layout::RowMajor, 0.0f,
+               Interpolation::Bilinear},
+        Config{"Quantized", true, Precision::Double, Layout::RowMajor, 0.01f,
+               Interpolation::Nearest}),
+    [](const ::testing::TestParamInfo<Config>& info) { return std::string(info.param.name); });
+
+} // namespace
@@ -0,0 +1,251 @@
+// Viewsheds: the R2 sweep against its definition, and cumulative_viewshed
+// against single-observer viewsheds.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "terrain.h"
+#include "thread_pool.h"
+#include "viewshed.h"
+#include "tests/rays.h"
+
+namespace {
+
+using los::Terrain;
+using los::bench::Grid;
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// Runs a test body on a pool of `threads`, restoring the pool after.
+class PoolSize {
+public:
+    explicit PoolSize(int threads) : saved_(los::ThreadPool::instance().num_threads()) {
+        los::ThreadPool::instance().set_num_threads(threads);
+    }
+    ~PoolSize() { los::ThreadPool::instance().set_num_threads(saved_); }
+
+private:
+    int saved_;
+};
+
+// The R2 viewshed by its definition: walk the ray from the observer to the
+// centre of every border cell of the window, carrying the highest slope
+// seen so far, and mark each cell on it within the radius whose target
+// stands at or above that slope. A cell is visible if any of its rays
+// marks it. `crossed` gets every cell some ray reaches.
+std::vector<uint8_t> border_ray_viewshed(const Grid& g, double x0, double y0, double z0,
+                                         double target_height, double max_radius,
+                                         double curvature, std::vector<uint8_t>& crossed) {
+    std::vector<uint8_t> out(g.data.size(), 0);
+    crossed.assign(g.data.size(), 0);
+    const int ox = static_cast<int>(std::floor(x0)), oy = static_cast<int>(std::floor(y0));
+    out[static_cast<size_t>(oy) * g.width + ox] = 1;
+    crossed[static_cast<size_t>(oy) * g.width + ox] = 1;
+    const los::ViewshedWindow w = los::viewshed_window(g.width, g.height, x0, y0, max_radius);
+
+    for (int py = w.y0; py <= w.y1; py++)
+        for (int px = w.x0; px <= w.x1; px++) {
+            if (px != w.x0 && px != w.x1 && py != w.y0 && py != w.y1)
+                continue;
+            los::DDA r(x0, y0, z0, px + 0.5, py + 0.5, z0);
+            double horizon = -kInf;
+            while (r.x >= w.x0 && r.y >= w.y0 && r.x <= w.x1 && r.y <= w.y1) {
+                if (r.x != ox || r.y != oy) {
+                    double cx = r.x + 0.5 - x0, cy = r.y + 0.5 - y0;
+                    double d2 = cx * cx + cy * cy;
+                    if (d2 > max_radius * max_radius)
+                        break;
+                    double d = std::sqrt(d2);
+                    double h = g.at(r.x, r.y) - curvature * d2;
+                    size_t idx = static_cast<size_t>(r.y) * g.width + r.x;
+                    crossed[idx] = 1;
+                    if ((h + target_height - z0) / d >= horizon)
+                        out[idx] = 1;
+                    horizon = std::max(horizon, (h - z0) / d);
+                }
+                if (r.at_end())
+                    break;
+                r.step();
+            }
+        }
+    return out;
+}
+
+TEST(Viewshed, IsTheUnionOfItsBorderRays) {
+    Grid g = los::bench::fractal_grid(150, 23);
+    Terrain terrain(g.data.data(), g.width, g.height, true);
+    struct Observer {
+        double x, y, radius;
+    };
+    // Centred, off-centre in its cell, on every edge and corner, and with
+    // radii that clip the window to a few cells.
+    const Observer observers[] = {{75.5, 75.5, kInf}, {40.2, 99.9, 60.0}, {0.1, 0.1, kInf},
+                                  {149.9, 70.3, 45.0}, {20.7, 149.2, 35.0}, {149.5, 0.5, 80.0},
+                                  {88.8, 12.3, 1.5},  {63.0, 64.0, 0.7}};
+
+    std::vector<uint8_t> got(g.data.size()), crossed;
+    for (double curvature : {0.0, los::earth_curvature(30.0, 4.0 / 3.0)}) {
+        if (curvature > 0)
+            terrain.set_earth_curvature(30.0, 4.0 / 3.0);
+        for (const Observer& o : observers) {
+            double z0 = g.at(static_cast<int>(o.x), static_cast<int>(o.y)) + 8.0;
+            terrain.viewshed(o.x, o.y, z0, 2.0, o.radius, got.data());
+            std::vector<uint8_t> want =
+                border_ray_viewshed(g, o.x, o.y, z0, 2.0, o.radius, curvature, crossed);
+            ASSERT_EQ(got, want) << "observer (" << o.x << ", " << o.y << "), r " << o.radius;
+
+            // Every cell within the radius lies on some border ray.
+            for (int y = 0; y < g.height; y++)
+                for (int x = 0; x < g.width; x++) {
+                    double cx = x + 0.5 - o.x, cy = y + 0.5 - o.y;
+                    if (cx * cx + cy * cy <= o.radius * o.radius)
+                        ASSERT_TRUE(crossed[static_cast<size_t>(y) * g.width + x])
+                            << "cell (" << x << ", " << y << ") on no ray";
+                }
+        }
+    }
+}
+
+// A target exactly on the horizon is visible. Along the rows of a ramp
+// rising one unit per cell every slope from the observer is exactly 1.
+TEST(Viewshed, TargetOnTheHorizonIsVisible) {
+    Grid g = los::bench::flat_grid(40);
+    for (int y = 0; y < g.height; y++)
+        for (int x = 0; x < g.width; x++)
+            g.data[static_cast<size_t>(y) * g.width + x] = x + 0.5f;
+    Terrain terrain(g.data.data(), g.width, g.height);
+    std::vector<uint8_t> got(g.data.size()), crossed;
+    terrain.viewshed(0.5, 20.5, 0.5, 0.0, kInf, got.data());
+    EXPECT_EQ(got, border_ray_viewshed(g, 0.5, 20.5, 0.5, 0.0, kInf, 0.0, crossed));
+    for (int x = 0; x < g.width; x++)
+        EXPECT_EQ(got[20 * g.width + x], 1) << "cell (" << x << ", 20)";
+}
+
+// Sanity check only: R2 measures slopes to cell centres, los_boolean walks
+// the corner-sampled segment, so a few cells may differ.
+TEST(Viewshed, MostlyAgreesWithLosBoolean) {
+    Grid g = los::bench::fractal_grid(120, 29);
+    Terrain terrain(g.data.data(), g.width, g.height, true);
+    double x0 = 60.5, y0 = 55.5, z0 = g.at(60, 55) + 8.0;
+    std::vector<uint8_t> mask(g.data.size());
+    terrain.viewshed(x0, y0, z0, 2.0, kInf, mask.data());
+
+    int64_t agree = 0, visible = 0;
+    for (int y = 0; y < g.height; y++)
+        for (int x = 0; x < g.width; x++) {
+            bool los = terrain.los_boolean(x0, y0, z0, x + 0.5, y + 0.5, g.at(x, y) + 2.0) > 0.5;
+            agree += los == static_cast<bool>(mask[static_cast<size_t>(y) * g.width + x]);
+            visible += los;
+        }
+    EXPECT_GE(agree, static_cast<int64_t>(g.data.size() * 0.97));
+    EXPECT_GT(visible, static_cast<int64_t>(g.data.size() / 10));
+    EXPECT_LT(visible, static_cast<int64_t>(g.data.size() * 9 / 10));
+}
+
+// The sum of the single viewsheds of `observers`, saturated at 65535.
+std::vector<uint16_t> summed_viewsheds(const Terrain& t, const std::vector<double>& observers,
+                                       double target_height, double max_radius) {
+    size_t cells = static_cast<size_t>(t.width()) * t.height();
+    std::vector<uint32_t> sum(cells, 0);
+    std::vector<uint8_t> mask(cells);
+    for (size_t i = 0; i < observers.size() / 3; i++) {
+        const double* o = &observers[3 * i];
+        t.viewshed(o[0], o[1], o[2], target_height, max_radius, mask.data());
+        for (size_t c = 0; c < cells; c++)
+            sum[c] += mask[c];
+    }
+    std::vector<uint16_t> out(cells);
+    for (size_t c = 0; c < cells; c++)
+        out[c] = static_cast<uint16_t>(std::min<uint32_t>(sum[c], 0xFFFF));
+    return out;
+}
+
+TEST(CumulativeViewshed, MatchesSumOfSingleViewsheds) {
+    // Four slots, so 37 observers take ten rounds, the last one partial.
+    PoolSize pool(4);
+    Grid g = los::bench::fractal_grid(160, 17);
+    Terrain terrain(g.data.data(), g.width, g.height, true);
+
+    std::vector<double> observers;
+    for (int i = 0; i < 37; i++) {
+        uint64_t k = 1000 + 4 * static_cast<uint64_t>(i);
+        double x, y;
+        if (i >= 8 && i < 12) {
+            // A whole round off the grid: no window, nothing added.
+            x = -5.0 - i;
+            y = g.height + 3.0 * i;
+        } else if (i % 5 == 0) {
+            // On the edges and corners, so windows clip.
+            x = (i % 2) ? g.width - 0.5 : 0.25;
+            y = (i % 3) ? los::bench::unit(k) * g.height : g.height - 0.75;
+        } else {
+            // Clustered in the middle, so windows overlap.
+            x = 60.0 + 40.0 * los::bench::unit(k);
+            y = 50.0 + 50.0 * los::bench::unit(k + 1);
+        }
+        double z = 6.0;
+        if (x >= 0 && y >= 0 && x < g.width && y < g.height)
+            z += g.at(static_cast<int>(x), static_cast<int>(y));
+        observers.insert(observers.end(), {x, y, z});
+    }
+    int64_t m = static_cast<int64_t>(observers.size() / 3);
+
+    for (double radius : {25.0, 70.0, kInf}) {
+        for (int curved = 0; curved < 2; curved++) {
+            if (curved)
+                terrain.set_earth_curvature(40.0, 4.0 / 3.0);
+            else
+                terrain.clear_earth_curvature();
+            std::vector<uint16_t> got(g.data.size(), 7);
+            terrain.cumulative_viewshed(observers.data(), m, 1.5, radius, got.data());
+            EXPECT_EQ(got, summed_viewsheds(terrain, observers, 1.5, radius))
+                << "radius " << radius << (curved ? ", curved" : "");
+        }
+    }
+}
+
+TEST(CumulativeViewshed, SaturatesAt65535) {
+    PoolSize pool(3);
+    Grid g = los::bench::flat_grid(8);
+    g.data[3 * 8 + 5] = 50.0f;  // a wall one cell wide
+    Terrain terrain(g.data.data(), g.width, g.height);
+
+    // 65535 + 600 observers at (1.5, 1.5) and 300 at the other corner.
+    // Cells the first group sees saturate; those in the wall's shadow count
+    // the second group only.
+    std::vector<double> observers;
+    for (int i = 0; i < 65535 + 600; i++)
+        observers.insert(observers.end(), {1.5, 1.5, 2.0});
+    std::vector<double> near;
+    for (int i = 0; i < 300; i++)
+        near.insert(near.end(), {6.5, 6.5, 2.0});
+
+    std::vector<uint16_t> far(g.data.size()), both(g.data.size());
+    terrain.cumulative_viewshed(observers.data(), static_cast<int64_t>(observers.size() / 3),
+                                0.0, kInf, far.data());
+    std::vector<double> all = near;
+    all.insert(all.end(), observers.begin(), observers.end());
+    terrain.cumulative_viewshed(all.data(), static_cast<int64_t>(all.size() / 3), 0.0, kInf,
+                                both.data());
+
+    std::vector<uint8_t> seenFar(g.data.size()), seenNear(g.data.size());
+    terrain.viewshed(1.5, 1.5, 2.0, 0.0, kInf, seenFar.data());
+    terrain.viewshed(6.5, 6.5, 2.0, 0.0, kInf, seenNear.data());
+    int saturated = 0, shadowed = 0;
+    for (size_t c = 0; c < g.data.size(); c++) {
+        EXPECT_EQ(far[c], seenFar[c] ? 0xFFFF : 0) << "cell " << c;
+        uint32_t want = 300u * seenNear[c] + (65535u + 600u) * seenFar[c];
+        EXPECT_EQ(both[c], std::min<uint32_t>(want, 0xFFFF)) << "cell " << c;
+        saturated += both[c] == 0xFFFF;
+        shadowed += !seenFar[c] && seenNear[c];
+    }
+    EXPECT_GT(saturated, 0);
+    EXPECT_GT(shadowed, 0);
+}
+
+} // namespace
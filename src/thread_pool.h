@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace los {
+
+// Persistent worker pool used by every batch entry point.
+//
+// parallel_for() splits [0, n) into one contiguous range per participating
+// worker. Each worker pops `grain`-sized chunks from the front of its own
+// range and, once it runs dry, steals the back half of another worker's
+// range. Rays vary a lot in length, so this balances far better than static
+// chunking while still keeping neighbouring rays on the same thread.
+//
+// Results are written by index, never accumulated across chunks, so output
+// is identical for any thread count.
+class ThreadPool {
+public:
+    using Body = std::function<void(int64_t begin, int64_t end, int worker)>;
+
+    static ThreadPool& instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ~ThreadPool() { stop_workers(); }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads used by parallel_for, including the calling thread.
+    int num_threads() const {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        return num_threads_;
+    }
+
+    // Resize the pool. n <= 0 selects std::thread::hardware_concurrency().
+    void set_num_threads(int n) {
+        if (n <= 0)
+            n = default_threads();
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        if (n == num_threads_)
+            return;
+        stop_workers();
+        start_workers(n);
+    }
+
+    // Run body over [0, n) in chunks of at most `grain` indices. Blocks until
+    // every chunk has run. Calls made from inside a worker run inline.
+    void parallel_for(int64_t n, int64_t grain, const Body& body) {
+        if (n <= 0)
+            return;
+        grain = std::max<int64_t>(grain, 1);
+
+        if (in_worker()) {
+            body(0, n, current_worker());
+            return;
+        }
+
+        std::lock_guard<std::mutex> submit(submit_mutex_);
+
+        int64_t chunks = (n + grain - 1) / grain;
+        int workers = static_cast<int>(std::min<int64_t>(num_threads_, chunks));
+        if (workers <= 1) {
+            WorkerScope scope(0);
+            body(0, n, 0);
+            return;
+        }
+
+        Job job;
+        job.body = &body;
+        job.grain = grain;
+        job.workers = workers;
+        job.ranges.reset(new Range[workers]);
+        for (int w = 0; w < workers; w++) {
+            job.ranges[w].begin = n * w / workers;
+            job.ranges[w].end = n * (w + 1) / workers;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            job_workers_ = workers;
+            pending_ = workers - 1;
+            generation_++;
+        }
+        wake_cv_.notify_all();
+
+        run(job, 0);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [&] { return pending_ == 0; });
+            job_ = nullptr;
+            job_workers_ = 0;
+        }
+
+        if (job.error)
+            std::rethrow_exception(job.error);
+    }
+
+private:
+    struct alignas(64) Range {
+        std::mutex mutex;
+        int64_t begin = 0;
+        int64_t end = 0;
+    };
+
+    struct Job {
+        const Body* body = nullptr;
+        int64_t grain = 1;
+        int workers = 0;
+        std::unique_ptr<Range[]> ranges;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    // Marks the current thread as a pool worker so nested parallel_for calls
+    // run inline instead of deadlocking on the submit mutex.
+    struct WorkerScope {
+        int previous;
+        explicit WorkerScope(int id) : previous(worker_id()) { worker_id() = id; }
+        ~WorkerScope() { worker_id() = previous; }
+    };
+
+    ThreadPool() { start_workers(default_threads()); }
+
+    static int default_threads() {
+        unsigned hw = std::thread::hardware_concurrency();
+        return hw > 0 ? static_cast<int>(hw) : 1;
+    }
+
+    static int& worker_id() {
+        static thread_local int id = -1;
+        return id;
+    }
+
+    static bool in_worker() { return worker_id() >= 0; }
+    static int current_worker() { return worker_id(); }
+
+    void start_workers(int n) {
+        num_threads_ = n;
+        stop_ = false;
+        for (int id = 1; id < n; id++)
+            threads_.emplace_back([this, id] { worker_loop(id); });
+    }
+
+    void stop_workers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_cv_.notify_all();
+        for (auto& t : threads_)
+            t.join();
+        threads_.clear();
+    }
+
+    void worker_loop(int id) {
+        uint64_t seen = 0;
+        while (true) {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_)
+                    return;
+                seen = generation_;
+                // Only participants are waited on, so anyone else must not
+                // touch the job: it may already be gone.
+                if (job_ == nullptr || id >= job_workers_)
+                    continue;
+                job = job_;
+            }
+
+            run(*job, id);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                pending_--;
+            }
+            done_cv_.notify_one();
+        }
+    }
+
+    // Take the next chunk for `id`, stealing from other workers if needed.
+    static bool next_chunk(Job& job, int id, int64_t& begin, int64_t& end) {
+        Range& own = job.ranges[id];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.begin < own.end) {
+                begin = own.begin;
+                end = std::min(own.begin + job.grain, own.end);
+                own.begin = end;
+                return true;
+            }
+        }
+
+        for (int k = 1; k < job.workers; k++) {
+            Range& victim = job.ranges[(id + k) % job.workers];
+            int64_t stolen_begin, stolen_end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                int64_t remaining = victim.end - victim.begin;
+                if (remaining <= 0)
+                    continue;
+                stolen_begin = remaining > job.grain
+                                   ? victim.begin + remaining / 2
+                                   : victim.begin;
+                stolen_end = victim.end;
+                victim.end = stolen_begin;
+            }
+
+            begin = stolen_begin;
+            end = std::min(stolen_begin + job.grain, stolen_end);
+            if (end < stolen_end) {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.begin = end;
+                own.end = stolen_end;
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    static void run(Job& job, int id) {
+        WorkerScope scope(id);
+        int64_t begin, end;
+        while (next_chunk(job, id, begin, end)) {
+            try {
+                (*job.body)(begin, end, id);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(job.error_mutex);
+                if (!job.error)
+                    job.error = std::current_exception();
+            }
+        }
+    }
+
+    mutable std::mutex submit_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable done_cv_;
+    std::vector<std::thread> threads_;
+    Job* job_ = nullptr;
+    int job_workers_ = 0;
+    uint64_t generation_ = 0;
+    int pending_ = 0;
+    int num_threads_ = 1;
+    bool stop_ = false;
+};
+
+// Convenience wrapper around the shared pool.
+inline void parallel_for(int64_t n, int64_t grain, const ThreadPool::Body& body) {
+    ThreadPool::instance().parallel_for(n, grain, body);
+}
+
+} // namespace los
@@ -0,0 +1,793 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+namespace los {
+
+// On-disk tiled DEM (*_dem.ltd, written by tiled_dem.py or natively by
+// write_tiled_dem() in preprocess.h). Little-endian:
+//
+//   header     128 bytes, TiledHeader below
+//   directory  tilesX * tilesY TileEntry, row-major by tile
+//   pyramid    optional: the max/min of 2^L x 2^L tile blocks for levels
+//              L = 1 .. pyramidLevels, each a row-major array of TileRange
+//              (coarsest 1 x 1), level after level
+//   metadata   UTF-8 JSON (what fetch_usgs_lidar.py used to put in
+//              *_dem_meta.json)
+//   tiles      tileSize x tileSize float32, row-major inside the tile,
+//              page-aligned and stored in Morton order of (tx, ty)
+//
+// Readers go by the offsets: the native writer puts the metadata after the
+// tiles, since it holds the elevation range found while writing them.
+// Edge tiles are padded with NaN. Tiles that hold no data at all are not
+// stored: their entry has offset 0 and max -inf. Files without a pyramid
+// (pyramidLevels 0, e.g. from tiled_dem.py) skip by the directory alone.
+struct TiledHeader {
+    char magic[8];  // "LOSTILE1"
+    uint32_t version;
+    uint32_t tileSize;  // power of two
+    uint32_t width, height;
+    uint32_t tilesX, tilesY;
+    uint64_t directoryOffset;
+    uint64_t metaOffset, metaLength;
+    uint64_t pyramidOffset;
+    uint32_t pyramidLevels;
+    uint8_t reserved[60];
+};
+static_assert(sizeof(TiledHeader) == 128, "TiledHeader must be 128 bytes");
+
+struct TileEntry {
+    uint64_t offset;  // 0: empty tile
+    float max;        // NaN cells ignored, -inf when the tile is empty
+    float min;
+};
+static_assert(sizeof(TileEntry) == 16, "TileEntry must be 16 bytes");
+
+struct TileRange {
+    float max;  // -inf when every tile in the block is empty
+    float min;  // +inf likewise
+};
+static_assert(sizeof(TileRange) == 8, "TileRange must be 8 bytes");
+
+// Levels above the tile grid of a tiles_x x tiles_y tile pyramid: each
+// halves the grid, rounding up, until one block covers every tile.
+inline int tile_pyramid_levels(int tilesX, int tilesY) {
+    int levels = 0;
+    for (; tilesX > 1 || tilesY > 1; levels++) {
+        tilesX = (tilesX + 1) / 2;
+        tilesY = (tilesY + 1) / 2;
+    }
+    return levels;
+}
+
+constexpr char kTiledMagic[8] = {'L', 'O', 'S', 'T', 'I', 'L', 'E', '1'};
+constexpr uint32_t kTiledVersion = 1;
+
+// Read-only memory map of a tiled DEM. Opening validates the header and
+// the directory and touches nothing else, so it costs the same for any
+// DEM size; tile pages are faulted in only when a query reads them.
+class TiledDem {
+public:
+    explicit TiledDem(const std::string& path) : path_(path) {
+        map(path);
+        try {
+            validate();
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    ~TiledDem() { unmap(); }
+
+    TiledDem(const TiledDem&) = delete;
+    TiledDem& operator=(const TiledDem&) = delete;
+
+    const std::string& path() const { return path_; }
+    int width() const { return static_cast<int>(header().width); }
+    int height() const { return static_cast<int>(header().height); }
+    int tile_size() const { return static_cast<int>(header().tileSize); }
+    int tile_shift() const { return shift_; }
+    int tiles_x() const { return static_cast<int>(header().tilesX); }
+    int tiles_y() const { return static_cast<int>(header().tilesY); }
+    size_t file_bytes() const { return size_; }
+
+    std::string metadata() const {
+        const TiledHeader& h = header();
+        return std::string(reinterpret_cast<const char*>(base_ + h.metaOffset), h.metaLength);
+    }
+
+    const TileEntry& entry(int tx, int ty) const {
+        return directory_[static_cast<size_t>(ty) * header().tilesX + tx];
+    }
+
+    float tile_max(int tx, int ty) const { return entry(tx, ty).max; }
+
+    // Levels of the tile pyramid above the directory (0 when the file has
+    // none), and the range of the level-L block holding tile (tx, ty).
+    int pyramid_levels() const { return static_cast<int>(levels_.size()); }
+
+    const TileRange& block_range(int level, int tx, int ty) const {
+        const Level& l = levels_[level - 1];
+        return l.ranges[static_cast<size_t>(ty >> level) * l.width + (tx >> level)];
+    }
+
+    float block_max(int level, int tx, int ty) const { return block_range(level, tx, ty).max; }
+
+    // Cell bounds of the level-L block holding tile (tx, ty), clipped at
+    // the grid edge.
+    MaxPyramid::Block block(int level, int tx, int ty) const {
+        int shift = shift_ + level;
+        int x0 = (tx >> level) << shift, y0 = (ty >> level) << shift;
+        return {x0, y0, std::min(x0 + (1 << shift) - 1, width() - 1),
+                std::min(y0 + (1 << shift) - 1, height() - 1)};
+    }
+
+    // Cells of tile (tx, ty), or nullptr for an empty (all-NaN) tile.
+    const float* tile(int tx, int ty) const {
+        uint64_t offset = entry(tx, ty).offset;
+        return offset ? reinterpret_cast<const float*>(base_ + offset) : nullptr;
+    }
+
+    // Cell bounds of tile (tx, ty), clipped at the grid edge.
+    MaxPyramid::Block tile_block(int tx, int ty) const {
+        int x0 = tx << shift_, y0 = ty << shift_;
+        return {x0, y0, std::min(x0 + tile_size() - 1, width() - 1),
+                std::min(y0 + tile_size() - 1, height() - 1)};
+    }
+
+    // TiledDem maps every tile in place and has nothing to prefetch; see
+    // TileCache for the bounded alternative.
+    int lookahead() const { return 0; }
+    void prefetch(int, int) const {}
+
+    // Drop this process's mapping of tile (tx, ty) so it stops counting as
+    // resident. The pages stay in the OS file cache and fault back in if
+    // the tile is read again.
+    void release(int tx, int ty) const {
+#ifndef _WIN32
+        uint64_t offset = entry(tx, ty).offset;
+        if (!offset)
+            return;
+        const uint64_t page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        uint64_t begin = (offset + page - 1) / page * page;
+        uint64_t end = (offset + sizeof(float) * static_cast<uint64_t>(tile_size()) * tile_size()) /
+                       page * page;
+        if (end > begin)
+            ::madvise(const_cast<uint8_t*>(base_ + begin), end - begin, MADV_DONTNEED);
+#else
+        (void)tx;
+        (void)ty;
+#endif
+    }
+
+private:
+    const TiledHeader& header() const { return *reinterpret_cast<const TiledHeader*>(base_); }
+
+    [[noreturn]] void fail(const std::string& why) const {
+        throw std::runtime_error(path_ + ": " + why);
+    }
+
+    void validate() {
+        if (size_ < sizeof(TiledHeader))
+            fail("too small to be a tiled DEM");
+        const TiledHeader& h = header();
+        if (std::memcmp(h.magic, kTiledMagic, sizeof(kTiledMagic)) != 0)
+            fail("not a tiled DEM (bad magic)");
+        if (h.version != kTiledVersion)
+            fail("unsupported tiled DEM version " + std::to_string(h.version));
+        if (h.tileSize < 16 || h.tileSize > 4096 || (h.tileSize & (h.tileSize - 1)))
+            fail("tile size must be a power of two in [16, 4096]");
+        if (h.width == 0 || h.height == 0 ||
+            h.width > static_cast<uint32_t>(std::numeric_limits<int>::max()) ||
+            h.height > static_cast<uint32_t>(std::numeric_limits<int>::max()))
+            fail("bad grid dimensions");
+        if (h.tilesX != (h.width + h.tileSize - 1) / h.tileSize ||
+            h.tilesY != (h.height + h.tileSize - 1) / h.tileSize)
+            fail("tile counts do not match the grid dimensions");
+
+        shift_ = 0;
+        while ((1u << shift_) < h.tileSize)
+            shift_++;
+
+        uint64_t tiles = static_cast<uint64_t>(h.tilesX) * h.tilesY;
+        if (h.directoryOffset % alignof(TileEntry) ||
+            h.directoryOffset > size_ || tiles > (size_ - h.directoryOffset) / sizeof(TileEntry))
+            fail("directory lies outside the file");
+        if (h.metaOffset > size_ || h.metaLength > size_ - h.metaOffset)
+            fail("metadata lies outside the file");
+
+        directory_ = reinterpret_cast<const TileEntry*>(base_ + h.directoryOffset);
+        uint64_t tileBytes = sizeof(float) * static_cast<uint64_t>(h.tileSize) * h.tileSize;
+        for (uint64_t i = 0; i < tiles; i++) {
+            uint64_t offset = directory_[i].offset;
+            if (offset && (offset % alignof(float) || offset > size_ || tileBytes > size_ - offset))
+                fail("tile " + std::to_string(i) + " lies outside the file");
+        }
+
+        levels_.clear();
+        if (!h.pyramidLevels)
+            return;
+        if (static_cast<int>(h.pyramidLevels) !=
+            tile_pyramid_levels(static_cast<int>(h.tilesX), static_cast<int>(h.tilesY)))
+            fail("pyramid levels do not match the tile counts");
+        uint64_t offset = h.pyramidOffset;
+        int w = static_cast<int>(h.tilesX), hgt = static_cast<int>(h.tilesY);
+        for (uint32_t l = 0; l < h.pyramidLevels; l++) {
+            w = (w + 1) / 2;
+            hgt = (hgt + 1) / 2;
+            uint64_t bytes = sizeof(TileRange) * static_cast<uint64_t>(w) * hgt;
+            if (offset % alignof(TileRange) || offset > size_ || bytes > size_ - offset)
+                fail("pyramid lies outside the file");
+            levels_.push_back({w, reinterpret_cast<const TileRange*>(base_ + offset)});
+            offset += bytes;
+        }
+    }
+
+#ifdef _WIN32
+    void map(const std::string& path) {
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            fail("cannot open (error " + std::to_string(GetLastError()) + ")");
+        LARGE_INTEGER size;
+        GetFileSizeEx(file_, &size);
+        size_ = static_cast<size_t>(size.QuadPart);
+        mapping_ = size_ ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        base_ = mapping_ ? static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0))
+                         : nullptr;
+        if (!base_) {
+            unmap();
+            fail("cannot map (error " + std::to_string(GetLastError()) + ")");
+        }
+    }
+
+    void unmap() {
+        if (base_) UnmapViewOfFile(base_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        base_ = nullptr;
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    void map(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            fail(std::strerror(errno));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            fail(std::strerror(err));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        void* p = size_ ? ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        int err = errno;
+        ::close(fd);
+        if (p == MAP_FAILED)
+            fail(size_ ? std::strerror(err) : "empty file");
+        // Rays touch scattered tiles; read-ahead would page in neighbours
+        // they never visit.
+        ::madvise(p, size_, MADV_RANDOM);
+        base_ = static_cast<const uint8_t*>(p);
+    }
+
+    void unmap() {
+        if (base_)
+            ::munmap(const_cast<uint8_t*>(base_), size_);
+        base_ = nullptr;
+    }
+#endif
+
+    std::string path_;
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    const TileEntry* directory_ = nullptr;
+    int shift_ = 0;
+
+    struct Level {
+        int width;  // blocks per row
+        const TileRange* ranges;
+    };
+    std::vector<Level> levels_;
+};
+
+// Bounded LRU cache of tiles copied out of a TiledDem, for DEMs larger
+// than RAM: at most about `budget` bytes of tiles are resident at once,
+// plus the tile each in-flight ray holds. A tile is loaded on first use and
+// the mapped pages it came from are released, so the mapping itself never
+// grows the resident set.
+//
+// The cache is split into shards by tile, each with its own lock and
+// budget / shards bytes, so pool threads rarely contend. prefetch() queues a
+// tile for a background thread; los_boolean_tiled calls it for the next
+// lookahead() tiles along the ray that it will have to test.
+class TileCache {
+public:
+    using Tile = std::shared_ptr<const float[]>;
+
+    struct Stats {
+        uint64_t hits, misses, prefetched, evictions;
+        size_t tiles, bytes, budget;
+    };
+
+    TileCache(const TiledDem& dem, size_t budget, int lookahead = 2)
+        : dem_(dem), budget_(budget), lookahead_(std::max(lookahead, 0)),
+          tileBytes_(sizeof(float) * static_cast<size_t>(dem.tile_size()) * dem.tile_size()) {
+        // Keep at least four tiles per shard so LRU order still means something.
+        size_t shards = std::min<size_t>(kMaxShards, budget_ / (4 * tileBytes_));
+        shards_ = std::vector<Shard>(std::max<size_t>(shards, 1));
+        shardBudget_ = std::max(budget_ / shards_.size(), tileBytes_);
+        if (lookahead_ > 0)
+            prefetcher_ = std::thread([this] { prefetch_loop(); });
+    }
+
+    ~TileCache() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            stopping_ = true;
+        }
+        queueReady_.notify_all();
+        if (prefetcher_.joinable())
+            prefetcher_.join();
+    }
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    int width() const { return dem_.width(); }
+    int height() const { return dem_.height(); }
+    int tile_size() const { return dem_.tile_size(); }
+    int tile_shift() const { return dem_.tile_shift(); }
+    float tile_max(int tx, int ty) const { return dem_.tile_max(tx, ty); }
+    MaxPyramid::Block tile_block(int tx, int ty) const { return dem_.tile_block(tx, ty); }
+    int pyramid_levels() const { return dem_.pyramid_levels(); }
+    float block_max(int level, int tx, int ty) const { return dem_.block_max(level, tx, ty); }
+    MaxPyramid::Block block(int level, int tx, int ty) const { return dem_.block(level, tx, ty); }
+    int lookahead() const { return lookahead_; }
+
+    // Cells of tile (tx, ty), loading it on a miss; null for an empty tile.
+    // The returned pointer keeps the tile alive after it is evicted.
+    Tile tile(int tx, int ty) const {
+        if (!dem_.entry(tx, ty).offset)
+            return nullptr;
+        uint64_t key = key_of(tx, ty);
+        if (Tile t = lookup(key, true)) {
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            LOS_STAT_ADD(TileHits, 1);
+            return t;
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        LOS_STAT_ADD(TileMisses, 1);
+        return insert(key, load(tx, ty));
+    }
+
+    // Queue tile (tx, ty) for the prefetch thread. Never blocks: requests
+    // beyond kMaxQueued are dropped.
+    void prefetch(int tx, int ty) const {
+        if (!lookahead_ || !dem_.entry(tx, ty).offset)
+            return;
+        uint64_t key = key_of(tx, ty);
+        if (lookup(key, false))
+            return;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            if (queue_.size() >= kMaxQueued)
+                return;
+            queue_.push_back(key);
+        }
+        queueReady_.notify_one();
+    }
+
+    Stats stats() const {
+        Stats s{hits_.load(), misses_.load(), prefetched_.load(), evictions_.load(), 0, 0, budget_};
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            s.tiles += shard.lru.size();
+            s.bytes += shard.bytes;
+        }
+        return s;
+    }
+
+    void reset_stats() {
+        hits_ = 0;
+        misses_ = 0;
+        prefetched_ = 0;
+        evictions_ = 0;
+    }
+
+    // Evict every tile (tiles still held by a caller stay alive until released).
+    void clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.lru.clear();
+            shard.index.clear();
+            shard.bytes = 0;
+        }
+    }
+
+private:
+    static constexpr size_t kMaxShards = 16;
+    static constexpr size_t kMaxQueued = 256;
+
+    using Lru = std::list<std::pair<uint64_t, Tile>>;
+
+    struct Shard {
+        std::mutex mutex;
+        Lru lru;  // most recently used first
+        std::unordered_map<uint64_t, Lru::iterator> index;
+        size_t bytes = 0;
+    };
+
+    uint64_t key_of(int tx, int ty) const {
+        return static_cast<uint64_t>(ty) * static_cast<uint64_t>(dem_.tiles_x()) + tx;
+    }
+
+    Shard& shard_of(uint64_t key) const {
+        // Neighbouring tiles land in different shards.
+        return shards_[(key * 0x9E3779B97F4A7C15ull >> 32) % shards_.size()];
+    }
+
+    Tile lookup(uint64_t key, bool touch) const {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+            return nullptr;
+        if (touch)
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->second;
+    }
+
+    // Copy the tile out of the mapping. Runs without any lock held, so two
+    // threads may load the same tile; insert() keeps the first.
+    Tile load(int tx, int ty) const {
+        std::shared_ptr<float[]> cells(new float[tileBytes_ / sizeof(float)]);
+        std::memcpy(cells.get(), dem_.tile(tx, ty), tileBytes_);
+        dem_.release(tx, ty);
+        return cells;
+    }
+
+    Tile insert(uint64_t key, Tile t) const {
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return it->second->second;
+        }
+        shard.lru.emplace_front(key, t);
+        shard.index.emplace(key, shard.lru.begin());
+        shard.bytes += tileBytes_;
+        while (shard.bytes > shardBudget_ && shard.lru.size() > 1) {
+            shard.index.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+            shard.bytes -= tileBytes_;
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    void prefetch_loop() {
+        while (true) {
+            uint64_t key;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex_);
+                queueReady_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+                if (stopping_)
+                    return;
+                key = queue_.front();
+                queue_.pop_front();
+            }
+            if (lookup(key, false))
+                continue;
+            int tx = static_cast<int>(key % static_cast<uint64_t>(dem_.tiles_x()));
+            int ty = static_cast<int>(key / static_cast<uint64_t>(dem_.tiles_x()));
+            insert(key, load(tx, ty));
+            prefetched_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    const TiledDem& dem_;
+    size_t budget_;
+    int lookahead_;
+    size_t tileBytes_;
+    size_t shardBudget_;
+    mutable std::vector<Shard> shards_;
+
+    mutable std::atomic<uint64_t> hits_{0}, misses_{0}, prefetched_{0}, evictions_{0};
+
+    mutable std::mutex queueMutex_;
+    mutable std::condition_variable queueReady_;
+    mutable std::deque<uint64_t> queue_;
+    bool stopping_ = false;
+    std::thread prefetcher_;
+};
+
+// Height of cell (x, y) through a TiledDem or TileCache; NaN for no data.
+template <typename Tiles>
+inline float tile_height(const Tiles& tiles, int x, int y) {
+    const int shift = tiles.tile_shift(), mask = tiles.tile_size() - 1;
+    auto t = tiles.tile(x >> shift, y >> shift);
+    return t ? t[((y & mask) << shift) | (x & mask)] : std::numeric_limits<float>::quiet_NaN();
+}
+
+// Copy the w x h window at (x, y) into out (row-major, w floats per row).
+// The window must lie inside the grid.
+template <typename Tiles>
+inline void read_tile_window(const Tiles& tiles, int x, int y, int w, int h, float* out) {
+    const int shift = tiles.tile_shift(), size = tiles.tile_size(), mask = size - 1;
+    for (int row = 0; row < h; row++) {
+        int cy = y + row;
+        float* dst = out + static_cast<size_t>(row) * w;
+        for (int cx = x; cx < x + w;) {
+            int n = std::min(size - (cx & mask), x + w - cx);
+            auto t = tiles.tile(cx >> shift, cy >> shift);
+            if (t)
+                std::memcpy(dst + (cx - x), &t[((cy & mask) << shift) + (cx & mask)],
+                            sizeof(float) * n);
+            else
+                std::fill_n(dst + (cx - x), n, std::numeric_limits<float>::quiet_NaN());
+            cx += n;
+        }
+    }
+}
+
+// Prefetch the next tiles.lookahead() tiles the walk from r (currently in
+// tile block b) will have to test, skipping the ones it will clear. Only a
+// hint: the walk may stop earlier at the terrain.
+template <typename Real, typename Tiles>
+inline void prefetch_along(const Tiles& tiles, BasicDDA<Real> r, MaxPyramid::Block b,
+                           bool reachesEnd) {
+    const int shift = tiles.tile_shift();
+    const int lookahead = tiles.lookahead();
+    int queued = 0;
+    for (int crossed = 0; queued < lookahead && crossed < 4 * lookahead; crossed++) {
+        if (reachesEnd && b.contains(r.endX, r.endY))
+            return;
+        r.exit_block(b);
+        if (!r.in_bounds(tiles.width(), tiles.height()))
+            return;
+        int tx = r.x >> shift, ty = r.y >> shift;
+        b = tiles.tile_block(tx, ty);
+        if ((!reachesEnd && b.contains(r.endX, r.endY)) ||
+            tiles.tile_max(tx, ty) > r.min_height_in(b)) {
+            tiles.prefetch(tx, ty);
+            queued++;
+        }
+    }
+}
+
+// Same answer as los_boolean_raw over a TiledDem or a TileCache. The tile
+// max in the directory plays the part of one pyramid level: a ray skips any
+// tile whose max is at or below the lowest ray height tested inside it, so
+// tiles it clears are never read, and empty tiles never are. Entering a
+// tile it first tries the file's coarser blocks of tiles, as
+// los_boolean_pyramid does, so a ray high above the terrain clears a run of
+// tiles in one test. Crossing into a tile it must test, it fetches that
+// tile and prefetches the next ones.
+template <typename Real = double, typename Tiles = TiledDem>
+inline double los_boolean_tiled(
+    const Tiles& tiles,
+    double x0, double y0, double z0,
+    double x1, double y1, double z1,
+    double curvature = 0.0
+) {
+    BasicDDA<Real> r(x0, y0, z0, x1, y1, z1, curvature);
+    const bool reachesEnd = r.reaches_end();
+    const int width = tiles.width(), height = tiles.height();
+    const int shift = tiles.tile_shift(), mask = tiles.tile_size() - 1;
+    const int top = tiles.pyramid_levels();
+    decltype(tiles.tile(0, 0)) tile{};
+    int tileX = -1, tileY = -1;
+    int level = 1;
+    LOS_STAT_CELLS(walked);
+
+    while (true) {
+
+        if (!r.in_bounds(width, height))
+            return 0.0;
+
+        if ((r.x >> shift) != tileX || (r.y >> shift) != tileY) {
+            tileX = r.x >> shift;
+            tileY = r.y >> shift;
+            bool skipped = false;
+            for (int l = std::min(level, top); l >= 1; l--) {
+                MaxPyramid::Block b = tiles.block(l, tileX, tileY);
+                bool holdsEnd = b.contains(r.endX, r.endY);
+                if (holdsEnd && !reachesEnd)
+                    continue;
+                if (tiles.block_max(l, tileX, tileY) <= r.min_height_in(b)) {
+                    LOS_STAT_SKIP(shift + l);
+                    if (holdsEnd)
+                        return 1.0;
+                    r.exit_block(b);
+                    level = l + 1;
+                    skipped = true;
+                    break;
+                }
+            }
+            if (skipped)
+                continue;
+            level = 1;
+            MaxPyramid::Block b = tiles.tile_block(tileX, tileY);
+            bool holdsEnd = b.contains(r.endX, r.endY);
+            // As in los_boolean_pyramid, a walk that misses the end cell
+            // walks the tile holding it cell by cell.
+            if (!(holdsEnd && !reachesEnd) && tiles.tile_max(tileX, tileY) <= r.min_height_in(b)) {
+                LOS_STAT_SKIP(shift);
+                if (holdsEnd)
+                    return 1.0;
+                r.exit_block(b);
+                continue;
+            }
+            tile = tiles.tile(tileX, tileY);
+            if (tiles.lookahead() > 0)
+                prefetch_along(tiles, r, b, reachesEnd);
+        }
+
+        // An empty tile is all NaN, which never blocks.
+        if (tile) {
+            LOS_STAT_STEP(walked);
+            Real rayHeight = r.ray_height(r.cell_t(r.x, r.y));
+
+            float terrain = tile[((r.y & mask) << shift) | (r.x & mask)];
+
+            if (terrain > rayHeight)
+                return 0.0;
+        }
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return 1.0;
+}
+
+// Query interface of Terrain over a memory-mapped tiled DEM.
+//
+// With cache_bytes == 0 tiles are read straight from the mapping and the
+// OS decides what stays resident. With a budget every read goes through a
+// TileCache of about cache_bytes, which prefetches `lookahead` tiles ahead
+// of each ray.
+class TiledTerrain {
+public:
+    explicit TiledTerrain(const std::string& path, Precision precision = Precision::Double,
+                          size_t cache_bytes = 0, int lookahead = 2)
+        : dem_(path), precision_(precision) {
+        if (cache_bytes)
+            cache_ = std::make_unique<TileCache>(dem_, cache_bytes, lookahead);
+    }
+
+    const TiledDem& dem() const { return dem_; }
+    int width() const { return dem_.width(); }
+    int height() const { return dem_.height(); }
+    Precision precision() const { return precision_; }
+    TileCache* cache() const { return cache_.get(); }
+
+    // Bend rays by the earth's curvature, as Terrain::set_earth_curvature.
+    void set_earth_curvature(double cell_size, double k_factor) {
+        if (!(cell_size > 0) || !std::isfinite(cell_size) ||
+            !(k_factor > 0) || !std::isfinite(k_factor))
+            throw std::invalid_argument("cell_size and k_factor must be positive");
+        curvature_ = earth_curvature(cell_size, k_factor);
+        cellSize_ = cell_size;
+        kFactor_ = k_factor;
+    }
+
+    void clear_earth_curvature() { curvature_ = cellSize_ = kFactor_ = 0.0; }
+
+    double curvature() const { return curvature_; }
+    double curvature_cell_size() const { return cellSize_; }
+    double curvature_k_factor() const { return kFactor_; }
+
+    float height_at(int x, int y) const {
+        return cache_ ? tile_height(*cache_, x, y) : tile_height(dem_, x, y);
+    }
+
+    void read_window(int x, int y, int w, int h, float* out) const {
+        if (cache_)
+            return read_tile_window(*cache_, x, y, w, h, out);
+        read_tile_window(dem_, x, y, w, h, out);
+    }
+
+    double los_boolean(double x0, double y0, double z0,
+                       double x1, double y1, double z1) const {
+        LOS_STAT_SCOPE(1);
+        return walk(x0, y0, z0, x1, y1, z1);
+    }
+
+    double los_probability(double x0, double y0, double z0,
+                           double x1, double y1, double z1,
+                           int num_samples) const {
+        LOS_STAT_SCOPE(1);
+        auto trace = [this](double ax, double ay, double az,
+                            double bx, double by, double bz) {
+            return walk(ax, ay, az, bx, by, bz);
+        };
+        return los_probability_sampled(trace, x0, y0, z0, x1, y1, z1, num_samples);
+    }
+
+    void los_boolean_batch(const double* pairs, int64_t n, uint8_t* out) const {
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                out[i] = los_boolean(r[0], r[1], r[2], r[3], r[4], r[5]) > 0.5;
+            }
+        });
+    }
+
+    void los_probability_batch(const double* pairs, int64_t n, int num_samples,
+                               double* out) const {
+        parallel_for(n, kBatchGrain, [&](int64_t begin, int64_t end, int) {
+            for (int64_t i = begin; i < end; i++) {
+                const double* r = pairs + 6 * i;
+                out[i] = los_probability(r[0], r[1], r[2], r[3], r[4], r[5], num_samples);
+            }
+        });
+    }
+
+private:
+    double walk(double x0, double y0, double z0, double x1, double y1, double z1) const {
+        if (precision_ == Precision::Float)
+            return los_boolean_as<float>(x0, y0, z0, x1, y1, z1);
+        return los_boolean_as<double>(x0, y0, z0, x1, y1, z1);
+    }
+
+    template <typename Real>
+    double los_boolean_as(double x0, double y0, double z0,
+                          double x1, double y1, double z1) const {
+        if (cache_)
+            return los_boolean_tiled<Real>(*cache_, x0, y0, z0, x1, y1, z1, curvature_);
+        return los_boolean_tiled<Real>(dem_, x0, y0, z0, x1, y1, z1, curvature_);
+    }
+
+    TiledDem dem_;
+    Precision precision_;
+    std::unique_ptr<TileCache> cache_;
+    double curvature_ = 0.0;  // set_earth_curvature()
+    double cellSize_ = 0.0;
+    double kFactor_ = 0.0;
+};
+
+} // namespace los
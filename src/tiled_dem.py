@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Tiled DEM files (*_dem.ltd) for los.TiledTerrain
+
+The DEM is cut into square float32 tiles (256x256 by default) stored in
+Morton order, behind a 128-byte header, a per-tile directory and a JSON
+metadata block that replaces the old *_dem_meta.json sidecar. See
+TiledHeader in tiled.h for the exact layout. Files written here leave out
+the optional max/min levels over blocks of tiles that los.write_tiled_dem
+adds; readers then skip by the per-tile directory alone. los.TiledTerrain memory-maps
+the file, so opening it costs the same for any DEM size and only the tiles
+a ray actually reaches are read from disk.
+
+Usage:
+    python tiled_dem.py lidar_data/sample_lidar_39.7392_-104.9903_dem.npy
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+from pathlib import Path
+
+import numpy as np
+
+MAGIC = b"LOSTILE1"
+VERSION = 1
+HEADER = struct.Struct("<8s6I3Q72x")
+ENTRY = np.dtype([("offset", "<u8"), ("max", "<f4"), ("min", "<f4")])
+PAGE = 4096
+
+
+def morton(tx, ty):
+    """Interleave the bits of tx (even) and ty (odd)."""
+    key = 0
+    for bit in range(32):
+        key |= ((tx >> bit) & 1) << (2 * bit) | ((ty >> bit) & 1) << (2 * bit + 1)
+    return key
+
+
+def write_tiled_dem(path, dem, metadata=None, tile_size=256):
+    """Write a 2-D array as a tiled DEM.
+
+    dem is only sliced one tile at a time, so an np.memmap (or anything else
+    with 2-D slicing) larger than RAM works. NaN cells never block a ray;
+    tiles that are entirely NaN are not stored.
+    """
+    if tile_size < 16 or tile_size > 4096 or tile_size & (tile_size - 1):
+        raise ValueError("tile_size must be a power of two in [16, 4096]")
+    if len(dem.shape) != 2 or dem.shape[0] == 0 or dem.shape[1] == 0:
+        raise ValueError("dem must be a non-empty 2-D array")
+
+    height, width = dem.shape
+    tiles_x = -(-width // tile_size)
+    tiles_y = -(-height // tile_size)
+    meta = json.dumps(metadata or {}, indent=2).encode("utf-8")
+
+    directory = np.zeros(tiles_y * tiles_x, dtype=ENTRY)
+    directory_offset = HEADER.size
+    meta_offset = directory_offset + directory.nbytes
+    pos = -(-(meta_offset + len(meta)) // PAGE) * PAGE
+
+    order = sorted(((tx, ty) for ty in range(tiles_y) for tx in range(tiles_x)),
+                   key=lambda t: morton(*t))
+
+    path = Path(path)
+    tmp = path.with_name(path.name + ".tmp")
+    with open(tmp, "wb") as f:
+        f.seek(pos)
+        for tx, ty in order:
+            x0, y0 = tx * tile_size, ty * tile_size
+            block = np.asarray(dem[y0:y0 + tile_size, x0:x0 + tile_size], dtype=np.float32)
+            i = ty * tiles_x + tx
+            if np.isnan(block).all():
+                directory["max"][i], directory["min"][i] = -np.inf, np.inf
+                continue
+
+            tile = np.full((tile_size, tile_size), np.nan, dtype="<f4")
+            tile[:block.shape[0], :block.shape[1]] = block
+            f.write(tile.tobytes())
+            directory["offset"][i] = pos
+            directory["max"][i], directory["min"][i] = np.nanmax(block), np.nanmin(block)
+            pos += tile.nbytes
+
+        f.seek(0)
+        f.write(HEADER.pack(MAGIC, VERSION, tile_size, width, height, tiles_x, tiles_y,
+                            directory_offset, meta_offset, len(meta)))
+        f.write(directory.tobytes())
+        f.write(meta)
+    os.replace(tmp, path)
+    return path
+
+
+def read_tiled_header(path):
+    """Return (width, height, tile_size, metadata) without mapping any tile."""
+    with open(path, "rb") as f:
+        fields = HEADER.unpack(f.read(HEADER.size))
+        if fields[0] != MAGIC:
+            raise ValueError(f"{path}: not a tiled DEM")
+        if fields[1] != VERSION:
+            raise ValueError(f"{path}: unsupported tiled DEM version {fields[1]}")
+        _, _, tile_size, width, height, _, _, _, meta_offset, meta_length = fields
+        f.seek(meta_offset)
+        metadata = json.loads(f.read(meta_length).decode("utf-8") or "{}")
+    return width, height, tile_size, metadata
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a *_dem.npy to a tiled *_dem.ltd")
+    parser.add_argument("dem", help="Path to a 2-D .npy DEM")
+    parser.add_argument("--tile-size", type=int, default=256)
+    parser.add_argument("--output", default=None,
+                        help="Output path (default: the .npy path with .ltd)")
+    args = parser.parse_args()
+
+    npy_path = Path(args.dem)
+    dem = np.load(npy_path, mmap_mode="r")
+
+    # Pick up the legacy metadata sidecar if there is one
+    metadata = {}
+    meta_path = npy_path.parent / f"{npy_path.stem}_meta.json"
+    if meta_path.exists():
+        with open(meta_path) as f:
+            metadata = json.load(f)
+
+    out = write_tiled_dem(args.output or npy_path.with_suffix(".ltd"), dem, metadata,
+                          args.tile_size)
+    print(f"Saved tiled DEM: {out}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "los_kernel.h"
+#include "pyramid.h"
+#include "stats.h"
+
+namespace los {
+
+// Where a ray is blocked and by how much, from one walk. t is the walk's
+// own parameter (BasicDDA::cell_t) at the cell tested, and clearance is
+// the ray height there minus the terrain, so the first cell with negative
+// clearance is the one los_boolean stops at.
+struct TraceResult {
+    bool visible = true;
+    // First blocking cell, or the first cell outside the grid for a ray
+    // that leaves it (which los_boolean also reports blocked); -1 if visible.
+    int hitX = -1, hitY = -1;
+    double hitT = std::numeric_limits<double>::quiet_NaN();
+    // Lowest clearance over the cells walked and the first cell it occurs
+    // at; +inf and -1 when no walked cell had data.
+    double minClearance = std::numeric_limits<double>::infinity();
+    int minX = -1, minY = -1;
+    double minT = std::numeric_limits<double>::quiet_NaN();
+    // Cells tested one by one; with a profile, the rows it holds
+    // (up to its capacity).
+    int64_t cells = 0;
+};
+
+// Columns of one profile row.
+constexpr int kProfileColumns = 5;  // x, y, t, terrain, ray height
+
+// Trace the ray (x0, y0, z0) -> (x1, y1, z1) through cells(x, y), visiting
+// exactly the cells los_boolean_cells does. The walk stops at the first
+// blocking cell when stop_at_block, otherwise it runs to the end and the
+// minimum clearance covers the whole ray.
+//
+// A non-null `pyramid` skips blocks that can neither block the ray (before
+// the first hit) nor hold a lower clearance than the lowest found so far,
+// so skipping never changes the result. With a non-null `profile` of
+// `capacity` rows every cell is walked and written as one row instead.
+// Ray heights, in the profile too, include the `curvature` drop (BasicDDA).
+template <typename Real = double, typename Pyramid = MaxPyramid, typename Cells>
+inline TraceResult los_trace_cells(const Cells& cells, int width, int height,
+                                   const Pyramid* pyramid,
+                                   double x0, double y0, double z0,
+                                   double x1, double y1, double z1,
+                                   bool stop_at_block,
+                                   double* profile = nullptr, int64_t capacity = 0,
+                                   double curvature = 0.0) {
+    TraceResult out;
+    BasicDDA<Real> r(x0, y0, z0, x1, y1, z1, curvature);
+    const bool reachesEnd = r.reaches_end();
+    const int top = pyramid && !profile ? pyramid->levels() : 0;
+    Real best = std::numeric_limits<Real>::infinity();
+    int level = 1;
+    LOS_STAT_CELLS(walked);
+
+    while (true) {
+
+        if (!r.in_bounds(width, height)) {
+            if (out.visible) {
+                out.visible = false;
+                out.hitX = r.x;
+                out.hitY = r.y;
+                out.hitT = static_cast<double>(r.cell_t(r.x, r.y));
+            }
+            return out;
+        }
+
+        bool skipped = false;
+        for (int l = std::min(level, top); l >= 1; l--) {
+            MaxPyramid::Block b = pyramid->block(l, r.x, r.y);
+            bool holdsEnd = b.contains(r.endX, r.endY);
+            if (holdsEnd && !reachesEnd)
+                continue;
+            Real lowest = r.min_height_in(b);
+            Real blockMax = pyramid->block_max(l, r.x, r.y);
+            if ((!out.visible || blockMax <= lowest) && !(lowest - blockMax < best)) {
+                LOS_STAT_SKIP(l);
+                if (holdsEnd)
+                    return out;
+                r.exit_block(b);
+                level = l + 1;
+                skipped = true;
+                break;
+            }
+        }
+        if (skipped)
+            continue;
+        level = 1;
+
+        Real t = r.cell_t(r.x, r.y);
+        Real rayHeight = r.ray_height(t);
+        LOS_STAT_STEP(walked);
+        float terrain = cells(r.x, r.y);
+        if (profile && out.cells < capacity) {
+            double* row = profile + kProfileColumns * out.cells;
+            row[0] = r.x;
+            row[1] = r.y;
+            row[2] = static_cast<double>(t);
+            row[3] = terrain;
+            row[4] = static_cast<double>(rayHeight);
+        }
+        out.cells++;
+
+        Real clearance = rayHeight - terrain;
+        if (clearance < best) {
+            best = clearance;
+            out.minClearance = static_cast<double>(clearance);
+            out.minX = r.x;
+            out.minY = r.y;
+            out.minT = static_cast<double>(t);
+        }
+        if (terrain > rayHeight && out.visible) {
+            out.visible = false;
+            out.hitX = r.x;
+            out.hitY = r.y;
+            out.hitT = static_cast<double>(t);
+            if (stop_at_block)
+                return out;
+        }
+
+        if (r.at_end())
+            break;
+
+        r.step();
+    }
+
+    return out;
+}
+
+} // namespace los
@@ -6,6 +6,7 @@ Tests line-of-sight analysis using real or sample USGS LiDAR data
 Usage:
     python usgs_los_test.py
     python usgs_los_test.py --dem lidar_data/sample_lidar_39.7392_-104.9903_dem.npy
+    python usgs_los_test.py --dem lidar_data/sample_lidar_39.7392_-104.9903_dem.ltd
 """
 
 import numpy as np
@@ -22,23 +23,31 @@ except ImportError:
 
 
 def find_latest_dem(data_dir="lidar_data"):
-    """Find the most recently created DEM file"""
+    """Find the most recently created DEM file, preferring tiled .ltd files"""
     data_path = Path(data_dir)
     if not data_path.exists():
         return None
     
-    npy_files = list(data_path.glob("*_dem.npy"))
-    if not npy_files:
+    dem_files = list(data_path.glob("*_dem.ltd")) or list(data_path.glob("*_dem.npy"))
+    if not dem_files:
         return None
     
     # Sort by modification time, newest first
-    npy_files.sort(key=lambda x: x.stat().st_mtime, reverse=True)
-    return npy_files[0]
+    dem_files.sort(key=lambda x: x.stat().st_mtime, reverse=True)
+    return dem_files[0]
 
 
 def load_dem_with_metadata(dem_path):
-    """Load DEM and its metadata"""
-    dem = np.load(str(dem_path))
+    """Load DEM and its metadata.
+
+    A tiled .ltd file is memory-mapped as a los.TiledTerrain and carries its
+    own metadata; a .npy is loaded whole, with the legacy _meta.json sidecar.
+    """
+    if dem_path.suffix == ".ltd":
+        terrain = los.TiledTerrain(str(dem_path))
+        return terrain, terrain.metadata
+    
+    dem = np.ascontiguousarray(np.load(str(dem_path)), dtype=np.float32)
     
     # Try to load metadata
     meta_path = dem_path.parent / f"{dem_path.stem}_meta.json"
@@ -50,9 +59,32 @@ def load_dem_with_metadata(dem_path):
     return dem, metadata
 
 
+def ground(dem, x, y):
+    """Terrain height at cell (x, y) of an array or TiledTerrain"""
+    if isinstance(dem, los.TiledTerrain):
+        return float(dem.height_at(int(x), int(y)))
+    return float(dem[int(y), int(x)])
+
+
+def extreme_cell(dem, highest):
+    """(y, x) of the highest or lowest cell. A TiledTerrain reads one tile."""
+    if not isinstance(dem, los.TiledTerrain):
+        return np.unravel_index(np.argmax(dem) if highest else np.argmin(dem), dem.shape)
+    stats = dem.tile_max if highest else dem.tile_min
+    ty, tx = np.unravel_index(np.argmax(stats) if highest else np.argmin(stats), stats.shape)
+    x0, y0 = tx * dem.tile_size, ty * dem.tile_size
+    window = dem.read_window(x0, y0, min(dem.tile_size, dem.width - x0),
+                             min(dem.tile_size, dem.height - y0))
+    iy, ix = np.unravel_index(np.nanargmax(window) if highest else np.nanargmin(window),
+                              window.shape)
+    return y0 + iy, x0 + ix
+
+
 def los_boolean_test(dem, width, height, x0, y0, z0, x1, y1, z1):
     """Wrapper for los.los_boolean with error handling"""
     try:
+        if isinstance(dem, los.TiledTerrain):
+            return dem.los_boolean(x0, y0, z0, x1, y1, z1)
         result = los.los_boolean(
             dem,
             width,
@@ -69,6 +101,8 @@ def los_boolean_test(dem, width, height, x0, y0, z0, x1, y1, z1):
 def los_probability_test(dem, width, height, x0, y0, z0, x1, y1, z1):
     """Wrapper for los.los_probability with error handling"""
     try:
+        if isinstance(dem, los.TiledTerrain):
+            return dem.los_probability(x0, y0, z0, x1, y1, z1)
         result = los.los_probability(
             dem,
             width,
@@ -92,7 +126,7 @@ def print_test_header(test_num, description):
 def main():
     parser = argparse.ArgumentParser(description="Test LOS with USGS LiDAR data")
     parser.add_argument("--dem", type=str, default=None,
-                       help="Path to DEM .npy file (default: auto-detect latest)")
+                       help="Path to DEM .ltd or .npy file (default: auto-detect latest)")
     parser.add_argument("--data-dir", type=str, default="lidar_data",
                        help="Directory containing DEM files")
     
@@ -121,13 +155,14 @@ def main():
     # Load DEM and metadata
     dem, metadata = load_dem_with_metadata(dem_path)
     
-    # Ensure contiguous array
-    dem = np.ascontiguousarray(dem, dtype=np.float32)
-    
     height, width = dem.shape
     
     print(f"DEM size: {width}x{height}")
-    print(f"Elevation range: {dem.min():.2f}m to {dem.max():.2f}m")
+    if isinstance(dem, los.TiledTerrain):
+        print(f"Tiles: {dem.tiles[1]}x{dem.tiles[0]} of {dem.tile_size}x{dem.tile_size}")
+        print(f"Elevation range: {dem.tile_min.min():.2f}m to {dem.tile_max.max():.2f}m")
+    else:
+        print(f"Elevation range: {dem.min():.2f}m to {dem.max():.2f}m")
     
     if metadata:
         print(f"Resolution: {metadata.get('resolution', 'unknown')}m/pixel")
@@ -140,12 +175,12 @@ def main():
     # Observer in lower-left quadrant
     x0 = float(margin)
     y0 = float(margin)
-    z0 = float(dem[int(y0), int(x0)] + 2.0)  # 2m above ground
+    z0 = ground(dem, x0, y0) + 2.0  # 2m above ground
     
     # Target in upper-right quadrant
     x1 = float(width - margin)
     y1 = float(height - margin)
-    z1 = float(dem[int(y1), int(x1)] + 2.0)  # 2m above ground
+    z1 = ground(dem, x1, y1) + 2.0  # 2m above ground
     
     print(f"\nObserver: ({x0:.1f}, {y0:.1f}, {z0:.1f})")
     print(f"Target:   ({x1:.1f}, {y1:.1f}, {z1:.1f})")
@@ -161,8 +196,8 @@ def main():
     
     # Test 2: Elevated observer and target (more likely to see over terrain)
     print_test_header(2, "Elevated LOS (20m above surface)")
-    z0_elevated = float(dem[int(y0), int(x0)] + 20.0)
-    z1_elevated = float(dem[int(y1), int(x1)] + 20.0)
+    z0_elevated = ground(dem, x0, y0) + 20.0
+    z1_elevated = ground(dem, x1, y1) + 20.0
     
     print(f"Observer: ({x0:.1f}, {y0:.1f}, {z0_elevated:.1f})")
     print(f"Target:   ({x1:.1f}, {y1:.1f}, {z1_elevated:.1f})")
@@ -178,11 +213,11 @@ def main():
     print_test_header(3, "Short distance LOS")
     x0_short = float(width // 2)
     y0_short = float(height // 2)
-    z0_short = float(dem[int(y0_short), int(x0_short)] + 2.0)
+    z0_short = ground(dem, x0_short, y0_short) + 2.0
     
     x1_short = float(width // 2 + 10)
     y1_short = float(height // 2 + 10)
-    z1_short = float(dem[min(int(y1_short), height-1), min(int(x1_short), width-1)] + 2.0)
+    z1_short = ground(dem, min(int(x1_short), width-1), min(int(y1_short), height-1)) + 2.0
     
     print(f"Observer: ({x0_short:.1f}, {y0_short:.1f}, {z0_short:.1f})")
     print(f"Target:   ({x1_short:.1f}, {y1_short:.1f}, {z1_short:.1f})")
@@ -199,16 +234,16 @@ def main():
     # Test 4: Find highest and lowest points
     print_test_header(4, "Peak to valley LOS")
     
-    max_idx = np.unravel_index(np.argmax(dem), dem.shape)
-    min_idx = np.unravel_index(np.argmin(dem), dem.shape)
+    max_idx = extreme_cell(dem, highest=True)
+    min_idx = extreme_cell(dem, highest=False)
     
     x0_peak = float(max_idx[1])
     y0_peak = float(max_idx[0])
-    z0_peak = float(dem[max_idx] + 2.0)
+    z0_peak = ground(dem, max_idx[1], max_idx[0]) + 2.0
     
     x1_valley = float(min_idx[1])
     y1_valley = float(min_idx[0])
-    z1_valley = float(dem[min_idx] + 2.0)
+    z1_valley = ground(dem, min_idx[1], min_idx[0]) + 2.0
     
     print(f"Peak:   ({x0_peak:.1f}, {y0_peak:.1f}, {z0_peak:.1f})")
     print(f"Valley: ({x1_valley:.1f}, {y1_valley:.1f}, {z1_valley:.1f})")
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "los_kernel.h"
+#include "thread_pool.h"
+
+namespace los {
+
+// Cell window a viewshed covers: the grid clipped to the observer's radius.
+struct ViewshedWindow {
+    int x0, y0, x1, y1;  // inclusive cell bounds
+};
+
+inline ViewshedWindow viewshed_window(int width, int height,
+                                      double x0, double y0, double max_radius) {
+    if (!(max_radius < std::numeric_limits<double>::infinity()))
+        return {0, 0, width - 1, height - 1};
+    return {std::max(0, static_cast<int>(std::floor(x0 - max_radius))),
+            std::max(0, static_cast<int>(std::floor(y0 - max_radius))),
+            std::min(width - 1, static_cast<int>(std::floor(x0 + max_radius))),
+            std::min(height - 1, static_cast<int>(std::floor(y0 + max_radius)))};
+}
+
+// One R2 ray from the observer at (x0, y0, z0) to the centre of border cell
+// (px, py) of window w, marking visible cells in out. (ox, oy) is the
+// observer's cell. Rays write only 1s, so they may run concurrently on
+// the same mask.
+//
+// Cells is a cell reader (IndexedCells in layout.h): the horizon follows
+// cells(x, y) and targets stand on cells.lower(x, y), so a lossy heightmap
+// whose bounds bracket the true heights only ever loses visible cells.
+//
+// A non-zero `curvature` (earth_curvature()) lowers each cell by curvature
+// times its squared distance in cells from the observer, the earth's drop
+// below the observer's horizontal. Sighting straight across the lowered
+// grid is then the same as los_boolean's bent ray between the two ends.
+template <typename Cells>
+inline void viewshed_r2_ray_cells(
+    const Cells& cells,
+    int width,
+    const ViewshedWindow& w,
+    double x0, double y0, double z0,
+    double target_height,
+    double radius2,
+    int px, int py,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    const int ox = static_cast<int>(std::floor(x0));
+    const int oy = static_cast<int>(std::floor(y0));
+    DDA r(x0, y0, z0, px + 0.5, py + 0.5, z0);
+    double horizon = -std::numeric_limits<double>::infinity();
+
+    while (true) {
+        if (r.x < w.x0 || r.y < w.y0 || r.x > w.x1 || r.y > w.y1)
+            break;
+
+        if (r.x != ox || r.y != oy) {
+            double cx = r.x + 0.5 - x0;
+            double cy = r.y + 0.5 - y0;
+            double d2 = cx * cx + cy * cy;
+            if (d2 > radius2)
+                break;
+
+            double d = std::sqrt(d2);
+            size_t idx = static_cast<size_t>(r.y) * width + r.x;
+            double drop = curvature * d2;
+            double h = cells(r.x, r.y) - drop;
+            double slope = (h - z0) / d;
+
+            if ((cells.lower(r.x, r.y) - drop + target_height - z0) / d >= horizon)
+                out[idx] = 1;
+            if (slope > horizon)
+                horizon = slope;
+        }
+
+        if (r.at_end())
+            break;
+        r.step();
+    }
+}
+
+inline void viewshed_r2_ray(
+    const float* ptr,
+    int width,
+    const ViewshedWindow& w,
+    double x0, double y0, double z0,
+    double target_height,
+    double radius2,
+    int px, int py,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    viewshed_r2_ray_cells(IndexedCells<RowMajorIndex>{ptr, RowMajorIndex(width)}, width, w,
+                          x0, y0, z0, target_height, radius2, px, py, out, curvature);
+}
+
+// Number of border cells of window w, i.e. rays in its R2 sweep.
+inline int64_t viewshed_border_cells(const ViewshedWindow& w) {
+    int64_t cols = w.x1 - w.x0 + 1, rows = w.y1 - w.y0 + 1;
+    if (cols <= 0 || rows <= 0) return 0;
+    if (cols == 1 || rows == 1) return cols * rows;
+    return 2 * cols + 2 * (rows - 2);
+}
+
+// Border cell k of window w, 0 <= k < viewshed_border_cells(w): the top and
+// bottom rows first, then the left and right columns.
+inline void viewshed_border_cell(const ViewshedWindow& w, int64_t k, int& px, int& py) {
+    int cols = w.x1 - w.x0 + 1;
+    int rowPairs = w.y1 != w.y0 ? 2 : 1;
+    if (k < static_cast<int64_t>(cols) * rowPairs) {
+        px = w.x0 + static_cast<int>(k / rowPairs);
+        py = k % rowPairs ? w.y1 : w.y0;
+        return;
+    }
+    k -= static_cast<int64_t>(cols) * rowPairs;
+    int colPairs = w.x1 != w.x0 ? 2 : 1;
+    py = w.y0 + 1 + static_cast<int>(k / colPairs);
+    px = k % colPairs ? w.x1 : w.x0;
+}
+
+// Single-observer viewshed using the R2 algorithm (Franklin & Ray).
+//
+// One ray is cast from the observer to the centre of every cell on the
+// border of the window. Each ray walks the same DDA as los_boolean and keeps
+// the running maximum terrain slope (height above z0 over distance to the
+// cell centre) as its horizon. A cell is visible when a target standing
+// `target_height` above it sits on or above that horizon. Every cell in the
+// window is crossed by at least one border ray, and the horizon is carried
+// along the ray rather than recomputed, so the cost is O(cells in window).
+//
+// Visible cells inside the returned window are set to 1 in out (row-major,
+// width x height); nothing else is written, so the caller clears the window
+// beforehand. Slopes are measured to cell centres, so a few cells per ray can
+// differ from los_boolean, which tests the corner-sampled straight segment;
+// the per-pair kernel remains the exact reference.
+//
+// The *_cells variants read heights through a cell reader as
+// viewshed_r2_ray_cells does; the others read a row-major float array.
+template <typename Cells>
+inline ViewshedWindow viewshed_r2_window_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double target_height,
+    double max_radius,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    ViewshedWindow w = viewshed_window(width, height, x0, y0, max_radius);
+
+    int ox = static_cast<int>(std::floor(x0));
+    int oy = static_cast<int>(std::floor(y0));
+    if (ox < 0 || oy < 0 || ox >= width || oy >= height)
+        return {0, 0, -1, -1};
+    double radius2 = max_radius * max_radius;
+
+    out[static_cast<size_t>(oy) * width + ox] = 1;
+
+    int64_t rays = viewshed_border_cells(w);
+    for (int64_t k = 0; k < rays; k++) {
+        int px, py;
+        viewshed_border_cell(w, k, px, py);
+        viewshed_r2_ray_cells(cells, width, w, x0, y0, z0, target_height, radius2, px, py, out,
+                              curvature);
+    }
+
+    return w;
+}
+
+inline ViewshedWindow viewshed_r2_window(
+    const float* ptr,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double target_height,
+    double max_radius,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    return viewshed_r2_window_cells(IndexedCells<RowMajorIndex>{ptr, RowMajorIndex(width)},
+                                    width, height, x0, y0, z0, target_height, max_radius, out,
+                                    curvature);
+}
+
+// Full-grid viewshed: out[y * width + x] is 1 for visible cells, 0 elsewhere.
+template <typename Cells>
+inline void viewshed_r2_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double target_height,
+    double max_radius,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    std::fill(out, out + static_cast<size_t>(width) * height, uint8_t(0));
+    viewshed_r2_window_cells(cells, width, height, x0, y0, z0, target_height, max_radius, out,
+                             curvature);
+}
+
+inline void viewshed_r2(
+    const float* ptr,
+    int width,
+    int height,
+    double x0, double y0, double z0,
+    double target_height,
+    double max_radius,
+    uint8_t* out,
+    double curvature = 0.0
+) {
+    viewshed_r2_cells(IndexedCells<RowMajorIndex>{ptr, RowMajorIndex(width)}, width, height,
+                      x0, y0, z0, target_height, max_radius, out, curvature);
+}
+
+// Scratch budget of cumulative_viewshed_r2_cells: its one-byte-per-cell
+// observer masks, all slots together.
+constexpr size_t kCumulativeMaskBytes = size_t(256) << 20;
+
+// Number of observers that see each cell, saturating at 65535.
+//
+// `observers` holds m rows of (x, y, z). Observers run in rounds of one per
+// slot: each slot runs the R2 viewshed of its observer into its own scratch
+// mask, then the round's masks are added into out in parallel over rows,
+// each mask over its own window only, and cleared. There is one slot per
+// pool thread, capped so the masks fit kCumulativeMaskBytes (at least one).
+// Memory beyond out is therefore
+// min(threads, m, max(1, kCumulativeMaskBytes / cells)) bytes per cell,
+// whatever m. The saturating integer adds make the result independent of
+// scheduling.
+template <typename Cells>
+inline void cumulative_viewshed_r2_cells(
+    const Cells& cells,
+    int width,
+    int height,
+    const double* observers,
+    int64_t m,
+    double target_height,
+    double max_radius,
+    uint16_t* out,
+    double curvature = 0.0
+) {
+    const size_t size = static_cast<size_t>(width) * height;
+    std::fill(out, out + size, uint16_t(0));
+    const int64_t fit = std::max<size_t>(1, kCumulativeMaskBytes / std::max<size_t>(size, 1));
+    const int slots = static_cast<int>(std::max<int64_t>(
+        1, std::min<int64_t>({ThreadPool::instance().num_threads(), m, fit})));
+
+    std::vector<std::vector<uint8_t>> masks(slots);
+    std::vector<ViewshedWindow> windows(slots);
+
+    for (int64_t first = 0; first < m; first += slots) {
+        const int round = static_cast<int>(std::min<int64_t>(slots, m - first));
+        parallel_for(round, 1, [&](int64_t begin, int64_t end, int) {
+            for (int64_t s = begin; s < end; s++) {
+                if (masks[s].empty())
+                    masks[s].assign(size, 0);
+                const double* o = observers + 3 * (first + s);
+                windows[s] = viewshed_r2_window_cells(cells, width, height, o[0], o[1], o[2],
+                                                      target_height, max_radius, masks[s].data(),
+                                                      curvature);
+            }
+        });
+
+        int y0 = height, y1 = -1;
+        for (int s = 0; s < round; s++) {
+            y0 = std::min(y0, windows[s].y0);
+            y1 = std::max(y1, windows[s].y1);
+        }
+        if (y1 < y0)
+            continue;
+        parallel_for(y1 - y0 + 1, 16, [&](int64_t begin, int64_t end, int) {
+            for (int y = y0 + static_cast<int>(begin); y < y0 + end; y++) {
+                size_t row = static_cast<size_t>(y) * width;
+                for (int s = 0; s < round; s++) {
+                    const ViewshedWindow& w = windows[s];
+                    if (y < w.y0 || y > w.y1)
+                        continue;
+                    uint8_t* mask = masks[s].data();
+                    for (int x = w.x0; x <= w.x1; x++) {
+                        uint16_t& c = out[row + x];
+                        c = static_cast<uint16_t>(c + (mask[row + x] & (c != 0xFFFF)));
+                        mask[row + x] = 0;
+                    }
+                }
+            }
+        });
+    }
+}
+
+inline void cumulative_viewshed_r2(
+    const float* ptr,
+    int width,
+    int height,
+    const double* observers,
+    int64_t m,
+    double target_height,
+    double max_radius,
+    uint16_t* out,
+    double curvature = 0.0
+) {
+    cumulative_viewshed_r2_cells(IndexedCells<RowMajorIndex>{ptr, RowMajorIndex(width)},
+                                 width, height, observers, m, target_height, max_radius, out,
+                                 curvature);
+}
+
+} // namespace los